@@ -0,0 +1,548 @@
+/**
+ * @file bench.c
+ * Microbenchmarks for the parsing and dispatch hot paths. Built against the TEST objects so STATIC functions are reachable
+ * Run with "make bench" or "bin/irc-bot-bench [options] [name_filter]"
+ *
+ * Options:
+ *   --json               Print the results as JSON on stdout instead of a table
+ *   --time=seconds       Minimum time spent measuring each benchmark (default 0.5)
+ *   --compare=file.json  Compare against an earlier --json run. Exits with 1 if a benchmark got slower than the threshold
+ *   --threshold=percent  Allowed ns/op increase for --compare (default 10)
+ *
+ * Allocations are counted by wrapping malloc / calloc / realloc at link time, so only calls made by the bot's code count
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <yajl/yajl_tree.h>
+#include "socket.h"
+#include "irc.h"
+#include "gperf.h"
+#include "curl.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "common.h"
+
+#define BATCHSIZE 32768 //!< Bytes queued on the socketpair per batch. Must fit in the socket buffer
+
+// Same layout as in irc.c, so the benchmarks can point a server at a socketpair
+struct irc_type {
+	int sock;
+	int pipe[2];
+	char line[IRCLEN + 1];
+	size_t line_offset;
+	char address[ADDRLEN];
+	char port[PORTLEN];
+	char nick[NICKLEN];
+	char user[USERLEN];
+	char channels[MAXCHANS][CHANLEN];
+	int channels_set;
+	bool isConnected;
+};
+
+struct bench {
+	const struct benchmark *benchmark;
+	uint64_t iterations;
+	uint64_t bytes; //!< Bytes processed in all iterations, filled by the benchmark
+	uint64_t ns;
+	uint64_t allocations;
+	uint64_t start_ns, start_allocations;
+};
+
+struct benchmark {
+	const char *name;
+	void (*function)(struct bench *b);
+	const char *unit; //!< What one operation is
+};
+
+extern pid_t main_pid;
+int mpdfd = -1; // Defined in main.c, which is not linked
+
+ssize_t sock_readbyte(int sock, char *byte);
+size_t curl_write_memory(char *data, size_t size, size_t elements, void *membuf);
+char *base64_encode(const unsigned char *src, int size);
+size_t read_file(char **buf, const char *filename);
+
+static uint64_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+
+	allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+// Traffic of a busy channel as the server sends it. Nothing here makes parse_irc_line() fork or sleep
+static const char *irc_lines[] = {
+	":wolfe.freenode.net 372 fossbot :- Welcome to freenode - supporting the free and open source software communities since 1998.",
+	":wolfe.freenode.net 353 fossbot = #foss-teimes :fossbot laxanofido freestyler @ChanServ kostas_ nikos mpougatsa alex_ zorbas vasilis",
+	"PING :wolfe.freenode.net",
+	":laxanofido!~laxanofid@snf-23545.vm.okeanos.grnet.gr PRIVMSG #foss-teimes :How YA doing fossbot",
+	":freestyler!~free@ppp-94-65-12-7.home.otenet.gr PRIVMSG #foss-teimes :has anyone tried the new kernel on the lab machines? the nvidia module fails to build",
+	":kostas_!~kostas@athedsl-4471.home.otenet.gr JOIN #foss-teimes",
+	":nikos!~nikos@2a02:587:c40e:c00::4 PART #foss-teimes :Leaving",
+	":ChanServ!ChanServ@services. MODE #foss-teimes +o freestyler",
+	":alex_!~alex@unaffiliated/alex PRIVMSG fossbot :\x01VERSION\x01",
+	":NickServ!NickServ@services. NOTICE fossbot :You are now identified for fossbot.",
+	":zorbas!~zorbas@host-212-251-5-9.cable.forthnet.gr QUIT :Ping timeout: 260 seconds",
+	":mpougatsa!~mpou@ip-46-176.adsl.ntua.gr PRIVMSG #foss-teimes :lol",
+	":vasilis!~vas@teimes-gw.teimes.gr PRIVMSG #foss-teimes :https://github.com/foss-teimes/irc-bot/pull/12 can someone review this?",
+};
+
+// Both IRC commands and bot commands go through the same table. Misses are as common as hits
+static const char *commands[] = {
+	"PRIVMSG", "NOTICE", "JOIN", "PART", "MODE", "QUIT", "KICK", "url", "roll", "github", "current", "playlist",
+	"uptime", "stats", "hello", "lol", "VERSION", "353", "announce", "tweet"
+};
+
+// Message part of PRIVMSG lines, as bot commands receive it in pdata.message
+static const char *params[] = {
+	"https://www.youtube.com/watch?v=dQw4w9WgXcQ",
+	"6 12 20",
+	"foss-teimes/irc-bot 5",
+	"",
+	"Dire Straits - Sultans of Swing",
+	"1:42",
+	"freestyler laxanofido kostas_ nikos mpougatsa alex_ zorbas vasilis theo giorgos",
+};
+
+// Greek page titles in ISO-8859-7, the only charset get_url_title() converts
+static const char *iso_titles[] = {
+	"\xc5\xeb\xeb\xe7\xed\xe9\xea\xdc \xed\xdd\xe1 - \xc5\xf0\xe9\xea\xe1\xe9\xf1\xfc\xf4\xe7\xf4\xe1 - in.gr",
+	"\xd4\xc5\xc9 \xc4\xf5\xf4\xe9\xea\xde\xf2 \xcc\xe1\xea\xe5\xe4\xef\xed\xdf\xe1\xf2 | \xc1\xf1\xf7\xe9\xea\xde \xf3\xe5\xeb\xdf\xe4\xe1",
+	"Linux 4.0 released - \xd3\xf5\xe6\xde\xf4\xe7\xf3\xe7 \xf3\xf4\xef forum",
+};
+
+static uint64_t now_ns(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void start_timer(struct bench *b) {
+
+	b->start_allocations = allocations;
+	b->start_ns = now_ns();
+}
+
+static void stop_timer(struct bench *b) {
+
+	b->ns += now_ns() - b->start_ns;
+	b->allocations += allocations - b->start_allocations;
+}
+
+static void open_socketpair(int fd[2]) {
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		exit_msg("socketpair failed");
+
+	// The bot's replies are drained from this end after each batch
+	fcntl(fd[1], F_SETFL, O_NONBLOCK);
+}
+
+static void drain(int fd) {
+
+	char buf[4096];
+
+	while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+/** Fill buf with whole lines of the corpus, ending with "\r\n", starting from line *next
+ *  @returns  the number of bytes written in buf */
+static size_t fill_batch(char *buf, size_t size, int *lines, int *next) {
+
+	size_t len = 0, line_len;
+
+	*lines = 0;
+	for (;;) {
+		line_len = strlen(irc_lines[*next]);
+		if (len + line_len + 2 > size)
+			return len;
+
+		memcpy(buf + len, irc_lines[*next], line_len);
+		memcpy(buf + len + line_len, "\r\n", 2);
+		len += line_len + 2;
+		(*lines)++;
+		*next = (*next + 1) % SIZE(irc_lines);
+	}
+}
+
+/** Queue batches on the socketpair and let read_batch consume exactly the lines of each batch
+ *  Whole batches are always read, so sock_readbyte's buffer ends up empty and the iterations are rounded up */
+static void run_socket_batches(struct bench *b, bool per_byte, void (*read_batch)(int sock, int lines, size_t bytes)) {
+
+	static char batch[BATCHSIZE];
+	uint64_t done = 0;
+	int fd[2], lines, next = 0;
+	size_t len;
+
+	open_socketpair(fd);
+	while (done < b->iterations) {
+		len = fill_batch(batch, sizeof(batch), &lines, &next);
+		if (sock_write(fd[1], batch, len) != (ssize_t) len)
+			exit_msg("socketpair write failed");
+
+		start_timer(b);
+		read_batch(fd[0], lines, len);
+		stop_timer(b);
+
+		drain(fd[1]);
+		done += per_byte ? len : (uint64_t) lines;
+		b->bytes += len;
+	}
+	b->iterations = done;
+	close(fd[0]);
+	close(fd[1]);
+}
+
+static void readbyte_batch(int sock, int lines, size_t bytes) {
+
+	char byte;
+
+	(void) lines;
+	while (bytes--)
+		sock_readbyte(sock, &byte);
+}
+
+static void readline_batch(int sock, int lines, size_t bytes) {
+
+	char line[IRCLEN + 1];
+
+	(void) bytes;
+	while (lines--)
+		sock_readline(sock, line, IRCLEN);
+}
+
+static Irc parse_server;
+
+static void parse_batch(int sock, int lines, size_t bytes) {
+
+	(void) bytes;
+	parse_server->sock = sock;
+	while (lines--)
+		parse_irc_line(parse_server);
+}
+
+static void bench_sock_readbyte(struct bench *b) {
+
+	run_socket_batches(b, true, readbyte_batch);
+}
+
+static void bench_sock_readline(struct bench *b) {
+
+	run_socket_batches(b, false, readline_batch);
+}
+
+static void bench_parse_irc_line(struct bench *b) {
+
+	// Bot commands fork a worker per line, which is not what this measures. Everything else is dispatched as usual
+	parse_server = CALLOC_W(sizeof(*parse_server));
+	run_socket_batches(b, false, parse_batch);
+	free(parse_server);
+}
+
+static void bench_function_lookup(struct bench *b) {
+
+	size_t len[SIZE(commands)];
+	uint64_t i;
+	int found = 0;
+
+	for (i = 0; i < SIZE(commands); i++)
+		len[i] = strlen(commands[i]);
+
+	start_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		found += function_lookup(commands[i % SIZE(commands)], len[i % SIZE(commands)]) != NULL;
+		b->bytes += len[i % SIZE(commands)];
+	}
+	stop_timer(b);
+
+	if (!found)
+		exit_msg("function_lookup found no commands");
+}
+
+static void bench_extract_params(struct bench *b) {
+
+	char msg[IRCLEN], **argv;
+	uint64_t i;
+	size_t len;
+
+	// Includes copying the message back in, extract_params() tokenizes it in place
+	start_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		len = strlen(params[i % SIZE(params)]);
+		memcpy(msg, params[i % SIZE(params)], len + 1);
+		if (extract_params(msg, &argv))
+			free(argv);
+		b->bytes += len;
+	}
+	stop_timer(b);
+}
+
+static void bench_irc_command(struct bench *b) {
+
+	struct irc_type server;
+	uint64_t i;
+	int fd[2];
+
+	// The formatted line is written to the socketpair like it would be to the server
+	memset(&server, 0, sizeof(server));
+	open_socketpair(fd);
+	server.sock = fd[0];
+
+	for (i = 0; i < b->iterations; i++) {
+		start_timer(b);
+		send_message(&server, "#foss-teimes", "%s: %s", "laxanofido", params[i % SIZE(params)]);
+		stop_timer(b);
+		b->bytes += strlen(params[i % SIZE(params)]);
+
+		if (i % 64 == 63)
+			drain(fd[1]);
+	}
+	close(fd[0]);
+	close(fd[1]);
+}
+
+static void bench_iso8859_7_to_utf8(struct bench *b) {
+
+	char *title;
+	uint64_t i;
+
+	start_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		title = iso8859_7_to_utf8((char *) iso_titles[i % SIZE(iso_titles)]);
+		b->bytes += strlen(iso_titles[i % SIZE(iso_titles)]);
+		free(title);
+	}
+	stop_timer(b);
+}
+
+static void bench_base64_encode(struct bench *b) {
+
+	// twitter.c encodes 20 byte HMAC-SHA1 signatures
+	unsigned char signature[20] = "\x3a\x91\x0f\xc2\x5e\x77\x08\xd4\xb9\x61\x2c\xee\x13\x84\x50\xaf\x96\x0b\x7d\x21";
+	char *encoded;
+	uint64_t i;
+
+	start_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		signature[i % 20]++;
+		encoded = base64_encode(signature, 20);
+		free(encoded);
+	}
+	stop_timer(b);
+	b->bytes = b->iterations * 20;
+}
+
+static void bench_curl_write_memory(struct bench *b) {
+
+	// Curl hands over a page in chunks of up to 16KB. Every 64KB document starts a new buffer, like a new request
+	static char chunk[16384];
+	const size_t sizes[] = { 16384, 1448, 16384, 2896, 16384, 11584, 4344 };
+	Mem_buffer mem = { NULL, 0, 0 };
+	uint64_t i;
+
+	memset(chunk, 'x', sizeof(chunk));
+	start_timer(b);
+	for (i = 0; i < b->iterations; i++) {
+		if (curl_write_memory(chunk, 1, sizes[i % SIZE(sizes)], &mem) != sizes[i % SIZE(sizes)])
+			exit_msg("curl_write_memory failed");
+
+		b->bytes += sizes[i % SIZE(sizes)];
+		if (mem.size >= 65536) {
+			free(mem.buffer);
+			mem.buffer = NULL;
+			mem.size = 0;
+		}
+	}
+	stop_timer(b);
+	free(mem.buffer);
+}
+
+static const struct benchmark benchmarks[] = {
+	{ "sock_readbyte",     bench_sock_readbyte,     "byte" },
+	{ "sock_readline",     bench_sock_readline,     "line" },
+	{ "parse_irc_line",    bench_parse_irc_line,    "line" },
+	{ "function_lookup",   bench_function_lookup,   "lookup" },
+	{ "extract_params",    bench_extract_params,    "message" },
+	{ "_irc_command",      bench_irc_command,       "line" },
+	{ "iso8859_7_to_utf8", bench_iso8859_7_to_utf8, "title" },
+	{ "base64_encode",     bench_base64_encode,     "signature" },
+	{ "curl_write_memory", bench_curl_write_memory, "chunk" },
+};
+
+static struct bench results[SIZE(benchmarks)];
+
+/** Run the benchmark with growing iteration counts until it takes at least min_ns */
+static void run(struct bench *b, uint64_t min_ns) {
+
+	uint64_t iterations = 1, next;
+
+	for (;;) {
+		b->iterations = iterations;
+		b->bytes = b->ns = b->allocations = 0;
+		b->benchmark->function(b);
+		if (b->ns >= min_ns || iterations >= 1000000000)
+			return;
+
+		// Aim 20% past the target, growing at most 100x at a time
+		next = b->ns ? min_ns * 6 / 5 * b->iterations / b->ns : iterations * 100;
+		if (next > iterations * 100)
+			next = iterations * 100;
+		iterations = next > iterations ? next : iterations + 1;
+	}
+}
+
+static double ns_per_op(const struct bench *b) {
+
+	return (double) b->ns / b->iterations;
+}
+
+static void print_table(int count) {
+
+	int i;
+
+	printf("%-20s %12s %12s %10s %12s  %s\n", "benchmark", "iterations", "ns/op", "allocs/op", "MB/s", "op");
+	for (i = 0; i < count; i++)
+		printf("%-20s %12llu %12.1f %10.2f %12.1f  %s\n", results[i].benchmark->name, (unsigned long long) results[i].iterations,
+			ns_per_op(&results[i]), (double) results[i].allocations / results[i].iterations,
+			results[i].bytes * 1e3 / results[i].ns, results[i].benchmark->unit);
+}
+
+static void print_json(int count) {
+
+	int i;
+
+	printf("{\n\t\"benchmarks\": [\n");
+	for (i = 0; i < count; i++)
+		printf("\t\t{ \"name\": \"%s\", \"unit\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, "
+			"\"ops_per_sec\": %.0f, \"mb_per_sec\": %.2f }%s\n", results[i].benchmark->name, results[i].benchmark->unit,
+			(unsigned long long) results[i].iterations, ns_per_op(&results[i]),
+			(double) results[i].allocations / results[i].iterations, 1e9 / ns_per_op(&results[i]),
+			results[i].bytes * 1e3 / results[i].ns, i < count - 1 ? "," : "");
+	printf("\t]\n}\n");
+}
+
+/** Print the change of every benchmark found in the old run
+ *  @returns  true if none got slower than threshold percent */
+static bool compare(const char *file, int count, double threshold) {
+
+	const char *path_list[] = { "benchmarks", NULL }, *name_path[] = { "name", NULL }, *ns_path[] = { "ns_per_op", NULL };
+	char *text, errbuf[256];
+	yajl_val old_run, list, name, ns;
+	double change;
+	bool ok = true;
+	size_t i;
+	int j;
+
+	if (!read_file(&text, file)) {
+		fprintf(stderr, "%s\n", file);
+		return false;
+	}
+
+	old_run = yajl_tree_parse(text, errbuf, sizeof(errbuf));
+	free(text);
+	list = yajl_tree_get(old_run, path_list, yajl_t_array);
+	if (!list) {
+		fprintf(stderr, "%s: no benchmarks found %s\n", file, old_run ? "" : errbuf);
+		yajl_tree_free(old_run);
+		return false;
+	}
+	fprintf(stderr, "\n%-20s %12s %12s %9s\n", "compared to", "old ns/op", "new ns/op", "change");
+	for (i = 0; i < YAJL_GET_ARRAY(list)->len; i++) {
+		name = yajl_tree_get(YAJL_GET_ARRAY(list)->values[i], name_path, yajl_t_string);
+		ns = yajl_tree_get(YAJL_GET_ARRAY(list)->values[i], ns_path, yajl_t_number);
+		if (!name || !ns)
+			continue;
+
+		for (j = 0; j < count; j++) {
+			if (!streq(results[j].benchmark->name, YAJL_GET_STRING(name)))
+				continue;
+
+			change = (ns_per_op(&results[j]) / YAJL_GET_DOUBLE(ns) - 1) * 100;
+			fprintf(stderr, "%-20s %12.1f %12.1f %+8.1f%%%s\n", results[j].benchmark->name, YAJL_GET_DOUBLE(ns),
+				ns_per_op(&results[j]), change, change > threshold ? "  REGRESSION" : "");
+			if (change > threshold)
+				ok = false;
+		}
+	}
+	yajl_tree_free(old_run);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+
+	const struct option options[] = {
+		{ "json",      no_argument,       NULL, 'j' },
+		{ "time",      required_argument, NULL, 't' },
+		{ "compare",   required_argument, NULL, 'c' },
+		{ "threshold", required_argument, NULL, 'p' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *compare_file = NULL, *filter = NULL;
+	double seconds = 0.5, threshold = 10;
+	bool json = false;
+	int opt, i, count = 0;
+
+	main_pid = getpid();
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'j': json = true; break;
+		case 't': seconds = atof(optarg); break;
+		case 'c': compare_file = optarg; break;
+		case 'p': threshold = atof(optarg); break;
+		default:
+			exit_msg("Usage: %s [--json] [--time=seconds] [--compare=old.json] [--threshold=percent] [name_filter]", argv[0]);
+		}
+	}
+	if (optind < argc)
+		filter = argv[optind];
+
+	// The hot paths feed the metrics and the flight recorder in production, so keep them enabled
+	cfg.bot_version = "irc-bot benchmark";
+	metrics_init();
+	recorder_init("/dev/null");
+
+	for (i = 0; i < SIZE(benchmarks); i++) {
+		if (filter && !strstr(benchmarks[i].name, filter))
+			continue;
+
+		results[count].benchmark = &benchmarks[i];
+		run(&results[count++], seconds * 1e9);
+	}
+	if (json)
+		print_json(count);
+	else
+		print_table(count);
+
+	fflush(stdout); // Keep the comparison after the results
+	if (compare_file && !compare(compare_file, count, threshold))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
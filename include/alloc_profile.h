@@ -0,0 +1,52 @@
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * @file alloc_profile.h
+ * Optional allocation profiler, enabled at build time with "make ALLOC_PROFILE=1".
+ * MALLOC_W / CALLOC_W / REALLOC_W report every allocation with it's call site and free() is wrapped by the linker,
+ * so allocation counts, bytes, live bytes and high-water marks are aggregated per call site.
+ * The per site counters live in shared memory and are updated with atomic operations, so workers contribute their churn.
+ * Live bytes and high-water marks only describe the main process, since workers exit shortly after forking.
+ * Exported on /metrics, printed on stderr on SIGUSR2 and the blocks still allocated are reported at exit.
+ * Without ALLOC_PROFILE every function compiles to nothing
+ */
+
+#define ALLOC_SITES    512   //!< Distinct call sites tracked
+#define ALLOC_POINTERS 65536 //!< Live blocks tracked per process, a power of 2. Newer ones are ignored once full
+
+#ifdef ALLOC_PROFILE
+
+/** Map the shared tables, install the SIGUSR2 handler and the exit report. Call it before anything is allocated */
+void alloc_profile_init(void);
+
+/** Account a block returned by one of the allocation wrappers */
+void alloc_profile_record(void *ptr, size_t size, const char *caller, const char *file, int line);
+
+/** Stop tracking a block. The wrapped free() calls it, realloc() callers must call it before resizing */
+void alloc_profile_forget(void *ptr);
+
+/** Write the per call site counters in Prometheus text format */
+void alloc_profile_write_prometheus(FILE *stream);
+
+/** Print a table of the call sites, the ones with most allocations first */
+void alloc_profile_print(FILE *stream);
+
+/** Print the table on stderr if SIGUSR2 was received since the last call. Call it from the main loop */
+void alloc_profile_poll(void);
+
+#else
+
+#define alloc_profile_init() do { } while (0)
+#define alloc_profile_record(ptr, size, caller, file, line) do { } while (0)
+#define alloc_profile_forget(ptr) do { } while (0)
+#define alloc_profile_write_prometheus(stream) do { } while (0)
+#define alloc_profile_print(stream) do { } while (0)
+#define alloc_profile_poll() do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "irc.h"
+
+/**
+ * @file archive.h
+ * Channel log archive with a full-text index, searched by !grep and !last.
+ * Every channel message is appended to archive_dir/tail.log (one write each) and collected into a block. Full blocks
+ * are compressed into active.dat and listed in active.blk. After ARCHIVE_SEGMENT messages the active files are
+ * renamed to a sealed segment "<first>-<last>" and a background process builds it's inverted index (.idx):
+ * term -> posting list of varint encoded doc ID deltas. The same process merges runs of ARCHIVE_FANIN segments
+ * of the same size into one, so the number of segments grows with the log of the history.
+ * Indexes are memory-mapped and searched in place. Segments not indexed yet and the active one are scanned.
+ *
+ * Terms are lowercased words of 2 or more bytes, "@nick" for the sender and the channel name
+ */
+
+#define ARCHIVE_BLOCK    (32 * 1024) //!< Uncompressed bytes per block
+#define ARCHIVE_SEGMENT  8192 //!< Messages per sealed segment
+#define ARCHIVE_FANIN    4
+#define ARCHIVE_TERMLEN  32 //!< Longer words are cut
+#define ARCHIVE_TERMS    64 //!< Distinct terms indexed per message
+#define ARCHIVE_MAGIC    "IRCIDX1" //!< Written with the null char, 8 bytes
+#define ARCHIVE_RESULTS  3 //!< Lines printed by !grep
+
+/** Block table entry, in .blk files and after the .idx header */
+struct archive_block {
+	uint32_t first_doc;
+	uint32_t docs;
+	uint32_t min_time;
+	uint32_t max_time;
+	uint64_t offset; //!< In the segment's .dat file
+	uint32_t clen;
+	uint32_t ulen;
+};
+
+/** Layout of an .idx file: this header, the block table, the term table sorted by term, the term strings and the
+ *  posting lists. Offsets are from the start of the file, doc IDs in the postings relative to first_doc */
+struct archive_header {
+	char magic[8];
+	uint32_t first_doc;
+	uint32_t docs;
+	uint32_t min_time;
+	uint32_t max_time;
+	uint32_t blocks;
+	uint32_t terms;
+	uint64_t terms_offset;
+	uint64_t strings_offset;
+	uint64_t postings_offset;
+	uint64_t size; //!< Of the whole file
+};
+
+struct archive_term {
+	uint32_t string; //!< Offset in the strings section
+	uint32_t length;
+	uint32_t docs;
+	uint32_t postings; //!< Offset in the postings section
+	uint32_t postings_len;
+};
+
+/**
+ * Open the archive, recover the active block from tail.log and restart any index builds that were interrupted.
+ * Must be called before any fork
+ *
+ * @param dir  Archive directory, created if missing. An empty string disables archiving
+ */
+void archive_init(const char *dir);
+
+/** Store a channel message. Called from the main process only */
+void archive_append(const char *channel, size_t channel_len, const char *nick, const char *text);
+
+/** Search the archive of the current channel. Usage: !grep words [after:YYYY-MM-DD|Nd] [before:YYYY-MM-DD|Nd] */
+void archive_grep(Irc server, Parsed_data pdata);
+
+/** Print the last message of a nick on the current channel */
+void archive_last(Irc server, Parsed_data pdata);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "irc.h"
 #include "murmur.h"
+#include "curl.h"
 
 /**
  * @file bot.h
@@ -19,7 +20,6 @@
 #define MAXCOMMITS   10
 #define MAXPINGS     10
 #define REPOLEN      80
-#define QUOTELEN     150
 #define DEFAULT_ROLL 100
 #define MAXROLL      1000000
 
@@ -55,9 +55,6 @@ void url(Irc server, Parsed_data pdata);
 /** Get foss-tesyd mumble user list by reading a webpage made specific for this. No parsing involved */
 void mumble(Irc server, Parsed_data pdata);
 
-/** Print random messages (with random colors) from the quotes list in the config */
-void bot_fail(Irc server, Parsed_data pdata);
-
 /**
  * Print latest commits info in the format "[sha] commit_message --author - short_url"
  *
@@ -66,6 +63,9 @@ void bot_fail(Irc server, Parsed_data pdata);
  */
 void github(Irc server, Parsed_data pdata);
 
+/** Print one commit in the format of github(), with it's short url */
+void print_commit(Irc server, const char *target, const Github *commit);
+
 /** Traceroute IPv4 / IPv6 host / IP and print the result in private to avoid spam */
 void traceroute(Irc server, Parsed_data pdata);
 
@@ -87,4 +87,8 @@ void marker(Irc server, Parsed_data pdata);
 /** Send tweet */
 void tweet(Irc server, Parsed_data pdata);
 
+/** Print a summary of the bot's metrics: lines parsed, dispatch latency, forks, HTTP transfers and the busiest commands.
+ *  With a channel argument print the channel's statistics instead. Usage: !stats [#channel] */
+void stats(Irc server, Parsed_data pdata);
+
 #endif
@@ -0,0 +1,38 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/**
+ * @file capture.h
+ * Traffic capture and deterministic replay.
+ * With capture_file set, every raw line received from the IRC server is appended to it with it's receive time.
+ * "--replay <file>" starts a feeder process that stands in for the server and plays a capture back, either as fast
+ * as possible or scaled in time with "--replay-speed". The bot reads it through the usual socket reader and dispatcher.
+ * While replaying, HTTP requests fail, external programs are not run and MPD / Murmur are not contacted.
+ * The bot exits with a throughput summary once the whole capture has been parsed
+ *
+ * File format: CAPTURE_MAGIC, then for every line it's receive time in CLOCK_REALTIME usec (8 bytes),
+ * it's length (2 bytes) and the line without "\r\n". Integers are in host byte order
+ */
+
+#define CAPTURE_MAGIC  "IRCCAP1" //!< Written with the null char, 8 bytes
+#define CAPTURE_HEADER 10 //!< Bytes before each line
+
+/** Open the capture file for appending. Call it before any fork
+ *  @param path  Empty string disables capturing */
+void capture_init(const char *path);
+
+/** Store a line received from the server. Lines are also counted for the replay summary */
+void capture_line(const char *line);
+
+/**
+ * Start feeding a capture to the bot. The feeder listens on a local port and cfg.server / cfg.port are pointed to it
+ *
+ * @param path   Capture file. Exits if it's missing or not a capture
+ * @param speed  1 replays in real time, 2 twice as fast etc. 0 sends every line as fast as possible
+ */
+void replay_init(const char *path, double speed);
+
+/** Print how many lines were replayed and how fast, then exit. Called when the feeder closes the connection */
+void replay_finish(void);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CHANSTATS_H
+#define CHANSTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "irc.h"
+
+/**
+ * @file chanstats.h
+ * Per channel statistics for !stats #channel, in constant memory whatever the channel size.
+ * Messages per hour are counted in STATS_HOURS buckets. Unique speakers go into one HyperLogLog sketch per day, a week
+ * or month is the union of the daily sketches. Top talkers are estimated by a count-min sketch and the STATS_TOP
+ * biggest estimates are kept in a min-heap. Counts are halved every week so old chatter fades out.
+ * Fed by the main process. Workers print the copy they got at fork. Checkpointed to stats_file by a forked child
+ */
+
+#define STATS_HOURS      24
+#define STATS_DAYS       30
+#define STATS_HLL_BITS   10 //!< 1024 registers per sketch, ~3% standard error
+#define STATS_HLL_SIZE   (1 << STATS_HLL_BITS)
+#define STATS_CMS_DEPTH  4
+#define STATS_CMS_WIDTH  1024 //!< Must be a power of 2
+#define STATS_TOP        5
+#define STATS_CHECKPOINT 300 //!< Seconds between checkpoints, only while there's activity
+#define STATS_MAGIC      "IRCSTA1"
+
+struct stats_talker {
+	char nick[NICKLEN];
+	uint32_t count;
+};
+
+struct channel_stats {
+	char channel[CHANLEN];
+	uint32_t hour[STATS_HOURS];     //!< Hours since the epoch each bucket is counting
+	uint32_t messages[STATS_HOURS];
+	uint32_t day[STATS_DAYS];       //!< Days since the epoch (UTC) each sketch is counting
+	uint8_t hll[STATS_DAYS][STATS_HLL_SIZE];
+	uint32_t cms[STATS_CMS_DEPTH][STATS_CMS_WIDTH];
+	struct stats_talker top[STATS_TOP]; //!< Min-heap on count
+	uint32_t top_count;
+	uint32_t week; //!< Weeks since the epoch the counts were last halved
+};
+
+/**
+ * Load the last checkpoint. Must be called before any fork
+ *
+ * @param path  Checkpoint file. An empty string keeps the statistics in memory only
+ */
+void chanstats_init(const char *path);
+
+/** Count a channel message. Called from the main process */
+void chanstats_message(const char *channel, size_t channel_len, const char *nick);
+
+/** Print messages per hour, unique speakers per day / week / month and the top talkers of a channel */
+void chanstats_print(Irc server, const char *target, const char *channel);
+
+#endif
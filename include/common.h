@@ -2,6 +2,8 @@
 #define COMMON_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <yajl/yajl_tree.h>
 #include "irc.h"
 #include "twitter.h"
@@ -20,10 +22,12 @@
 
 #define STARTSIZE   5
 #define MAXQUOTES   20
+#define MAXWATCH    10
+#define MAXFEEDS    500
 #define PATHLEN     120
 #define EXIT_MSGLEN 128
 #define LINELEN     300
-#define CONFSIZE    4096
+#define CONFSIZE    (8192 + MAXFEEDS * 512) //!< Room for MAXFEEDS feed URLs on top of the rest
 #define TIMEOUT     300000 //!< Timeout in milliseconds for the poll function
 #define LOCALHOST  "127.0.0.1"
 #define SCRIPTDIR "scripts/" //!< default folder to look for scripts like the youtube one
@@ -44,6 +48,28 @@ struct config_options {
 	char *mpd_port;
 	char *mpd_database;
 	char *mpd_random_file;
+	char *http_port;
+	char *trace_file;
+	char *flight_recorder_file;
+	char *capture_file;
+	char *log_file;
+	char *log_level;
+	char *log_max_kb;
+	char *log_max_hours;
+	char *archive_dir;
+	char *seen_file;
+	char *quote_file;
+	char *stats_file;
+	char *flood_action;
+	char *remind_file;
+	char *webhook_secret;
+	char *shortener_file;
+	char *shortener_url;
+	char *paste_url;
+	char *paste_lines;
+	char *http_fixture_url;
+	char *http_record_dir;
+	char *http_replay_dir;
 	char *oauth_consumer_key;
 	char *oauth_consumer_secret;
 	char *oauth_token;
@@ -52,9 +78,16 @@ struct config_options {
 	char *twitter_access_list[MAXLIST];
 	bool twitter_details_set;
 	int access_list_count;
+	char *watch_repos[MAXWATCH];
+	int watch_repo_count;
+	char *feeds[MAXFEEDS];
+	int feed_count;
 	char *quotes[MAXQUOTES];
 	int quote_count;
+	yajl_val triggers; //!< Compiled by triggers_init()
+	yajl_val webhook_channels;
 	bool verbose;
+	bool replay; //!< Set by --replay. Network side effects are stubbed
 };
 
 extern struct config_options cfg; //!< global struct with config's values
@@ -87,7 +120,7 @@ void initialize(int argc, char *argv[]);
 /** Cleanup curl, free yajl handler etc */
 void cleanup(void);
 
-/** Takes a format specifier with a variable number of arguments. Prints message and exits with failure
+/** Takes a format specifier with a variable number of arguments. Prints message, dumps the flight recorder and exits with failure
  *  If the caller is not the main process then _exit() will be used to avoid,
  *  calling the functions registered with atexit(), flushing descriptors etc */
 void exit_msg(const char *format, ...);
@@ -142,6 +175,34 @@ void print_cmd_output_unsafe(Irc server, const char *target, const char *cmd);
 /** Parse json config_file and update cfg global struct with the values read */
 void parse_config(yajl_val root, const char *config_file);
 
+/** @returns  microseconds from CLOCK_MONOTONIC. Use it to measure durations */
+uint64_t monotonic_usec(void);
+
+/** Write secs as "3d 4h", "2h 5m", "5m" or "42s". Negative durations are written as "0s" */
+void format_duration(char *buf, size_t len, long secs);
+
+/**
+ * Backward shift deletion for open addressing hash tables with linear probing and a power of 2 size. Slot i is
+ * emptied by moving back the rest of it's probe run, so lookups never stop early at a hole
+ *
+ * @param table  Passed on to the callbacks
+ * @param mask   Table size - 1
+ * @param home   Returns false if the slot is empty, otherwise stores the home slot of it's entry
+ * @param move   Copy the entry of slot from to slot to
+ * @returns      the slot left over at the end of the run. The caller must empty it
+ */
+uint32_t probe_remove(void *table, uint32_t i, uint32_t mask, bool (*home)(void *table, uint32_t slot, uint32_t *home),
+	void (*move)(void *table, uint32_t from, uint32_t to));
+
+/** Initialize a mutex that lives in shared memory. It's robust, a process that dies holding it doesn't lock out the
+ *  rest. Always initialize it again after mapping a file, a crashed bot may have left it locked */
+void shared_mutex_init(pthread_mutex_t *mutex);
+
+/** Lock a shared_mutex_init() mutex, unlock it with pthread_mutex_unlock()
+ *  @returns  false if it's previous owner died holding it. The lock is taken, but the data it guards may be half
+ *            updated */
+bool shared_mutex_lock(pthread_mutex_t *mutex);
+
 /** Convert string's encoding from ISO 8859-7 to UTF-8
  *  @warning  Return value must be freed to avoid memory leak */
 char *iso8859_7_to_utf8(char *iso);
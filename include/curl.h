@@ -2,6 +2,7 @@
 #define CURL_H
 
 #include <sys/types.h>
+#include <curl/curl.h>
 #include <yajl/yajl_tree.h>
 
 /**
@@ -11,18 +12,21 @@
 
 #define URLLEN   440
 #define TITLELEN 300
-#define TESTDIR "file:///home/free/programming/c/irc-bot/test-files/" //!< Run network tests from file instead of actually connecting to a service
+#define ETAGLEN  100
+#define DATELEN  40
 
 /** HTTP status codes */
 enum http_codes {
 	UNKNOWN      = 0, 
 	UNAUTHORIZED = 401,
+	NOT_MODIFIED = 304,
 	FORBIDDEN    = 403
 };
 
 typedef struct {
 	char *buffer;
 	size_t size;
+	long status; //!< HTTP status, filled by perform_transfer()
 } Mem_buffer;
 
 typedef struct {
@@ -32,13 +36,47 @@ typedef struct {
 	char *url;
 } Github;
 
+/** Conditional request state of a repo, kept between polls. Filled from the response headers */
+typedef struct {
+	char etag[ETAGLEN]; //!< Sent back as If-None-Match, a 304 reply costs no quota
+	long status;
+	long remaining;     //!< X-RateLimit-Remaining or -1 if not sent
+	long reset;         //!< X-RateLimit-Reset, the epoch second the quota is refilled
+	long retry_after;   //!< Retry-After seconds of a secondary rate limit, 0 if not sent
+} Github_poll;
+
+/** Validators of a conditional GET, from the last 200 reply */
+typedef struct {
+	char etag[ETAGLEN];          //!< Sent back as If-None-Match
+	char last_modified[DATELEN]; //!< Sent back as If-Modified-Since
+} Http_validators;
+
 /**
- * Send long_url to google's shortener service and request a short version
- * @warning  Returned string must be freed when no longer needed
+ * Choose where perform_transfer() gets it's responses. Empty strings or NULL disable each option
+ *
+ * @param base_url  Send every request here instead, like bin/http_fixtured. The original host and path become the path
+ * @param record    Save every response in this directory as a fixture
+ * @param replay    Answer from the fixtures in this directory and never touch the network
+ */
+void http_fixtures_init(const char *base_url, const char *record, const char *replay);
+
+/**
+ * Fetch url with the options already set on curl and save the reply in mem.
+ * Records the transfer's status and size in the metrics and it's phases (DNS, connect, TLS, wait, download)
+ * in the request's trace. Compressed replies are accepted and decoded
  *
- * @returns  short version or NULL on failure
+ * @param post  POST body or NULL for GET
+ * @param mem   Must be zero initialized. buffer must be freed afterwards, even on failure
  */
-char *shorten_url(const char *long_url);
+CURLcode perform_transfer(CURL *curl, const char *url, const char *post, Mem_buffer *mem);
+
+/**
+ * GET url unless it's unchanged since validators were filled. file:// URLs are always read
+ *
+ * @param validators  Zero initialized before the first call. Updated on every 200 reply
+ * @param mem         Must be zero initialized. mem->status is 304 and the buffer empty if nothing changed
+ */
+CURLcode fetch_if_modified(const char *url, Http_validators *validators, Mem_buffer *mem);
 
 /**
  * Get url's html and search for the title tag. Conversion from iso8859_7_to_utf8 will be used if needed
@@ -63,5 +101,12 @@ char *fetch_mumble_users(void);
  */
 Github *fetch_github_commits(yajl_val *root, const char *repo, int *commits);
 
+/**
+ * Same as fetch_github_commits() but conditional on poll->etag. A reply of 304 (not modified) returns no commits
+ *
+ * @param poll  Must be zero initialized before the first call. Updated with the status, ETag and rate limit
+ */
+Github *poll_github_commits(yajl_val *root, const char *repo, int *commits, Github_poll *poll);
+
 #endif
 
@@ -0,0 +1,45 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include <stdint.h>
+#include <time.h>
+#include "irc.h"
+#include "curl.h"
+
+/**
+ * @file feed.h
+ * Announce new entries of the RSS and Atom feeds in the config on the first channel. A forked child fetches them with
+ * conditional GETs and reads them with the xml.h tokenizer, newest entry first, stopping at the first one it has seen.
+ * Entries are told apart by their guid / id, the hashes of the last FEED_SEEN are kept per feed.
+ * Fetches are spread evenly over FEED_INTERVAL whatever the number of feeds, failing feeds back off.
+ * file:// URLs and the HTTP fixtures of curl.h work too
+ */
+
+#define FEED_INTERVAL     900   //!< Seconds between fetches of a feed
+#define FEED_MAX_INTERVAL 21600 //!< Longest back off of a failing feed
+#define FEED_SEEN         64    //!< Entry ids remembered per feed
+#define FEED_ANNOUNCE     3     //!< The rest of the new entries are only counted
+#define FEED_TITLELEN     100
+#define FEED_TEXTLEN      200
+
+struct feed_entry {
+	char title[FEED_TEXTLEN];
+	char link[URLLEN];
+	char id[URLLEN];
+};
+
+struct feed {
+	const char *url;
+	char title[FEED_TITLELEN];
+	Http_validators validators;
+	uint64_t seen[FEED_SEEN]; //!< Ring of id hashes, 0 is unused
+	uint32_t seen_next;
+	uint32_t failures;
+	time_t next_fetch;
+	bool primed;              //!< The entries of the first fetch are taken as seen
+};
+
+/** Start the feed reader if there are feeds. Must be called after connecting, announcements go to it's channel */
+void feeds_start(Irc server);
+
+#endif
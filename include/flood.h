@@ -0,0 +1,107 @@
+#ifndef FLOOD_H
+#define FLOOD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "irc.h"
+
+/**
+ * @file flood.h
+ * Flood and spam detection on the inbound path. Messages are counted per nick and per host in sliding windows,
+ * estimated from the counts of the current and the previous window. A busy host only counts as a clone flood when
+ * several nicks are using it, and since people share hosts (NAT, web gateways, bridges) it's never kicked for it.
+ * Lines are fingerprinted with SimHash over character trigrams: a few near duplicates within a minute from one nick
+ * are spam, and so are ones from several nicks on a channel that advertise a link or a channel. Lines naming many
+ * different members of the channel are mass highlights. Flooders' commands are ignored for a while and flood_action
+ * can kick them or set the channel +m for some time, join floods included.
+ * Everything lives in fixed size tables. Trackers are in a set associative cache where stale entries make room for
+ * new ones, so nothing needs to be cleaned up
+ */
+
+#define FLOOD_WINDOW        10  //!< Seconds of the sliding windows
+#define FLOOD_NICK_MESSAGES 6   //!< Messages per window from one nick
+#define FLOOD_HOST_MESSAGES 10  //!< Messages and joins per window from one host, catches clones
+#define FLOOD_CLONES        3   //!< Nicks on one host within two windows before it's rate counts
+#define FLOOD_JOINS         8   //!< Joins per window on one channel
+#define FLOOD_REPEATS       3   //!< Near duplicates that make spam
+#define FLOOD_REPEAT_WINDOW 60  //!< Seconds near duplicates are looked for
+#define FLOOD_NEAR_BITS     8   //!< Fingerprints that differ in this many bits or less are near duplicates
+#define FLOOD_MINLEN        16  //!< Shorter lines are too common to be compared
+#define FLOOD_HIGHLIGHTS    5   //!< Member nicks on one line
+#define FLOOD_IGNORE        300 //!< Seconds a flooder's commands are ignored
+#define FLOOD_MODERATE      60  //!< Seconds a channel stays +m
+#define FLOOD_SETS          128
+#define FLOOD_WAYS          4   //!< Trackers per set, the stalest one is replaced
+#define FLOOD_PRINTS        4   //!< Last fingerprints kept per nick
+#define FLOOD_MEMBERS       512 //!< Slots of each channel's member set, must be a power of 2
+#define FLOOD_RECENT        16  //!< Last fingerprints kept per channel
+
+enum flood_reason {
+	FLOOD_NONE,
+	FLOOD_NICK_RATE,
+	FLOOD_HOST_RATE,
+	FLOOD_REPEAT,
+	FLOOD_SPAM, //!< Near duplicates from several nicks
+	FLOOD_HIGHLIGHT
+};
+
+/** Events are counted in whole windows. The sliding window takes the part of the previous one it still overlaps */
+struct flood_window {
+	uint32_t start;
+	uint16_t count;
+	uint16_t previous; //!< Events in the window before start
+};
+
+struct flood_tracker {
+	uint32_t key; //!< Hash of the nick or host, 0 for unused
+	uint32_t ignored_until;
+	struct flood_window rate;
+	uint64_t prints[FLOOD_PRINTS];
+	uint32_t print_times[FLOOD_PRINTS];
+	uint32_t next_print;
+	uint32_t clones[FLOOD_CLONES];      //!< Host trackers: the last nicks seen from it
+	uint32_t clone_times[FLOOD_CLONES];
+};
+
+struct flood_channel {
+	char channel[CHANLEN];
+	uint32_t members[FLOOD_MEMBERS]; //!< Open addressing on the lowercased nick hash, 0 for empty slots
+	uint32_t member_count;
+	struct flood_window joins;
+	uint64_t prints[FLOOD_RECENT];
+	uint32_t print_times[FLOOD_RECENT];
+	uint32_t print_nicks[FLOOD_RECENT]; //!< Nick hash of each print, spam needs more than one nick
+	uint32_t next_print;
+	uint32_t moderated_until;
+};
+
+/**
+ * Check the configured action. Must be called before any fork
+ *
+ * @param name  "ignore", "kick", "moderate" or an empty string to disable the detection
+ */
+void flood_init(const char *name);
+
+/**
+ * Look for floods in a message and act on them. Called from the main process for every PRIVMSG
+ *
+ * @param target  Channel or our nick, target_len bytes long
+ * @param host    Host of the sender, can be empty
+ * @returns       true if the sender is flooding and it's commands and triggers must be ignored
+ */
+bool flood_message(Irc server, const char *target, size_t target_len, const char *nick, const char *host, const char *text);
+
+/** Count a join. Join floods set +m when flood_action is "moderate" */
+void flood_join(Irc server, const char *channel, const char *nick, const char *host);
+
+/** Forget a nick that left the channel, or every channel if it's NULL */
+void flood_part(const char *channel, const char *nick);
+
+/** Follow a nick change on every channel */
+void flood_nick(const char *old_nick, const char *new_nick);
+
+/** Add the nicks of a names reply to the member set. Example: "fossbot = #foss-teimes :fossbot @nikos +laxanofido" */
+void flood_names(char *reply);
+
+#endif
@@ -5,6 +5,11 @@
 #include "bot.h"
 #include "mpd.h"
 #include "twitter.h"
+#include "archive.h"
+#include "seen.h"
+#include "quotes.h"
+#include "trending.h"
+#include "remind.h"
 
 /**
  * @file gperf.h
@@ -0,0 +1,76 @@
+#ifndef HTTPD_H
+#define HTTPD_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * @file httpd.h
+ * Minimal non-blocking HTTP/1.1 server that runs inside the main poll() loop.
+ * Requests are read whole (within the size limits below), passed to the handler registered
+ * for their path and the connection is closed after the response has been sent
+ */
+
+#define HTTPD_MAXCLIENTS 8
+#define HTTPD_MAXROUTES  8
+#define HTTPD_MAXHEADERS 32
+#define HTTPD_HEADERLEN  4096  //!< Maximum size of the request line plus headers
+#define HTTPD_MAXBODY    65536 //!< Maximum size of a request body
+#define HTTPD_TIMEOUT    10    //!< Seconds a client has to complete it's request and read the reply
+
+/** Parsed request. All pointers point inside the client's receive buffer */
+typedef struct {
+	char *method;
+	char *path;
+	char *query; //!< Everything after '?' or NULL
+	char *headers[HTTPD_MAXHEADERS][2];
+	int header_count;
+	char *body;
+	size_t body_len;
+} Http_request;
+
+/** Filled by the handler. Status defaults to 200 */
+typedef struct {
+	int status;
+	const char *content_type;
+	const char *location; //!< Sets the Location header for redirects
+	char *body; //!< Must be allocated with malloc(). It will be freed by the server
+	size_t len;
+} Http_response;
+
+typedef void (*http_handler)(Http_request *req, Http_response *res);
+
+/**
+ * Start listening on localhost
+ *
+ * @param port  Port in string form. An empty string disables the server
+ * @returns     listening socket or -1 if disabled / failed
+ */
+int httpd_listen(const char *port);
+
+/**
+ * Register a handler for every request whose path starts with prefix
+ *
+ * @param method  "GET", "POST" etc. NULL matches any method
+ * @returns       false if HTTPD_MAXROUTES is reached
+ */
+bool httpd_route(const char *method, const char *prefix, http_handler handler);
+
+/** Case insensitive header lookup
+ *  @returns  the header's value or NULL if missing */
+const char *http_header(const Http_request *req, const char *name);
+
+/** Fill a response with a printf style formatted body */
+void http_reply(Http_response *res, int status, const char *content_type, const char *format, ...);
+
+/**
+ * Accept connections, read requests, dispatch them and write the replies
+ * Call it after every poll() return
+ *
+ * @param pfd  Array of 1 + HTTPD_MAXCLIENTS entries. The first one must hold the listening socket,
+ *             the rest are managed by the server and must be initialized to -1
+ */
+void httpd_poll(struct pollfd *pfd);
+
+#endif
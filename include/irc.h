@@ -31,6 +31,7 @@ typedef struct {
 
 /** IRC server numeric replies. See http://www.ietf.org/rfc/rfc1459.txt for a detailed list */
 enum irc_reply {
+	NAMREPLY      = 353, //!< Nicks on a channel, sent after joining it
 	ENDOFMOTD     = 376, //!< Registration successful, join the channels already set
 	NICKNAMEINUSE = 433  //!< Add an extra '_' to the end of our nickname each time
 };
@@ -52,12 +53,21 @@ Irc irc_connect(const char *address, const char *port);
  */
 int get_socket(Irc server);
 
+/** True once the server accepted our registration */
+bool is_connected(Irc server);
+
 /** Returns a default channel to send messages to. Currently it's the first channel set */
 char *default_channel(Irc server);
 
 /** Set nickname */
 void set_nick(Irc server, const char *nick);
 
+/** Set or unset a channel mode. Example: set_mode(server, "#foss-teimes", "+m") */
+void set_mode(Irc server, const char *channel, const char *mode);
+
+/** Kick a nick out of a channel. Needs channel operator status */
+void kick_user(Irc server, const char *channel, const char *nick, const char *reason);
+
 /** Set user. Will use user as a real name as well and set default flags 0.
  *  Can only be set during server connection so it should only be called once */
 void set_user(Irc server, const char *user);
@@ -88,6 +98,14 @@ void irc_notice(Irc server, Parsed_data pdata);
 /** Rejoin few secs after being kicked and send message to offender */
 void irc_kick(Irc server, Parsed_data pdata);
 
+//@{
+/** Track other users' activity for !seen and deliver their !tell memos */
+void irc_join(Irc server, Parsed_data pdata);
+void irc_part(Irc server, Parsed_data pdata);
+void irc_quit(Irc server, Parsed_data pdata);
+void irc_nick(Irc server, Parsed_data pdata);
+//@}
+
 /**
  * Handle server numeric replies
  *
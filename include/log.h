@@ -0,0 +1,64 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file log.h
+ * Structured logging off the main loop. log_msg() formats the message straight into a slot of a lock-free ring
+ * shared by the main process and the workers and returns without a system call. A writer process drains the ring
+ * every LOG_FLUSH_MS, writes the records in batches as logfmt lines and rotates the log file by size and age.
+ * When the ring is full new records are dropped and counted, the main loop never waits for the writer. A slot that
+ * stays claimed but unfinished for LOG_STALL_MS, like one of a worker killed halfway, is dropped too.
+ * Records are redacted by the caller: nothing secret must be passed to log_msg()
+ */
+
+#define LOG_RECORDS  1024 //!< Ring slots, must be a power of 2
+#define LOG_TEXTLEN  480  //!< Longer messages are truncated
+#define LOG_BATCH    (64 * 1024)
+#define LOG_FLUSH_MS 50
+#define LOG_STALL_MS 1000 //!< Writing a record takes microseconds, a slot this late won't be finished
+#define LOG_KEEP     5    //!< Rotated files kept as <log_file>.1 to <log_file>.LOG_KEEP
+
+enum log_level {
+	LVL_DEBUG,
+	LVL_INFO,
+	LVL_WARN,
+	LVL_ERROR,
+	LVL_MAX
+};
+
+enum log_category {
+	LOG_IRC_IN,   //!< Raw line from the server. Only logged with verbose on
+	LOG_IRC_OUT,  //!< Raw line sent to the server. Only logged with verbose on
+	LOG_DISPATCH, //!< Bot commands and their workers
+	LOG_SYSTEM,   //!< Startup, shutdown and fatal errors
+	LOG_CATEGORY_MAX
+};
+
+/** One slot of the ring. Time is CLOCK_REALTIME in microseconds */
+struct log_record {
+	uint64_t seq; //!< Position + 1 once the record is complete, position + LOG_RECORDS once it's free again
+	uint64_t time;
+	int32_t pid;
+	uint16_t level;
+	uint16_t category;
+	uint16_t len;
+	char text[LOG_TEXTLEN];
+};
+
+/**
+ * Map the ring and start the writer process. Must be called before any fork
+ *
+ * @param path       Log file. An empty string logs to stdout, without rotation
+ * @param level      Lowest level logged: "debug", "info", "warn" or "error"
+ * @param max_kb     Rotate once the file gets this big. 0 disables
+ * @param max_hours  Rotate once the file gets this old. 0 disables
+ */
+void log_init(const char *path, const char *level, long max_kb, long max_hours);
+
+/** Queue a record. Safe to call from any process, never blocks */
+void log_msg(enum log_level level, enum log_category category, const char *format, ...);
+
+#endif
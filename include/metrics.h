@@ -0,0 +1,116 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "irc.h"
+#include "httpd.h"
+
+/**
+ * @file metrics.h
+ * Counters, gauges and latency histograms for the whole bot.
+ * The registry lives in shared memory so the bot commands running in forked processes can update it
+ * with plain atomic adds. Exported in Prometheus text format on the local HTTP port (/metrics) and by !stats
+ */
+
+#define MAXCMDS      48
+#define CMDNAMELEN   16
+#define HIST_SUBBITS 2  //!< Each power of two is split into 2^HIST_SUBBITS buckets (~25% max error)
+#define HIST_BUCKETS ((32 - HIST_SUBBITS + 1) << HIST_SUBBITS) //!< Enough to hold microseconds up to ~71 minutes
+#define RATE_WINDOW  60 //!< Seconds used to calculate lines parsed per second
+
+enum metric_counter {
+	LINES_PARSED,
+	LINES_SENT,
+	SEND_FAILURES,
+	COMMANDS,
+	FORKS,
+	FORK_FAILURES,
+	HTTP_REQUESTS,
+	HTTP_FAILURES,
+	HTTP_BYTES,
+	MPD_FAILURES,
+	MURMUR_FAILURES,
+	FLOODS,
+	SHORT_EVICTIONS,
+	COUNTER_MAX
+};
+
+enum metric_gauge {
+	SEND_QUEUE_BYTES,
+	GAUGE_MAX
+};
+
+enum metric_histogram {
+	DISPATCH_LATENCY,
+	HISTOGRAM_MAX
+};
+
+/** HDR style histogram with logarithmic buckets. Values are in microseconds */
+struct histogram {
+	uint32_t buckets[HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+};
+
+struct command_stats {
+	char name[CMDNAMELEN];
+	uint64_t calls;
+	uint64_t forks;
+	uint64_t http_bytes;
+	uint64_t http_status[6]; //!< Index 0 holds failed transfers, the rest the status class (1xx - 5xx)
+	struct histogram wall_time;
+};
+
+/** Create the shared memory registry. Must be called before any fork */
+void metrics_init(void);
+
+/** Add n to a counter. Safe to call from any process */
+void metrics_count(enum metric_counter counter, uint64_t n);
+
+/** Set a gauge to value */
+void metrics_gauge(enum metric_gauge gauge, int64_t value);
+
+/** Record a duration (microseconds) in one of the global histograms */
+void metrics_observe(enum metric_histogram hist, uint64_t usec);
+
+/** Mark a parsed IRC line. Keeps a per second ring for the lines per second rate as well */
+void metrics_line_parsed(void);
+
+/**
+ * Find or register the statistics slot of a bot command.
+ * @warning  Only the main process may register new commands, children inherit the slot index
+ *
+ * @returns  slot index or -1 if MAXCMDS is reached
+ */
+int metrics_command(const char *command);
+
+//@{
+/** Bracket the execution of a bot command inside it's process.
+ *  Fork and HTTP statistics reported in between are attributed to that command */
+void metrics_command_start(int slot);
+void metrics_command_end(void);
+//@}
+
+/** Count a fork. Use it everywhere we fork so workers spawning helpers are accounted for */
+void metrics_fork(bool success);
+
+/**
+ * Record the outcome of an HTTP transfer
+ *
+ * @param status  HTTP status code or 0 if the transfer failed
+ * @param bytes   Body bytes received
+ */
+void metrics_http(long status, size_t bytes);
+
+/** Write all metrics in Prometheus text exposition format */
+void metrics_write_prometheus(FILE *stream);
+
+/** HTTP handler for GET /metrics */
+void metrics_serve(Http_request *req, Http_response *res);
+
+/** Summarize the most important metrics in IRC. Invoked by the !stats command */
+void metrics_print_summary(Irc server, const char *target);
+
+#endif
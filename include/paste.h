@@ -0,0 +1,51 @@
+#ifndef PASTE_H
+#define PASTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "httpd.h"
+
+/**
+ * @file paste.h
+ * Long command output is pasted instead of flooding IRC. Pastes go in a fixed size ring in shared memory: the text
+ * wraps around PASTE_SIZE bytes and the entries around PASTE_SLOTS, whatever gets overwritten is dropped, so the
+ * store never grows. Workers add pastes and the main process serves GET /p/id of the HTTP server until they expire.
+ * Ids are random, a paste can only be found through it's link. A robust process shared mutex in the header guards the
+ * store, if a worker dies holding it every paste is dropped
+ */
+
+#define PASTE_SLOTS  128
+#define PASTE_SIZE   (1024 * 1024)
+#define PASTE_MAXLEN (64 * 1024) //!< Longer output is cut
+#define PASTE_TTL    3600        //!< Seconds a paste is served
+#define PASTE_PATH   "/p/"
+
+/** id is 0 for unused entries */
+struct paste_entry {
+	uint64_t id;
+	int64_t expires;
+	uint32_t offset;
+	uint32_t len;
+};
+
+/**
+ * Create the store and register it's route on PASTE_PATH. Must be called before any fork
+ *
+ * @param base_url  Public URL that reaches PASTE_PATH of the HTTP server, like "https://example.org/p/".
+ *                  An empty string disables pasting
+ * @param lines     Output longer than this many lines is pasted
+ */
+void paste_init(const char *base_url, int lines);
+
+/** @returns  the number of lines printed on IRC before the rest is pasted, 0 if pasting is disabled */
+int paste_lines(void);
+
+/**
+ * Store text for PASTE_TTL seconds, dropping the oldest pastes if needed
+ * @warning  Returned string must be freed when no longer needed
+ *
+ * @returns  the paste's link or NULL if disabled
+ */
+char *paste_store(const char *text, size_t len);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/**
+ * @file probes.h
+ * USDT static tracepoints for bpftrace / perf under the "irc_bot" provider.
+ * With systemtap's sys/sdt.h installed every probe compiles to a single nop and a note in the ELF file,
+ * so they cost nothing unless a tracer attaches. Without it they compile to nothing.
+ * List them with "bpftrace -l 'usdt:bin/irc-bot:*'". Example scripts live in bpftrace/
+ *
+ * Probe              | Arguments
+ * ---                | ---
+ * line_received      | char *line, uint64_t receive time (CLOCK_MONOTONIC usec)
+ * command_lookup     | char *command, void *handler (NULL if unknown)
+ * handler_start      | char *command
+ * handler_end        | char *command
+ * send               | char *line, long bytes sent or negative on error
+ * http_start         | void *curl handle
+ * http_end           | void *curl handle, int CURLcode, long HTTP status, long bytes received
+ * mpd_connect        | int socket or -1
+ * mpd_event          | char *reply
+ * murmur_connect     | int socket or -1
+ * murmur_callback    | int packet type, char *username or NULL
+ * fork               | int pid returned by fork()
+ * exec               | char *program or shell command
+ *
+ * @warning  Keep the arguments cheap (variables, pointers). They are evaluated even when no tracer is attached
+ */
+
+#ifdef HAVE_SYS_SDT_H
+	#include <sys/sdt.h>
+	#define PROBE1(name, a)          DTRACE_PROBE1(irc_bot, name, a)
+	#define PROBE2(name, a, b)       DTRACE_PROBE2(irc_bot, name, a, b)
+	#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(irc_bot, name, a, b, c, d)
+#else
+	#define PROBE1(name, a)          do { } while (0)
+	#define PROBE2(name, a, b)       do { } while (0)
+	#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif
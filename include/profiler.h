@@ -0,0 +1,37 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "httpd.h"
+
+/**
+ * @file profiler.h
+ * Sampling CPU profiler enabled with "--profile[=hz]". SIGPROF fires every 1/hz seconds of CPU time
+ * in the main process and in the workers. Each sample's stack is captured with backtrace() and counted
+ * in a hash table shared by all processes. Stacks are written in the collapsed format flamegraph.pl and
+ * speedscope read, tagged with the command the worker runs ("main" for the main process).
+ * Available on GET /profile and written to PROFILE_FILE when the bot exits.
+ * Static functions have no dynamic symbol, they are printed as binary+offset for addr2line
+ */
+
+#define PROFILE_DEFAULT_HZ 99
+#define PROFILE_STACKS     4096 //!< Distinct stacks kept. Samples of new stacks are dropped once full
+#define PROFILE_DEPTH      32
+#define PROFILE_TAGLEN     16
+#define PROFILE_FILE       "irc-bot.folded"
+
+/** Map the shared table and start sampling. Must be called before any fork
+ *  @param hz  Samples per CPU second. 0 disables the profiler */
+void profiler_init(int hz);
+
+/** Tag the samples of this worker with the command it runs and restart the timer, since timers are not inherited */
+void profiler_worker_start(const char *command);
+
+/** Write every stack seen so far in collapsed format: "tag;outer;...;inner count" */
+void profiler_write_collapsed(FILE *stream);
+
+/** HTTP handler for GET /profile */
+void profiler_serve(Http_request *req, Http_response *res);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef QUOTES_H
+#define QUOTES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "irc.h"
+
+/**
+ * @file quotes.h
+ * Quote database used by !fail, !quote, !addquote and !grab. Quotes are appended to quote_file, each one ends with a
+ * null char and lines are separated by '\n'. quote_file.idx holds one fixed size entry per quote, so quote N is found
+ * in O(1). Both files are memory-mapped and only ever grow. Workers map them again if another one appended since.
+ * An empty database is seeded with the fail_quotes of the config.
+ * The main process also keeps the last QUOTE_RING lines of each channel, !grab turns one of them into a quote
+ */
+
+#define QUOTE_MAXLEN  1024 //!< Longer quotes are rejected
+#define QUOTE_RING    64   //!< Lines remembered per channel for !grab
+#define QUOTE_MATCHES 10   //!< IDs listed by a keyword search
+
+/** Entry N of the index file describes quote N + 1 */
+struct quote_entry {
+	uint64_t offset; //!< In the data file
+	uint32_t len;    //!< Without the null char
+	uint32_t time;
+	char added_by[NICKLEN];
+	char pad[4];
+};
+
+/**
+ * Open and map the database. Must be called before any fork
+ *
+ * @param path  Data file, the index is path.idx. An empty string disables the quote commands
+ */
+void quotes_init(const char *path);
+
+/** Remember a channel line for !grab. Called from the main process */
+void quote_remember(const char *channel, size_t channel_len, const char *nick, const char *text);
+
+/** Print a random quote, line by line with a random color */
+void bot_fail(Irc server, Parsed_data pdata);
+
+/** Print quote by id, a random one without arguments or search them. Usage: !quote [id | words] */
+void quote(Irc server, Parsed_data pdata);
+
+/** Usage: !addquote text. A literal "\n" starts a new line */
+void addquote(Irc server, Parsed_data pdata);
+
+/** Save the last line a nick said on this channel as a quote. Usage: !grab nick */
+void grab(Irc server, Parsed_data pdata);
+
+#endif
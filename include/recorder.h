@@ -0,0 +1,75 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @file recorder.h
+ * Flight recorder. Keeps the last RECORDER_EVENTS events (raw IRC lines, dispatch decisions,
+ * connection changes, child exits) in a ring buffer shared by all processes.
+ * Slots are claimed with a single atomic add, so recording never blocks or takes a lock.
+ * The ring is dumped to flight_recorder_file on SIGUSR1, on fatal signals and inside exit_msg().
+ * Use bin/flight_decode to read a dump
+ */
+
+#define RECORDER_EVENTS  4096
+#define RECORDER_DATALEN 232 //!< Longer lines are truncated
+#define RECORDER_MAGIC   "IRCFR01"
+
+enum recorder_type {
+	REC_INBOUND,    //!< Raw line from the server
+	REC_OUTBOUND,   //!< Raw line sent to the server
+	REC_DISPATCH,   //!< Bot command forked. Value holds the worker's pid or -1 if fork failed
+	REC_CONNECT,    //!< Value is 0 on success or -1
+	REC_DISCONNECT,
+	REC_CHILD_EXIT, //!< Value holds the wait() status of the child in pid
+	REC_SIGNAL,     //!< Value holds the signal number
+	REC_EXIT,       //!< Message passed to exit_msg()
+	REC_TYPE_MAX
+};
+
+/** One slot of the ring. Time is CLOCK_REALTIME in microseconds, so it can be matched with other logs */
+struct recorder_event {
+	uint64_t seq; //!< Position in the stream + 1. Zero means the slot was never used
+	uint64_t time;
+	int32_t pid;
+	int32_t value;
+	uint16_t type;
+	uint16_t len;
+	char data[RECORDER_DATALEN];
+};
+
+/** Dump file layout: this header followed by RECORDER_EVENTS events in slot order */
+struct recorder_header {
+	char magic[8];
+	uint32_t events;
+	uint32_t event_size;
+	uint64_t time;
+	int32_t pid;     //!< Process that wrote the dump
+	int32_t padding;
+	char reason[112];
+};
+
+/**
+ * Map the shared ring and install the SIGUSR1, SIGCHLD and fatal signal handlers.
+ * Must be called before any fork
+ *
+ * @param dump_file  Where the ring is written. An empty string disables the recorder
+ */
+void recorder_init(const char *dump_file);
+
+/**
+ * Record an event. Safe to call from any process and from signal handlers
+ *
+ * @param data  Copied up to len or RECORDER_DATALEN bytes. May be NULL
+ */
+void recorder_event(enum recorder_type type, int32_t value, const char *data, size_t len);
+
+/** Same as recorder_event() for null terminated strings */
+void recorder_text(enum recorder_type type, int32_t value, const char *text);
+
+/** Write the ring to the dump file. Only uses async-signal-safe functions */
+void recorder_dump(const char *reason);
+
+#endif
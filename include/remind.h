@@ -0,0 +1,68 @@
+#ifndef REMIND_H
+#define REMIND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "irc.h"
+
+/**
+ * @file remind.h
+ * Reminders set with !remind, kept in remind_file so they survive restarts. The file is a log of fixed size records:
+ * a reminder is added, then marked done or cancelled. Workers append under an exclusive lock. The main process reads
+ * the new records on every loop, keeps the pending reminders in a min-heap on due time and fires them from the poll
+ * loop. An id table makes cancelling O(log n) too. The heap is sized for many thousands of pending reminders: adding,
+ * firing or cancelling one costs O(log n) and, unlike a timing wheel, nothing runs between due times.
+ * Once done records outnumber pending ones the log is rewritten.
+ * Reminders that came due while the bot was away are delivered in one batch per channel once it's connected again
+ */
+
+#define REMIND_TEXTLEN  200
+#define REMIND_PER_NICK 50
+#define REMIND_LIST     5    //!< Shown by !reminders
+#define REMIND_LATE     60   //!< Seconds late before a reminder counts as missed
+#define REMIND_COMPACT  1024 //!< Done records before the log is rewritten
+#define REMIND_MAGIC    "IRCREM1"
+
+enum remind_op {
+	REMIND_ADD,
+	REMIND_DONE,
+	REMIND_CANCEL
+};
+
+struct remind_header {
+	char magic[8];
+	uint32_t next_id;
+	uint32_t pad;
+};
+
+struct remind_record {
+	uint32_t op;
+	uint32_t id;
+	uint32_t due;
+	uint32_t created;
+	char nick[NICKLEN];
+	char target[CHANLEN]; //!< Channel, or the nick for private reminders
+	char text[REMIND_TEXTLEN];
+};
+
+/**
+ * Open the log and load the pending reminders. Must be called before any fork
+ *
+ * @param path  An empty string disables the reminder commands
+ */
+void reminders_init(const char *path);
+
+/** Read the records appended by the workers and fire the reminders that are due. Called from the main loop */
+void reminders_poll(Irc server);
+
+/** Milliseconds until the next reminder is due, -1 if there's none or we can't deliver it yet */
+int reminders_timeout(Irc server);
+
+/** Usage: !remind 2h | 1d12h30m | 18:30 | tomorrow [09:00] | 2025-05-01 [09:00] text, or !remind cancel id */
+void remind(Irc server, Parsed_data pdata);
+
+/** List the sender's pending reminders */
+void reminders(Irc server, Parsed_data pdata);
+
+#endif
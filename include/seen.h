@@ -0,0 +1,89 @@
+#ifndef SEEN_H
+#define SEEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "irc.h"
+
+/**
+ * @file seen.h
+ * Nick activity store behind !seen and !tell. An open addressing hash table (linear probing, keyed by the lowercased
+ * nick) lives in a memory-mapped file, so lookups are O(1) and a restart maps the file without loading anything.
+ * Entries are kept in a least recently active list. Once the table is SEEN_MAXUSED full the stalest nick without
+ * memos is evicted. Memos come from a fixed pool and are delivered on the recipient's next channel activity, or dropped
+ * after SEEN_MEMO_TTL. There are fewer memos than entries, so there's always a nick to evict.
+ * The file is shared by the main process and the workers, a robust process shared mutex in the header guards every
+ * access. If a worker dies holding it the store is reset
+ */
+
+#define SEEN_SLOTS      4096 //!< Must be a power of 2
+#define SEEN_MAXUSED    (SEEN_SLOTS / 4 * 3)
+#define SEEN_MEMOS      512
+#define SEEN_NICK_MEMOS 4    //!< Pending memos per recipient
+#define SEEN_TEXTLEN    160  //!< Longer lines / memos are truncated
+#define SEEN_MEMO_TTL   (30 * 86400) //!< Seconds before an undelivered memo is dropped
+#define SEEN_MAGIC      "IRCSEE2"
+
+enum seen_action {
+	SEEN_MESSAGE,
+	SEEN_JOIN,
+	SEEN_PART,
+	SEEN_QUIT,
+	SEEN_NICK,    //!< Old nick's entry. Text holds the new nick
+	SEEN_NEWNICK  //!< New nick's entry. Text holds the old nick
+};
+
+/** Empty slots have an empty nick. prev / next / memos are slot indexes, -1 ends the list */
+struct seen_entry {
+	char nick[NICKLEN];
+	char channel[CHANLEN];
+	char text[SEEN_TEXTLEN];
+	uint32_t time; //!< 0 if only memos were left for the nick
+	int32_t action;
+	int32_t prev;
+	int32_t next;
+	int32_t memos;
+};
+
+struct seen_memo {
+	char from[NICKLEN];
+	char text[SEEN_TEXTLEN];
+	uint32_t time;
+	int32_t next;
+};
+
+/** Layout of the file: this header, SEEN_SLOTS entries and SEEN_MEMOS memos */
+struct seen_header {
+	char magic[8];
+	uint32_t slots;
+	uint32_t memo_slots;
+	uint32_t used;
+	int32_t newest; //!< Head of the activity list
+	int32_t oldest;
+	int32_t free_memos;
+	pthread_mutex_t lock; //!< Last, a reset keeps it
+};
+
+/**
+ * Map the store, creating or resetting the file if it doesn't match the current layout. Must be called before any fork
+ *
+ * @param path  Backing file. An empty string disables !seen and !tell
+ */
+void seen_init(const char *path);
+
+/**
+ * Record a nick's activity and deliver it's pending memos, unless it's leaving. Called from the main process
+ *
+ * @param channel  Where it happened or NULL for a quit / nick change
+ * @param text     The line, part / quit reason or the new nick. Can be NULL
+ */
+void seen_activity(Irc server, const char *nick, const char *channel, enum seen_action action, const char *text);
+
+/** Print when and where a nick was last active */
+void seen(Irc server, Parsed_data pdata);
+
+/** Leave a memo for a nick. Usage: !tell nick message */
+void tell(Irc server, Parsed_data pdata);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SHORTEN_H
+#define SHORTEN_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "httpd.h"
+
+/**
+ * @file shorten.h
+ * URL shortener served by the bot itself. Links live in an open addressing hash table (linear probing, keyed by the
+ * FNV-1a hash of the URL) in a memory-mapped file, the URLs themselves in an append-only area after it, so a restart
+ * keeps every link without loading anything. A short code is the high bits of the URL's hash plus the slot it landed
+ * in, so URLs whose hashes collide still get different codes and a code leads straight to it's slot.
+ * Workers add links and the main process serves GET /s/code of the HTTP server with a redirect. A robust process
+ * shared mutex in the header guards the table, if a worker dies holding it the table is reset.
+ * When the table reaches SHORT_MAXUSED or the URLs fill SHORT_HEAP, the oldest half of the links, and at least half
+ * of the bytes, are dropped and the rest of the URLs are moved to the front. Kept links stay in their slots so their
+ * codes keep working. A dropped link that a kept one probed past stays behind as a tombstone, new links reuse those
+ */
+
+#define SHORT_SLOTS   16384 //!< Must be a power of 2
+#define SHORT_MAXUSED (SHORT_SLOTS / 4 * 3) //!< Links and tombstones before the oldest links are dropped
+#define SHORT_HEAP    (4 * 1024 * 1024) //!< Bytes for the URLs
+#define SHORT_CODELEN 6     //!< Base62 digits of a 32 bit code
+#define SHORT_PATH    "/s/"
+#define SHORT_MAGIC   "IRCSHR2"
+#define SHORT_DEAD    UINT32_MAX
+
+/** offset is where the URL starts in the heap, 0 for empty slots and SHORT_DEAD for tombstones */
+struct short_entry {
+	uint32_t hash;
+	uint32_t offset;
+};
+
+/** Layout of the file: this header, SHORT_SLOTS entries and SHORT_HEAP bytes of null terminated URLs, oldest first */
+struct short_header {
+	char magic[8];
+	uint32_t slots;
+	uint32_t heap_size;
+	uint32_t used; //!< Slots taken by links or tombstones
+	uint32_t heap_used;
+	pthread_mutex_t lock; //!< Last, a reset keeps it
+};
+
+/**
+ * Map the table, creating or resetting the file if it doesn't match the current layout, and register the redirects
+ * on SHORT_PATH. Must be called before any fork
+ *
+ * @param path      Backing file
+ * @param base_url  Public URL that reaches SHORT_PATH of the HTTP server, like "https://example.org/s/".
+ *                  An empty path or base_url, or a replay, disables shortening
+ */
+void shortener_init(const char *path, const char *base_url);
+
+/**
+ * Get the short version of long_url. The same URL always gets the same one
+ * @warning  Returned string must be freed when no longer needed
+ *
+ * @returns  base_url followed by the code or NULL if disabled or the URL is invalid
+ */
+char *shorten_url(const char *long_url);
+
+#endif
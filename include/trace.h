@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/**
+ * @file trace.h
+ * Per request tracing. Every bot command gets a request ID when it's dispatched and the spans recorded
+ * while it runs (fork wait, curl phases, subprocesses, outbound lines) are tagged with it.
+ * Forked processes inherit the ID, so the whole tree of workers is tied back to the originating line.
+ * Records are appended to trace_file with a single write() each. Use bin/trace_report to read them
+ */
+
+#define TRACE_NAMELEN 28
+#define TRACE_MAXSIZE (16 * 1024 * 1024) //!< Move the trace file to "<trace_file>.old" on startup once it gets bigger
+
+enum trace_type {
+	TRACE_DISPATCH,   //!< From reading the line until the worker is forked. Name holds the command
+	TRACE_FORK_WAIT,  //!< From the fork until the worker starts running
+	TRACE_COMMAND,    //!< The worker's whole runtime
+	TRACE_DNS,
+	TRACE_CONNECT,
+	TRACE_TLS,
+	TRACE_HTTP_WAIT,  //!< From sending the request until the first response byte
+	TRACE_HTTP_BODY,  //!< Downloading the response
+	TRACE_SUBPROCESS, //!< External program until it's output is consumed. Name holds the program
+	TRACE_SEND,       //!< Outbound IRC line. Name holds the target
+	TRACE_TYPE_MAX
+};
+
+/** Fixed size on-disk record. Timestamps are CLOCK_MONOTONIC microseconds */
+struct trace_record {
+	uint64_t start;
+	uint32_t duration;
+	uint32_t request;
+	int32_t session; //!< Main process pid. Request IDs start from 1 again after every restart
+	int32_t pid;     //!< Process that recorded the span
+	uint32_t type;
+	char name[TRACE_NAMELEN];
+};
+
+/**
+ * Open the trace file in append mode
+ *
+ * @param path  An empty string disables tracing
+ */
+void trace_init(const char *path);
+
+/** Stamp the line that is about to be dispatched with the time it was read */
+void trace_line_received(uint64_t usec);
+
+/** Assign a new request ID to the line received. The fork that follows passes it to the worker */
+void trace_request_begin(const char *command);
+
+/** Called in the parent after forking the worker. Later spans in the main process are not part of the request */
+void trace_request_end(void);
+
+//@{
+/** Bracket the worker's runtime. Records the fork wait and the command spans */
+void trace_worker_start(void);
+void trace_worker_end(void);
+//@}
+
+/**
+ * Record a span for the current request. Does nothing if tracing is off or no request is active
+ *
+ * @param name  Optional. Truncated to TRACE_NAMELEN - 1 characters
+ */
+void trace_span(enum trace_type type, uint64_t start, uint64_t duration, const char *name);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef TRENDING_H
+#define TRENDING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "irc.h"
+
+/**
+ * @file trending.h
+ * Words and links spiking in a channel, for !trending. Every channel message is split in terms (lowercased words of
+ * 3 or more bytes that aren't stopwords or numbers, links kept whole). Their recent counts are kept by a Space-Saving
+ * summary of TREND_TERMS counters under exponential decay with a TREND_RECENT half-life. A count-min sketch with a
+ * TREND_BASELINE half-life estimates every term's usual rate. A term trends when its recent rate is well above it.
+ * Decay is applied forward: new counts are scaled up instead of old ones down, and everything is rescaled rarely.
+ * Memory is fixed per channel. Fed by the main process, workers read the copy they got at fork
+ */
+
+#define TREND_TERMS     64 //!< At most 255
+#define TREND_TABLE     128 //!< Slots of the term index, a power of 2 bigger than TREND_TERMS
+#define TREND_TERMLEN   48 //!< Longer terms are cut
+#define TREND_RECENT    (15 * 60.0)
+#define TREND_BASELINE  (24 * 3600.0)
+#define TREND_CMS_DEPTH 4
+#define TREND_CMS_WIDTH 2048 //!< Must be a power of 2
+#define TREND_MINCOUNT  3.0  //!< Recent occurrences needed to trend
+#define TREND_MINRATIO  3.0  //!< Recent rate over baseline rate needed to trend
+#define TREND_SHOW      5
+
+struct trend_counter {
+	char term[TREND_TERMLEN];
+	double count; //!< Scaled by the recent decay
+	double error; //!< Count of the term it replaced
+};
+
+struct channel_trends {
+	char channel[CHANLEN];
+	double since;        //!< First message seen, rates are over shorter spans until the windows fill
+	double recent_start; //!< Time when the recent scale was 1
+	double baseline_start;
+	uint32_t hashes[TREND_TERMS]; //!< Of each counter's term
+	struct trend_counter counters[TREND_TERMS];
+	uint8_t heap[TREND_TERMS];     //!< Counter indexes, min-heap on count
+	uint8_t position[TREND_TERMS]; //!< Of each counter in the heap
+	uint8_t table[TREND_TABLE];    //!< Open addressing on the term hash. Counter index + 1, 0 for empty slots
+	uint32_t used;
+	float cms[TREND_CMS_DEPTH][TREND_CMS_WIDTH]; //!< Scaled by the baseline decay
+};
+
+struct trend {
+	const char *term;
+	double count; //!< Recent occurrences, decayed
+	double ratio; //!< Recent rate over the usual rate
+};
+
+/** Count the terms of a channel message. Called from the main process */
+void trending_message(const char *channel, size_t channel_len, const char *text);
+
+/** Print the terms trending on a channel. Usage: !trending [#channel] */
+void trending(Irc server, Parsed_data pdata);
+
+#endif
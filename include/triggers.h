@@ -0,0 +1,49 @@
+#ifndef TRIGGERS_H
+#define TRIGGERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <yajl/yajl_tree.h>
+#include "irc.h"
+
+/**
+ * @file triggers.h
+ * Keyword and phrase triggers from the config, answered with a canned reply or a bot command. All the phrases are
+ * compiled into one Aho-Corasick automaton with the failure links resolved into a full transition table, so every
+ * message is scanned once, byte by byte, however many triggers there are. Bytes are mapped to the classes that appear
+ * in the phrases first, which keeps the table small. Matching ignores ASCII case and a phrase that starts or ends with
+ * a letter or digit must not be part of a longer word
+ */
+
+#define TRIGGER_MAXCHANS MAXCHANS //!< Channels a trigger keeps a cooldown for
+
+struct trigger_cooldown {
+	char channel[CHANLEN];
+	time_t last;
+};
+
+struct trigger {
+	const char *reply; //!< Sent to the channel, run as a bot command by the sender if it starts with '!'
+	char **channels;   //!< Where it fires, all channels if there are none
+	int channel_count;
+	int cooldown;      //!< Seconds before it fires again on the same channel
+	struct trigger_cooldown fired[TRIGGER_MAXCHANS];
+};
+
+/**
+ * Compile the triggers. Can be called again to replace them
+ *
+ * @param array  The "triggers" array of the config. Each is an object with "match", an array of phrases, "reply",
+ *               "channels", an array that can be empty, and "cooldown" in seconds
+ */
+void triggers_init(yajl_val array);
+
+/**
+ * Find the first trigger that fires on a channel message and start it's cooldown. Called from the main process
+ *
+ * @returns  the trigger's reply or NULL
+ */
+const char *trigger_match(const char *channel, size_t channel_len, const char *text);
+
+#endif
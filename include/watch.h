@@ -0,0 +1,32 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <time.h>
+#include "bot.h"
+#include "curl.h"
+
+/**
+ * @file watch.h
+ * Announce new commits of the watch_repos on the default channel. A forked child polls the repos in turn with
+ * If-None-Match, so an unchanged repo is a 304 that costs no quota and has no body. New commits are the ones before
+ * the last seen sha. The pause between polls follows the X-RateLimit headers: the quota left until the reset is spread
+ * over the requests, shared by every watched repo, keeping a few for !github
+ */
+
+#define WATCH_FETCH      10 //!< Commits asked for on every poll
+#define WATCH_ANNOUNCE   5  //!< The rest of a big push is only counted
+#define WATCH_MIN_PERIOD 60 //!< Seconds between polls of the same repo at least
+#define WATCH_DEFAULT    60 //!< Seconds between polls when the rate limit is unknown
+#define WATCH_RESERVE    10 //!< Requests left for !github
+#define SHALEN           40
+
+struct watched_repo {
+	char name[REPOLEN + 1];
+	char last_sha[SHALEN + 1]; //!< Empty until the first poll, which only takes note of it
+	Github_poll poll;
+};
+
+/** Start the watcher if there are watch_repos. Must be called after connecting, announcements go to it's channel */
+void watch_start(Irc server);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef WEBHOOK_H
+#define WEBHOOK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <yajl/yajl_tree.h>
+#include "irc.h"
+#include "httpd.h"
+#include "watch.h"
+
+/**
+ * @file webhook.h
+ * Receiver of GitHub webhooks on POST /github of the HTTP server. Deliveries are signed with webhook_secret: the
+ * X-Hub-Signature-256 header must be the HMAC-SHA256 of the body. The payload goes through yajl's event parser and
+ * only the few fields announced are copied, no tree is built. Pushes, pull requests and issues are announced on the
+ * channel webhook_channels maps the repo to, or the first channel. Runs in the main process, nothing here blocks
+ */
+
+#define WEBHOOK_DEPTH   16  //!< Deeper JSON isn't looked at
+#define WEBHOOK_PATHLEN 128
+#define WEBHOOK_TEXTLEN 200
+
+/** The fields of an event that are announced */
+struct webhook_event {
+	char repo[REPOLEN + 1];
+	char action[16];
+	char ref[WEBHOOK_TEXTLEN];
+	char user[NICKLEN * 2];   //!< Pusher or sender
+	char title[WEBHOOK_TEXTLEN];
+	char url[WEBHOOK_TEXTLEN]; //!< Compare URL of a push or the page of a PR / issue
+	char number[12];
+	bool merged, forced, deleted;
+	int commit_count;
+	struct {
+		char id[SHALEN + 1];
+		char message[WEBHOOK_TEXTLEN];
+		char author[NICKLEN * 2];
+	} commits[WATCH_ANNOUNCE]; //!< The last ones, commit_count % WATCH_ANNOUNCE is the oldest once it wraps
+};
+
+/**
+ * Register the route if there's a secret. Unsigned deliveries are never accepted
+ *
+ * @param channels  webhook_channels object, "author/repo": "#channel"
+ */
+void webhook_init(Irc server, const char *secret, yajl_val channels);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef XML_H
+#define XML_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file xml.h
+ * Pull tokenizer for XML in memory. It hands out tags and text one at a time as pointers into the input, so there's
+ * no tree and nothing is allocated. The caller stops whenever it has what it needs.
+ * It's lenient, enough for feeds: no validation, declarations, comments and processing instructions are skipped
+ */
+
+enum xml_type {
+	XML_OPEN,  //!< Start tag. empty is set for <tag/>, no XML_CLOSE follows it
+	XML_CLOSE, //!< End tag
+	XML_TEXT,  //!< Text between tags, entities still encoded, or a CDATA section
+	XML_EOF    //!< End of input or markup that never ends
+};
+
+struct xml_token {
+	enum xml_type type;
+	const char *name; //!< Tag name, prefix included
+	size_t name_len;
+	const char *data; //!< Attributes of a start tag or the text
+	size_t data_len;
+	bool empty;
+	bool cdata;       //!< The text needs no decoding
+};
+
+struct xml_reader {
+	const char *p;
+	const char *end;
+};
+
+/** Read the next token. Returns false at XML_EOF */
+bool xml_next(struct xml_reader *reader, struct xml_token *token);
+
+/** True if the tag is named name */
+bool xml_is(const struct xml_token *token, const char *name);
+
+/**
+ * Find an attribute of a start tag and decode it
+ *
+ * @returns  false if it's missing
+ */
+bool xml_attr(const struct xml_token *token, const char *name, char *value, size_t size);
+
+/**
+ * Append text to a string, decoding the entities (&amp; &#233; etc) unless it's CDATA.
+ * Whitespace runs become one space and markup found in the decoded text is dropped, like escaped html in titles
+ *
+ * @param len  Current length of dest, updated
+ */
+void xml_append_text(char *dest, size_t size, size_t *len, const char *text, size_t text_len, bool cdata);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "recorder.h"
+
+/* Print the events of a flight recorder dump in the order they happened */
+
+static const char *type_name[REC_TYPE_MAX] = {
+	[REC_INBOUND]    = "<<",
+	[REC_OUTBOUND]   = ">>",
+	[REC_DISPATCH]   = "dispatch",
+	[REC_CONNECT]    = "connect",
+	[REC_DISCONNECT] = "disconnect",
+	[REC_CHILD_EXIT] = "child exit",
+	[REC_SIGNAL]     = "signal",
+	[REC_EXIT]       = "exit"
+};
+
+static int compare_events(const void *a, const void *b) {
+
+	const struct recorder_event *e1 = a, *e2 = b;
+
+	return e1->seq < e2->seq ? -1 : (e1->seq > e2->seq ? 1 : 0);
+}
+
+static void print_time(uint64_t usec) {
+
+	char buf[32];
+	time_t sec = usec / 1000000;
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&sec));
+	printf("%s.%06u", buf, (unsigned) (usec % 1000000));
+}
+
+static void print_event(const struct recorder_event *event) {
+
+	int i;
+
+	print_time(event->time);
+	printf("  %-6d %-10s ", event->pid, event->type < REC_TYPE_MAX ? type_name[event->type] : "?");
+
+	switch (event->type) {
+	case REC_CHILD_EXIT:
+		if (WIFSIGNALED(event->value))
+			printf("killed by signal %d%s", WTERMSIG(event->value), WCOREDUMP(event->value) ? " (core dumped)" : "");
+		else
+			printf("exit status %d", WEXITSTATUS(event->value));
+		break;
+	case REC_DISPATCH:
+		if (event->value < 0)
+			printf("fork failed: ");
+		break;
+	default:
+		if (event->value)
+			printf("[%d] ", event->value);
+	}
+	// Escape control characters like the CTCP \x01 delimiters
+	for (i = 0; i < event->len && i < RECORDER_DATALEN; i++) {
+		if (isprint((unsigned char) event->data[i]) || (unsigned char) event->data[i] >= 0x80)
+			putchar(event->data[i]);
+		else
+			printf("\\x%02x", (unsigned char) event->data[i]);
+	}
+	if (event->type == REC_DISPATCH && event->value > 0)
+		printf(" -> worker %d", event->value);
+
+	putchar('\n');
+}
+
+int main(int argc, char *argv[]) {
+
+	FILE *file;
+	struct recorder_header header;
+	struct recorder_event *events;
+	size_t n;
+	unsigned i;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <flight_recorder_file>\n", argv[0]);
+		return 1;
+	}
+	file = fopen(argv[1], "rb");
+	if (!file) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, RECORDER_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s: not a flight recorder dump\n", argv[1]);
+		return 1;
+	}
+	if (header.event_size != sizeof(*events) || header.events > 1000000) {
+		fprintf(stderr, "%s: dump was written by an incompatible version\n", argv[1]);
+		return 1;
+	}
+	events = calloc(header.events, sizeof(*events));
+	if (!events) {
+		perror("calloc");
+		return 1;
+	}
+	n = fread(events, sizeof(*events), header.events, file);
+	fclose(file);
+
+	printf("Dumped by pid %d at ", header.pid);
+	print_time(header.time);
+	printf(": %.*s\n", (int) sizeof(header.reason), header.reason);
+
+	// Slots are reused in a circle. Sorting by sequence number restores the original order
+	qsort(events, n, sizeof(*events), compare_events);
+	for (i = 0; i < n; i++) {
+		if (!events[i].seq) // Never used or it was being written during the dump
+			continue;
+
+		if (i && events[i - 1].seq && events[i].seq != events[i - 1].seq + 1)
+			printf("... %llu events lost\n", (unsigned long long) (events[i].seq - events[i - 1].seq - 1));
+
+		print_event(&events[i]);
+	}
+	free(events);
+	return 0;
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/* HTTP server for offline tests and benchmarks of the curl backed commands. Point http_fixture_url to it and every
+ * request arrives with the original host and path as it's path, e.g. GET /api.github.com/repos/...
+ * Paths are mapped to fixture files by prefix. Replies can be delayed, sent in chunks, gzip compressed and given any
+ * status code, to see how the commands cope with slow or broken services. Every connection is served by a new process */
+
+#define MAXMAPS   16
+#define HEADERLEN 8192
+
+struct map {
+	const char *prefix;
+	const char *file;
+};
+
+static struct map maps[MAXMAPS];
+static int map_count;
+
+static const char *dir = "test-files";
+static int delay_ms, chunk_size, chunk_delay_ms, status = 200;
+static bool gzip;
+
+static void sleep_ms(int ms) {
+
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+	while (ms > 0 && nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+static void add_map(const char *spec) {
+
+	char *copy, *file;
+
+	copy = strdup(spec);
+	file = copy ? strchr(copy, '=') : NULL;
+	if (!file || map_count == MAXMAPS) {
+		fprintf(stderr, "Invalid map: %s\n", spec);
+		exit(EXIT_FAILURE);
+	}
+	*file++ = '\0';
+	maps[map_count].prefix = copy;
+	maps[map_count++].file = file;
+}
+
+static const char *find_fixture(const char *path) {
+
+	int i;
+
+	for (i = 0; i < map_count; i++)
+		if (!strncmp(path, maps[i].prefix, strlen(maps[i].prefix)))
+			return maps[i].file;
+
+	return NULL;
+}
+
+static char *read_fixture(const char *file, size_t *len) {
+
+	char path[512], *buf;
+	struct stat st;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	if (fstat(fileno(f), &st) < 0 || !(buf = malloc(st.st_size + 1))) {
+		fclose(f);
+		return NULL;
+	}
+	*len = fread(buf, 1, st.st_size, f);
+	fclose(f);
+	return buf;
+}
+
+static char *gzip_body(const char *body, size_t *len) {
+
+	z_stream z;
+	char *out;
+
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	out = malloc(deflateBound(&z, *len));
+	if (!out) {
+		deflateEnd(&z);
+		return NULL;
+	}
+	z.next_in = (Bytef *) body;
+	z.avail_in = *len;
+	z.next_out = (Bytef *) out;
+	z.avail_out = deflateBound(&z, *len);
+	deflate(&z, Z_FINISH);
+	*len = z.total_out;
+	deflateEnd(&z);
+	return out;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n <= 0)
+			exit(EXIT_FAILURE); // Client went away
+		buf += n;
+		len -= n;
+	}
+}
+
+static void send_body(int fd, const char *body, size_t len) {
+
+	char size_line[32];
+	size_t n;
+
+	if (!chunk_size) {
+		write_all(fd, body, len);
+		return;
+	}
+	for (; len; body += n, len -= n) {
+		n = len < (size_t) chunk_size ? len : (size_t) chunk_size;
+		snprintf(size_line, sizeof(size_line), "%zx\r\n", n);
+		write_all(fd, size_line, strlen(size_line));
+		write_all(fd, body, n);
+		write_all(fd, "\r\n", 2);
+		sleep_ms(chunk_delay_ms);
+	}
+	write_all(fd, "0\r\n\r\n", 5);
+}
+
+static const char *content_type(const char *file) {
+
+	const char *ext = strrchr(file, '.');
+
+	if (ext && !strcmp(ext, ".json"))
+		return "application/json";
+	if (ext && !strcmp(ext, ".txt"))
+		return "text/html";
+
+	return "application/octet-stream";
+}
+
+static void serve(int fd) {
+
+	char request[HEADERLEN + 1], method[16], path[1024], header[512], *end, *body = NULL, *compressed;
+	const char *file;
+	size_t len = 0, body_len = 0;
+	bool compress;
+	ssize_t n;
+
+	// Headers are enough, POST bodies are not looked at
+	request[0] = '\0';
+	while (!(end = strstr(request, "\r\n\r\n"))) {
+		n = read(fd, request + len, HEADERLEN - len);
+		if (n <= 0 || (len += n) == HEADERLEN)
+			return;
+		request[len] = '\0';
+	}
+	if (sscanf(request, "%15s %1023s", method, path) != 2)
+		return;
+
+	compress = gzip && strcasestr(request, "accept-encoding") && strstr(request, "gzip");
+	file = find_fixture(path);
+	if (file)
+		body = read_fixture(file, &body_len);
+
+	fprintf(stderr, "%s %s -> %s %d%s\n", method, path, body ? file : "no fixture", body ? status : 404, compress ? " gzip" : "");
+	sleep_ms(delay_ms);
+	if (!body) {
+		snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		write_all(fd, header, strlen(header));
+		return;
+	}
+	if (compress && (compressed = gzip_body(body, &body_len))) {
+		free(body);
+		body = compressed;
+	} else
+		compress = false;
+
+	snprintf(header, sizeof(header), "HTTP/1.1 %d Fixture\r\nContent-Type: %s\r\nConnection: close\r\n%s", status,
+		content_type(file), compress ? "Content-Encoding: gzip\r\n" : "");
+	write_all(fd, header, strlen(header));
+	if (chunk_size)
+		snprintf(header, sizeof(header), "Transfer-Encoding: chunked\r\n\r\n");
+	else
+		snprintf(header, sizeof(header), "Content-Length: %zu\r\n\r\n", body_len);
+	write_all(fd, header, strlen(header));
+
+	send_body(fd, body, body_len);
+	free(body);
+}
+
+static void usage(const char *program) {
+
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  --port=N            Port to listen on 127.0.0.1 (default 8091)\n"
+		"  --dir=DIR           Directory with the fixture files (default test-files)\n"
+		"  --map=PREFIX=FILE   Serve FILE for paths starting with PREFIX. Checked in order, before the defaults:\n"
+		"                      /api.github.com/=github.json /=url-title.txt\n"
+		"  --delay=MS          Wait before replying\n"
+		"  --chunk=BYTES       Send the body with chunked encoding in pieces of this size\n"
+		"  --chunk-delay=MS    Wait between chunks\n"
+		"  --gzip              Compress the body if the client accepts gzip\n"
+		"  --status=CODE       Reply with this status instead of 200\n", program);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+	const struct option options[] = {
+		{ "port",        required_argument, NULL, 'p' },
+		{ "dir",         required_argument, NULL, 'd' },
+		{ "map",         required_argument, NULL, 'm' },
+		{ "delay",       required_argument, NULL, 'w' },
+		{ "chunk",       required_argument, NULL, 'c' },
+		{ "chunk-delay", required_argument, NULL, 'C' },
+		{ "gzip",        no_argument,       NULL, 'z' },
+		{ "status",      required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct sockaddr_in addr;
+	int c, listen_fd, client, port = 8091, on = 1;
+
+	while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (c) {
+		case 'p': port = atoi(optarg); break;
+		case 'd': dir = optarg; break;
+		case 'm': add_map(optarg); break;
+		case 'w': delay_ms = atoi(optarg); break;
+		case 'c': chunk_size = atoi(optarg); break;
+		case 'C': chunk_delay_ms = atoi(optarg); break;
+		case 'z': gzip = true; break;
+		case 's': status = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind < argc || chunk_size < 0 || status < 100 || status > 599)
+		usage(argv[0]);
+
+	add_map("/api.github.com/=github.json");
+	add_map("/=url-title.txt");
+
+	signal(SIGCHLD, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+		perror("listen");
+		return EXIT_FAILURE;
+	}
+	for (;;) {
+		client = accept(listen_fd, NULL, NULL);
+		if (client < 0) {
+			if (errno != EINTR)
+				perror("accept");
+			continue;
+		}
+		switch (fork()) {
+		case 0:
+			close(listen_fd);
+			serve(client);
+			close(client);
+			_exit(EXIT_SUCCESS);
+		case -1:
+			perror("fork");
+		}
+		close(client);
+	}
+}
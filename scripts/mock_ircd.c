@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* Local IRC server stand-in and load generator. Registers the bot (001 / 376), echoes it's JOINs, then plays
+ * channel traffic and bot commands at the given rates with periodic bursts. Commands are sent privately from a
+ * unique nick each, so the bot's reply to that nick gives the command-to-reply latency.
+ * Reports latency percentiles, the bot's outbound rate against an RFC 1459 style flood limit and, when the bot
+ * was started by us (arguments after --) or given with --pid, it's CPU time and peak RSS. Needs no network access */
+
+#define LINELEN      512
+#define MAXSECONDS   3600
+#define FLOOD_PENALTY 2  //!< Seconds each outbound line costs. Servers drop clients more than FLOOD_WINDOW seconds ahead
+#define FLOOD_WINDOW  10
+
+struct options {
+	int port;
+	const char *channel;
+	double rate; //!< Channel lines per second
+	double command_rate; //!< Bot commands per second
+	int duration;
+	int burst_interval;
+	int burst_size;
+	unsigned seed;
+	bool json;
+	pid_t pid;
+};
+
+struct command {
+	char name[32];
+	int weight;
+};
+
+struct pending {
+	uint64_t sent; //!< Zero once answered
+};
+
+static struct options opt = { 6667, "#foss-teimes", 20, 2, 30, 10, 100, 1, false, 0 };
+static struct command mix[16];
+static int mix_count, mix_total;
+
+static int client = -1;
+static char bot_nick[64] = "fossbot";
+static struct pending *pending;
+static uint64_t *latencies;
+static int commands_sent, replies, lines_sent, bot_lines, flood_violations;
+static int lines_per_second[MAXSECONDS + 60];
+static uint64_t start_usec, flood_clock;
+static long peak_rss_kb;
+
+static const char *nicks[] = { "laxanofido", "freestyler", "kostas_", "nikos", "mpougatsa", "alex_", "zorbas", "vasilis" };
+static const char *chat[] = {
+	"How YA doing fossbot",
+	"has anyone tried the new kernel on the lab machines? the nvidia module fails to build",
+	"lol",
+	"https://github.com/foss-teimes/irc-bot/pull/12 can someone review this?",
+	"brb",
+	"the lab printer is out of toner again",
+	"καλημέρα σε όλους",
+};
+
+static uint64_t now_usec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void send_line(const char *format, ...) {
+
+	char line[LINELEN + 2];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(line, LINELEN, format, args);
+	va_end(args);
+	if (len >= LINELEN)
+		len = LINELEN - 1;
+
+	memcpy(line + len, "\r\n", 2);
+	if (write(client, line, len + 2) != len + 2) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+	lines_sent++;
+}
+
+static void parse_mix(char *spec) {
+
+	char *entry, *weight;
+
+	for (entry = strtok(spec, ","); entry && mix_count < (int) (sizeof(mix) / sizeof(mix[0])); entry = strtok(NULL, ",")) {
+		weight = strchr(entry, ':');
+		if (weight)
+			*weight++ = '\0';
+
+		snprintf(mix[mix_count].name, sizeof(mix[0].name), "%s", entry);
+		mix[mix_count].weight = weight ? atoi(weight) : 1;
+		mix_total += mix[mix_count++].weight;
+	}
+}
+
+static const char *pick_command(void) {
+
+	int i, r = rand() % mix_total;
+
+	for (i = 0; r >= mix[i].weight; i++)
+		r -= mix[i].weight;
+
+	return mix[i].name;
+}
+
+static void send_traffic(void) {
+
+	const char *nick = nicks[rand() % (sizeof(nicks) / sizeof(nicks[0]))];
+	int r = rand() % 10;
+
+	if (r == 0)
+		send_line(":%s!~%s@%s.mock.host JOIN %s", nick, nick, nick, opt.channel);
+	else if (r == 1)
+		send_line(":%s!~%s@%s.mock.host QUIT :Ping timeout: 260 seconds", nick, nick, nick);
+	else
+		send_line(":%s!~%s@%s.mock.host PRIVMSG %s :%s", nick, nick, nick, opt.channel, chat[rand() % (sizeof(chat) / sizeof(chat[0]))]);
+}
+
+static void send_command(void) {
+
+	static int size;
+	const char *cmd = pick_command();
+
+	if (commands_sent == size) {
+		size = size ? size * 2 : 1024;
+		pending = realloc(pending, size * sizeof(*pending));
+		latencies = realloc(latencies, size * sizeof(*latencies));
+		if (!pending || !latencies) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	// Private commands are answered to the sender, so the nick identifies the command. Every client has it's own host
+	// like on a real network, flood detection would take a single one for clones
+	pending[commands_sent].sent = now_usec();
+	send_line(":lg%d!~load@lg%d.mock.host PRIVMSG %s :!%s", commands_sent, commands_sent, bot_nick, cmd);
+	commands_sent++;
+}
+
+static void account_bot_line(const char *line) {
+
+	uint64_t now = now_usec();
+	unsigned second = (now - start_usec) / 1000000;
+	int id;
+
+	bot_lines++;
+	if (second < sizeof(lines_per_second) / sizeof(lines_per_second[0]))
+		lines_per_second[second]++;
+
+	// Penalty clock of RFC 1459 8.10. A line sent while the clock is more than FLOOD_WINDOW seconds ahead means excess flood
+	if (flood_clock < now)
+		flood_clock = now;
+	flood_clock += FLOOD_PENALTY * 1000000;
+	if (flood_clock > now + FLOOD_WINDOW * 1000000)
+		flood_violations++;
+
+	if (sscanf(line, "PRIVMSG lg%d ", &id) != 1 && sscanf(line, "NOTICE lg%d ", &id) != 1)
+		return;
+
+	if (id >= 0 && id < commands_sent && pending[id].sent) {
+		latencies[replies++] = now - pending[id].sent;
+		pending[id].sent = 0;
+	}
+}
+
+/** Handle one line from the bot
+ *  @returns  false if the bot quit */
+static bool handle_line(char *line, bool *registered, int *joined) {
+
+	char arg[LINELEN];
+
+	if (sscanf(line, "NICK %63s", bot_nick) == 1) {
+		// Nick changes need no reply
+	} else if (!strncmp(line, "USER ", 5) && !*registered) {
+		send_line(":mock.server 001 %s :Welcome to the mock IRC network %s", bot_nick, bot_nick);
+		send_line(":mock.server 375 %s :- mock.server Message of the day -", bot_nick);
+		send_line(":mock.server 376 %s :End of /MOTD command.", bot_nick);
+		*registered = true;
+	} else if (sscanf(line, "JOIN %511s", arg) == 1) {
+		send_line(":%s!~bot@mock.host JOIN %s", bot_nick, arg);
+		send_line(":mock.server 366 %s %s :End of /NAMES list.", bot_nick, arg);
+		(*joined)++;
+	} else if (!strncmp(line, "QUIT", 4)) {
+		return false;
+	}
+	if (start_usec)
+		account_bot_line(line);
+
+	return true;
+}
+
+/** Read whatever the bot sent
+ *  @returns  false if the connection closed */
+static bool read_bot(bool *registered, int *joined) {
+
+	static char buf[LINELEN * 8];
+	static size_t len;
+	char *line, *end;
+	ssize_t n;
+
+	n = read(client, buf + len, sizeof(buf) - len - 1);
+	if (n <= 0)
+		return n < 0 && errno == EAGAIN;
+
+	len += n;
+	buf[len] = '\0';
+	for (line = buf; (end = strstr(line, "\r\n")); line = end + 2) {
+		*end = '\0';
+		if (!handle_line(line, registered, joined))
+			return false;
+	}
+	len -= line - buf;
+	memmove(buf, line, len);
+	if (len == sizeof(buf) - 1)
+		len = 0; // Line too long, drop it
+
+	return true;
+}
+
+/** Peak resident memory and CPU seconds of pid including it's reaped workers */
+static double sample_process(pid_t pid) {
+
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	long cutime, cstime, rss;
+	FILE *file;
+	size_t n;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	n = fread(buf, 1, sizeof(buf) - 1, file);
+	fclose(file);
+	buf[n] = '\0';
+
+	// Skip "pid (comm)", comm may contain spaces
+	p = strrchr(buf, ')');
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld %*d %*d %*d %*d %*u %*u %ld",
+			&utime, &stime, &cutime, &cstime, &rss) != 5)
+		return -1;
+
+	rss *= sysconf(_SC_PAGESIZE) / 1024;
+	if (rss > peak_rss_kb)
+		peak_rss_kb = rss;
+
+	return (double) (utime + stime + cutime + cstime) / sysconf(_SC_CLK_TCK);
+}
+
+static int compare_u64(const void *a, const void *b) {
+
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double p) {
+
+	return replies ? latencies[(int) (p * (replies - 1) + 0.5)] / 1000.0 : 0;
+}
+
+static void report(double elapsed, double cpu) {
+
+	int i, j, window, max_second = 0, max_window = 0, seconds = elapsed + 1;
+
+	qsort(latencies, replies, sizeof(*latencies), compare_u64);
+	for (i = 0; i < seconds && i < MAXSECONDS; i++) {
+		if (lines_per_second[i] > max_second)
+			max_second = lines_per_second[i];
+
+		for (window = 0, j = i; j < i + FLOOD_WINDOW && j < seconds; j++)
+			window += lines_per_second[j];
+		if (window > max_window)
+			max_window = window;
+	}
+	if (opt.json) {
+		printf("{ \"duration\": %.1f, \"lines_sent\": %d, \"commands_sent\": %d, \"replies\": %d, "
+			"\"latency_ms\": { \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f }, "
+			"\"bot_lines\": %d, \"bot_max_lines_per_sec\": %d, \"bot_max_lines_per_%ds\": %d, \"flood_violations\": %d, "
+			"\"bot_cpu_sec\": %.2f, \"bot_peak_rss_kb\": %ld }\n", elapsed, lines_sent, commands_sent, replies,
+			percentile(0.5), percentile(0.9), percentile(0.99), percentile(1), bot_lines, max_second, FLOOD_WINDOW,
+			max_window, flood_violations, cpu, peak_rss_kb);
+		return;
+	}
+	printf("Run: %.1fs, %d lines sent to the bot, %d commands, %d answered (%d lost)\n", elapsed, lines_sent, commands_sent,
+		replies, commands_sent - replies);
+	printf("Command latency: p50 %.2fms  p90 %.2fms  p99 %.2fms  max %.2fms\n", percentile(0.5), percentile(0.9),
+		percentile(0.99), percentile(1));
+	printf("Bot output: %d lines, max %d in a second, max %d in %d seconds. %d lines over the flood limit (1 per %ds, %ds burst)\n",
+		bot_lines, max_second, max_window, FLOOD_WINDOW, flood_violations, FLOOD_PENALTY, FLOOD_WINDOW);
+	if (cpu >= 0)
+		printf("Bot resources: %.2fs CPU (%.1f%%), peak RSS %ld KB\n", cpu, cpu * 100 / elapsed, peak_rss_kb);
+}
+
+static int listen_on(int port) {
+
+	struct sockaddr_in addr;
+	int fd, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static pid_t spawn_bot(char *argv[]) {
+
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		// The bot echoes everything on stdout with verbose on. Keep stderr for it's errors
+		if (!freopen("/dev/null", "w", stdout))
+			perror("freopen");
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(EXIT_FAILURE);
+	}
+	if (pid < 0)
+		perror("fork");
+
+	return pid;
+}
+
+static void usage(const char *program) {
+
+	fprintf(stderr, "Usage: %s [options] [-- bot command...]\n"
+		"  --port=N            Port to listen on 127.0.0.1 (default 6667)\n"
+		"  --channel=#name     Channel the traffic goes to (default #foss-teimes)\n"
+		"  --rate=N            Channel lines per second: chat, JOIN and QUIT (default 20)\n"
+		"  --commands=N        Bot commands per second (default 2)\n"
+		"  --mix=cmd:w,...     Weighted command mix (default roll:4,uptime:2,help:1,stats:1)\n"
+		"  --burst=S:N         Every S seconds send N extra lines at once, 1 in 10 a command (default 10:100, 0:0 disables)\n"
+		"  --duration=S        Seconds of traffic after the bot joins (default 30)\n"
+		"  --seed=N            Random seed, the same seed replays the same traffic (default 1)\n"
+		"  --pid=N             Measure CPU and RSS of an already running bot\n"
+		"  --json              Print the report as JSON\n", program);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+	const struct option options[] = {
+		{ "port",     required_argument, NULL, 'p' },
+		{ "channel",  required_argument, NULL, 'c' },
+		{ "rate",     required_argument, NULL, 'r' },
+		{ "commands", required_argument, NULL, 'C' },
+		{ "mix",      required_argument, NULL, 'm' },
+		{ "burst",    required_argument, NULL, 'b' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "seed",     required_argument, NULL, 's' },
+		{ "pid",      required_argument, NULL, 'P' },
+		{ "json",     no_argument,       NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	char default_mix[] = "roll:4,uptime:2,help:1,stats:1";
+	uint64_t now, next_line = 0, next_command = 0, next_burst = 0, next_sample = 0, end = 0, drain_end;
+	struct pollfd pfd;
+	bool registered = false, spawned = false;
+	int c, i, listen_fd, joined = 0;
+	double cpu_start = 0, cpu = -1;
+
+	while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (c) {
+		case 'p': opt.port = atoi(optarg); break;
+		case 'c': opt.channel = optarg; break;
+		case 'r': opt.rate = atof(optarg); break;
+		case 'C': opt.command_rate = atof(optarg); break;
+		case 'm': parse_mix(optarg); break;
+		case 'b':
+			if (sscanf(optarg, "%d:%d", &opt.burst_interval, &opt.burst_size) != 2)
+				usage(argv[0]);
+			break;
+		case 'd': opt.duration = atoi(optarg); break;
+		case 's': opt.seed = strtoul(optarg, NULL, 10); break;
+		case 'P': opt.pid = atoi(optarg); break;
+		case 'j': opt.json = true; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!mix_count)
+		parse_mix(default_mix);
+	if (opt.duration <= 0 || opt.duration > MAXSECONDS || !mix_total)
+		usage(argv[0]);
+
+	srand(opt.seed);
+	signal(SIGPIPE, SIG_IGN);
+	listen_fd = listen_on(opt.port);
+
+	if (optind < argc) {
+		opt.pid = spawn_bot(argv + optind);
+		spawned = opt.pid > 0;
+	}
+	pfd.fd = listen_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 10000) != 1) {
+		fprintf(stderr, "The bot did not connect within 10 seconds\n");
+		return EXIT_FAILURE;
+	}
+	client = accept(listen_fd, NULL, NULL);
+	if (client < 0) {
+		perror("accept");
+		return EXIT_FAILURE;
+	}
+	fcntl(client, F_SETFL, O_NONBLOCK);
+	pfd.fd = client;
+
+	// Registration, then start the clock once the bot has joined it's channels or after 5 idle seconds
+	drain_end = now_usec() + 5000000;
+	for (;;) {
+		now = now_usec();
+		if (!start_usec && (joined || now > drain_end) && registered) {
+			start_usec = now + 200000; // Let the JOINs settle
+			next_line = next_command = start_usec;
+			next_burst = start_usec + opt.burst_interval * 1000000ull;
+			end = start_usec + opt.duration * 1000000ull;
+			if (opt.pid)
+				cpu_start = sample_process(opt.pid);
+		}
+		if (start_usec && now >= start_usec && now < end) {
+			for (; opt.rate > 0 && next_line <= now; next_line += 1000000 / opt.rate)
+				send_traffic();
+			for (; opt.command_rate > 0 && next_command <= now; next_command += 1000000 / opt.command_rate)
+				send_command();
+			if (opt.burst_interval > 0 && next_burst <= now) {
+				for (i = 0; i < opt.burst_size; i++)
+					rand() % 10 ? send_traffic() : send_command();
+				next_burst += opt.burst_interval * 1000000ull;
+			}
+		}
+		if (start_usec && now >= end + 3000000)
+			break; // 3 seconds for the last replies
+
+		if (opt.pid && start_usec && now >= next_sample) {
+			sample_process(opt.pid);
+			next_sample = now + 1000000;
+		}
+		if (poll(&pfd, 1, 10) > 0 && !read_bot(&registered, &joined))
+			break;
+	}
+	now = now_usec();
+	if (opt.pid) {
+		cpu = sample_process(opt.pid);
+		if (cpu >= 0)
+			cpu -= cpu_start;
+	}
+	close(client);
+	if (spawned) {
+		kill(opt.pid, SIGTERM);
+		waitpid(opt.pid, NULL, 0);
+	}
+	if (!start_usec) {
+		fprintf(stderr, "The bot never registered\n");
+		return EXIT_FAILURE;
+	}
+	report((now - start_usec) / 1e6, cpu);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Local MPD stand-in. Speaks enough of the protocol for the bot and mpc: the greeting, idle / noidle, currentsong,
+ * status, playlistinfo and ping. Songs change at the given rate and idle clients get "changed: player".
+ * Replies can be split in small writes with pauses in between, to catch readers that expect a whole reply per read.
+ * Reports how fast the bot reacted to each change (changed -> currentsong) and re-armed it's idle (changed -> idle) */
+
+#define MAXCLIENTS 8
+#define INLEN      1024
+#define OUTLEN     (64 * 1024)
+#define MAXSAMPLES 100000
+
+struct options {
+	int port;
+	double rate; //!< Song changes per second
+	int songs;
+	int title_len;
+	int split; //!< Bytes per write, 0 writes whole replies
+	int split_delay; //!< Milliseconds between split writes
+	int duration;
+	bool json;
+};
+
+struct client {
+	int fd;
+	bool idle;
+	bool pending; //!< Song changed while the client was not idle
+	char in[INLEN];
+	size_t in_len;
+	char out[OUTLEN];
+	size_t out_len, out_off;
+	uint64_t next_write;
+	uint64_t changed_sent; //!< When "changed" was sent, until currentsong comes
+	uint64_t answered; //!< Change time of the last answered currentsong, until idle comes
+};
+
+struct samples {
+	uint64_t usec[MAXSAMPLES];
+	int count;
+};
+
+static struct options opt = { 6600, 1, 50, 0, 0, 0, 30, false };
+static struct client clients[MAXCLIENTS];
+static struct samples reaction, rearm;
+static int song, changes, delivered, coalesced, connections, commands, unknown;
+
+static uint64_t now_usec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void add_sample(struct samples *s, uint64_t usec) {
+
+	if (s->count < MAXSAMPLES)
+		s->usec[s->count++] = usec;
+}
+
+static void reply(struct client *c, const char *format, ...) {
+
+	va_list args;
+	int n;
+
+	va_start(args, format);
+	n = vsnprintf(c->out + c->out_len, OUTLEN - c->out_len, format, args);
+	va_end(args);
+	if (n < 0 || (size_t) n >= OUTLEN - c->out_len) {
+		fprintf(stderr, "Output buffer full, dropping client\n");
+		close(c->fd);
+		c->fd = -1;
+		return;
+	}
+	c->out_len += n;
+}
+
+static const char *title(int index) {
+
+	static char buf[4096];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "Mock Artist - Song %d", index);
+	while (n < opt.title_len && n < (int) sizeof(buf) - 1)
+		buf[n++] = '~';
+	buf[n] = '\0';
+	return buf;
+}
+
+static void song_info(struct client *c, int index) {
+
+	reply(c, "file: mock/song-%d.mp3\nLast-Modified: 2016-01-01T00:00:00Z\nTime: 180\nArtist: Mock Artist\n"
+		"Title: %s\nPos: %d\nId: %d\n", index, title(index), index, index + 1);
+}
+
+static void send_changed(struct client *c, uint64_t now) {
+
+	reply(c, "changed: player\nOK\n");
+	c->idle = c->pending = false;
+	c->changed_sent = now;
+	delivered++;
+}
+
+static void change_song(uint64_t now) {
+
+	int i;
+
+	song = (song + 1) % opt.songs;
+	changes++;
+	for (i = 0; i < MAXCLIENTS; i++) {
+		if (clients[i].fd < 0)
+			continue;
+		if (clients[i].idle)
+			send_changed(&clients[i], now);
+		else if (clients[i].pending)
+			coalesced++;
+		else
+			clients[i].pending = true;
+	}
+}
+
+static void handle_command(struct client *c, char *line, uint64_t now) {
+
+	int i;
+
+	commands++;
+	if (!strncmp(line, "idle", 4)) {
+		if (c->answered) {
+			add_sample(&rearm, now - c->answered);
+			c->answered = 0;
+		}
+		if (c->pending)
+			send_changed(c, now);
+		else
+			c->idle = true;
+	} else if (!strcmp(line, "noidle")) {
+		if (c->idle)
+			reply(c, "OK\n");
+		c->idle = false;
+	} else if (!strcmp(line, "currentsong")) {
+		if (c->changed_sent) {
+			add_sample(&reaction, now - c->changed_sent);
+			c->answered = c->changed_sent;
+			c->changed_sent = 0;
+		}
+		song_info(c, song);
+		reply(c, "OK\n");
+	} else if (!strcmp(line, "status")) {
+		reply(c, "volume: 100\nrepeat: 0\nrandom: 0\nsingle: 0\nconsume: 0\nplaylist: %d\nplaylistlength: %d\n"
+			"state: play\nsong: %d\nsongid: %d\nelapsed: 42.000\nbitrate: 320\naudio: 44100:24:2\nOK\n", changes + 1,
+			opt.songs, song, song + 1);
+	} else if (!strcmp(line, "playlistinfo")) {
+		for (i = 0; i < opt.songs; i++)
+			song_info(c, i);
+		reply(c, "OK\n");
+	} else if (!strcmp(line, "ping")) {
+		reply(c, "OK\n");
+	} else if (!strcmp(line, "close")) {
+		close(c->fd);
+		c->fd = -1;
+	} else {
+		unknown++;
+		reply(c, "ACK [5@0] {%s} unknown command \"%s\"\n", line, line);
+	}
+}
+
+/** Run every complete line in the client's input. Returns false if the client hung up */
+static bool read_client(struct client *c, uint64_t now) {
+
+	char *line, *newline;
+	ssize_t n;
+
+	n = read(c->fd, c->in + c->in_len, INLEN - c->in_len - 1);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+		return false;
+	if (n < 0)
+		return true;
+
+	c->in_len += n;
+	c->in[c->in_len] = '\0';
+	for (line = c->in; c->fd >= 0 && (newline = strchr(line, '\n')); line = newline + 1) {
+		*newline = '\0';
+		handle_command(c, line, now);
+	}
+	if (c->fd < 0)
+		return true;
+
+	c->in_len -= line - c->in;
+	memmove(c->in, line, c->in_len);
+	if (c->in_len == INLEN - 1)
+		return false; // No newline in a whole buffer
+
+	return true;
+}
+
+static bool write_client(struct client *c, uint64_t now) {
+
+	size_t len = c->out_len - c->out_off;
+	ssize_t n;
+
+	if (opt.split && len > (size_t) opt.split)
+		len = opt.split;
+
+	n = write(c->fd, c->out + c->out_off, len);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	c->out_off += n;
+	if (c->out_off == c->out_len)
+		c->out_off = c->out_len = 0;
+	c->next_write = now + opt.split_delay * 1000ull;
+	return true;
+}
+
+static void drop_client(struct client *c) {
+
+	close(c->fd);
+	c->fd = -1;
+}
+
+static void accept_client(int listen_fd) {
+
+	int i, fd;
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	for (i = 0; i < MAXCLIENTS && clients[i].fd >= 0; i++);
+	if (i == MAXCLIENTS) {
+		close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	memset(&clients[i], 0, sizeof(clients[i]));
+	clients[i].fd = fd;
+	reply(&clients[i], "OK MPD 0.19.0\n");
+	connections++;
+}
+
+static int compare_u64(const void *a, const void *b) {
+
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(struct samples *s, double p) {
+
+	return s->count ? s->usec[(int) (p * (s->count - 1) + 0.5)] / 1000.0 : 0;
+}
+
+static void report(double elapsed) {
+
+	qsort(reaction.usec, reaction.count, sizeof(uint64_t), compare_u64);
+	qsort(rearm.usec, rearm.count, sizeof(uint64_t), compare_u64);
+	if (opt.json) {
+		printf("{ \"duration\": %.1f, \"connections\": %d, \"commands\": %d, \"unknown_commands\": %d, \"changes\": %d, "
+			"\"delivered\": %d, \"coalesced\": %d, \"reactions\": %d, "
+			"\"reaction_ms\": { \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f }, "
+			"\"rearm_ms\": { \"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f } }\n", elapsed, connections, commands, unknown,
+			changes, delivered, coalesced, reaction.count, percentile(&reaction, 0.5), percentile(&reaction, 0.99),
+			percentile(&reaction, 1), percentile(&rearm, 0.5), percentile(&rearm, 0.99), percentile(&rearm, 1));
+		return;
+	}
+	printf("Run: %.1fs, %d connections, %d commands (%d unknown)\n", elapsed, connections, commands, unknown);
+	printf("Song changes: %d, %d sent to idle clients, %d merged into a pending change, %d followed by currentsong\n",
+		changes, delivered, coalesced, reaction.count);
+	printf("Reaction (changed -> currentsong): p50 %.2fms  p99 %.2fms  max %.2fms\n", percentile(&reaction, 0.5),
+		percentile(&reaction, 0.99), percentile(&reaction, 1));
+	printf("Re-arm (changed -> idle):          p50 %.2fms  p99 %.2fms  max %.2fms\n", percentile(&rearm, 0.5),
+		percentile(&rearm, 0.99), percentile(&rearm, 1));
+}
+
+static int listen_on(int port) {
+
+	struct sockaddr_in addr;
+	int fd, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, MAXCLIENTS) < 0) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void usage(const char *program) {
+
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  --port=N            Port to listen on 127.0.0.1 (default 6600)\n"
+		"  --rate=N            Song changes per second (default 1)\n"
+		"  --songs=N           Playlist length (default 50)\n"
+		"  --title-len=N       Pad titles to N characters\n"
+		"  --split=BYTES       Write replies in pieces of this size\n"
+		"  --split-delay=MS    Wait between pieces\n"
+		"  --duration=S        Seconds to run after the first client connects (default 30)\n"
+		"  --json              Print the report as JSON\n", program);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+	const struct option options[] = {
+		{ "port",        required_argument, NULL, 'p' },
+		{ "rate",        required_argument, NULL, 'r' },
+		{ "songs",       required_argument, NULL, 'n' },
+		{ "title-len",   required_argument, NULL, 't' },
+		{ "split",       required_argument, NULL, 's' },
+		{ "split-delay", required_argument, NULL, 'S' },
+		{ "duration",    required_argument, NULL, 'd' },
+		{ "json",        no_argument,       NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct pollfd pfd[MAXCLIENTS + 1];
+	struct client *map[MAXCLIENTS + 1];
+	uint64_t now, start = 0, next_change = 0;
+	int c, i, n, timeout;
+
+	while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (c) {
+		case 'p': opt.port = atoi(optarg); break;
+		case 'r': opt.rate = atof(optarg); break;
+		case 'n': opt.songs = atoi(optarg); break;
+		case 't': opt.title_len = atoi(optarg); break;
+		case 's': opt.split = atoi(optarg); break;
+		case 'S': opt.split_delay = atoi(optarg); break;
+		case 'd': opt.duration = atoi(optarg); break;
+		case 'j': opt.json = true; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind < argc || opt.songs <= 0 || opt.duration <= 0 || opt.split < 0 || opt.split_delay < 0)
+		usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < MAXCLIENTS; i++)
+		clients[i].fd = -1;
+
+	pfd[0].fd = listen_on(opt.port);
+	pfd[0].events = POLLIN;
+	for (;;) {
+		now = now_usec();
+		if (start && now >= start + opt.duration * 1000000ull)
+			break;
+		for (; start && opt.rate > 0 && next_change <= now; next_change += 1000000 / opt.rate)
+			change_song(now);
+
+		// Poll the clients, asking for POLLOUT only when a split write is due
+		timeout = start && opt.rate > 0 ? (next_change - now) / 1000 + 1 : 100;
+		for (i = 0, n = 1; i < MAXCLIENTS; i++) {
+			if (clients[i].fd < 0)
+				continue;
+			pfd[n].fd = clients[i].fd;
+			pfd[n].events = POLLIN;
+			if (clients[i].out_len) {
+				if (clients[i].next_write <= now)
+					pfd[n].events |= POLLOUT;
+				else if ((int) ((clients[i].next_write - now) / 1000 + 1) < timeout)
+					timeout = (clients[i].next_write - now) / 1000 + 1;
+			}
+			map[n++] = &clients[i];
+		}
+		if (poll(pfd, n, timeout) < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+		now = now_usec();
+		if (pfd[0].revents & POLLIN) {
+			accept_client(pfd[0].fd);
+			if (!start)
+				start = next_change = now;
+		}
+		for (i = 1; i < n; i++) {
+			if ((pfd[i].revents & POLLOUT) && !write_client(map[i], now))
+				drop_client(map[i]);
+			if (map[i]->fd >= 0 && (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) && !read_client(map[i], now))
+				drop_client(map[i]);
+		}
+	}
+	report((now_usec() - start) / 1e6);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,620 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Local Murmur stand-in. Speaks enough Ice 3.4 (encoding 1.0) for the bot: validateConnection, ice_isA, addCallback
+ * and getUsers on the listening side. Once a callback is added it connects back to the bot and sends
+ * userConnected / userDisconnected requests at the given rate. Replies and callbacks can be split in small writes
+ * with pauses in between, to catch readers that expect a whole message per read. Every userConnected sent should
+ * show up as a "Mumble: <user> connected" line on the IRC side */
+
+#define MAXCONNS   8
+#define MSGLEN     (64 * 1024)
+#define HEADERLEN  14
+#define MAXUSERS   64
+
+enum msg_type { REQUEST, BATCH_REQUEST, REPLY, VALIDATE_CONNECTION, CLOSE_CONNECTION };
+
+struct options {
+	int port;
+	double rate; //!< Callbacks per second
+	int users;
+	int name_len;
+	int split; //!< Bytes per write, 0 writes whole messages
+	int split_delay; //!< Milliseconds between split writes
+	int duration;
+	unsigned seed;
+	bool json;
+};
+
+struct conn {
+	int fd;
+	bool callback; //!< Connection we opened to the bot
+	unsigned char in[MSGLEN];
+	size_t in_len;
+	unsigned char out[MSGLEN];
+	size_t out_len, out_off;
+	uint64_t next_write;
+};
+
+/** Growing little endian Ice message */
+struct msg {
+	unsigned char buf[MSGLEN];
+	size_t len;
+};
+
+struct reader {
+	const unsigned char *p, *end;
+};
+
+static struct options opt = { 6502, 5, 5, 0, 0, 0, 30, 1, false };
+static struct conn conns[MAXCONNS];
+static bool online[MAXUSERS];
+static char callback_identity[256];
+static int callback_port, connections, requests, unknown, user_lists, connected_sent, disconnected_sent, callback_drops;
+
+static uint64_t now_usec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void put_bytes(struct msg *m, const void *data, size_t len) {
+
+	if (m->len + len > MSGLEN) {
+		fprintf(stderr, "Message too big\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(m->buf + m->len, data, len);
+	m->len += len;
+}
+
+static void put_byte(struct msg *m, unsigned char b) {
+
+	put_bytes(m, &b, 1);
+}
+
+static void put_int(struct msg *m, int32_t value) {
+
+	uint32_t v = value;
+	unsigned char le[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+	put_bytes(m, le, 4);
+}
+
+static void set_int(struct msg *m, size_t offset, int32_t value) {
+
+	uint32_t v = value;
+
+	m->buf[offset] = v;
+	m->buf[offset + 1] = v >> 8;
+	m->buf[offset + 2] = v >> 16;
+	m->buf[offset + 3] = v >> 24;
+}
+
+static void put_size(struct msg *m, size_t size) {
+
+	if (size < 255)
+		put_byte(m, size);
+	else {
+		put_byte(m, 255);
+		put_int(m, size);
+	}
+}
+
+static void put_string(struct msg *m, const char *s) {
+
+	put_size(m, strlen(s));
+	put_bytes(m, s, strlen(s));
+}
+
+static void put_float(struct msg *m, float f) {
+
+	uint32_t v;
+
+	memcpy(&v, &f, sizeof(v));
+	put_int(m, v);
+}
+
+static void start_message(struct msg *m, enum msg_type type) {
+
+	const unsigned char magic[] = { 'I', 'c', 'e', 'P', 1, 0, 1, 0 };
+
+	m->len = 0;
+	put_bytes(m, magic, sizeof(magic));
+	put_byte(m, type);
+	put_byte(m, 0); // Uncompressed
+	put_int(m, 0); // Size, set by finish_message()
+}
+
+static void finish_message(struct msg *m) {
+
+	set_int(m, 10, m->len);
+}
+
+/** Encapsulations are the operation parameters, prefixed with their size and encoding version */
+static size_t start_encaps(struct msg *m) {
+
+	size_t start = m->len;
+
+	put_int(m, 0);
+	put_byte(m, 1);
+	put_byte(m, 0);
+	return start;
+}
+
+static void finish_encaps(struct msg *m, size_t start) {
+
+	set_int(m, start, m->len - start);
+}
+
+static int32_t get_int(struct reader *r) {
+
+	uint32_t v;
+
+	if (r->end - r->p < 4) {
+		r->p = r->end;
+		return 0;
+	}
+	v = r->p[0] | r->p[1] << 8 | r->p[2] << 16 | (uint32_t) r->p[3] << 24;
+	r->p += 4;
+	return v;
+}
+
+static size_t get_size(struct reader *r) {
+
+	if (r->p >= r->end)
+		return 0;
+	if (*r->p != 255)
+		return *r->p++;
+
+	r->p++;
+	return get_int(r);
+}
+
+static void get_string(struct reader *r, char *s, size_t len) {
+
+	size_t n = get_size(r);
+
+	if (n > (size_t) (r->end - r->p))
+		n = r->end - r->p;
+	snprintf(s, len, "%.*s", (int) n, (const char *) r->p);
+	r->p += n;
+}
+
+static const char *user_name(int user) {
+
+	static char name[512];
+	int n;
+
+	n = snprintf(name, sizeof(name), "user%d", user);
+	while (n < opt.name_len && n < (int) sizeof(name) - 1)
+		name[n++] = '_';
+	name[n] = '\0';
+	return name;
+}
+
+/** Murmur::User, as found in getUsers replies and userConnected / userDisconnected callbacks */
+static void put_user(struct msg *m, int user) {
+
+	const unsigned char address[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1 }; // ::ffff:127.0.0.1
+	int i;
+
+	put_int(m, user + 1); // session
+	put_int(m, -1); // userid, not registered
+	for (i = 0; i < 7; i++)
+		put_byte(m, 0); // mute, deaf, suppress, prioritySpeaker, selfMute, selfDeaf, recording
+	put_int(m, 0); // channel
+	put_string(m, user_name(user));
+	put_int(m, 60); // onlinesecs
+	put_int(m, 0); // bytespersec
+	put_int(m, 0x010204); // version 1.2.4
+	put_string(m, "1.2.4");
+	put_string(m, "Linux");
+	put_string(m, "Mock");
+	put_string(m, ""); // identity
+	put_string(m, ""); // context
+	put_string(m, ""); // comment
+	put_size(m, sizeof(address));
+	put_bytes(m, address, sizeof(address));
+	put_byte(m, 0); // tcponly
+	put_int(m, 0); // idlesecs
+	put_float(m, 12.5); // udpPing
+	put_float(m, 13.5); // tcpPing
+}
+
+static void queue(struct conn *c, const struct msg *m) {
+
+	if (c->out_len + m->len > MSGLEN) {
+		fprintf(stderr, "Output buffer full, dropping connection\n");
+		close(c->fd);
+		c->fd = -1;
+		return;
+	}
+	memcpy(c->out + c->out_len, m->buf, m->len);
+	c->out_len += m->len;
+}
+
+static void send_validate(struct conn *c) {
+
+	struct msg m;
+
+	start_message(&m, VALIDATE_CONNECTION);
+	finish_message(&m);
+	queue(c, &m);
+}
+
+/** Remember the identity and port of the callback proxy: identity, facet, mode, secure, then a TCP endpoint */
+static void parse_callback(struct reader *r) {
+
+	char category[256], host[256];
+	size_t facets;
+
+	get_int(r); // Encapsulation size
+	r->p += 2;
+	get_string(r, callback_identity, sizeof(callback_identity));
+	get_string(r, category, sizeof(category));
+	for (facets = get_size(r); facets > 0; facets--)
+		get_string(r, category, sizeof(category));
+	r->p += 2; // mode, secure
+	if (get_size(r) < 1)
+		return;
+	r->p += 2 + 6; // Endpoint type, encapsulation size and version
+	get_string(r, host, sizeof(host));
+	callback_port = get_int(r);
+}
+
+static void handle_request(struct conn *c, struct reader *r) {
+
+	char name[256], category[256], operation[64];
+	struct msg m;
+	size_t facets, encaps;
+	int32_t request_id;
+	int i, count;
+
+	requests++;
+	request_id = get_int(r);
+	get_string(r, name, sizeof(name));
+	get_string(r, category, sizeof(category));
+	for (facets = get_size(r); facets > 0; facets--)
+		get_string(r, category, sizeof(category));
+	get_string(r, operation, sizeof(operation));
+	r->p++; // mode
+	for (i = get_size(r) * 2; i > 0; i--) // context
+		get_string(r, category, sizeof(category));
+
+	start_message(&m, REPLY);
+	put_int(&m, request_id);
+	if (!strcmp(operation, "ice_isA")) {
+		put_byte(&m, 0); // Success
+		encaps = start_encaps(&m);
+		put_byte(&m, 1); // True, it's a Murmur::Meta
+		finish_encaps(&m, encaps);
+	} else if (!strcmp(operation, "addCallback")) {
+		parse_callback(r);
+		put_byte(&m, 0);
+		finish_encaps(&m, start_encaps(&m));
+	} else if (!strcmp(operation, "getUsers")) {
+		user_lists++;
+		for (i = count = 0; i < opt.users; i++)
+			count += online[i];
+		put_byte(&m, 0);
+		encaps = start_encaps(&m);
+		put_size(&m, count);
+		for (i = 0; i < opt.users; i++) {
+			if (!online[i])
+				continue;
+			put_int(&m, i + 1);
+			put_user(&m, i);
+		}
+		finish_encaps(&m, encaps);
+	} else {
+		unknown++;
+		put_byte(&m, 2); // Operation does not exist
+		put_string(&m, name);
+		put_string(&m, "");
+		put_size(&m, 0);
+		put_string(&m, operation);
+	}
+	finish_message(&m);
+	if (request_id) // Oneway requests get no reply
+		queue(c, &m);
+}
+
+/** Handle every complete message in the input. Returns false on protocol errors or closeConnection */
+static bool handle_input(struct conn *c) {
+
+	struct reader r;
+	size_t offset = 0;
+	uint32_t size;
+
+	while (c->in_len - offset >= HEADERLEN) {
+		r.p = c->in + offset + 10;
+		r.end = r.p + 4;
+		size = get_int(&r);
+		if (memcmp(c->in + offset, "IceP", 4) || size < HEADERLEN || size > MSGLEN)
+			return false;
+		if (c->in_len - offset < size)
+			break;
+
+		r.p = c->in + offset + HEADERLEN;
+		r.end = c->in + offset + size;
+		switch (c->in[offset + 8]) {
+		case REQUEST:
+			if (!c->callback)
+				handle_request(c, &r);
+			break;
+		case CLOSE_CONNECTION:
+			return false;
+		}
+		offset += size;
+	}
+	c->in_len -= offset;
+	memmove(c->in, c->in + offset, c->in_len);
+	return true;
+}
+
+static void send_callback(struct conn *c) {
+
+	struct msg m;
+	size_t encaps;
+	int user = rand() % opt.users;
+
+	// userConnected(User state) or userDisconnected(User state) on the callback object, oneway
+	start_message(&m, REQUEST);
+	put_int(&m, 0);
+	put_string(&m, callback_identity);
+	put_string(&m, "");
+	put_size(&m, 0);
+	put_string(&m, online[user] ? "userDisconnected" : "userConnected");
+	put_byte(&m, 0); // Normal mode
+	put_size(&m, 0); // Context
+	encaps = start_encaps(&m);
+	put_user(&m, user);
+	finish_encaps(&m, encaps);
+	finish_message(&m);
+	queue(c, &m);
+
+	online[user] ? disconnected_sent++ : connected_sent++;
+	online[user] = !online[user];
+}
+
+static struct conn *add_conn(int fd, bool callback) {
+
+	int i;
+
+	for (i = 0; i < MAXCONNS && conns[i].fd >= 0; i++);
+	if (i == MAXCONNS) {
+		close(fd);
+		return NULL;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	memset(&conns[i], 0, sizeof(conns[i]));
+	conns[i].fd = fd;
+	conns[i].callback = callback;
+	return &conns[i];
+}
+
+static struct conn *connect_callback(void) {
+
+	struct sockaddr_in addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(callback_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		if (fd >= 0)
+			close(fd);
+		return NULL; // The bot listens only after addCallback returns, try again later
+	}
+	return add_conn(fd, true);
+}
+
+static bool read_conn(struct conn *c) {
+
+	ssize_t n;
+
+	n = read(c->fd, c->in + c->in_len, MSGLEN - c->in_len);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+		return false;
+	if (n > 0)
+		c->in_len += n;
+
+	return handle_input(c);
+}
+
+static bool write_conn(struct conn *c, uint64_t now) {
+
+	size_t len = c->out_len - c->out_off;
+	ssize_t n;
+
+	if (opt.split && len > (size_t) opt.split)
+		len = opt.split;
+
+	n = write(c->fd, c->out + c->out_off, len);
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	c->out_off += n;
+	if (c->out_off == c->out_len)
+		c->out_off = c->out_len = 0;
+	c->next_write = now + opt.split_delay * 1000ull;
+	return true;
+}
+
+static void report(double elapsed) {
+
+	if (opt.json) {
+		printf("{ \"duration\": %.1f, \"connections\": %d, \"requests\": %d, \"unknown_requests\": %d, \"user_lists\": %d, "
+			"\"user_connected\": %d, \"user_disconnected\": %d, \"callback_drops\": %d }\n", elapsed, connections,
+			requests, unknown, user_lists, connected_sent, disconnected_sent, callback_drops);
+		return;
+	}
+	printf("Run: %.1fs, %d connections, %d requests (%d unknown), %d user lists served\n", elapsed, connections,
+		requests, unknown, user_lists);
+	printf("Callbacks: %d userConnected, %d userDisconnected, the callback connection was closed %d times\n",
+		connected_sent, disconnected_sent, callback_drops);
+}
+
+static int listen_on(int port) {
+
+	struct sockaddr_in addr;
+	int fd, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, MAXCONNS) < 0) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void usage(const char *program) {
+
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  --port=N            Port to listen on 127.0.0.1 (default 6502)\n"
+		"  --rate=N            userConnected / userDisconnected callbacks per second (default 5)\n"
+		"  --users=N           Users that come and go, at most %d (default 5)\n"
+		"  --name-len=N        Pad user names to N characters\n"
+		"  --split=BYTES       Write messages in pieces of this size\n"
+		"  --split-delay=MS    Wait between pieces\n"
+		"  --duration=S        Seconds to run after the first connection (default 30)\n"
+		"  --seed=N            Random seed (default 1)\n"
+		"  --json              Print the report as JSON\n", program, MAXUSERS);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+	const struct option options[] = {
+		{ "port",        required_argument, NULL, 'p' },
+		{ "rate",        required_argument, NULL, 'r' },
+		{ "users",       required_argument, NULL, 'u' },
+		{ "name-len",    required_argument, NULL, 'n' },
+		{ "split",       required_argument, NULL, 's' },
+		{ "split-delay", required_argument, NULL, 'S' },
+		{ "duration",    required_argument, NULL, 'd' },
+		{ "seed",        required_argument, NULL, 'x' },
+		{ "json",        no_argument,       NULL, 'j' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct pollfd pfd[MAXCONNS + 1];
+	struct conn *map[MAXCONNS + 1], *callback = NULL, *c;
+	uint64_t now, start = 0, next_event = 0, next_connect = 0;
+	int opt_char, i, n, fd, timeout;
+
+	while ((opt_char = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt_char) {
+		case 'p': opt.port = atoi(optarg); break;
+		case 'r': opt.rate = atof(optarg); break;
+		case 'u': opt.users = atoi(optarg); break;
+		case 'n': opt.name_len = atoi(optarg); break;
+		case 's': opt.split = atoi(optarg); break;
+		case 'S': opt.split_delay = atoi(optarg); break;
+		case 'd': opt.duration = atoi(optarg); break;
+		case 'x': opt.seed = strtoul(optarg, NULL, 10); break;
+		case 'j': opt.json = true; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind < argc || opt.users <= 0 || opt.users > MAXUSERS || opt.duration <= 0 || opt.split < 0 || opt.split_delay < 0)
+		usage(argv[0]);
+
+	srand(opt.seed);
+	signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < MAXCONNS; i++)
+		conns[i].fd = -1;
+
+	pfd[0].fd = listen_on(opt.port);
+	pfd[0].events = POLLIN;
+	for (;;) {
+		now = now_usec();
+		if (start && now >= start + opt.duration * 1000000ull)
+			break;
+
+		if (callback_port && !callback && now >= next_connect) {
+			callback = connect_callback();
+			next_connect = now + 100000;
+			next_event = now;
+		}
+		for (; callback && opt.rate > 0 && next_event <= now; next_event += 1000000 / opt.rate)
+			send_callback(callback);
+		if (callback && callback->fd < 0) {
+			callback = NULL;
+			callback_drops++;
+		}
+
+		timeout = callback && opt.rate > 0 ? (next_event - now) / 1000 + 1 : 100;
+		for (i = 0, n = 1; i < MAXCONNS; i++) {
+			c = &conns[i];
+			if (c->fd < 0)
+				continue;
+			pfd[n].fd = c->fd;
+			pfd[n].events = POLLIN;
+			if (c->out_len) {
+				if (c->next_write <= now)
+					pfd[n].events |= POLLOUT;
+				else if ((int) ((c->next_write - now) / 1000 + 1) < timeout)
+					timeout = (c->next_write - now) / 1000 + 1;
+			}
+			map[n++] = c;
+		}
+		if (poll(pfd, n, timeout) < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+		now = now_usec();
+		if (pfd[0].revents & POLLIN) {
+			fd = accept(pfd[0].fd, NULL, NULL);
+			if (fd >= 0 && (c = add_conn(fd, false))) {
+				send_validate(c);
+				connections++;
+				if (!start)
+					start = now;
+			}
+		}
+		for (i = 1; i < n; i++) {
+			c = map[i];
+			if ((pfd[i].revents & POLLOUT) && !write_conn(c, now)) {
+				close(c->fd);
+				c->fd = -1;
+			}
+			if (c->fd >= 0 && (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) && !read_conn(c)) {
+				close(c->fd);
+				c->fd = -1;
+			}
+			if (c->fd < 0 && c == callback) {
+				callback = NULL;
+				callback_drops++;
+			}
+		}
+	}
+	report((now_usec() - start) / 1e6);
+	return EXIT_SUCCESS;
+}
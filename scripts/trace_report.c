@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+/* Print the slowest requests found in a trace file with a breakdown of where the time went */
+
+struct request {
+	struct trace_record *spans;
+	int count;
+	uint64_t begin;
+	uint64_t end;
+};
+
+static const char *type_name[TRACE_TYPE_MAX] = {
+	[TRACE_DISPATCH]   = "dispatch",
+	[TRACE_FORK_WAIT]  = "fork wait",
+	[TRACE_COMMAND]    = "command",
+	[TRACE_DNS]        = "dns",
+	[TRACE_CONNECT]    = "connect",
+	[TRACE_TLS]        = "tls",
+	[TRACE_HTTP_WAIT]  = "http wait",
+	[TRACE_HTTP_BODY]  = "http body",
+	[TRACE_SUBPROCESS] = "subprocess",
+	[TRACE_SEND]       = "send"
+};
+
+static int compare_records(const void *a, const void *b) {
+
+	const struct trace_record *r1 = a, *r2 = b;
+
+	if (r1->session != r2->session)
+		return r1->session < r2->session ? -1 : 1;
+	if (r1->request != r2->request)
+		return r1->request < r2->request ? -1 : 1;
+	if (r1->start != r2->start)
+		return r1->start < r2->start ? -1 : 1;
+
+	return (int) r1->type - (int) r2->type;
+}
+
+static int compare_requests(const void *a, const void *b) {
+
+	const struct request *r1 = a, *r2 = b;
+	uint64_t t1 = r1->end - r1->begin, t2 = r2->end - r2->begin;
+
+	return t1 < t2 ? 1 : (t1 > t2 ? -1 : 0);
+}
+
+static void print_request(const struct request *req) {
+
+	const struct trace_record *rec;
+	uint64_t phase[TRACE_TYPE_MAX] = { 0 };
+	const char *command = "?", *separator = "";
+	int i;
+
+	for (i = 0; i < req->count; i++)
+		if (req->spans[i].type == TRACE_DISPATCH)
+			command = req->spans[i].name;
+
+	printf("request %u (!%s) session %d: %.3f ms\n", req->spans[0].request, command, req->spans[0].session,
+		(req->end - req->begin) / 1e3);
+
+	for (i = 0; i < req->count; i++) {
+		rec = &req->spans[i];
+		if (rec->type >= TRACE_TYPE_MAX)
+			continue;
+
+		phase[rec->type] += rec->duration;
+		printf("  +%10.3f ms  %-10s %10.3f ms  pid %-6d %s\n", (rec->start - req->begin) / 1e3, type_name[rec->type],
+			rec->duration / 1e3, rec->pid, rec->name);
+	}
+	// Totals per phase. They can add up to more than the request's time since workers run in parallel
+	printf("  total:");
+	for (i = 0; i < TRACE_TYPE_MAX; i++) {
+		if (phase[i] && i != TRACE_COMMAND) {
+			printf("%s %s %.3f ms", separator, type_name[i], phase[i] / 1e3);
+			separator = ",";
+		}
+	}
+
+	printf("\n\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	FILE *file;
+	struct trace_record *records = NULL;
+	struct request *requests = NULL;
+	size_t n = 0, size = 0;
+	int i, request_count = 0, slow = 0, max_shown = 10;
+	double min_ms = 1000;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: %s <trace_file> [min_ms (default 1000)] [max_requests (default 10)]\n", argv[0]);
+		return 1;
+	}
+	if (argc >= 3)
+		min_ms = atof(argv[2]);
+	if (argc == 4)
+		max_shown = atoi(argv[3]);
+
+	file = fopen(argv[1], "rb");
+	if (!file) {
+		perror(argv[1]);
+		return 1;
+	}
+	for (;;) {
+		if (n == size) {
+			size = size ? size * 2 : 1024;
+			records = realloc(records, size * sizeof(*records));
+			if (!records) {
+				perror("realloc");
+				return 1;
+			}
+		}
+		if (fread(&records[n], sizeof(*records), 1, file) != 1)
+			break;
+		n++;
+	}
+	fclose(file);
+
+	// Group the spans of every request together, sorted by start time
+	qsort(records, n, sizeof(*records), compare_records);
+	requests = calloc(n + 1, sizeof(*requests));
+	if (!requests) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < (int) n; i++) {
+		if (!i || records[i].session != records[i - 1].session || records[i].request != records[i - 1].request) {
+			requests[request_count].spans = &records[i];
+			requests[request_count].begin = records[i].start;
+			request_count++;
+		}
+		requests[request_count - 1].count++;
+		if (records[i].start + records[i].duration > requests[request_count - 1].end)
+			requests[request_count - 1].end = records[i].start + records[i].duration;
+	}
+	qsort(requests, request_count, sizeof(*requests), compare_requests);
+
+	for (i = 0; i < request_count; i++) {
+		if ((requests[i].end - requests[i].begin) / 1e3 < min_ms)
+			break;
+
+		if (i < max_shown)
+			print_request(&requests[i]);
+		slow++;
+	}
+	printf("%d of %d requests took %.0f ms or more\n", slow, request_count, min_ms);
+
+	free(requests);
+	free(records);
+	return 0;
+}
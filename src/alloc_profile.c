@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "alloc_profile.h"
+#include "common.h"
+
+#ifdef ALLOC_PROFILE
+
+struct alloc_site {
+	uint64_t key; //!< File name pointer + line. Zero if the slot is free
+	const char *caller;
+	const char *file;
+	int line;
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t bytes;
+	int64_t live_bytes;
+	int64_t live_blocks;
+	int64_t peak_bytes;
+};
+
+struct alloc_profile {
+	struct alloc_site sites[ALLOC_SITES];
+	int64_t live_bytes;
+	int64_t peak_bytes;
+	uint64_t untracked; //!< Allocations not accounted because a table was full
+};
+
+/** Live block of this process. Entries are copied to the workers with the rest of the memory on fork */
+struct alloc_block {
+	void *ptr;
+	uint32_t size;
+	uint16_t site;
+	int32_t pid; //!< Process that made the allocation
+};
+
+static struct alloc_profile *profile;
+static struct alloc_block *blocks;
+static int block_count;
+static pid_t profile_pid;
+static volatile sig_atomic_t print_requested;
+
+void __real_free(void *ptr);
+
+static unsigned hash_pointer(const void *ptr) {
+
+	uint64_t h = (uintptr_t) ptr;
+
+	// Fibonacci hashing. Spreads the 16 byte aligned addresses malloc returns
+	return (h * 11400714819323198485llu) >> 48;
+}
+
+static struct alloc_site *find_site(const char *caller, const char *file, int line) {
+
+	struct alloc_site *site;
+	uint64_t key;
+	unsigned i, start;
+
+	// User space pointers fit in 48 bits, so the line can use the top bits
+	key = (uint64_t) (uintptr_t) file + ((uint64_t) line << 48);
+	start = hash_pointer((void *) (uintptr_t) key) % ALLOC_SITES;
+
+	for (i = 0; i < ALLOC_SITES; i++) {
+		site = &profile->sites[(start + i) % ALLOC_SITES];
+		if (site->key == key)
+			return site;
+
+		// Claim an empty slot. Another process may win the race with the same key, so check again
+		if (!site->key && __sync_bool_compare_and_swap(&site->key, 0, key)) {
+			site->caller = caller;
+			site->line = line;
+			__sync_synchronize();
+			site->file = file; // Readers skip sites until this is set
+			return site;
+		}
+		if (site->key == key)
+			return site;
+	}
+	return NULL;
+}
+
+static struct alloc_block *find_block(const void *ptr) {
+
+	unsigned i;
+
+	for (i = hash_pointer(ptr) % ALLOC_POINTERS; blocks[i].ptr; i = (i + 1) % ALLOC_POINTERS)
+		if (blocks[i].ptr == ptr)
+			return &blocks[i];
+
+	return NULL;
+}
+
+static bool block_home(void *table, uint32_t slot, uint32_t *home) {
+
+	(void) table;
+	if (!blocks[slot].ptr)
+		return false;
+
+	*home = hash_pointer(blocks[slot].ptr) % ALLOC_POINTERS;
+	return true;
+}
+
+static void block_move(void *table, uint32_t from, uint32_t to) {
+
+	(void) table;
+	blocks[to] = blocks[from];
+}
+
+/** Linear probing deletion without tombstones: move back the entries that would no longer be found */
+static void remove_block(struct alloc_block *block) {
+
+	blocks[probe_remove(NULL, block - blocks, ALLOC_POINTERS - 1, block_home, block_move)].ptr = NULL;
+	block_count--;
+}
+
+void alloc_profile_forget(void *ptr) {
+
+	struct alloc_block *block;
+	struct alloc_site *site;
+
+	if (!profile || !ptr)
+		return;
+
+	block = find_block(ptr);
+	if (!block)
+		return;
+
+	// Blocks inherited from the main process are freed in the worker's copy of the memory only
+	site = &profile->sites[block->site];
+	if (block->pid == getpid()) {
+		__sync_fetch_and_add(&site->frees, 1);
+		if (block->pid == profile_pid) {
+			site->live_bytes -= block->size;
+			site->live_blocks--;
+			profile->live_bytes -= block->size;
+		}
+	}
+	remove_block(block);
+}
+
+void __wrap_free(void *ptr) {
+
+	alloc_profile_forget(ptr);
+	__real_free(ptr);
+}
+
+void alloc_profile_record(void *ptr, size_t size, const char *caller, const char *file, int line) {
+
+	struct alloc_site *site;
+	unsigned i;
+	pid_t pid;
+
+	if (!profile)
+		return;
+
+	site = find_site(caller, file, line);
+	if (!site || block_count >= ALLOC_POINTERS / 4 * 3) {
+		__sync_fetch_and_add(&profile->untracked, 1);
+		return;
+	}
+	__sync_fetch_and_add(&site->allocs, 1);
+	__sync_fetch_and_add(&site->bytes, size);
+
+	pid = getpid();
+	for (i = hash_pointer(ptr) % ALLOC_POINTERS; blocks[i].ptr; i = (i + 1) % ALLOC_POINTERS);
+	blocks[i].ptr  = ptr;
+	blocks[i].size = size;
+	blocks[i].site = site - profile->sites;
+	blocks[i].pid  = pid;
+	block_count++;
+
+	// Only the main process updates the live counters, it's the only one that stays around
+	if (pid != profile_pid)
+		return;
+
+	site->live_bytes += size;
+	site->live_blocks++;
+	if (site->live_bytes > site->peak_bytes)
+		site->peak_bytes = site->live_bytes;
+
+	profile->live_bytes += size;
+	if (profile->live_bytes > profile->peak_bytes)
+		profile->peak_bytes = profile->live_bytes;
+}
+
+void alloc_profile_write_prometheus(FILE *stream) {
+
+	const char *metric[][3] = {
+		{ "irc_bot_alloc_calls_total",  "counter", "Allocations made through the MALLOC_W wrappers per call site" },
+		{ "irc_bot_alloc_frees_total",  "counter", "Tracked blocks freed per call site" },
+		{ "irc_bot_alloc_bytes_total",  "counter", "Bytes allocated per call site" },
+		{ "irc_bot_alloc_live_bytes",   "gauge",   "Bytes still allocated by the main process per call site" },
+		{ "irc_bot_alloc_peak_bytes",   "gauge",   "High-water mark of live bytes in the main process per call site" }
+	};
+	struct alloc_site *site;
+	long long value = 0;
+	int i, j;
+
+	if (!profile)
+		return;
+
+	for (i = 0; i < SIZE(metric); i++) {
+		fprintf(stream, "# HELP %s %s\n# TYPE %s %s\n", metric[i][0], metric[i][2], metric[i][0], metric[i][1]);
+		for (j = 0; j < ALLOC_SITES; j++) {
+			site = &profile->sites[j];
+			if (!site->file)
+				continue;
+
+			switch (i) {
+			case 0: value = site->allocs;     break;
+			case 1: value = site->frees;      break;
+			case 2: value = site->bytes;      break;
+			case 3: value = site->live_bytes; break;
+			case 4: value = site->peak_bytes; break;
+			}
+			fprintf(stream, "%s{function=\"%s\",site=\"%s:%d\"} %lld\n", metric[i][0], site->caller, site->file, site->line, value);
+		}
+	}
+	fprintf(stream, "# HELP irc_bot_alloc_process_peak_bytes High-water mark of tracked bytes in the main process\n"
+		"# TYPE irc_bot_alloc_process_peak_bytes gauge\nirc_bot_alloc_process_peak_bytes %lld\n", (long long) profile->peak_bytes);
+	fprintf(stream, "# HELP irc_bot_alloc_untracked_total Allocations not accounted because a table was full\n"
+		"# TYPE irc_bot_alloc_untracked_total counter\nirc_bot_alloc_untracked_total %llu\n", (unsigned long long) profile->untracked);
+}
+
+static int compare_allocs(const void *a, const void *b) {
+
+	const struct alloc_site *s1 = *(struct alloc_site * const *) a, *s2 = *(struct alloc_site * const *) b;
+
+	return s1->allocs < s2->allocs ? 1 : (s1->allocs > s2->allocs ? -1 : 0);
+}
+
+void alloc_profile_print(FILE *stream) {
+
+	struct alloc_site *sorted[ALLOC_SITES];
+	int i, count = 0;
+
+	if (!profile)
+		return;
+
+	for (i = 0; i < ALLOC_SITES; i++)
+		if (profile->sites[i].file)
+			sorted[count++] = &profile->sites[i];
+
+	qsort(sorted, count, sizeof(*sorted), compare_allocs);
+
+	fprintf(stream, "%10s %10s %12s %10s %10s  %s\n", "allocs", "frees", "bytes", "live", "peak", "call site");
+	for (i = 0; i < count; i++)
+		fprintf(stream, "%10llu %10llu %12llu %10lld %10lld  %s() %s:%d\n", (unsigned long long) sorted[i]->allocs,
+			(unsigned long long) sorted[i]->frees, (unsigned long long) sorted[i]->bytes, (long long) sorted[i]->live_bytes,
+			(long long) sorted[i]->peak_bytes, sorted[i]->caller, sorted[i]->file, sorted[i]->line);
+
+	fprintf(stream, "main process: %lld bytes live, %lld peak, %llu allocations untracked\n", (long long) profile->live_bytes,
+		(long long) profile->peak_bytes, (unsigned long long) profile->untracked);
+}
+
+void alloc_profile_poll(void) {
+
+	if (!print_requested)
+		return;
+
+	print_requested = 0;
+	alloc_profile_print(stderr);
+}
+
+static void request_print(int sig) {
+
+	(void) sig;
+	print_requested = 1;
+}
+
+static void report_leaks(void) {
+
+	static uint64_t blocks_left[ALLOC_SITES], bytes_left[ALLOC_SITES];
+	struct alloc_site *site;
+	int i;
+
+	if (getpid() != profile_pid)
+		return;
+
+	for (i = 0; i < ALLOC_POINTERS; i++) {
+		if (blocks[i].ptr && blocks[i].pid == profile_pid) {
+			blocks_left[blocks[i].site]++;
+			bytes_left[blocks[i].site] += blocks[i].size;
+		}
+	}
+	for (i = 0; i < ALLOC_SITES; i++) {
+		site = &profile->sites[i];
+		if (blocks_left[i])
+			fprintf(stderr, "Not freed at exit: %llu blocks, %llu bytes from %s() %s:%d\n", (unsigned long long) blocks_left[i],
+				(unsigned long long) bytes_left[i], site->caller, site->file, site->line);
+	}
+}
+
+void alloc_profile_init(void) {
+
+	struct sigaction sa;
+
+	profile = mmap(NULL, sizeof(*profile), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	blocks = mmap(NULL, ALLOC_POINTERS * sizeof(*blocks), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (profile == MAP_FAILED || blocks == MAP_FAILED) {
+		profile = NULL;
+		exit_msg("alloc profile: mmap failed");
+	}
+
+	profile_pid = getpid();
+	atexit(report_leaks);
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = request_print;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+#endif
@@ -0,0 +1,1314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include "irc.h"
+#include "archive.h"
+#include "common.h"
+
+#define RECORD_HEADER 8 //!< time (4), channel length (1), nick length (1), text length (2)
+#define RECORD_MAX    (RECORD_HEADER + 2 * 255 + IRCLEN)
+#define NAMELEN       32
+#define EXTLEN        16 //!< Longest extension is ".dat.tmp"
+#define FILELEN       (PATHLEN + NAMELEN + EXTLEN) //!< archive_dir, '/', a name and it's extension
+#define MAXSEGMENTS   1024
+#define QUERY_TERMS   8
+
+typedef char Term[ARCHIVE_TERMLEN + 2]; //!< Room for the '@' / '#' prefix and the null char
+
+struct record {
+	uint32_t time;
+	const char *channel, *nick, *text;
+	unsigned channel_len, nick_len, text_len;
+};
+
+struct segment {
+	uint32_t first, last;
+	bool indexed;
+	const struct archive_header *idx; //!< Mapped index when indexed
+};
+
+/** A term's postings while an index is built */
+struct posting_list {
+	char *term;
+	unsigned char *data;
+	size_t len, size;
+	uint32_t docs, last;
+};
+
+struct term_table {
+	struct posting_list *slots;
+	size_t size, used;
+};
+
+struct query {
+	Term terms[QUERY_TERMS];
+	int count;
+	uint32_t after, before;
+	int want;
+	char results[ARCHIVE_RESULTS][IRCLEN]; //!< Newest first
+	int found;
+};
+
+/** The newest matches of a scanned source, oldest overwritten first */
+struct matches {
+	char lines[ARCHIVE_RESULTS][IRCLEN];
+	int count, next;
+};
+
+static char archive_dir[PATHLEN];
+static struct segment segments[MAXSEGMENTS];
+static int segment_count;
+
+// Active segment, only touched by the main process
+static int tail_fd = -1, data_fd = -1, blocks_fd = -1;
+static char block[ARCHIVE_BLOCK + RECORD_MAX];
+static size_t block_len;
+static struct archive_block current;
+static uint64_t data_size;
+static uint32_t next_doc, active_first;
+
+/** @returns  false if it doesn't fit. Never for our own names, archive_dir is shorter than PATHLEN */
+static bool archive_path(char *buf, size_t len, const char *name, const char *ext) {
+
+	return (size_t) snprintf(buf, len, "%s/%s%s", archive_dir, name, ext) < len;
+}
+
+static void segment_name(char *buf, uint32_t first, uint32_t last) {
+
+	snprintf(buf, NAMELEN, "%010u-%010u", first, last);
+}
+
+STATIC size_t varint_encode(uint32_t value, unsigned char *out) {
+
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		out[n++] = value | 0x80;
+		value >>= 7;
+	}
+	out[n++] = value;
+	return n;
+}
+
+/** @returns  the bytes used or 0 if the input ends early or the value is too long */
+STATIC size_t varint_decode(const unsigned char *in, size_t len, uint32_t *value) {
+
+	size_t i;
+
+	*value = 0;
+	for (i = 0; i < len && i < 5; i++) {
+		*value |= (uint32_t) (in[i] & 0x7f) << (7 * i);
+		if (!(in[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+static bool is_word(char c) {
+
+	return isalnum((unsigned char) c) || (unsigned char) c >= 0x80;
+}
+
+/** Split text in lowercased words of 2 or more bytes, without duplicates. Returns how many were stored */
+STATIC int tokenize(const char *text, size_t len, Term terms[], int count, int max) {
+
+	Term word;
+	size_t i = 0, n;
+	int j;
+
+	while (i < len && count < max) {
+		while (i < len && !is_word(text[i]))
+			i++;
+		for (n = 0; i < len && is_word(text[i]); i++)
+			if (n < ARCHIVE_TERMLEN)
+				word[n++] = tolower((unsigned char) text[i]);
+		if (n < 2)
+			continue;
+
+		word[n] = '\0';
+		for (j = 0; j < count && strcmp(terms[j], word); j++);
+		if (j == count)
+			strcpy(terms[count++], word);
+	}
+	return count;
+}
+
+static void lowercase_term(Term term, char prefix, const char *s, size_t len) {
+
+	size_t i, n = 0;
+
+	if (prefix)
+		term[n++] = prefix;
+	for (i = 0; i < len && n < ARCHIVE_TERMLEN + 1; i++)
+		term[n++] = tolower((unsigned char) s[i]);
+	term[n] = '\0';
+}
+
+/** Sender, channel and words of a message */
+static int record_terms(const struct record *rec, Term terms[]) {
+
+	lowercase_term(terms[0], '@', rec->nick, rec->nick_len);
+	lowercase_term(terms[1], '\0', rec->channel, rec->channel_len);
+	return tokenize(rec->text, rec->text_len, terms, 2, ARCHIVE_TERMS);
+}
+
+static size_t encode_record(char *buf, uint32_t time, const char *channel, size_t channel_len, const char *nick,
+		const char *text) {
+
+	size_t nick_len = strlen(nick), text_len = strlen(text);
+	uint16_t len;
+
+	if (channel_len > 255)
+		channel_len = 255;
+	if (nick_len > 255)
+		nick_len = 255;
+	if (text_len > IRCLEN)
+		text_len = IRCLEN;
+
+	len = text_len;
+	memcpy(buf, &time, 4);
+	buf[4] = channel_len;
+	buf[5] = nick_len;
+	memcpy(buf + 6, &len, 2);
+	memcpy(buf + RECORD_HEADER, channel, channel_len);
+	memcpy(buf + RECORD_HEADER + channel_len, nick, nick_len);
+	memcpy(buf + RECORD_HEADER + channel_len + nick_len, text, text_len);
+	return RECORD_HEADER + channel_len + nick_len + text_len;
+}
+
+/** @returns  false at the end of the buffer or on a truncated record */
+static bool next_record(const char *buf, size_t len, size_t *offset, struct record *rec) {
+
+	uint16_t text_len;
+	size_t size;
+
+	if (len - *offset < RECORD_HEADER)
+		return false;
+
+	buf += *offset;
+	memcpy(&rec->time, buf, 4);
+	memcpy(&text_len, buf + 6, 2);
+	rec->channel_len = (unsigned char) buf[4];
+	rec->nick_len    = (unsigned char) buf[5];
+	rec->text_len    = text_len;
+	size = RECORD_HEADER + rec->channel_len + rec->nick_len + rec->text_len;
+	if (len - *offset < size)
+		return false;
+
+	rec->channel = buf + RECORD_HEADER;
+	rec->nick    = rec->channel + rec->channel_len;
+	rec->text    = rec->nick + rec->nick_len;
+	*offset += size;
+	return true;
+}
+
+static void *read_whole_file(const char *path, size_t *len) {
+
+	struct stat st;
+	char *buf;
+	int fd;
+
+	*len = 0;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	buf = MALLOC_W(st.st_size);
+	*len = read(fd, buf, st.st_size);
+	if (*len == (size_t) -1)
+		*len = 0;
+
+	close(fd);
+	return buf;
+}
+
+static struct archive_block *read_blocks(const char *name, int *count) {
+
+	char path[FILELEN];
+	struct archive_block *blocks;
+	size_t len;
+
+	archive_path(path, sizeof(path), name, ".blk");
+	blocks = read_whole_file(path, &len);
+	*count = len / sizeof(*blocks);
+	return blocks;
+}
+
+/** Decompress a block of a .dat file. The buffer returned must be freed */
+static char *read_block(int fd, const struct archive_block *b) {
+
+	unsigned char *in;
+	char *out;
+	uLongf len = b->ulen;
+
+	in = MALLOC_W(b->clen);
+	out = MALLOC_W(b->ulen ? b->ulen : 1);
+	if (pread(fd, in, b->clen, b->offset) != (ssize_t) b->clen
+			|| uncompress((Bytef *) out, &len, in, b->clen) != Z_OK || len != b->ulen) {
+		free(out);
+		out = NULL;
+	}
+	free(in);
+	return out;
+}
+
+static const struct archive_header *map_index(const char *name) {
+
+	char path[FILELEN];
+	const struct archive_header *h;
+	struct stat st;
+	void *map;
+	int fd;
+
+	archive_path(path, sizeof(path), name, ".idx");
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*h)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	h = map;
+	if (memcmp(h->magic, ARCHIVE_MAGIC, sizeof(h->magic)) || h->size != (uint64_t) st.st_size
+			|| sizeof(*h) + (uint64_t) h->blocks * sizeof(struct archive_block) > h->terms_offset
+			|| h->terms_offset + (uint64_t) h->terms * sizeof(struct archive_term) > h->strings_offset
+			|| h->strings_offset > h->postings_offset || h->postings_offset > h->size) {
+		fprintf(stderr, "archive: %s is corrupted\n", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	return h;
+}
+
+static int compare_segments(const void *a, const void *b) {
+
+	const struct segment *x = a, *y = b;
+
+	if (x->first != y->first)
+		return x->first < y->first ? -1 : 1;
+
+	return x->last > y->last ? -1 : x->last < y->last; // The bigger one first, it covers the other
+}
+
+/** Sync the segment list with the directory. Indexes still listed stay mapped, new ones are mapped */
+static void refresh_segments(void) {
+
+	static struct segment found[MAXSEGMENTS];
+	char name[NAMELEN];
+	struct dirent *entry;
+	uint32_t first, last;
+	int i, j, count = 0, kept = 0;
+	char ext[4];
+	DIR *dir;
+
+	dir = opendir(archive_dir);
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir))) {
+		if (strlen(entry->d_name) != 25 || sscanf(entry->d_name, "%10u-%10u.%3s", &first, &last, ext) != 3)
+			continue;
+		if (strcmp(ext, "idx") && strcmp(ext, "blk"))
+			continue;
+
+		for (i = 0; i < count && (found[i].first != first || found[i].last != last); i++);
+		if (i == count) {
+			if (count == MAXSEGMENTS)
+				continue;
+			found[count].first = first;
+			found[count].last = last;
+			found[count].indexed = false;
+			found[count++].idx = NULL;
+		}
+		if (!strcmp(ext, "idx"))
+			found[i].indexed = true;
+	}
+	closedir(dir);
+
+	// Drop segments already merged into a bigger one that's still being cleaned up
+	qsort(found, count, sizeof(*found), compare_segments);
+	for (i = 0; i < count; i++)
+		if (!kept || found[i].first > found[kept - 1].last)
+			found[kept++] = found[i];
+
+	for (i = 0; i < kept; i++) {
+		if (!found[i].indexed)
+			continue;
+		for (j = 0; j < segment_count; j++) {
+			if (segments[j].idx && segments[j].first == found[i].first && segments[j].last == found[i].last) {
+				found[i].idx = segments[j].idx;
+				segments[j].idx = NULL;
+				break;
+			}
+		}
+		if (!found[i].idx) {
+			segment_name(name, found[i].first, found[i].last);
+			found[i].idx = map_index(name);
+			found[i].indexed = found[i].idx != NULL;
+		}
+	}
+	for (j = 0; j < segment_count; j++)
+		if (segments[j].idx)
+			munmap((void *) segments[j].idx, segments[j].idx->size);
+
+	memcpy(segments, found, kept * sizeof(*found));
+	segment_count = kept;
+}
+
+static uint32_t term_hash(const char *term) {
+
+	uint32_t hash = 2166136261u;
+
+	for (; *term; term++)
+		hash = (hash ^ (unsigned char) *term) * 16777619;
+
+	return hash;
+}
+
+static struct posting_list *term_get(struct term_table *t, const char *term) {
+
+	struct posting_list *old;
+	size_t i, j, old_size;
+
+	// Keep the table at most half full. The lists move to the new table as they are, keys included
+	if (t->used * 2 >= t->size) {
+		old = t->slots;
+		old_size = t->size;
+		t->size = old_size ? old_size * 2 : 4096;
+		t->slots = CALLOC_W(t->size * sizeof(*t->slots));
+		for (i = 0; i < old_size; i++) {
+			if (!old[i].term)
+				continue;
+			for (j = term_hash(old[i].term) & (t->size - 1); t->slots[j].term; j = (j + 1) & (t->size - 1));
+			t->slots[j] = old[i];
+		}
+		free(old);
+	}
+	for (i = term_hash(term) & (t->size - 1); t->slots[i].term; i = (i + 1) & (t->size - 1))
+		if (!strcmp(t->slots[i].term, term))
+			return &t->slots[i];
+
+	t->slots[i].term = strdup(term);
+	t->used++;
+	return &t->slots[i];
+}
+
+/** Append a doc ID, relative to the segment's first one, to a list. IDs must be added in order */
+static void posting_add(struct posting_list *p, uint32_t doc) {
+
+	if (p->docs && doc == p->last)
+		return;
+
+	if (p->len + 5 > p->size) {
+		p->size = p->size ? p->size * 2 : 16;
+		p->data = REALLOC_W(p->data, p->size);
+	}
+	p->len += varint_encode(p->docs ? doc - p->last : doc, p->data + p->len);
+	p->last = doc;
+	p->docs++;
+}
+
+static int compare_lists(const void *a, const void *b) {
+
+	return strcmp(((const struct posting_list *) a)->term, ((const struct posting_list *) b)->term);
+}
+
+/** Write a segment's index to a temporary file and move it in place. Lists must be sorted by term */
+static bool write_index(const char *name, uint32_t first, uint32_t docs, const struct archive_block *blocks,
+		int block_count, const struct posting_list *lists, size_t list_count) {
+
+	char tmp[FILELEN], path[FILELEN];
+	struct archive_header h = { .magic = ARCHIVE_MAGIC };
+	struct archive_term term;
+	uint64_t strings = 0, postings = 0;
+	size_t i;
+	int k;
+	FILE *f;
+
+	h.first_doc = first;
+	h.docs      = docs;
+	h.min_time  = block_count ? blocks[0].min_time : 0;
+	for (k = 0; k < block_count; k++) {
+		if (blocks[k].min_time < h.min_time)
+			h.min_time = blocks[k].min_time;
+		if (blocks[k].max_time > h.max_time)
+			h.max_time = blocks[k].max_time;
+	}
+	for (i = 0; i < list_count; i++) {
+		strings += strlen(lists[i].term);
+		postings += lists[i].len;
+	}
+	h.blocks          = block_count;
+	h.terms           = list_count;
+	h.terms_offset    = sizeof(h) + block_count * sizeof(*blocks);
+	h.strings_offset  = h.terms_offset + list_count * sizeof(term);
+	h.postings_offset = h.strings_offset + strings;
+	h.size            = h.postings_offset + postings;
+
+	archive_path(tmp, sizeof(tmp), name, ".idx.tmp");
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		return false;
+	}
+	fwrite(&h, sizeof(h), 1, f);
+	fwrite(blocks, sizeof(*blocks), block_count, f);
+	for (i = 0, strings = postings = 0; i < list_count; i++) {
+		term.string       = strings;
+		term.length       = strlen(lists[i].term);
+		term.docs         = lists[i].docs;
+		term.postings     = postings;
+		term.postings_len = lists[i].len;
+		fwrite(&term, sizeof(term), 1, f);
+		strings += term.length;
+		postings += term.postings_len;
+	}
+	for (i = 0; i < list_count; i++)
+		fwrite(lists[i].term, 1, strlen(lists[i].term), f);
+	for (i = 0; i < list_count; i++)
+		fwrite(lists[i].data, 1, lists[i].len, f);
+
+	if (fflush(f) || fsync(fileno(f)) || ferror(f)) {
+		perror(tmp);
+		fclose(f);
+		unlink(tmp);
+		return false;
+	}
+	fclose(f);
+	archive_path(path, sizeof(path), name, ".idx");
+	return rename(tmp, path) == 0;
+}
+
+static void free_lists(struct posting_list *lists, size_t count) {
+
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		free(lists[i].term);
+		free(lists[i].data);
+	}
+	free(lists);
+}
+
+/** Build the index of a sealed segment from it's blocks */
+static void index_segment(const struct segment *seg) {
+
+	char name[NAMELEN], path[FILELEN], *buf;
+	struct term_table table = { NULL, 0, 0 };
+	struct archive_block *blocks;
+	struct record rec;
+	Term terms[ARCHIVE_TERMS];
+	size_t offset, i, n = 0;
+	uint32_t doc;
+	int b, t, count, fd;
+
+	segment_name(name, seg->first, seg->last);
+	blocks = read_blocks(name, &count);
+	archive_path(path, sizeof(path), name, ".dat");
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (!blocks || fd < 0) {
+		fprintf(stderr, "archive: cannot read segment %s\n", name);
+		free(blocks);
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	for (b = 0; b < count; b++) {
+		buf = read_block(fd, &blocks[b]);
+		if (!buf)
+			continue;
+		for (offset = 0, doc = blocks[b].first_doc; next_record(buf, blocks[b].ulen, &offset, &rec); doc++)
+			for (t = record_terms(&rec, terms) - 1; t >= 0; t--)
+				posting_add(term_get(&table, terms[t]), doc - seg->first);
+		free(buf);
+	}
+	close(fd);
+
+	// Compact and sort the table
+	for (i = 0; i < table.size; i++)
+		if (table.slots[i].term)
+			table.slots[n++] = table.slots[i];
+	qsort(table.slots, n, sizeof(*table.slots), compare_lists);
+
+	if (write_index(name, seg->first, seg->last - seg->first + 1, blocks, count, table.slots, n)) {
+		archive_path(path, sizeof(path), name, ".blk");
+		unlink(path);
+	}
+	free_lists(table.slots, n);
+	free(blocks);
+}
+
+static const struct archive_block *index_blocks(const struct archive_header *h) {
+
+	return (const struct archive_block *) ((const char *) h + sizeof(*h));
+}
+
+static const struct archive_term *index_terms(const struct archive_header *h) {
+
+	return (const struct archive_term *) ((const char *) h + h->terms_offset);
+}
+
+static bool term_valid(const struct archive_header *h, const struct archive_term *t) {
+
+	return h->strings_offset + t->string + t->length <= h->postings_offset
+		&& h->postings_offset + t->postings + t->postings_len <= h->size && t->docs <= h->docs;
+}
+
+/** Decode a posting list into absolute doc IDs. The array returned must be freed */
+static uint32_t *decode_postings(const struct archive_header *h, const struct archive_term *t, uint32_t *count) {
+
+	const unsigned char *p = (const unsigned char *) h + h->postings_offset + t->postings;
+	uint32_t *docs, delta, doc = 0;
+	size_t offset = 0, n;
+
+	docs = MALLOC_W((t->docs ? t->docs : 1) * sizeof(*docs));
+	for (*count = 0; *count < t->docs; (*count)++) {
+		n = varint_decode(p + offset, t->postings_len - offset, &delta);
+		if (!n)
+			break;
+		offset += n;
+		doc = *count ? doc + delta : delta;
+		docs[*count] = h->first_doc + doc;
+	}
+	return docs;
+}
+
+static int segment_level(const struct segment *seg) {
+
+	uint32_t docs = seg->last - seg->first + 1;
+	int level = 0;
+
+	while (docs >= (uint32_t) ARCHIVE_SEGMENT * ARCHIVE_FANIN) {
+		docs /= ARCHIVE_FANIN;
+		level++;
+	}
+	return level;
+}
+
+/** Make the renames done so far durable before the next one */
+static void sync_dir(void) {
+
+	int fd = open(archive_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+static bool copy_data(int out, const char *name, uint64_t *size) {
+
+	char path[FILELEN], buf[64 * 1024];
+	ssize_t n;
+	int in;
+
+	archive_path(path, sizeof(path), name, ".dat");
+	in = open(path, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return false;
+
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			n = -1;
+			break;
+		}
+		*size += n;
+	}
+	close(in);
+	return n == 0;
+}
+
+/** Merge consecutive indexed segments: their data files are concatenated and the posting lists joined term by term */
+static void merge_segments(const struct segment *in, int count) {
+
+	char name[NAMELEN], input[NAMELEN], tmp[FILELEN], path[FILELEN];
+	const struct archive_term *terms[ARCHIVE_FANIN], *t;
+	uint32_t cursor[ARCHIVE_FANIN], *docs, n;
+	struct archive_block *blocks;
+	struct posting_list *lists = NULL;
+	size_t list_count = 0, list_size = 0, len;
+	uint64_t shift[ARCHIVE_FANIN], data = 0;
+	const char *smallest, *s;
+	int i, k, b, block_count = 0, fd;
+	bool ok = true;
+
+	segment_name(name, in[0].first, in[count - 1].last);
+	archive_path(tmp, sizeof(tmp), name, ".dat.tmp");
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+
+	for (i = 0; i < count; i++) {
+		shift[i] = data;
+		segment_name(input, in[i].first, in[i].last);
+		ok = ok && copy_data(fd, input, &data);
+		block_count += in[i].idx->blocks;
+		terms[i] = index_terms(in[i].idx);
+		cursor[i] = 0;
+	}
+	// Publish the data before the index that points to it. An index is what makes readers switch to the merged
+	// segment, a data file without one is ignored and overwritten by the next try
+	archive_path(path, sizeof(path), name, ".dat");
+	if (!ok || fsync(fd) || rename(tmp, path) < 0) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+	sync_dir();
+
+	blocks = MALLOC_W(block_count * sizeof(*blocks));
+	for (i = 0, b = 0; i < count; i++) {
+		memcpy(blocks + b, index_blocks(in[i].idx), in[i].idx->blocks * sizeof(*blocks));
+		for (k = 0; k < (int) in[i].idx->blocks; k++)
+			blocks[b++].offset += shift[i];
+	}
+	// Walk the sorted term tables side by side, like the merge step of a merge sort
+	for (;;) {
+		smallest = NULL;
+		len = 0;
+		for (i = 0; i < count; i++) {
+			if (cursor[i] == in[i].idx->terms)
+				continue;
+			t = &terms[i][cursor[i]];
+			if (!term_valid(in[i].idx, t)) {
+				cursor[i] = in[i].idx->terms; // Skip the rest of a corrupted table
+				continue;
+			}
+			s = (const char *) in[i].idx + in[i].idx->strings_offset + t->string;
+			if (!smallest || memcmp(s, smallest, t->length < len ? t->length : len) < 0
+					|| (!memcmp(s, smallest, t->length < len ? t->length : len) && t->length < len)) {
+				smallest = s;
+				len = t->length;
+			}
+		}
+		if (!smallest)
+			break;
+
+		if (list_count == list_size) {
+			list_size = list_size ? list_size * 2 : 4096;
+			lists = REALLOC_W(lists, list_size * sizeof(*lists));
+		}
+		memset(&lists[list_count], 0, sizeof(*lists));
+		lists[list_count].term = strndup(smallest, len);
+		for (i = 0; i < count; i++) {
+			if (cursor[i] == in[i].idx->terms)
+				continue;
+			t = &terms[i][cursor[i]];
+			s = (const char *) in[i].idx + in[i].idx->strings_offset + t->string;
+			if (t->length != len || memcmp(s, lists[list_count].term, len))
+				continue;
+
+			docs = decode_postings(in[i].idx, t, &n);
+			for (k = 0; k < (int) n; k++)
+				posting_add(&lists[list_count], docs[k] - in[0].first);
+			free(docs);
+			cursor[i]++;
+		}
+		list_count++;
+	}
+
+	if (write_index(name, in[0].first, in[count - 1].last - in[0].first + 1, blocks, block_count, lists, list_count)) {
+		// The new index makes the inputs invisible to readers, remove them after it's in place
+		sync_dir();
+		for (i = 0; i < count; i++) {
+			segment_name(input, in[i].first, in[i].last);
+			archive_path(path, sizeof(path), input, ".idx");
+			unlink(path);
+			archive_path(path, sizeof(path), input, ".dat");
+			unlink(path);
+		}
+	} else
+		unlink(path);
+
+	free_lists(lists, list_count);
+	free(blocks);
+}
+
+/** Merge the oldest run of ARCHIVE_FANIN consecutive indexed segments of the same size. Returns false if none */
+static bool merge_once(void) {
+
+	int i, k;
+
+	for (i = 0; i + ARCHIVE_FANIN <= segment_count; i++) {
+		for (k = 0; k < ARCHIVE_FANIN; k++) {
+			if (!segments[i + k].indexed || segment_level(&segments[i + k]) != segment_level(&segments[i]))
+				break;
+			if (k && segments[i + k].first != segments[i + k - 1].last + 1)
+				break;
+		}
+		if (k == ARCHIVE_FANIN) {
+			merge_segments(&segments[i], ARCHIVE_FANIN);
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Index every sealed segment that has no index yet, then merge. Runs in a background process */
+STATIC void build_indexes(void) {
+
+	char path[FILELEN];
+	int i, lock;
+
+	// One builder at a time. A later one waits and finds the work done
+	archive_path(path, sizeof(path), "lock", "");
+	lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (lock < 0 || flock(lock, LOCK_EX) < 0)
+		return;
+
+	refresh_segments();
+	for (i = 0; i < segment_count; i++)
+		if (!segments[i].indexed)
+			index_segment(&segments[i]);
+
+	do
+		refresh_segments();
+	while (merge_once());
+
+	close(lock);
+}
+
+static void start_builder(void) {
+
+	switch (fork()) {
+	case 0:
+		if (setpriority(PRIO_PROCESS, 0, 10) < 0)
+			perror("setpriority");
+		build_indexes();
+		_exit(EXIT_SUCCESS);
+	case -1:
+		perror("archive: fork");
+	}
+}
+
+static void open_active(void) {
+
+	char path[FILELEN];
+
+	archive_path(path, sizeof(path), "active", ".dat");
+	data_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	archive_path(path, sizeof(path), "active", ".blk");
+	blocks_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (data_fd < 0 || blocks_fd < 0)
+		perror("archive: active segment");
+}
+
+static void add_to_block(const char *rec, size_t len, uint32_t time) {
+
+	if (!current.docs) {
+		current.first_doc = next_doc;
+		current.min_time = current.max_time = time;
+	}
+	if (time < current.min_time)
+		current.min_time = time;
+	if (time > current.max_time)
+		current.max_time = time;
+
+	memcpy(block + block_len, rec, len);
+	block_len += len;
+	current.docs++;
+	next_doc++;
+}
+
+static void flush_block(void) {
+
+	unsigned char *out;
+	uLongf len;
+
+	if (!current.docs)
+		return;
+
+	len = compressBound(block_len);
+	out = MALLOC_W(len);
+	if (compress2(out, &len, (Bytef *) block, block_len, Z_DEFAULT_COMPRESSION) == Z_OK) {
+		current.offset = data_size;
+		current.clen = len;
+		current.ulen = block_len;
+		if (pwrite(data_fd, out, len, data_size) != (ssize_t) len
+				|| write(blocks_fd, &current, sizeof(current)) != sizeof(current))
+			perror("archive: active segment");
+
+		// The block is safe in active.dat now
+		data_size += len;
+		if (ftruncate(tail_fd, 0) < 0)
+			perror("archive: tail.log");
+	}
+	free(out);
+	block_len = 0;
+	memset(&current, 0, sizeof(current));
+}
+
+static void seal_segment(void) {
+
+	char name[NAMELEN], from[FILELEN], to[FILELEN];
+
+	flush_block();
+	close(data_fd);
+	close(blocks_fd);
+
+	segment_name(name, active_first, next_doc - 1);
+	archive_path(from, sizeof(from), "active", ".dat");
+	archive_path(to, sizeof(to), name, ".dat");
+	rename(from, to);
+	archive_path(from, sizeof(from), "active", ".blk");
+	archive_path(to, sizeof(to), name, ".blk");
+	rename(from, to);
+
+	active_first = next_doc;
+	data_size = 0;
+	open_active();
+	start_builder();
+	refresh_segments();
+}
+
+void archive_append(const char *channel, size_t channel_len, const char *nick, const char *text) {
+
+	char rec[RECORD_MAX];
+	uint32_t now = time(NULL);
+	size_t len;
+
+	if (tail_fd < 0)
+		return;
+
+	len = encode_record(rec, now, channel, channel_len, nick, text);
+	if (write(tail_fd, rec, len) != (ssize_t) len)
+		perror("archive: tail.log");
+
+	add_to_block(rec, len, now);
+	if (block_len >= ARCHIVE_BLOCK)
+		flush_block();
+	if (next_doc - active_first >= ARCHIVE_SEGMENT)
+		seal_segment();
+}
+
+/** Pick up the active segment where it was left: complete blocks from active.blk, the rest from tail.log */
+static void recover_active(void) {
+
+	char path[FILELEN], *tail;
+	struct archive_block *blocks;
+	struct record rec;
+	size_t len, offset = 0, start;
+	int i, count;
+
+	blocks = read_blocks("active", &count);
+	for (i = 0; i < count && blocks[i].first_doc == next_doc; i++) {
+		next_doc += blocks[i].docs;
+		data_size = blocks[i].offset + blocks[i].clen;
+	}
+	free(blocks);
+
+	// Drop whatever didn't make it in full
+	archive_path(path, sizeof(path), "active", ".blk");
+	if (truncate(path, i * sizeof(*blocks)) < 0 && errno != ENOENT)
+		perror(path);
+	archive_path(path, sizeof(path), "active", ".dat");
+	if (truncate(path, data_size) < 0 && errno != ENOENT)
+		perror(path);
+
+	archive_path(path, sizeof(path), "tail", ".log");
+	tail = read_whole_file(path, &len);
+	for (start = 0; next_record(tail, len, &offset, &rec); start = offset)
+		add_to_block(tail + start, offset - start, rec.time);
+	free(tail);
+	if (truncate(path, offset) < 0 && errno != ENOENT)
+		perror(path);
+}
+
+void archive_init(const char *dir) {
+
+	char path[FILELEN];
+	struct dirent *entry;
+	bool unindexed = false;
+	DIR *d;
+	int i;
+
+	if (!dir || !*dir)
+		return;
+
+	if (strlen(dir) >= PATHLEN) {
+		fprintf(stderr, "archive_dir is longer than %d characters, the archive is disabled\n", PATHLEN - 1);
+		return;
+	}
+	snprintf(archive_dir, PATHLEN, "%s", dir);
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		*archive_dir = '\0';
+		return;
+	}
+	// Leftovers of builds that were interrupted
+	d = opendir(dir);
+	while (d && (entry = readdir(d))) {
+		if (strstr(entry->d_name, ".tmp") && archive_path(path, sizeof(path), entry->d_name, ""))
+			unlink(path);
+	}
+	if (d)
+		closedir(d);
+
+	refresh_segments();
+	for (i = 0; i < segment_count; i++) {
+		unindexed |= !segments[i].indexed;
+		if (segments[i].last + 1 > next_doc)
+			next_doc = segments[i].last + 1;
+	}
+	active_first = next_doc;
+	recover_active();
+	open_active();
+
+	archive_path(path, sizeof(path), "tail", ".log");
+	tail_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (tail_fd < 0)
+		perror(path);
+
+	if (unindexed)
+		start_builder();
+}
+
+static void format_result(char *buf, const struct record *rec) {
+
+	time_t t = rec->time;
+	char date[32];
+	struct tm tm;
+
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime_r(&t, &tm));
+	snprintf(buf, IRCLEN, "[%s] <%.*s> %.*s", date, rec->nick_len, rec->nick, rec->text_len, rec->text);
+}
+
+static bool record_matches(const struct record *rec, const struct query *q) {
+
+	Term terms[ARCHIVE_TERMS];
+	int i, j, count;
+
+	if (rec->time < q->after || rec->time > q->before)
+		return false;
+
+	count = record_terms(rec, terms);
+	for (i = 0; i < q->count; i++) {
+		for (j = 0; j < count && strcmp(q->terms[i], terms[j]); j++);
+		if (j == count)
+			return false;
+	}
+	return true;
+}
+
+static void scan_buffer(const char *buf, size_t len, const struct query *q, struct matches *m) {
+
+	struct record rec;
+	size_t offset = 0;
+
+	while (next_record(buf, len, &offset, &rec)) {
+		if (!record_matches(&rec, q))
+			continue;
+		format_result(m->lines[m->next], &rec);
+		m->next = (m->next + 1) % q->want;
+		if (m->count < q->want)
+			m->count++;
+	}
+}
+
+static void scan_blocks(const char *name, const struct archive_block *blocks, int count, const struct query *q,
+		struct matches *m) {
+
+	char path[FILELEN], *buf;
+	int i, fd;
+
+	archive_path(path, sizeof(path), name, ".dat");
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (blocks[i].max_time < q->after || blocks[i].min_time > q->before)
+			continue;
+		buf = read_block(fd, &blocks[i]);
+		if (buf)
+			scan_buffer(buf, blocks[i].ulen, q, m);
+		free(buf);
+	}
+	close(fd);
+}
+
+/** Move the newest matches of a scanned source to the results */
+static void add_matches(struct query *q, struct matches *m) {
+
+	int i;
+
+	for (i = 1; i <= m->count && q->found < q->want; i++)
+		strcpy(q->results[q->found++], m->lines[(m->next - i + q->want) % q->want]);
+}
+
+/** Scan the active segment. active.blk is read again if a block was flushed while reading tail.log */
+static void search_active(struct query *q) {
+
+	char path[FILELEN], *tail = NULL;
+	struct archive_block *blocks = NULL;
+	struct matches m = { .count = 0 };
+	struct stat st;
+	int count = 0, tries;
+	size_t len = 0;
+
+	archive_path(path, sizeof(path), "active", ".blk");
+	for (tries = 0; tries < 3; tries++) {
+		free(blocks);
+		free(tail);
+		blocks = read_blocks("active", &count);
+		archive_path(path, sizeof(path), "tail", ".log");
+		tail = read_whole_file(path, &len);
+		archive_path(path, sizeof(path), "active", ".blk");
+		if (stat(path, &st) < 0 || st.st_size == (off_t) (count * sizeof(*blocks)))
+			break;
+	}
+	scan_blocks("active", blocks, count, q, &m);
+	scan_buffer(tail, len, q, &m);
+	add_matches(q, &m);
+	free(blocks);
+	free(tail);
+}
+
+static const struct archive_term *find_term(const struct archive_header *h, const char *term) {
+
+	const struct archive_term *terms = index_terms(h), *t;
+	size_t len = strlen(term), low = 0, high = h->terms, mid;
+	int cmp;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		t = &terms[mid];
+		if (!term_valid(h, t))
+			return NULL;
+		cmp = memcmp((const char *) h + h->strings_offset + t->string, term, t->length < len ? t->length : len);
+		if (!cmp)
+			cmp = t->length < len ? -1 : t->length > len;
+		if (!cmp)
+			return t;
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return NULL;
+}
+
+static int compare_doc_counts(const void *a, const void *b) {
+
+	const struct archive_term *x = *(const struct archive_term * const *) a, *y = *(const struct archive_term * const *) b;
+
+	return x->docs < y->docs ? -1 : x->docs > y->docs;
+}
+
+/** Look the terms up in a mapped index, intersect their postings and read the newest matching messages */
+static void search_index(const struct segment *seg, struct query *q) {
+
+	const struct archive_header *h = seg->idx;
+	const struct archive_block *blocks = index_blocks(h);
+	const struct archive_term *found[QUERY_TERMS];
+	uint32_t *docs, *other, count, other_count, i, j, k;
+	char name[NAMELEN], path[FILELEN], *buf = NULL;
+	struct record rec;
+	size_t offset;
+	int t, fd, cached = -1, low, high, mid;
+
+	if (h->max_time < q->after || h->min_time > q->before)
+		return;
+	for (t = 0; t < q->count; t++)
+		if (!(found[t] = find_term(h, q->terms[t])))
+			return;
+
+	// Start from the rarest term, so the candidates only get fewer
+	qsort(found, q->count, sizeof(*found), compare_doc_counts);
+	docs = decode_postings(h, found[0], &count);
+	for (t = 1; t < q->count && count; t++) {
+		other = decode_postings(h, found[t], &other_count);
+		for (i = j = k = 0; i < count && j < other_count;) {
+			if (docs[i] < other[j])
+				i++;
+			else if (docs[i] > other[j])
+				j++;
+			else {
+				docs[k++] = docs[i++];
+				j++;
+			}
+		}
+		count = k;
+		free(other);
+	}
+	segment_name(name, seg->first, seg->last);
+	archive_path(path, sizeof(path), name, ".dat");
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	for (i = count; fd >= 0 && i-- > 0 && q->found < q->want;) {
+		// Find the block holding the doc
+		for (low = 0, high = h->blocks; high - low > 1;) {
+			mid = (low + high) / 2;
+			if (blocks[mid].first_doc <= docs[i])
+				low = mid;
+			else
+				high = mid;
+		}
+		if (!h->blocks || docs[i] < blocks[low].first_doc || docs[i] - blocks[low].first_doc >= blocks[low].docs)
+			continue;
+		if (blocks[low].max_time < q->after || blocks[low].min_time > q->before)
+			continue;
+		if (low != cached) {
+			free(buf);
+			buf = read_block(fd, &blocks[low]);
+			cached = low;
+		}
+		if (!buf)
+			continue;
+
+		offset = 0;
+		for (k = blocks[low].first_doc; k <= docs[i] && next_record(buf, blocks[low].ulen, &offset, &rec); k++);
+		if (k > docs[i] && rec.time >= q->after && rec.time <= q->before)
+			format_result(q->results[q->found++], &rec);
+	}
+	if (fd >= 0)
+		close(fd);
+	free(buf);
+	free(docs);
+}
+
+/** Newest sources first: the active segment, then sealed segments from the most recent */
+static void search(struct query *q) {
+
+	struct matches m;
+	char name[NAMELEN];
+	struct archive_block *blocks;
+	int i, count;
+
+	refresh_segments();
+	search_active(q);
+	for (i = segment_count - 1; i >= 0 && q->found < q->want; i--) {
+		if (segments[i].indexed) {
+			search_index(&segments[i], q);
+			continue;
+		}
+		// Sealed but the index is still being built
+		memset(&m, 0, sizeof(m));
+		segment_name(name, segments[i].first, segments[i].last);
+		blocks = read_blocks(name, &count);
+		scan_blocks(name, blocks, count, q, &m);
+		add_matches(q, &m);
+		free(blocks);
+	}
+}
+
+/** "2016-05-01" or "7d" / "12h" ago */
+static bool parse_time(const char *s, uint32_t *t) {
+
+	struct tm tm;
+	char *end;
+	long n;
+
+	n = strtol(s, &end, 10);
+	if (n >= 0 && end != s && (streq(end, "d") || streq(end, "h"))) {
+		*t = time(NULL) - n * (*end == 'd' ? 86400 : 3600);
+		return true;
+	}
+	memset(&tm, 0, sizeof(tm));
+	end = strptime(s, "%Y-%m-%d", &tm);
+	if (!end || *end)
+		return false;
+
+	tm.tm_isdst = -1;
+	*t = mktime(&tm);
+	return true;
+}
+
+/** Searches are limited to the channel they are asked on. In a query there's no channel to limit them to */
+static bool channel_only(Irc server, Parsed_data pdata) {
+
+	if (*pdata.target == '#')
+		return true;
+
+	send_message(server, pdata.target, "%s", "Ask on the channel you want to search");
+	return false;
+}
+
+static void add_channel_term(struct query *q, const char *target) {
+
+	if (q->count < QUERY_TERMS)
+		lowercase_term(q->terms[q->count++], '\0', target, strlen(target));
+}
+
+void archive_grep(Irc server, Parsed_data pdata) {
+
+	struct query q = { .count = 0, .after = 0, .before = UINT32_MAX, .want = ARCHIVE_RESULTS, .found = 0 };
+	char **argv;
+	int argc, i;
+	bool valid = true;
+
+	if (!*archive_dir || !channel_only(server, pdata))
+		return;
+
+	argc = pdata.message ? extract_params(pdata.message, &argv) : 0;
+	for (i = 0; i < argc; i++) {
+		if (starts_with(argv[i], "after:"))
+			valid &= parse_time(argv[i] + 6, &q.after);
+		else if (starts_with(argv[i], "before:")) {
+			valid &= parse_time(argv[i] + 7, &q.before);
+			q.before--;
+		} else
+			q.count = tokenize(argv[i], strlen(argv[i]), q.terms, q.count, QUERY_TERMS - 1);
+	}
+	if (argc)
+		free(argv);
+	if (!valid || !q.count) {
+		send_message(server, pdata.target, "%s", "usage: !grep words [after:YYYY-MM-DD|Nd] [before:YYYY-MM-DD|Nd]");
+		return;
+	}
+	add_channel_term(&q, pdata.target);
+	search(&q);
+	if (!q.found)
+		send_message(server, pdata.target, "%s", "no matches");
+	for (i = 0; i < q.found; i++)
+		send_message(server, pdata.target, "%s", q.results[i]);
+}
+
+void archive_last(Irc server, Parsed_data pdata) {
+
+	struct query q = { .count = 1, .after = 0, .before = UINT32_MAX, .want = 1, .found = 0 };
+	char **argv;
+	int argc;
+
+	if (!*archive_dir || !channel_only(server, pdata))
+		return;
+
+	argc = pdata.message ? extract_params(pdata.message, &argv) : 0;
+	if (argc != 1) {
+		send_message(server, pdata.target, "%s", "usage: !last nick");
+		if (argc)
+			free(argv);
+		return;
+	}
+	lowercase_term(q.terms[0], '@', argv[0], strlen(argv[0]));
+	free(argv);
+
+	add_channel_term(&q, pdata.target);
+	search(&q);
+	if (q.found)
+		send_message(server, pdata.target, "%s", q.results[0]);
+	else
+		send_message(server, pdata.target, "%s", "never seen");
+}
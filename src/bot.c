@@ -2,55 +2,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/wait.h>
-#include <sys/mman.h>
 #include <time.h>
 #include <yajl/yajl_tree.h>
 #include "bot.h"
 #include "irc.h"
 #include "curl.h"
+#include "shorten.h"
 #include "twitter.h"
+#include "metrics.h"
+#include "chanstats.h"
 #include "common.h"
 
 
 void help(Irc server, Parsed_data pdata) {
 
-	send_message(server, pdata.target, "%s", "url, mumble, fail, github, ping, traceroute, dns, uptime, roll, tweet, marker");
+	send_message(server, pdata.target, "%s", "url, mumble, fail, github, ping, traceroute, dns, uptime, roll, tweet, marker, stats, grep, last, seen, tell, quote, addquote, grab, trending, remind, reminders");
 	send_message(server, pdata.target, "%s", "MPD: play, playlist, history, current, next, random, stop, seek, announce");
 }
 
-void bot_fail(Irc server, Parsed_data pdata) {
-
-	int r, clr_r;
-	size_t len, maxlen, sum = 0;
-	char quote[QUOTELEN];
-
-	if (!cfg.quote_count)
-		return;
-
-	// Make sure the seed is different even if we call the command twice in a second
-	srand(time(NULL) + getpid());
-	r      = rand() % cfg.quote_count;
-	clr_r  = rand() % COLORCOUNT;
-	maxlen = strlen(cfg.quotes[r]);
-
-	// Pick a random entry from the read-only quotes array and print it.
-	// We use indexes and lengths since we can't make changes to the array
-	while (sum < maxlen) {
-		len = strcspn(cfg.quotes[r] + sum, "\n");
-		if (!len)
-			return;
-
-		snprintf(quote, QUOTELEN, COLOR "%d%.*s", clr_r, (int) len, cfg.quotes[r] + sum);
-		send_message(server, pdata.target, "%s", quote);
-		sum += ++len; // Skip newline
-	}
-}
-
 void url(Irc server, Parsed_data pdata) {
 
 	int argc;
-	char *temp, **argv, *short_url, *url_title = NULL;
+	char **argv, *short_url, *url_title;
 
 	argc = extract_params(pdata.message, &argv);
 	if (!argc)
@@ -60,37 +33,14 @@ void url(Irc server, Parsed_data pdata) {
 	if (!strchr(argv[0], '.'))
 		goto cleanup;
 
-	// Map shared memory for inter-process communication
-	short_url = mmap(NULL, ADDRLEN + 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	if (short_url == MAP_FAILED) {
-		perror("mmap");
-		goto cleanup;
-	}
-
-	switch (fork()) {
-	case -1:
-		perror("fork");
-		break;
-	case 0:
-		temp = shorten_url(argv[0]);
-		if (temp) {
-			strncpy(short_url, temp, ADDRLEN);
-			free(temp);
-		} else // Put a null char in the first byte if shorten_url fails so we can test for it in send_message
-			*short_url = '\0';
-
-		munmap(short_url, ADDRLEN + 1); // Unmap pages from child process
-		_exit(EXIT_SUCCESS);
-	default:
-		url_title = get_url_title(argv[0]);
-		wait(NULL); // Wait for child results before continuing
-
-		// Only print short_url / title if they are not empty
-		send_message(server, pdata.target, "%s -- %s", (*short_url ? short_url : ""), (url_title ? url_title : ""));
-	}
+	// Shortening is a local table lookup, only the title needs the network
+	short_url = shorten_url(argv[0]);
+	url_title = get_url_title(argv[0]);
 
+	// Only print short_url / title if they are not empty
+	send_message(server, pdata.target, "%s -- %s", (short_url ? short_url : ""), (url_title ? url_title : ""));
+	free(short_url);
 	free(url_title);
-	munmap(short_url, ADDRLEN + 1); // Unmap pages from parent as well
 
 cleanup:
 	free(argv);
@@ -112,7 +62,7 @@ void github(Irc server, Parsed_data pdata) {
 	Github *commits;
 	yajl_val root = NULL;
 	int argc, i, commit_count = 1;
-	char **argv, *short_url, repo[REPOLEN + 1];
+	char **argv, repo[REPOLEN + 1];
 
 	argc = extract_params(pdata.message, &argv);
 	if (!argc)
@@ -135,12 +85,8 @@ void github(Irc server, Parsed_data pdata) {
 		goto cleanup;
 
 	// Print each commit info with it's short url in a seperate colorized line
-	for (i = 0; i < commit_count; i++) {
-		short_url = shorten_url(commits[i].url);
-		send_message(server, pdata.target, PURPLE "[%.7s]" RESET " %.120s" ORANGE " --%s" BLUE " - %s",
-			commits[i].sha, commits[i].msg, commits[i].name, (short_url ? short_url : ""));
-		free(short_url);
-	}
+	for (i = 0; i < commit_count; i++)
+		print_commit(server, pdata.target, &commits[i]);
 
 cleanup:
 	yajl_tree_free(root);
@@ -148,6 +94,15 @@ cleanup:
 	free(argv);
 }
 
+void print_commit(Irc server, const char *target, const Github *commit) {
+
+	char *short_url = shorten_url(commit->url);
+
+	send_message(server, target, PURPLE "[%.7s]" RESET " %.120s" ORANGE " --%s" BLUE " - %s",
+		commit->sha, commit->msg, commit->name, (short_url ? short_url : ""));
+	free(short_url);
+}
+
 void ping(Irc server, Parsed_data pdata) {
 
 	int argc, count = 3;
@@ -292,3 +247,18 @@ void tweet(Irc server, Parsed_data pdata) {
 		send_message(server, pdata.target, "message posted @ %s", cfg.twitter_profile_url);
 	}
 }
+
+void stats(Irc server, Parsed_data pdata) {
+
+	char **argv;
+	int argc;
+
+	argc = extract_params(pdata.message, &argv);
+	if (argc == 1 && *argv[0] == '#')
+		chanstats_print(server, pdata.target, argv[0]);
+	else
+		metrics_print_summary(server, pdata.target);
+
+	if (argc)
+		free(argv);
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "irc.h"
+#include "capture.h"
+#include "common.h"
+
+static int capture_fd = -1;
+static uint64_t lines, replay_started;
+static char replay_port[PORTLEN + 1];
+
+static uint64_t realtime_usec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void capture_init(const char *path) {
+
+	struct stat st;
+
+	if (!path || !*path)
+		return;
+
+	capture_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (capture_fd < 0) {
+		perror(path);
+		return;
+	}
+	if (!fstat(capture_fd, &st) && !st.st_size)
+		if (write(capture_fd, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != sizeof(CAPTURE_MAGIC))
+			perror(path);
+}
+
+void capture_line(const char *line) {
+
+	char record[CAPTURE_HEADER + IRCLEN];
+	uint64_t now;
+	uint16_t len;
+
+	lines++;
+	if (capture_fd < 0)
+		return;
+
+	// One write per line, so a crash never leaves half a record behind
+	len = strnlen(line, IRCLEN);
+	now = realtime_usec();
+	memcpy(record, &now, sizeof(now));
+	memcpy(record + sizeof(now), &len, sizeof(len));
+	memcpy(record + CAPTURE_HEADER, line, len);
+	if (write(capture_fd, record, CAPTURE_HEADER + len) < 0)
+		perror("capture");
+}
+
+/** Read the next line of a capture with the "\r\n" terminators put back
+ *  @returns  the line's length or -1 at the end of the file */
+static int read_record(FILE *file, uint64_t *time, char *line) {
+
+	unsigned char header[CAPTURE_HEADER];
+	uint16_t len;
+
+	if (fread(header, 1, CAPTURE_HEADER, file) != CAPTURE_HEADER)
+		return -1;
+
+	memcpy(time, header, sizeof(*time));
+	memcpy(&len, header + sizeof(*time), sizeof(len));
+	if (len > IRCLEN - 2 || fread(line, 1, len, file) != len)
+		return -1;
+
+	memcpy(line + len, "\r\n", 2);
+	return len + 2;
+}
+
+/** Play the capture to the bot's connection, while discarding everything the bot sends */
+static void feed(int listen_fd, FILE *file, double speed) {
+
+	struct pollfd pfd;
+	char line[IRCLEN], discard[4096];
+	uint64_t time, first = 0, due = 0, start, now;
+	int len = 0, sent = 0, wait;
+	ssize_t n;
+
+	pfd.fd = accept(listen_fd, NULL, NULL);
+	close(listen_fd);
+	if (pfd.fd < 0) {
+		perror("replay: accept");
+		_exit(EXIT_FAILURE);
+	}
+	fcntl(pfd.fd, F_SETFL, O_NONBLOCK);
+	start = monotonic_usec();
+
+	for (;;) {
+		if (sent == len) {
+			len = read_record(file, &time, line);
+			if (len < 0)
+				break;
+
+			sent = 0;
+			if (!first)
+				first = time;
+			due = speed > 0 ? start + (time - first) / speed : 0;
+		}
+		now = monotonic_usec();
+		wait = due > now ? (due - now) / 1000 + 1 : 0;
+		pfd.events = POLLIN | (wait ? 0 : POLLOUT);
+		if (poll(&pfd, 1, wait ? wait : -1) < 0 && errno != EINTR)
+			break;
+
+		if (pfd.revents & (POLLIN | POLLHUP)) {
+			n = read(pfd.fd, discard, sizeof(discard));
+			if (n == 0 || (n < 0 && errno != EAGAIN))
+				_exit(EXIT_SUCCESS); // The bot is gone
+		}
+		if (pfd.revents & POLLOUT) {
+			n = write(pfd.fd, line + sent, len - sent);
+			if (n > 0)
+				sent += n;
+		}
+	}
+	// Signal the end of the capture and wait for the bot to hang up
+	shutdown(pfd.fd, SHUT_WR);
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, -1) >= 0 || errno == EINTR) {
+		n = read(pfd.fd, discard, sizeof(discard));
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+			break;
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+void replay_init(const char *path, double speed) {
+
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	char magic[sizeof(CAPTURE_MAGIC)];
+	FILE *file;
+	int listen_fd;
+
+	file = fopen(path, "rb");
+	if (!file)
+		exit_msg("replay: cannot open %s", path);
+
+	if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)))
+		exit_msg("replay: %s is not a capture file", path);
+
+	// Listen on any free port and let the bot connect there as if it was the server
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0
+			|| getsockname(listen_fd, (struct sockaddr *) &addr, &addrlen) < 0)
+		exit_msg("replay: cannot listen on a local port");
+
+	snprintf(replay_port, sizeof(replay_port), "%d", ntohs(addr.sin_port));
+	switch (fork()) {
+	case 0:
+		feed(listen_fd, file, speed);
+		break;
+	case -1:
+		exit_msg("replay: fork failed");
+	}
+	close(listen_fd);
+	fclose(file);
+
+	cfg.server = LOCALHOST;
+	cfg.port = replay_port;
+	cfg.replay = true;
+	replay_started = monotonic_usec();
+}
+
+void replay_finish(void) {
+
+	double elapsed = (monotonic_usec() - replay_started) / 1e6;
+
+	fprintf(stderr, "Replayed %llu lines in %.3fs, %.0f lines/s\n", (unsigned long long) lines, elapsed, lines / elapsed);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include "irc.h"
+#include "chanstats.h"
+#include "metrics.h"
+#include "common.h"
+
+struct stats_file {
+	char magic[8];
+	uint32_t size; //!< Of the whole file, catches layout changes
+	uint32_t last_checkpoint;
+	struct channel_stats channels[MAXCHANS];
+};
+
+static struct stats_file state;
+static char stats_path[PATHLEN];
+
+/** FNV-1a of the lowercased nick, scrambled with the splitmix64 finalizer so every bit is usable */
+STATIC uint64_t nick_hash(const char *nick) {
+
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *nick; nick++)
+		h = (h ^ (unsigned char) tolower((unsigned char) *nick)) * 1099511628211ULL;
+
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/** The top bits pick the register, the rank is the position of the first 1 bit in the rest */
+STATIC void hll_add(uint8_t *regs, uint64_t hash) {
+
+	uint32_t index = hash >> (64 - STATS_HLL_BITS);
+	uint64_t rest = hash << STATS_HLL_BITS;
+	uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - STATS_HLL_BITS + 1;
+
+	if (rank > regs[index])
+		regs[index] = rank;
+}
+
+STATIC double hll_estimate(const uint8_t *regs) {
+
+	double m = STATS_HLL_SIZE, sum = 0, estimate;
+	int i, zeros = 0;
+
+	for (i = 0; i < STATS_HLL_SIZE; i++) {
+		sum += ldexp(1.0, -regs[i]);
+		zeros += !regs[i];
+	}
+	estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+	// Linear counting is more accurate while many registers are still empty
+	if (estimate <= 2.5 * m && zeros)
+		estimate = m * log(m / zeros);
+
+	return estimate;
+}
+
+/** Unique speakers in the last days, merging the daily sketches register by register */
+static double unique_speakers(const struct channel_stats *ch, uint32_t today, uint32_t days) {
+
+	uint8_t merged[STATS_HLL_SIZE] = { 0 };
+	int d, i;
+
+	for (d = 0; d < STATS_DAYS; d++) {
+		if (ch->day[d] > today || today - ch->day[d] >= days)
+			continue;
+		for (i = 0; i < STATS_HLL_SIZE; i++)
+			if (ch->hll[d][i] > merged[i])
+				merged[i] = ch->hll[d][i];
+	}
+	return hll_estimate(merged);
+}
+
+/** Add one to every row and return the new estimate, the smallest of the counters */
+static uint32_t cms_add(struct channel_stats *ch, uint64_t hash) {
+
+	uint32_t h1 = hash, h2 = hash >> 32, min = UINT32_MAX, *counter;
+	int i;
+
+	for (i = 0; i < STATS_CMS_DEPTH; i++) {
+		counter = &ch->cms[i][(h1 + i * h2) & (STATS_CMS_WIDTH - 1)];
+		if (*counter < UINT32_MAX)
+			(*counter)++;
+		if (*counter < min)
+			min = *counter;
+	}
+	return min;
+}
+
+static void heap_swap(struct stats_talker *a, struct stats_talker *b) {
+
+	struct stats_talker temp = *a;
+
+	*a = *b;
+	*b = temp;
+}
+
+static void sift_down(struct channel_stats *ch, uint32_t i) {
+
+	uint32_t smallest, child;
+
+	for (;;) {
+		smallest = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2 && child < ch->top_count; child++)
+			if (ch->top[child].count < ch->top[smallest].count)
+				smallest = child;
+		if (smallest == i)
+			return;
+
+		heap_swap(&ch->top[i], &ch->top[smallest]);
+		i = smallest;
+	}
+}
+
+static void sift_up(struct channel_stats *ch, uint32_t i) {
+
+	for (; i > 0 && ch->top[i].count < ch->top[(i - 1) / 2].count; i = (i - 1) / 2)
+		heap_swap(&ch->top[i], &ch->top[(i - 1) / 2]);
+}
+
+/** Keep the nick in the heap if it's estimate is among the biggest */
+STATIC void top_update(struct channel_stats *ch, const char *nick, uint32_t estimate) {
+
+	uint32_t i;
+
+	for (i = 0; i < ch->top_count; i++) {
+		if (!strcasecmp(ch->top[i].nick, nick)) {
+			ch->top[i].count = estimate; // Estimates only grow, so it can only move down
+			sift_down(ch, i);
+			return;
+		}
+	}
+	if (ch->top_count < STATS_TOP) {
+		i = ch->top_count++;
+		snprintf(ch->top[i].nick, NICKLEN, "%s", nick);
+		ch->top[i].count = estimate;
+		sift_up(ch, i);
+	} else if (estimate > ch->top[0].count) {
+		snprintf(ch->top[0].nick, NICKLEN, "%s", nick);
+		ch->top[0].count = estimate;
+		sift_down(ch, 0);
+	}
+}
+
+/** Halve every count once a week. The heap keeps it's order */
+static void decay(struct channel_stats *ch, uint32_t week) {
+
+	uint32_t i, j;
+
+	if (ch->week == week)
+		return;
+
+	for (i = 0; i < STATS_CMS_DEPTH; i++)
+		for (j = 0; j < STATS_CMS_WIDTH; j++)
+			ch->cms[i][j] >>= 1;
+	for (i = 0; i < ch->top_count; i++)
+		ch->top[i].count >>= 1;
+
+	ch->week = week;
+}
+
+static struct channel_stats *find_channel(const char *channel, size_t len) {
+
+	int i;
+
+	for (i = 0; i < MAXCHANS && *state.channels[i].channel; i++)
+		if (strlen(state.channels[i].channel) == len && !strncasecmp(state.channels[i].channel, channel, len))
+			return &state.channels[i];
+
+	return NULL;
+}
+
+/** Write a snapshot from a child process, so the main loop never waits for the disk */
+static void checkpoint(void) {
+
+	char tmp[PATHLEN + 8];
+	pid_t pid;
+	int fd;
+
+	pid = fork();
+	switch (pid) {
+	case 0:
+		snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0 || write(fd, &state, sizeof(state)) != sizeof(state) || fsync(fd) < 0 || rename(tmp, stats_path) < 0)
+			perror(tmp);
+		_exit(EXIT_SUCCESS);
+	case -1:
+		perror("fork");
+		metrics_fork(false);
+		break;
+	default:
+		metrics_fork(true);
+	}
+}
+
+void chanstats_init(const char *path) {
+
+	int fd;
+
+	memcpy(state.magic, STATS_MAGIC, sizeof(state.magic));
+	state.size = sizeof(state);
+	state.last_checkpoint = time(NULL);
+
+	snprintf(stats_path, PATHLEN, "%s", path);
+	if (!*path)
+		return;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (read(fd, &state, sizeof(state)) != sizeof(state) || memcmp(state.magic, STATS_MAGIC, sizeof(state.magic))
+			|| state.size != sizeof(state)) {
+		fprintf(stderr, "%s: not a checkpoint of this version, starting over\n", path);
+		memset(&state, 0, sizeof(state));
+		memcpy(state.magic, STATS_MAGIC, sizeof(state.magic));
+		state.size = sizeof(state);
+	}
+	state.last_checkpoint = time(NULL);
+	close(fd);
+}
+
+void chanstats_message(const char *channel, size_t channel_len, const char *nick) {
+
+	struct channel_stats *ch;
+	uint32_t now = time(NULL), hour = now / 3600, day = now / 86400;
+	uint64_t hash;
+	int i, slot;
+
+	ch = find_channel(channel, channel_len);
+	if (!ch) {
+		for (i = 0; i < MAXCHANS && *state.channels[i].channel; i++);
+		if (i == MAXCHANS || channel_len >= CHANLEN)
+			return;
+
+		ch = &state.channels[i];
+		memcpy(ch->channel, channel, channel_len);
+		ch->week = day / 7;
+	}
+	slot = hour % STATS_HOURS;
+	if (ch->hour[slot] != hour) {
+		ch->hour[slot] = hour;
+		ch->messages[slot] = 0;
+	}
+	ch->messages[slot]++;
+
+	hash = nick_hash(nick);
+	slot = day % STATS_DAYS;
+	if (ch->day[slot] != day) {
+		ch->day[slot] = day;
+		memset(ch->hll[slot], 0, STATS_HLL_SIZE);
+	}
+	hll_add(ch->hll[slot], hash);
+
+	decay(ch, day / 7);
+	top_update(ch, nick, cms_add(ch, hash));
+
+	if (*stats_path && now - state.last_checkpoint >= STATS_CHECKPOINT) {
+		state.last_checkpoint = now;
+		checkpoint();
+	}
+}
+
+static int compare_talkers(const void *a, const void *b) {
+
+	const struct stats_talker *x = a, *y = b;
+
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+void chanstats_print(Irc server, const char *target, const char *channel) {
+
+	struct channel_stats *ch;
+	struct stats_talker top[STATS_TOP];
+	uint32_t now = time(NULL), hour = now / 3600, day = now / 86400, last_hour = 0, day_total = 0, i;
+	char line[IRCLEN / 2];
+	int len = 0;
+
+	ch = find_channel(channel, strlen(channel));
+	if (!ch) {
+		send_message(server, target, "no messages seen on %s yet", channel);
+		return;
+	}
+	for (i = 0; i < STATS_HOURS; i++) {
+		if (ch->hour[i] > hour || hour - ch->hour[i] >= STATS_HOURS)
+			continue;
+		day_total += ch->messages[i];
+		if (ch->hour[i] == hour)
+			last_hour = ch->messages[i];
+	}
+	send_message(server, target, "%s: %u msgs this hour, %.1f/h over 24h. Unique speakers: %.0f today, %.0f this week, %.0f this month",
+		ch->channel, last_hour, day_total / 24.0, unique_speakers(ch, day, 1), unique_speakers(ch, day, 7),
+		unique_speakers(ch, day, 30));
+
+	memcpy(top, ch->top, sizeof(top));
+	qsort(top, ch->top_count, sizeof(*top), compare_talkers);
+	for (i = 0; i < ch->top_count && len < (int) sizeof(line); i++)
+		len += snprintf(line + len, sizeof(line) - len, "%s%s (~%u)", i ? ", " : "", top[i].nick, top[i].count);
+	if (len)
+		send_message(server, target, "top talkers: %s", line);
+}
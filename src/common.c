@@ -2,8 +2,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <getopt.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <curl/curl.h>
@@ -11,6 +14,23 @@
 #include "irc.h"
 #include "mpd.h"
 #include "twitter.h"
+#include "curl.h"
+#include "metrics.h"
+#include "trace.h"
+#include "recorder.h"
+#include "archive.h"
+#include "seen.h"
+#include "quotes.h"
+#include "chanstats.h"
+#include "triggers.h"
+#include "flood.h"
+#include "remind.h"
+#include "paste.h"
+#include "probes.h"
+#include "alloc_profile.h"
+#include "profiler.h"
+#include "capture.h"
+#include "log.h"
 #include "common.h"
 
 pid_t main_pid;
@@ -20,13 +40,43 @@ struct mpd_status_type *mpd_status;
 
 void initialize(int argc, char *argv[]) {
 
-	main_pid = getpid(); // store our process id to help exit_msg function exit appropriately
+	const struct option options[] = {
+		{ "profile",      optional_argument, NULL, 'p' },
+		{ "replay",       required_argument, NULL, 'r' },
+		{ "replay-speed", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *replay_file = NULL;
+	double replay_speed = 0;
+	int opt, profile_hz = 0;
 
+	main_pid = getpid(); // store our process id to help exit_msg function exit appropriately
+	alloc_profile_init(); // No-op unless built with ALLOC_PROFILE=1
+
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'p':
+			profile_hz = optarg ? atoi(optarg) : PROFILE_DEFAULT_HZ;
+			if (profile_hz <= 0)
+				exit_msg("Invalid profiling rate: %s", optarg);
+			break;
+		case 'r':
+			replay_file = optarg;
+			break;
+		case 's':
+			replay_speed = atof(optarg);
+			if (replay_speed < 0)
+				exit_msg("Invalid replay speed: %s", optarg);
+			break;
+		default:
+			exit_msg("Usage: %s [--profile[=hz]] [--replay file [--replay-speed x]] [path_to_config]", argv[0]);
+		}
+	}
 	// Accept config path as an optional argument
-	if (argc > 2)
-		exit_msg("Usage: %s [path_to_config]\n", argv[0]);
-	else if (argc == 2)
-		parse_config(root, argv[1]);
+	if (argc - optind > 1)
+		exit_msg("Usage: %s [--profile[=hz]] [--replay file [--replay-speed x]] [path_to_config]", argv[0]);
+	else if (argc - optind == 1)
+		parse_config(root, argv[optind]);
 	else
 		parse_config(root, DEFAULT_CONFIG_NAME);
 
@@ -37,6 +87,27 @@ void initialize(int argc, char *argv[]) {
 	signal(SIGCHLD, SIG_IGN); // Make child processes not leave zombies behind when killed
 	signal(SIGPIPE, SIG_IGN); // Handle writing on closed sockets on our own
 	curl_global_init(CURL_GLOBAL_ALL); // Initialize curl library
+	http_fixtures_init(cfg.http_fixture_url, cfg.http_record_dir, cfg.http_replay_dir);
+	metrics_init();
+	trace_init(cfg.trace_file);
+	log_init(cfg.log_file, cfg.log_level, atol(cfg.log_max_kb), atol(cfg.log_max_hours)); // Before any handlers that the writer must not inherit
+	recorder_init(cfg.flight_recorder_file); // Replaces the SIGCHLD disposition with a handler that records child exits
+	profiler_init(profile_hz);
+
+	// A replay never captures, it would append to the file it's reading. It doesn't touch the live bot's stores either:
+	// replayed messages would be archived twice, deliver it's memos and add quotes and reminders
+	if (replay_file)
+		replay_init(replay_file, replay_speed);
+	else {
+		capture_init(cfg.capture_file);
+		archive_init(cfg.archive_dir);
+		seen_init(cfg.seen_file);
+		quotes_init(cfg.quote_file); // Seeded from fail_quotes the first time
+		reminders_init(cfg.remind_file);
+	}
+	chanstats_init(replay_file ? "" : cfg.stats_file); // In memory only during a replay
+	triggers_init(cfg.triggers);
+	flood_init(cfg.flood_action);
 
 	mpd_status = mmap(NULL, sizeof(*mpd_status), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 	if (mpd_status == MAP_FAILED)
@@ -73,9 +144,14 @@ void exit_msg(const char *format, ...) {
 	va_list args;
 
 	va_start(args, format);
-	sprintf(buf, "%s\n", format);
-	vfprintf(stderr, buf, args);
+	vsnprintf(buf, EXIT_MSGLEN, format, args);
 	va_end(args);
+	fprintf(stderr, "%s\n", buf);
+	log_msg(LVL_ERROR, LOG_SYSTEM, "%s", buf);
+
+	// Keep the events that led here
+	recorder_text(REC_EXIT, 0, buf);
+	recorder_dump(buf);
 
 	if (getpid() == main_pid)
 		exit(EXIT_FAILURE);
@@ -91,6 +167,7 @@ void *_malloc_w(size_t size, const char *caller, const char *file, int line) {
 	if (!buffer)
 		ALLOC_ERROR(caller, file, line); // We exit here
 
+	alloc_profile_record(buffer, size, caller, file, line);
 	return buffer;
 }
 
@@ -102,6 +179,7 @@ void *_calloc_w(size_t size, const char *caller, const char *file, int line) {
 	if (!buffer)
 		ALLOC_ERROR(caller, file, line);
 
+	alloc_profile_record(buffer, size, caller, file, line);
 	return buffer;
 }
 
@@ -109,10 +187,12 @@ void *_realloc_w(void *buf, size_t size, const char *caller, const char *file, i
 
 	void *buffer;
 
+	alloc_profile_forget(buf); // We exit if realloc fails, so the old block can't be used anymore
 	buffer = realloc(buf, size);
 	if (!buffer)
 		ALLOC_ERROR(caller, file, line);
 
+	alloc_profile_record(buffer, size, caller, file, line);
 	return buffer;
 }
 
@@ -170,21 +250,77 @@ int get_int(const char *num, int max) {
 		return converted_num;
 }
 
+/**
+ * Print the program's output line by line. Past paste_lines() lines the rest is held back and the whole output is
+ * pasted, the link goes out after the lines already printed
+ */
+static void relay_output(Irc server, const char *target, FILE *prog) {
+
+	char line[LINELEN], *text = NULL, *url = NULL, *rest, *next;
+	size_t len, text_len = 0, text_size = 0, held = 0, paste_len = 0;
+	int count = 0, pasted = 0, max = paste_lines();
+
+	while (fgets(line, LINELEN, prog)) {
+		len = strlen(line);
+		if (len <= 2) // Only print if line is not empty
+			continue;
+
+		if (!max || ++count <= max)
+			send_message(server, target, "%s", line); // The %s is needed to avoid interpeting format specifiers in output
+		if (!max)
+			continue;
+
+		// Keep everything in case pasting fails, the paste gets the whole lines that fit in PASTE_MAXLEN
+		if (text_len + len > text_size) {
+			text_size = text_size ? text_size * 2 : 4096;
+			text = REALLOC_W(text, text_size);
+		}
+		memcpy(text + text_len, line, len);
+		text_len += len;
+		if (count == max)
+			held = text_len;
+		if (text_len <= PASTE_MAXLEN && pasted == count - 1) {
+			paste_len = text_len;
+			pasted = count;
+		}
+	}
+	if (count > max && pasted > max)
+		url = paste_store(text, paste_len);
+
+	if (url)
+		send_message(server, target, "... %d more lines%s: %s", pasted - max, pasted < count ? ", output cut" : "", url);
+	else if (count > max) { // Send the rest like short output
+		for (rest = text + held; rest < text + text_len; rest = next) {
+			next = memchr(rest, '\n', text + text_len - rest);
+			next = next ? next + 1 : text + text_len;
+			send_message(server, target, "%.*s", (int) (next - rest), rest);
+		}
+	}
+	free(url);
+	free(text);
+}
+
 void print_cmd_output(Irc server, const char *target, char *cmd_args[]) {
 
 	FILE *prog;
-	char line[LINELEN];
-	size_t len;
 	int fd[2];
+	uint64_t start;
+	pid_t pid;
+
+	if (cfg.replay) // Programs like ping and mpc reach the network or the music player
+		return;
 
 	if (pipe(fd) < 0) {
 		perror("pipe");
 		return;
 	}
 
-	switch (fork()) {
+	pid = fork();
+	PROBE1(fork, pid);
+	switch (pid) {
 	case -1:
 		perror("fork");
+		metrics_fork(false);
 		return;
 	case 0:
 		close(fd[0]); // Close reading end of the socket
@@ -195,48 +331,44 @@ void print_cmd_output(Irc server, const char *target, char *cmd_args[]) {
 			return;
 		}
 		close(fd[1]); // We don't need this anymore
+		PROBE1(exec, cmd_args[0]);
 		execvp(cmd_args[0], cmd_args);
 
 		perror("exec failed"); // Exec functions return only on error
 		return;
 	}
 	close(fd[1]); // Close writting end
+	metrics_fork(true);
+	start = monotonic_usec();
 
 	// Open socket as FILE stream since we need to print in lines anyway
 	prog = fdopen(fd[0], "r");
 	if (!prog)
 		return;
 
-	// Print line by line the output of the program
-	while (fgets(line, LINELEN, prog)) {
-		len = strlen(line);
-		if (len > 2) { // Only print if line is not empty
-			line[len] = '\0'; // Remove last newline char (\n) since we add it inside send_message()
-			send_message(server, target, "%s", line); // The %s is needed to avoid interpeting format specifiers in output
-		}
-	}
+	relay_output(server, target, prog);
 	fclose(prog);
+	trace_span(TRACE_SUBPROCESS, start, monotonic_usec() - start, cmd_args[0]);
 }
 
 void print_cmd_output_unsafe(Irc server, const char *target, const char *cmd) {
 
 	FILE *prog;
-	char line[LINELEN];
-	int len;
+	uint64_t start;
+
+	if (cfg.replay)
+		return;
 
 	// Open the program with arguments specified
+	start = monotonic_usec();
+	PROBE1(exec, cmd);
 	prog = popen(cmd, "r");
 	if (!prog)
 		return;
 
-	while (fgets(line, LINELEN, prog)) {
-		len = strlen(line);
-		if (len > 2) {
-			line[len] = '\0';
-			send_message(server, target, "%s", line);
-		}
-	}
+	relay_output(server, target, prog);
 	pclose(prog);
+	trace_span(TRACE_SUBPROCESS, start, monotonic_usec() - start, cmd);
 }
 
 STATIC size_t read_file(char **buf, const char *filename) {
@@ -330,6 +462,28 @@ void parse_config(yajl_val root, const char *config_file) {
 	CFG_GET(cfg, root, mpd_port);
 	CFG_GET(cfg, root, mpd_database);
 	CFG_GET(cfg, root, mpd_random_file);
+	CFG_GET(cfg, root, http_port);
+	CFG_GET(cfg, root, trace_file);
+	CFG_GET(cfg, root, flight_recorder_file);
+	CFG_GET(cfg, root, capture_file);
+	CFG_GET(cfg, root, log_file);
+	CFG_GET(cfg, root, log_level);
+	CFG_GET(cfg, root, log_max_kb);
+	CFG_GET(cfg, root, log_max_hours);
+	CFG_GET(cfg, root, archive_dir);
+	CFG_GET(cfg, root, seen_file);
+	CFG_GET(cfg, root, quote_file);
+	CFG_GET(cfg, root, stats_file);
+	CFG_GET(cfg, root, flood_action);
+	CFG_GET(cfg, root, remind_file);
+	CFG_GET(cfg, root, webhook_secret);
+	CFG_GET(cfg, root, shortener_file);
+	CFG_GET(cfg, root, shortener_url);
+	CFG_GET(cfg, root, paste_url);
+	CFG_GET(cfg, root, paste_lines);
+	CFG_GET(cfg, root, http_fixture_url);
+	CFG_GET(cfg, root, http_record_dir);
+	CFG_GET(cfg, root, http_replay_dir);
 	CFG_GET(cfg, root, twitter_profile_url);
 	CFG_GET(cfg, root, oauth_consumer_key);
 	CFG_GET(cfg, root, oauth_consumer_secret);
@@ -362,6 +516,16 @@ void parse_config(yajl_val root, const char *config_file) {
 	cfg.channels_set = get_json_array(root, "channels", cfg.channels, MAXCHANS);
 	cfg.quote_count = get_json_array(root, "fail_quotes", cfg.quotes, MAXQUOTES);
 	cfg.access_list_count = get_json_array(root, "twitter_access_list", cfg.twitter_access_list, MAXLIST);
+	cfg.watch_repo_count = get_json_array(root, "watch_repos", cfg.watch_repos, MAXWATCH);
+	cfg.feed_count = get_json_array(root, "feeds", cfg.feeds, MAXFEEDS);
+
+	cfg.triggers = yajl_tree_get(root, CFG("triggers"), yajl_t_array);
+	if (!cfg.triggers)
+		exit_msg("triggers: missing / wrong type");
+
+	cfg.webhook_channels = yajl_tree_get(root, CFG("webhook_channels"), yajl_t_object);
+	if (!cfg.webhook_channels)
+		exit_msg("webhook_channels: missing / wrong type");
 }
 
 char *iso8859_7_to_utf8(char *iso) {
@@ -391,3 +555,65 @@ char *iso8859_7_to_utf8(char *iso) {
 	utf[y] = '\0';
 	return (char *) utf;
 }
+
+uint64_t monotonic_usec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void format_duration(char *buf, size_t len, long secs) {
+
+	if (secs < 0)
+		secs = 0;
+	if (secs >= 86400)
+		snprintf(buf, len, "%ldd %ldh", secs / 86400, secs % 86400 / 3600);
+	else if (secs >= 3600)
+		snprintf(buf, len, "%ldh %ldm", secs / 3600, secs % 3600 / 60);
+	else if (secs >= 60)
+		snprintf(buf, len, "%ldm", secs / 60);
+	else
+		snprintf(buf, len, "%lds", secs);
+}
+
+uint32_t probe_remove(void *table, uint32_t i, uint32_t mask, bool (*home)(void *table, uint32_t slot, uint32_t *home),
+		void (*move)(void *table, uint32_t from, uint32_t to)) {
+
+	uint32_t j = i, h;
+
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!home(table, j, &h))
+			break;
+
+		// Move it if the hole lies between it's home slot and where it sits now
+		if (((j - h) & mask) < ((j - i) & mask))
+			continue;
+
+		move(table, j, i);
+		i = j;
+	}
+	return i;
+}
+
+void shared_mutex_init(pthread_mutex_t *mutex) {
+
+	pthread_mutexattr_t attr;
+
+	if (pthread_mutexattr_init(&attr) || pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)
+			|| pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) || pthread_mutex_init(mutex, &attr))
+		exit_msg("Cannot initialize a shared mutex");
+
+	pthread_mutexattr_destroy(&attr);
+}
+
+bool shared_mutex_lock(pthread_mutex_t *mutex) {
+
+	if (pthread_mutex_lock(mutex) != EOWNERDEAD)
+		return true;
+
+	pthread_mutex_consistent(mutex);
+	return false;
+}
@@ -1,22 +1,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <ctype.h>
 #include <curl/curl.h>
 #include "curl.h"
+#include "metrics.h"
+#include "trace.h"
+#include "probes.h"
+#include "alloc_profile.h"
 #include "common.h"
 
+static const char *fixture_url, *record_dir, *replay_dir;
 
 STATIC size_t curl_write_memory(char *data, size_t size, size_t elements, void *membuf) {
 
 	Mem_buffer *mem = membuf;
 	size_t total_size = size * elements;
+	char *buffer;
 
 	// Our function will be called as many times as needed by curl_easy_perform to complete the operation
 	// So we increase the size of our buffer each time to accommodate for it (and null char)
-	mem->buffer = realloc(mem->buffer, mem->size + total_size + 1);
-	if (!mem->buffer)
+	alloc_profile_forget(mem->buffer);
+	buffer = realloc(mem->buffer, mem->size + total_size + 1);
+	if (!buffer)
 		return 0;
 
+	alloc_profile_record(buffer, mem->size + total_size + 1, __func__, __FILE__, __LINE__);
+	mem->buffer = buffer;
+
 	// Our mem_buffer struct keeps the current size so far, so we begin writting to the end of it each time
 	memcpy(&(mem->buffer[mem->size]), data, total_size);
 	mem->size += total_size;
@@ -27,88 +39,290 @@ STATIC size_t curl_write_memory(char *data, size_t size, size_t elements, void *
 	return total_size;
 }
 
-char *shorten_url(const char *long_url) {
+static void trace_transfer(CURL *curl, uint64_t start) {
+
+	double dns = 0, connect = 0, tls = 0, request = 0, first_byte = 0, total = 0;
+	char *url = NULL, host[TRACE_NAMELEN] = "";
+
+	// All times are seconds since the start of the transfer. Phases that did not happen are reported as 0
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &dns);
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect);
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &tls);
+	curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME, &request);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &first_byte);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+	curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+
+	// Keep only the host part of the URL
+	if (url && strstr(url, "://")) {
+		url = strstr(url, "://") + 3;
+		snprintf(host, TRACE_NAMELEN, "%.*s", (int) strcspn(url, "/:?"), url);
+	}
+
+	// Failed transfers stop at some phase. Attribute the rest of the time to it, so timeouts are visible
+	if (!connect)
+		connect = total;
+	else if (!first_byte && request)
+		first_byte = total;
+
+	trace_span(TRACE_DNS, start, dns * 1e6, host);
+	if (connect > dns)
+		trace_span(TRACE_CONNECT, start + dns * 1e6, (connect - dns) * 1e6, host);
+	if (tls > connect)
+		trace_span(TRACE_TLS, start + connect * 1e6, (tls - connect) * 1e6, host);
+	if (request && first_byte > request)
+		trace_span(TRACE_HTTP_WAIT, start + request * 1e6, (first_byte - request) * 1e6, host);
+	if (first_byte && total > first_byte)
+		trace_span(TRACE_HTTP_BODY, start + first_byte * 1e6, (total - first_byte) * 1e6, host);
+}
+
+void http_fixtures_init(const char *base_url, const char *record, const char *replay) {
+
+	fixture_url = base_url && *base_url ? base_url : NULL;
+	record_dir  = record && *record ? record : NULL;
+	replay_dir  = replay && *replay ? replay : NULL;
+}
+
+STATIC void fixture_name(char *name, size_t len, const char *url, const char *post) {
+
+	uint32_t hash = 2166136261u; // FNV-1a
+	const char *p;
+	size_t i = 0;
+
+	for (p = url; *p; p++)
+		hash = (hash ^ (unsigned char) *p) * 16777619;
+	for (p = post ? post : ""; *p; p++)
+		hash = (hash ^ (unsigned char) *p) * 16777619;
+
+	// Readable part: host, path and query without the scheme. The hash tells apart long URLs and POST bodies
+	p = strstr(url, "://") ? strstr(url, "://") + 3 : url;
+	for (; *p && i < len - 16 && i < 96; p++)
+		name[i++] = isalnum((unsigned char) *p) || *p == '.' || *p == '-' ? *p : '_';
+
+	snprintf(name + i, len - i, "-%08x.http", hash);
+}
+
+/** Fill mem from a fixture file: the HTTP status on the first line, then the body */
+static CURLcode replay_fixture(const char *url, const char *post, Mem_buffer *mem) {
+
+	char name[128], path[PATHLEN + sizeof(name)], chunk[4096];
+	FILE *file;
+	size_t n;
+
+	fixture_name(name, sizeof(name), url, post);
+	snprintf(path, sizeof(path), "%s/%s", replay_dir, name);
+	file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "No fixture for %s: %s\n", url, path);
+		return CURLE_COULDNT_CONNECT;
+	}
+	if (fscanf(file, "%ld\n", &mem->status) != 1)
+		mem->status = 0;
+
+	while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		curl_write_memory(chunk, 1, n, mem);
+
+	fclose(file);
+	metrics_http(mem->status, mem->size);
+	return CURLE_OK;
+}
+
+static void record_fixture(const char *url, const char *post, const Mem_buffer *mem) {
+
+	char name[128], path[PATHLEN + sizeof(name)];
+	FILE *file;
+
+	fixture_name(name, sizeof(name), url, post);
+	snprintf(path, sizeof(path), "%s/%s", record_dir, name);
+	file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		return;
+	}
+	fprintf(file, "%ld\n", mem->status);
+	if (mem->buffer)
+		fwrite(mem->buffer, 1, mem->size, file);
+	fclose(file);
+}
+
+CURLcode perform_transfer(CURL *curl, const char *url, const char *post, Mem_buffer *mem) {
 
-	CURL *curl;
 	CURLcode code;
-	char url_formatted[URLLEN], *short_url = NULL;
-	Mem_buffer mem = { NULL, 0 };
-	struct curl_slist *headers = NULL;
+	curl_off_t bytes = 0;
+	long status = 0;
+	uint64_t start;
+	char redirected[PATHLEN + URLLEN];
 
-	// Set the Content-type and url format as required by Google API for the POST request
-	headers = curl_slist_append(headers, "Content-Type: application/json");
-	snprintf(url_formatted, URLLEN, "{\"longUrl\": \"%s\"}", long_url);
+	if (cfg.replay) // Replayed commands must not reach the network
+		return CURLE_COULDNT_CONNECT;
 
-	curl = curl_easy_init();
-	if (!curl)
-		goto cleanup;
+	if (replay_dir)
+		return replay_fixture(url, post, mem);
 
-#ifdef TEST
-	curl_easy_setopt(curl, CURLOPT_URL, TESTDIR "url-shorten.txt");
-#else
-	curl_easy_setopt(curl, CURLOPT_URL, "https://www.googleapis.com/urlshortener/v1/url"); // Set API url
-#endif
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, url_formatted); // Send the formatted POST
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Allow redirects
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 3L);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers); // Use our modified header
+	// The fixture server gets the original host and path as it's path
+	if (fixture_url) {
+		snprintf(redirected, sizeof(redirected), "%s/%s", fixture_url, strstr(url, "://") ? strstr(url, "://") + 3 : url);
+		curl_easy_setopt(curl, CURLOPT_URL, redirected);
+	} else
+		curl_easy_setopt(curl, CURLOPT_URL, url);
+
+	if (post)
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
 
-	// By default curl_easy_perform output the result in stdout, so we provide own function and data struct,
-	// so we can save the output in a string
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""); // Accept every compression curl can decode
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_memory);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &mem);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, mem);
 
-	code = curl_easy_perform(curl); // Do the job!
-	if (code != CURLE_OK || !mem.buffer) {
-		fprintf(stderr, "Error: %s\n", curl_easy_strerror(code));
-		goto cleanup;
+	start = monotonic_usec();
+	PROBE1(http_start, curl);
+	code = curl_easy_perform(curl);
+	if (code == CURLE_OK) {
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+		curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+		if (!status) // file:// and other protocols without status codes
+			status = 200;
 	}
-	// Find the short url in the reply and null terminate it
-	short_url = strstr(mem.buffer, "http");
-	if (!null_terminate(short_url, '"'))
-		goto cleanup;
+	PROBE4(http_end, curl, (int) code, status, (long) bytes);
+	metrics_http(status, bytes);
+	trace_transfer(curl, start);
 
-	// short_url must be freed to avoid memory leak
-	short_url = strndup(short_url, ADDRLEN);
+	mem->status = status;
+	if (record_dir && code == CURLE_OK)
+		record_fixture(url, post, mem);
+
+	return code;
+}
+
+STATIC size_t validator_header(char *data, size_t size, size_t elements, void *state) {
+
+	Http_validators *validators = state;
+	size_t total_size = size * elements;
+	char line[ETAGLEN + 32], *value;
+
+	snprintf(line, sizeof(line), "%.*s", (int) (total_size < sizeof(line) ? total_size : sizeof(line) - 1), data);
+	line[strcspn(line, "\r\n")] = '\0';
+	if (starts_with(line, "HTTP/")) { // Every reply of a redirect has it's own headers
+		memset(validators, 0, sizeof(*validators));
+		return total_size;
+	}
+	value = strchr(line, ':');
+	if (!value)
+		return total_size;
+
+	value += 1 + strspn(value + 1, " ");
+	if (starts_case_with(line, "ETag:"))
+		snprintf(validators->etag, ETAGLEN, "%s", value);
+	else if (starts_case_with(line, "Last-Modified:"))
+		snprintf(validators->last_modified, DATELEN, "%s", value);
+
+	return total_size;
+}
+
+CURLcode fetch_if_modified(const char *url, Http_validators *validators, Mem_buffer *mem) {
+
+	CURL *curl;
+	CURLcode code = CURLE_FAILED_INIT;
+	Http_validators received = { "", "" };
+	struct curl_slist *headers = NULL;
+	char header[ETAGLEN + 32];
+
+	curl = curl_easy_init();
+	if (!curl)
+		return code;
+
+	if (*validators->etag) {
+		snprintf(header, sizeof(header), "If-None-Match: %s", validators->etag);
+		headers = curl_slist_append(headers, header);
+	}
+	if (*validators->last_modified) {
+		snprintf(header, sizeof(header), "If-Modified-Since: %s", validators->last_modified);
+		headers = curl_slist_append(headers, header);
+	}
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, "irc-bot");
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, validator_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &received);
+
+	code = perform_transfer(curl, url, NULL, mem);
+	if (code == CURLE_OK && mem->status == 200)
+		*validators = received;
 
-cleanup:
-	free(mem.buffer);
 	curl_slist_free_all(headers);
 	curl_easy_cleanup(curl);
-	return short_url;
+	return code;
+}
+
+STATIC size_t github_header(char *data, size_t size, size_t elements, void *state) {
+
+	Github_poll *poll = state;
+	size_t total_size = size * elements;
+	char line[ETAGLEN + 32], *value;
+
+	snprintf(line, sizeof(line), "%.*s", (int) (total_size < sizeof(line) ? total_size : sizeof(line) - 1), data);
+	line[strcspn(line, "\r\n")] = '\0';
+	value = strchr(line, ':');
+	if (!value)
+		return total_size;
+
+	value += 1 + strspn(value + 1, " ");
+	if (starts_case_with(line, "ETag:"))
+		snprintf(poll->etag, ETAGLEN, "%s", value);
+	else if (starts_case_with(line, "X-RateLimit-Remaining:"))
+		poll->remaining = strtol(value, NULL, 10);
+	else if (starts_case_with(line, "X-RateLimit-Reset:"))
+		poll->reset = strtol(value, NULL, 10);
+	else if (starts_case_with(line, "Retry-After:"))
+		poll->retry_after = strtol(value, NULL, 10);
+
+	return total_size;
 }
 
 Github *fetch_github_commits(yajl_val *root, const char *repo, int *commit_count) {
 
+	return poll_github_commits(root, repo, commit_count, NULL);
+}
+
+Github *poll_github_commits(yajl_val *root, const char *repo, int *commit_count, Github_poll *poll) {
+
 	CURL *curl;
 	CURLcode code;
 	yajl_val val;
 	Github *commits = NULL;
-	Mem_buffer mem = { NULL, 0 };
-	char API_URL[URLLEN], errbuf[1024];
-	int i;
+	Mem_buffer mem = { NULL, 0, 0 };
+	struct curl_slist *headers = NULL;
+	char API_URL[URLLEN], errbuf[1024], if_none_match[ETAGLEN + 16];
+	int i, count = *commit_count;
 
+	*commit_count = 0;
 	curl = curl_easy_init();
 	if (!curl)
 		goto cleanup;
 
 	// Use per_page field to limit json reply to the amount of commits specified
-	snprintf(API_URL, URLLEN, "https://api.github.com/repos/%s/commits?per_page=%d", repo, *commit_count);
+	snprintf(API_URL, URLLEN, "https://api.github.com/repos/%s/commits?per_page=%d", repo, count);
 
-#ifdef TEST
-	curl_easy_setopt(curl, CURLOPT_URL, TESTDIR "github.json");
-#else
-	curl_easy_setopt(curl, CURLOPT_URL, API_URL);
-#endif
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, "irc-bot"); // Github requires a user-agent
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 8L);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_memory);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &mem);
-
-	code = curl_easy_perform(curl);
-	if (code != CURLE_OK || !mem.buffer) {
-		fprintf(stderr, "Error: %s\n", curl_easy_strerror(code));
+	if (poll) {
+		poll->remaining = -1;
+		poll->retry_after = 0;
+		if (*poll->etag) {
+			snprintf(if_none_match, sizeof(if_none_match), "If-None-Match: %s", poll->etag);
+			headers = curl_slist_append(headers, if_none_match);
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+		}
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, github_header);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, poll);
+	}
+	code = perform_transfer(curl, API_URL, NULL, &mem);
+	if (poll)
+		poll->status = mem.status;
+	if (code != CURLE_OK || !mem.buffer || mem.status == NOT_MODIFIED) {
+		if (code != CURLE_OK)
+			fprintf(stderr, "Error: %s\n", curl_easy_strerror(code));
 		goto cleanup;
 	}
 	*root = yajl_tree_parse(mem.buffer, errbuf, sizeof(errbuf));
@@ -117,6 +331,7 @@ Github *fetch_github_commits(yajl_val *root, const char *repo, int *commit_count
 		goto cleanup;
 	}
 	free(mem.buffer);
+	mem.buffer = NULL;
 	*commit_count = YAJL_IS_ARRAY(*root) ? YAJL_GET_ARRAY(*root)->len : 0;
 	commits = MALLOC_W(*commit_count * sizeof(*commits));
 
@@ -148,6 +363,8 @@ Github *fetch_github_commits(yajl_val *root, const char *repo, int *commit_count
 	}
 
 cleanup:
+	free(mem.buffer);
+	curl_slist_free_all(headers);
 	curl_easy_cleanup(curl);
 	return commits;
 }
@@ -156,7 +373,7 @@ char *get_url_title(const char *url) {
 
 	CURL *curl;
 	CURLcode code;
-	Mem_buffer mem = { NULL, 0 };
+	Mem_buffer mem = { NULL, 0, 0 };
 	char *temp, *url_title = NULL;
 	bool iso = false;
 
@@ -164,17 +381,10 @@ char *get_url_title(const char *url) {
 	if (!curl)
 		goto cleanup;
 
-#ifdef TEST
-	curl_easy_setopt(curl, CURLOPT_URL, TESTDIR "url-title.txt");
-#else
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-#endif
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 3L);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_memory);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &mem);
 
-	code = curl_easy_perform(curl);
+	code = perform_transfer(curl, url, NULL, &mem);
 	if (code != CURLE_OK || !mem.buffer) {
 		fprintf(stderr, "Error: %s\n", curl_easy_strerror(code));
 		goto cleanup;
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "feed.h"
+#include "xml.h"
+#include "bot.h"
+#include "curl.h"
+#include "metrics.h"
+#include "common.h"
+
+static struct feed *feeds;
+static int feed_count;
+
+static uint64_t id_hash(const char *id) {
+
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+
+	for (; *id; id++)
+		hash = (hash ^ (unsigned char) *id) * 1099511628211ULL;
+
+	return hash ? hash : 1;
+}
+
+STATIC bool feed_seen(const struct feed *feed, uint64_t hash) {
+
+	int i;
+
+	for (i = 0; i < FEED_SEEN; i++)
+		if (feed->seen[i] == hash)
+			return true;
+
+	return false;
+}
+
+static void trim(char *s, size_t len) {
+
+	while (len && s[len - 1] == ' ')
+		s[--len] = '\0';
+}
+
+/**
+ * Read the entries newer than the newest seen one
+ *
+ * @param entries  The first max new entries, newest first
+ * @param ids      Hashes of every new entry, up to FEED_SEEN
+ * @returns        The number of new entries
+ */
+STATIC int parse_feed(struct feed *feed, const char *xml, size_t len, struct feed_entry *entries, int max, uint64_t *ids) {
+
+	struct xml_reader reader = { xml, xml + len };
+	struct xml_token token;
+	struct feed_entry entry;
+	char *field = NULL, rel[16];
+	const char *field_tag = NULL, *id;
+	size_t field_size = 0, field_len = 0, field_tag_len = 0;
+	bool in_entry = false;
+	int n = 0;
+
+	memset(&entry, 0, sizeof(entry));
+	while (xml_next(&reader, &token)) {
+		switch (token.type) {
+		case XML_OPEN:
+			if (xml_is(&token, "item") || xml_is(&token, "entry")) {
+				memset(&entry, 0, sizeof(entry));
+				in_entry = true;
+				break;
+			}
+			if (field) // Markup inside a field, like xhtml titles
+				break;
+
+			if (in_entry && xml_is(&token, "link") && !*entry.link) {
+				// Atom links are attributes: <link rel="alternate" href="..."/>, RSS ones are text
+				if (xml_attr(&token, "rel", rel, sizeof(rel)) && !streq(rel, "alternate"))
+					break;
+				if (xml_attr(&token, "href", entry.link, URLLEN) || token.empty)
+					break;
+
+				field = entry.link;
+				field_size = URLLEN;
+			} else if (token.empty)
+				break;
+			else if (in_entry && xml_is(&token, "title")) {
+				field = entry.title;
+				field_size = FEED_TEXTLEN;
+			} else if (in_entry && (xml_is(&token, "guid") || xml_is(&token, "id"))) {
+				field = entry.id;
+				field_size = URLLEN;
+			} else if (!in_entry && xml_is(&token, "title") && !*feed->title) {
+				field = feed->title;
+				field_size = FEED_TITLELEN;
+			} else
+				break;
+
+			field_tag = token.name;
+			field_tag_len = token.name_len;
+			field_len = 0;
+			break;
+		case XML_TEXT:
+			if (field)
+				xml_append_text(field, field_size, &field_len, token.data, token.data_len, token.cdata);
+			break;
+		case XML_CLOSE:
+			if (field && token.name_len == field_tag_len && !memcmp(token.name, field_tag, field_tag_len)) {
+				trim(field, field_len);
+				field = NULL;
+				field_tag = NULL;
+			}
+			if (!in_entry || !(xml_is(&token, "item") || xml_is(&token, "entry")))
+				break;
+
+			in_entry = false;
+			id = *entry.id ? entry.id : *entry.link ? entry.link : entry.title;
+			if (feed_seen(feed, id_hash(id)))
+				return n; // The rest is older
+
+			ids[n] = id_hash(id);
+			if (n < max)
+				entries[n] = entry;
+			if (++n == FEED_SEEN)
+				return n;
+			break;
+		case XML_EOF:
+			break;
+		}
+	}
+	return n;
+}
+
+static void fetch_feed(Irc server, struct feed *feed) {
+
+	Mem_buffer mem = { NULL, 0, 0 };
+	struct feed_entry entries[FEED_ANNOUNCE];
+	uint64_t ids[FEED_SEEN];
+	const char *name;
+	int i, n;
+
+	if (fetch_if_modified(feed->url, &feed->validators, &mem) != CURLE_OK
+			|| (mem.status != 200 && mem.status != NOT_MODIFIED)) {
+		feed->failures++;
+		free(mem.buffer);
+		return;
+	}
+	feed->failures = 0;
+	if (mem.status == 200 && mem.buffer) {
+		n = parse_feed(feed, mem.buffer, mem.size, entries, FEED_ANNOUNCE, ids);
+		name = *feed->title ? feed->title : feed->url;
+		if (feed->primed) {
+			// Oldest first
+			for (i = (n < FEED_ANNOUNCE ? n : FEED_ANNOUNCE) - 1; i >= 0; i--)
+				send_message(server, default_channel(server), PURPLE "[%s]" RESET " %s" BLUE " - %s", name,
+					entries[i].title, entries[i].link);
+			if (n > FEED_ANNOUNCE)
+				send_message(server, default_channel(server), PURPLE "[%s]" RESET " and %d more", name, n - FEED_ANNOUNCE);
+		}
+		// The newest go in last so they are the last to be forgotten
+		for (i = n - 1; i >= 0; i--)
+			feed->seen[feed->seen_next++ % FEED_SEEN] = ids[i];
+		feed->primed = true;
+	}
+	free(mem.buffer);
+}
+
+/** Seconds until the feed is fetched again, doubled for every failure in a row */
+STATIC long feed_interval(const struct feed *feed) {
+
+	long interval = FEED_INTERVAL;
+	uint32_t i;
+
+	for (i = 0; i < feed->failures && interval < FEED_MAX_INTERVAL; i++)
+		interval *= 2;
+
+	return interval < FEED_MAX_INTERVAL ? interval : FEED_MAX_INTERVAL;
+}
+
+static void feed_reader(Irc server, pid_t parent) {
+
+	struct timespec gap;
+	struct feed *next;
+	time_t now;
+	long spacing = FEED_INTERVAL * 1000L / feed_count; // Milliseconds between two fetches
+	int i;
+
+	gap.tv_sec = spacing / 1000;
+	gap.tv_nsec = spacing % 1000 * 1000000L;
+	for (;;) {
+		next = &feeds[0];
+		for (i = 1; i < feed_count; i++)
+			if (feeds[i].next_fetch < next->next_fetch)
+				next = &feeds[i];
+
+		// The bot going away is what stops us
+		while ((now = time(NULL)) < next->next_fetch) {
+			if (getppid() != parent)
+				_exit(EXIT_SUCCESS);
+			sleep(1);
+		}
+		if (getppid() != parent)
+			_exit(EXIT_SUCCESS);
+
+		fetch_feed(server, next);
+		next->next_fetch = now + feed_interval(next);
+
+		// Feeds that came due together still go one at a time
+		nanosleep(&gap, NULL);
+	}
+}
+
+void feeds_start(Irc server) {
+
+	pid_t parent = getpid();
+	time_t now = time(NULL);
+	int i;
+
+	if (cfg.replay || !cfg.feed_count)
+		return;
+
+	feed_count = cfg.feed_count;
+	feeds = CALLOC_W(feed_count * sizeof(*feeds));
+	for (i = 0; i < feed_count; i++) {
+		feeds[i].url = cfg.feeds[i];
+		feeds[i].next_fetch = now + (long) i * FEED_INTERVAL / feed_count; // Evenly spread from the start
+	}
+	switch (fork()) {
+	case 0:
+		feed_reader(server, parent);
+		break;
+	case -1:
+		perror("feed: fork");
+		metrics_fork(false);
+		break;
+	default:
+		metrics_fork(true);
+	}
+}
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "irc.h"
+#include "flood.h"
+#include "metrics.h"
+#include "log.h"
+#include "common.h"
+
+enum flood_action {
+	ACTION_NONE,
+	ACTION_IGNORE,
+	ACTION_KICK,
+	ACTION_MODERATE
+};
+
+static const char *reasons[] = {
+	[FLOOD_NONE]      = "",
+	[FLOOD_NICK_RATE] = "too many messages",
+	[FLOOD_HOST_RATE] = "too many messages from one host",
+	[FLOOD_REPEAT]    = "repeating",
+	[FLOOD_SPAM]      = "spam",
+	[FLOOD_HIGHLIGHT] = "mass highlight"
+};
+
+static enum flood_action action;
+static struct flood_tracker trackers[FLOOD_SETS][FLOOD_WAYS];
+static struct flood_channel channels[MAXCHANS];
+
+/** Lowercased FNV-1a. The salt keeps nicks and hosts apart, 0 is never returned */
+static uint32_t key_hash(const char *s, size_t len, char salt) {
+
+	uint32_t hash = (2166136261u ^ (unsigned char) salt) * 16777619;
+	size_t i;
+
+	for (i = 0; i < len && s[i]; i++)
+		hash = (hash ^ (unsigned char) (s[i] >= 'A' && s[i] <= 'Z' ? s[i] | 0x20 : s[i])) * 16777619;
+
+	return hash ? hash : 1;
+}
+
+static uint32_t nick_key(const char *nick, size_t len) {
+
+	return key_hash(nick, len, 'n');
+}
+
+static uint64_t mix(uint64_t h) {
+
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/**
+ * SimHash of the character trigrams, close texts get close fingerprints. Case is ignored, runs of spaces count as one
+ * and digits are all the same, spammers often number their lines
+ */
+STATIC uint64_t simhash(const char *text) {
+
+	int votes[64] = { 0 }, bit;
+	uint32_t gram = 0, n = 0;
+	uint64_t h, print = 0;
+	unsigned char c, last = ' ';
+
+	for (; *text; text++) {
+		c = *text >= 'A' && *text <= 'Z' ? *text | 0x20 : *text;
+		if (c >= '0' && c <= '9')
+			c = '0';
+		if (c == ' ' && last == ' ')
+			continue;
+
+		last = c;
+		gram = (gram << 8 | c) & 0xffffff;
+		if (++n < 3)
+			continue;
+
+		h = mix(gram);
+		for (bit = 0; bit < 64; bit++)
+			votes[bit] += (h >> bit) & 1 ? 1 : -1;
+	}
+	for (bit = 0; bit < 64; bit++)
+		if (votes[bit] > 0)
+			print |= 1ULL << bit;
+
+	return print;
+}
+
+static bool near_duplicate(uint64_t a, uint64_t b) {
+
+	return __builtin_popcountll(a ^ b) <= FLOOD_NEAR_BITS;
+}
+
+/** Count an event and return the events in the last FLOOD_WINDOW seconds */
+static uint32_t window_add(struct flood_window *w, uint32_t now) {
+
+	uint32_t elapsed = now - w->start;
+
+	if (elapsed >= 2 * FLOOD_WINDOW) {
+		w->start = now;
+		w->count = w->previous = 0;
+	} else if (elapsed >= FLOOD_WINDOW) {
+		w->start += FLOOD_WINDOW;
+		w->previous = w->count;
+		w->count = 0;
+	}
+	if (w->count < UINT16_MAX)
+		w->count++;
+
+	return w->count + w->previous * (FLOOD_WINDOW - (now - w->start)) / FLOOD_WINDOW;
+}
+
+/** Find the key's tracker, or replace the one in it's set that's been quiet the longest */
+static struct flood_tracker *get_tracker(uint32_t key, uint32_t now) {
+
+	struct flood_tracker *set = trackers[key % FLOOD_SETS], *stalest = &set[0];
+	uint32_t last, stalest_last = UINT32_MAX;
+	int i;
+
+	for (i = 0; i < FLOOD_WAYS; i++) {
+		if (set[i].key == key)
+			return &set[i];
+
+		last = set[i].ignored_until > now ? now : set[i].rate.start;
+		if (last < stalest_last) {
+			stalest = &set[i];
+			stalest_last = last;
+		}
+	}
+	memset(stalest, 0, sizeof(*stalest));
+	stalest->key = key;
+	return stalest;
+}
+
+static struct flood_channel *get_channel(const char *channel, size_t len) {
+
+	int i;
+
+	for (i = 0; i < MAXCHANS && *channels[i].channel; i++)
+		if (strlen(channels[i].channel) == len && !strncasecmp(channels[i].channel, channel, len))
+			return &channels[i];
+
+	if (i == MAXCHANS || len >= CHANLEN)
+		return NULL;
+
+	memcpy(channels[i].channel, channel, len);
+	return &channels[i];
+}
+
+/** @returns  the member's slot or the empty slot where it would go */
+static uint32_t member_slot(const struct flood_channel *ch, uint32_t key) {
+
+	uint32_t i;
+
+	for (i = key & (FLOOD_MEMBERS - 1); ch->members[i] && ch->members[i] != key; i = (i + 1) & (FLOOD_MEMBERS - 1));
+	return i;
+}
+
+static void member_add(struct flood_channel *ch, uint32_t key) {
+
+	uint32_t i = member_slot(ch, key);
+
+	// Keep the probe runs short. Members that don't fit can't be highlighted
+	if (ch->members[i] || ch->member_count >= FLOOD_MEMBERS * 3 / 4)
+		return;
+
+	ch->members[i] = key;
+	ch->member_count++;
+}
+
+static bool member_home(void *table, uint32_t slot, uint32_t *home) {
+
+	struct flood_channel *ch = table;
+
+	if (!ch->members[slot])
+		return false;
+
+	*home = ch->members[slot] & (FLOOD_MEMBERS - 1);
+	return true;
+}
+
+static void member_move(void *table, uint32_t from, uint32_t to) {
+
+	struct flood_channel *ch = table;
+
+	ch->members[to] = ch->members[from];
+}
+
+/** Empty the member's slot and shift back the rest of it's probe run */
+static bool member_remove(struct flood_channel *ch, uint32_t key) {
+
+	uint32_t i = member_slot(ch, key);
+
+	if (!ch->members[i])
+		return false;
+
+	i = probe_remove(ch, i, FLOOD_MEMBERS - 1, member_home, member_move);
+	ch->members[i] = 0;
+	ch->member_count--;
+	return true;
+}
+
+static bool is_nick_char(char c) {
+
+	return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || (c >= '0' && c <= '9') || (c && strchr("[]\\`_^{|}-", c));
+}
+
+/** Different member nicks named in the text, up to FLOOD_HIGHLIGHTS. Saying one nick many times isn't a mass highlight */
+static int count_highlights(const struct flood_channel *ch, const char *text) {
+
+	uint32_t named[FLOOD_HIGHLIGHTS], key;
+	size_t len;
+	int i, count = 0;
+
+	while (*text && count < FLOOD_HIGHLIGHTS) {
+		for (len = 0; is_nick_char(text[len]); len++);
+		if (len && len < NICKLEN && ch->members[member_slot(ch, key = nick_key(text, len))]) {
+			for (i = 0; i < count && named[i] != key; i++);
+			if (i == count)
+				named[count++] = key;
+		}
+		text += len ? len : 1;
+	}
+	return count;
+}
+
+/** Remember a nick seen from a host and return how many different ones it had lately */
+static int clone_add(struct flood_tracker *host, uint32_t key, uint32_t now) {
+
+	int i, oldest = 0, count = 0;
+
+	for (i = 0; i < FLOOD_CLONES && host->clones[i] != key; i++)
+		if (host->clone_times[i] < host->clone_times[oldest])
+			oldest = i;
+	if (i == FLOOD_CLONES)
+		host->clones[i = oldest] = key;
+	host->clone_times[i] = now;
+
+	for (i = 0; i < FLOOD_CLONES; i++)
+		if (host->clone_times[i] && now - host->clone_times[i] < 2 * FLOOD_WINDOW)
+			count++;
+	return count;
+}
+
+/** Something to advertise: a link or a channel */
+static bool advertises(const char *text) {
+
+	const char *hash;
+
+	if (strstr(text, "://") || strstr(text, "www."))
+		return true;
+
+	for (hash = strchr(text, '#'); hash; hash = strchr(hash + 1, '#'))
+		if ((hash == text || hash[-1] == ' ') && is_nick_char(hash[1]))
+			return true;
+	return false;
+}
+
+/** Near duplicates of print among the recent ones, with the number of them from other nicks */
+static int count_near(const uint64_t *prints, const uint32_t *times, const uint32_t *nicks, int size, uint64_t print,
+		uint32_t nick, uint32_t now, int *others) {
+
+	int i, count = 0;
+
+	for (i = 0; i < size; i++) {
+		if (!times[i] || now - times[i] >= FLOOD_REPEAT_WINDOW || !near_duplicate(prints[i], print))
+			continue;
+		count++;
+		if (nicks && nicks[i] != nick)
+			(*others)++;
+	}
+	return count;
+}
+
+STATIC enum flood_reason flood_check(const char *target, size_t target_len, const char *nick, const char *host,
+		const char *text, uint32_t now) {
+
+	enum flood_reason reason = FLOOD_NONE;
+	struct flood_tracker *t;
+	struct flood_channel *ch = NULL;
+	uint32_t key = nick_key(nick, NICKLEN);
+	uint64_t print = 0;
+	bool compare = strlen(text) >= FLOOD_MINLEN;
+	int near, clones, others = 0;
+
+	if (*host) {
+		t = get_tracker(key_hash(host, strlen(host), 'h'), now);
+		clones = clone_add(t, key, now);
+		if (window_add(&t->rate, now) > FLOOD_HOST_MESSAGES && clones >= FLOOD_CLONES)
+			reason = FLOOD_HOST_RATE;
+	}
+	t = get_tracker(key, now);
+	if (window_add(&t->rate, now) > FLOOD_NICK_MESSAGES)
+		reason = FLOOD_NICK_RATE;
+
+	if (compare) {
+		print = simhash(text);
+		near = count_near(t->prints, t->print_times, NULL, FLOOD_PRINTS, print, key, now, &others);
+		if (near + 1 >= FLOOD_REPEATS)
+			reason = FLOOD_REPEAT;
+
+		t->prints[t->next_print] = print;
+		t->print_times[t->next_print] = now;
+		t->next_print = (t->next_print + 1) % FLOOD_PRINTS;
+	}
+	if (*target == '#')
+		ch = get_channel(target, target_len);
+	if (!ch)
+		return reason;
+
+	member_add(ch, key);
+	if (compare) {
+		// The same ad from different nicks. People say "happy new year" together too
+		near = count_near(ch->prints, ch->print_times, ch->print_nicks, FLOOD_RECENT, print, key, now, &others);
+		if (near + 1 >= FLOOD_REPEATS && others && advertises(text))
+			reason = FLOOD_SPAM;
+
+		ch->prints[ch->next_print] = print;
+		ch->print_times[ch->next_print] = now;
+		ch->print_nicks[ch->next_print] = key;
+		ch->next_print = (ch->next_print + 1) % FLOOD_RECENT;
+	}
+	if (count_highlights(ch, text) >= FLOOD_HIGHLIGHTS)
+		reason = FLOOD_HIGHLIGHT;
+
+	return reason;
+}
+
+/** Set +m now and -m later from a child process. Nobody can speak to trigger it while the channel is moderated */
+static void moderate(Irc server, struct flood_channel *ch, uint32_t now) {
+
+	pid_t pid;
+
+	if (ch->moderated_until > now)
+		return;
+
+	ch->moderated_until = now + FLOOD_MODERATE;
+	set_mode(server, ch->channel, "+m");
+	pid = fork();
+	switch (pid) {
+	case 0:
+		sleep(FLOOD_MODERATE);
+		set_mode(server, ch->channel, "-m");
+		_exit(EXIT_SUCCESS);
+	case -1:
+		perror("fork");
+		metrics_fork(false);
+		break;
+	default:
+		metrics_fork(true);
+	}
+}
+
+void flood_init(const char *name) {
+
+	if (!*name)
+		action = ACTION_NONE;
+	else if (streq(name, "ignore"))
+		action = ACTION_IGNORE;
+	else if (streq(name, "kick"))
+		action = ACTION_KICK;
+	else if (streq(name, "moderate"))
+		action = ACTION_MODERATE;
+	else
+		exit_msg("flood_action: %s is not ignore, kick, moderate or empty", name);
+}
+
+bool flood_message(Irc server, const char *target, size_t target_len, const char *nick, const char *host, const char *text) {
+
+	struct flood_tracker *t;
+	struct flood_channel *ch;
+	enum flood_reason reason;
+	uint32_t now = time(NULL);
+
+	if (action == ACTION_NONE)
+		return false;
+
+	reason = flood_check(target, target_len, nick, host, text, now);
+	t = get_tracker(nick_key(nick, NICKLEN), now);
+	if (!reason)
+		return t->ignored_until > now;
+
+	// Act once, then ignore the nick until it's quiet for a while
+	if (t->ignored_until <= now) {
+		metrics_count(FLOODS, 1);
+		log_msg(LVL_WARN, LOG_DISPATCH, "%s flooding %.*s: %s", nick, (int) target_len, target, reasons[reason]);
+
+		// Others may share the host, it's commands are ignored but nobody is kicked for it
+		ch = *target == '#' && reason != FLOOD_HOST_RATE ? get_channel(target, target_len) : NULL;
+		if (ch && action == ACTION_KICK)
+			kick_user(server, ch->channel, nick, reasons[reason]);
+		else if (ch && action == ACTION_MODERATE)
+			moderate(server, ch, now);
+	}
+	t->ignored_until = now + FLOOD_IGNORE;
+	return true;
+}
+
+void flood_join(Irc server, const char *channel, const char *nick, const char *host) {
+
+	struct flood_channel *ch;
+	struct flood_tracker *t;
+	uint32_t now = time(NULL);
+
+	if (action == ACTION_NONE)
+		return;
+
+	if (*host) {
+		t = get_tracker(key_hash(host, strlen(host), 'h'), now);
+		window_add(&t->rate, now);
+		clone_add(t, nick_key(nick, NICKLEN), now);
+	}
+	ch = get_channel(channel, strlen(channel));
+	if (!ch)
+		return;
+
+	member_add(ch, nick_key(nick, NICKLEN));
+	if (window_add(&ch->joins, now) > FLOOD_JOINS && action == ACTION_MODERATE && ch->moderated_until <= now) {
+		metrics_count(FLOODS, 1);
+		log_msg(LVL_WARN, LOG_DISPATCH, "join flood on %s", ch->channel);
+		moderate(server, ch, now);
+	}
+}
+
+void flood_part(const char *channel, const char *nick) {
+
+	int i;
+
+	for (i = 0; i < MAXCHANS && *channels[i].channel; i++)
+		if (!channel || !strcasecmp(channels[i].channel, channel))
+			member_remove(&channels[i], nick_key(nick, NICKLEN));
+}
+
+void flood_nick(const char *old_nick, const char *new_nick) {
+
+	int i;
+
+	for (i = 0; i < MAXCHANS && *channels[i].channel; i++)
+		if (member_remove(&channels[i], nick_key(old_nick, NICKLEN)))
+			member_add(&channels[i], nick_key(new_nick, NICKLEN));
+}
+
+void flood_names(char *reply) {
+
+	struct flood_channel *ch;
+	char *channel, *nicks, *nick;
+
+	if (action == ACTION_NONE)
+		return;
+
+	channel = strchr(reply, '#');
+	nicks = channel ? strstr(channel, " :") : NULL;
+	if (!nicks)
+		return;
+
+	ch = get_channel(channel, nicks - channel);
+	if (!ch)
+		return;
+
+	for (nick = strtok(nicks + 2, " "); nick; nick = strtok(NULL, " "))
+		member_add(ch, nick_key(nick + strspn(nick, "~&@%+"), NICKLEN));
+}
@@ -1,6 +1,6 @@
 /* ANSI-C code produced by gperf version 3.0.4 */
 /* Command-line: gperf include/gperf-input.txt  */
-/* Computed positions: -k'1-2' */
+/* Computed positions: -k'1,3,$' */
 
 #if !((' ' == 32) && ('!' == 33) && ('"' == 34) && ('#' == 35) \
       && ('%' == 37) && ('&' == 38) && ('\'' == 39) && ('(' == 40) \
@@ -36,12 +36,12 @@
 struct function_list;
 #include <string.h>
 
-#define TOTAL_KEYWORDS 24
+#define TOTAL_KEYWORDS 39
 #define MIN_WORD_LENGTH 3
 #define MAX_WORD_LENGTH 10
-#define MIN_HASH_VALUE 3
-#define MAX_HASH_VALUE 39
-/* maximum key range = 37, duplicates = 0 */
+#define MIN_HASH_VALUE 9
+#define MAX_HASH_VALUE 105
+/* maximum key range = 97, duplicates = 0 */
 
 #ifndef GPERF_DOWNCASE
 #define GPERF_DOWNCASE 1
@@ -100,34 +100,34 @@ hash (register const char *str, register unsigned int len)
 {
   static const unsigned char asso_values[] =
     {
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40,  5, 40, 10,  5, 10,
-       3, 15, 20, 10, 40, 25,  5, 15, 10,  0,
-       0, 40,  0, 15,  0,  0, 40,  0, 40, 40,
-      40, 40, 40, 40, 40, 40, 40,  5, 40, 10,
-       5, 10,  3, 15, 20, 10, 40, 25,  5, 15,
-      10,  0,  0, 40,  0, 15,  0,  0, 40,  0,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
-      40, 40, 40, 40, 40, 40
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106,   4,  30,  44,  19,   7,
+       15,  44,  19,  39,  23,   9,  27,  35,  20,  16,
+        7,  23,  32,   0,  15,  44, 106, 106,  40,  34,
+      106, 106, 106, 106, 106, 106, 106,   4,  30,  44,
+       19,   7,  15,  44,  19,  39,  23,   9,  27,  35,
+       20,  16,   7,  23,  32,   0,  15,  44, 106, 106,
+       40,  34, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106, 106, 106, 106, 106,
+      106, 106, 106, 106, 106, 106
     };
-  return len + asso_values[(unsigned char)str[1]] + asso_values[(unsigned char)str[0]];
+  return len + asso_values[(unsigned char)str[len - 1]] + asso_values[(unsigned char)str[2]] + asso_values[(unsigned char)str[0]];
 }
 
 #ifdef __GNUC__
@@ -141,54 +141,84 @@ function_lookup (register const char *str, register unsigned int len)
 {
   static const struct function_list wordlist[] =
     {
-#line 21 "include/gperf-input.txt"
-      {"url", url},
-#line 34 "include/gperf-input.txt"
-      {"roll", roll},
+#line 43 "include/gperf-input.txt"
+      {"stats", stats},
+#line 39 "include/gperf-input.txt"
+      {"seek", seek},
+#line 28 "include/gperf-input.txt"
+      {"dns", dns},
 #line 37 "include/gperf-input.txt"
-      {"tweet", tweet},
-#line 26 "include/gperf-input.txt"
-      {"uptime", uptime},
-#line 15 "include/gperf-input.txt"
-      {"PRIVMSG", irc_privmsg},
-#line 27 "include/gperf-input.txt"
-      {"play", play},
-#line 25 "include/gperf-input.txt"
-      {"traceroute", traceroute},
+      {"stop", stop},
+#line 46 "include/gperf-input.txt"
+      {"seen", seen},
 #line 32 "include/gperf-input.txt"
-      {"random", random_mode},
-#line 19 "include/gperf-input.txt"
-      {"fail", bot_fail},
-#line 28 "include/gperf-input.txt"
       {"playlist", playlist},
-#line 23 "include/gperf-input.txt"
-      {"ping", ping},
+#line 29 "include/gperf-input.txt"
+      {"traceroute", traceroute},
+#line 49 "include/gperf-input.txt"
+      {"addquote", addquote},
+#line 40 "include/gperf-input.txt"
+      {"announce", announce},
+#line 41 "include/gperf-input.txt"
+      {"tweet", tweet},
+#line 45 "include/gperf-input.txt"
+      {"last", archive_last},
 #line 16 "include/gperf-input.txt"
       {"NOTICE", irc_notice},
-#line 30 "include/gperf-input.txt"
-      {"current", current},
-#line 24 "include/gperf-input.txt"
-      {"dns", dns},
-#line 33 "include/gperf-input.txt"
-      {"stop", stop},
-#line 20 "include/gperf-input.txt"
-      {"mumble", mumble},
-#line 36 "include/gperf-input.txt"
-      {"announce", announce},
 #line 31 "include/gperf-input.txt"
-      {"next", next},
-#line 38 "include/gperf-input.txt"
-      {"marker", marker},
-#line 35 "include/gperf-input.txt"
-      {"seek", seek},
+      {"play", play},
+#line 48 "include/gperf-input.txt"
+      {"quote", quote},
 #line 22 "include/gperf-input.txt"
-      {"github", github},
-#line 18 "include/gperf-input.txt"
       {"help", help},
-#line 29 "include/gperf-input.txt"
+#line 19 "include/gperf-input.txt"
+      {"PART", irc_part},
+#line 33 "include/gperf-input.txt"
       {"history", history},
+#line 44 "include/gperf-input.txt"
+      {"grep", archive_grep},
 #line 17 "include/gperf-input.txt"
-      {"KICK", irc_kick}
+      {"KICK", irc_kick},
+#line 30 "include/gperf-input.txt"
+      {"uptime", uptime},
+#line 47 "include/gperf-input.txt"
+      {"tell", tell},
+#line 51 "include/gperf-input.txt"
+      {"trending", trending},
+#line 27 "include/gperf-input.txt"
+      {"ping", ping},
+#line 53 "include/gperf-input.txt"
+      {"reminders", reminders},
+#line 21 "include/gperf-input.txt"
+      {"NICK", irc_nick},
+#line 35 "include/gperf-input.txt"
+      {"next", next},
+#line 20 "include/gperf-input.txt"
+      {"QUIT", irc_quit},
+#line 50 "include/gperf-input.txt"
+      {"grab", grab},
+#line 24 "include/gperf-input.txt"
+      {"mumble", mumble},
+#line 23 "include/gperf-input.txt"
+      {"fail", bot_fail},
+#line 18 "include/gperf-input.txt"
+      {"JOIN", irc_join},
+#line 38 "include/gperf-input.txt"
+      {"roll", roll},
+#line 52 "include/gperf-input.txt"
+      {"remind", remind},
+#line 36 "include/gperf-input.txt"
+      {"random", random_mode},
+#line 26 "include/gperf-input.txt"
+      {"github", github},
+#line 15 "include/gperf-input.txt"
+      {"PRIVMSG", irc_privmsg},
+#line 34 "include/gperf-input.txt"
+      {"current", current},
+#line 25 "include/gperf-input.txt"
+      {"url", url},
+#line 42 "include/gperf-input.txt"
+      {"marker", marker}
     };
 
   if (len <= MAX_WORD_LENGTH && len >= MIN_WORD_LENGTH)
@@ -199,176 +229,281 @@ function_lookup (register const char *str, register unsigned int len)
         {
           register const struct function_list *resword;
 
-          switch (key - 3)
+          switch (key - 9)
             {
               case 0:
-                if (len == 3)
+                if (len == 5)
                   {
                     resword = &wordlist[0];
                     goto compare;
                   }
                 break;
-              case 1:
+              case 11:
                 if (len == 4)
                   {
                     resword = &wordlist[1];
                     goto compare;
                   }
                 break;
-              case 2:
-                if (len == 5)
+              case 13:
+                if (len == 3)
                   {
                     resword = &wordlist[2];
                     goto compare;
                   }
                 break;
-              case 3:
-                if (len == 6)
+              case 18:
+                if (len == 4)
                   {
                     resword = &wordlist[3];
                     goto compare;
                   }
                 break;
-              case 4:
-                if (len == 7)
+              case 22:
+                if (len == 4)
                   {
                     resword = &wordlist[4];
                     goto compare;
                   }
                 break;
-              case 6:
-                if (len == 4)
+              case 25:
+                if (len == 8)
                   {
                     resword = &wordlist[5];
                     goto compare;
                   }
                 break;
-              case 7:
+              case 27:
                 if (len == 10)
                   {
                     resword = &wordlist[6];
                     goto compare;
                   }
                 break;
-              case 8:
-                if (len == 6)
+              case 29:
+                if (len == 8)
                   {
                     resword = &wordlist[7];
                     goto compare;
                   }
                 break;
-              case 9:
-                if (len == 4)
+              case 30:
+                if (len == 8)
                   {
                     resword = &wordlist[8];
                     goto compare;
                   }
                 break;
-              case 10:
-                if (len == 8)
+              case 33:
+                if (len == 5)
                   {
                     resword = &wordlist[9];
                     goto compare;
                   }
                 break;
-              case 11:
+              case 37:
                 if (len == 4)
                   {
                     resword = &wordlist[10];
                     goto compare;
                   }
                 break;
-              case 13:
+              case 39:
                 if (len == 6)
                   {
                     resword = &wordlist[11];
                     goto compare;
                   }
                 break;
-              case 14:
-                if (len == 7)
+              case 40:
+                if (len == 4)
                   {
                     resword = &wordlist[12];
                     goto compare;
                   }
                 break;
-              case 15:
-                if (len == 3)
+              case 42:
+                if (len == 5)
                   {
                     resword = &wordlist[13];
                     goto compare;
                   }
                 break;
-              case 16:
+              case 48:
                 if (len == 4)
                   {
                     resword = &wordlist[14];
                     goto compare;
                   }
                 break;
-              case 18:
-                if (len == 6)
+              case 49:
+                if (len == 4)
                   {
                     resword = &wordlist[15];
                     goto compare;
                   }
                 break;
-              case 20:
-                if (len == 8)
+              case 51:
+                if (len == 7)
                   {
                     resword = &wordlist[16];
                     goto compare;
                   }
                 break;
-              case 21:
+              case 53:
                 if (len == 4)
                   {
                     resword = &wordlist[17];
                     goto compare;
                   }
                 break;
-              case 23:
-                if (len == 6)
+              case 57:
+                if (len == 4)
                   {
                     resword = &wordlist[18];
                     goto compare;
                   }
                 break;
-              case 26:
-                if (len == 4)
+              case 63:
+                if (len == 6)
                   {
                     resword = &wordlist[19];
                     goto compare;
                   }
                 break;
-              case 28:
-                if (len == 6)
+              case 64:
+                if (len == 4)
                   {
                     resword = &wordlist[20];
                     goto compare;
                   }
                 break;
-              case 31:
-                if (len == 4)
+              case 65:
+                if (len == 8)
                   {
                     resword = &wordlist[21];
                     goto compare;
                   }
                 break;
-              case 34:
-                if (len == 7)
+              case 66:
+                if (len == 4)
                   {
                     resword = &wordlist[22];
                     goto compare;
                   }
                 break;
-              case 36:
-                if (len == 4)
+              case 67:
+                if (len == 9)
                   {
                     resword = &wordlist[23];
                     goto compare;
                   }
                 break;
+              case 68:
+                if (len == 4)
+                  {
+                    resword = &wordlist[24];
+                    goto compare;
+                  }
+                break;
+              case 70:
+                if (len == 4)
+                  {
+                    resword = &wordlist[25];
+                    goto compare;
+                  }
+                break;
+              case 72:
+                if (len == 4)
+                  {
+                    resword = &wordlist[26];
+                    goto compare;
+                  }
+                break;
+              case 73:
+                if (len == 4)
+                  {
+                    resword = &wordlist[27];
+                    goto compare;
+                  }
+                break;
+              case 74:
+                if (len == 6)
+                  {
+                    resword = &wordlist[28];
+                    goto compare;
+                  }
+                break;
+              case 76:
+                if (len == 4)
+                  {
+                    resword = &wordlist[29];
+                    goto compare;
+                  }
+                break;
+              case 77:
+                if (len == 4)
+                  {
+                    resword = &wordlist[30];
+                    goto compare;
+                  }
+                break;
+              case 81:
+                if (len == 4)
+                  {
+                    resword = &wordlist[31];
+                    goto compare;
+                  }
+                break;
+              case 83:
+                if (len == 6)
+                  {
+                    resword = &wordlist[32];
+                    goto compare;
+                  }
+                break;
+              case 84:
+                if (len == 6)
+                  {
+                    resword = &wordlist[33];
+                    goto compare;
+                  }
+                break;
+              case 86:
+                if (len == 6)
+                  {
+                    resword = &wordlist[34];
+                    goto compare;
+                  }
+                break;
+              case 88:
+                if (len == 7)
+                  {
+                    resword = &wordlist[35];
+                    goto compare;
+                  }
+                break;
+              case 89:
+                if (len == 7)
+                  {
+                    resword = &wordlist[36];
+                    goto compare;
+                  }
+                break;
+              case 92:
+                if (len == 3)
+                  {
+                    resword = &wordlist[37];
+                    goto compare;
+                  }
+                break;
+              case 96:
+                if (len == 6)
+                  {
+                    resword = &wordlist[38];
+                    goto compare;
+                  }
+                break;
             }
           return 0;
         compare:
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include "socket.h"
+#include "httpd.h"
+#include "common.h"
+
+struct http_client {
+	char *buf;
+	size_t len;
+	size_t header_len; //!< Zero until the empty line that ends the headers is received
+	size_t content_length;
+	char *out;
+	size_t out_len;
+	size_t out_sent;
+	time_t started;
+};
+
+static struct http_client clients[HTTPD_MAXCLIENTS];
+
+static struct {
+	const char *method;
+	const char *prefix;
+	http_handler handler;
+} routes[HTTPD_MAXROUTES];
+
+static int route_count;
+
+int httpd_listen(const char *port) {
+
+	int listenfd;
+
+	if (!port || !*port)
+		return -1;
+
+	listenfd = sock_listen(LOCALHOST, port);
+	if (listenfd < 0)
+		fprintf(stderr, "Could not listen on HTTP port %s\n", port);
+
+	return listenfd;
+}
+
+bool httpd_route(const char *method, const char *prefix, http_handler handler) {
+
+	if (route_count == HTTPD_MAXROUTES) {
+		fprintf(stderr, "HTTP route limit reached (%d)\n", HTTPD_MAXROUTES);
+		return false;
+	}
+	routes[route_count].method  = method;
+	routes[route_count].prefix  = prefix;
+	routes[route_count].handler = handler;
+	route_count++;
+
+	return true;
+}
+
+const char *http_header(const Http_request *req, const char *name) {
+
+	int i;
+
+	for (i = 0; i < req->header_count; i++)
+		if (!strcasecmp(req->headers[i][0], name))
+			return req->headers[i][1];
+
+	return NULL;
+}
+
+void http_reply(Http_response *res, int status, const char *content_type, const char *format, ...) {
+
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vasprintf(&res->body, format, args);
+	va_end(args);
+
+	if (len < 0) {
+		res->body = NULL;
+		len = 0;
+	}
+	res->status = status;
+	res->content_type = content_type;
+	res->len = len;
+}
+
+static const char *status_text(int status) {
+
+	switch (status) {
+	case 200: return "OK";
+	case 202: return "Accepted";
+	case 204: return "No Content";
+	case 301: return "Moved Permanently";
+	case 302: return "Found";
+	case 400: return "Bad Request";
+	case 401: return "Unauthorized";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 408: return "Request Timeout";
+	case 410: return "Gone";
+	case 413: return "Payload Too Large";
+	case 431: return "Request Header Fields Too Large";
+	case 503: return "Service Unavailable";
+	default:  return "Internal Server Error";
+	}
+}
+
+static void close_client(struct pollfd *pfd, struct http_client *client) {
+
+	close(pfd->fd);
+	pfd->fd = -1;
+	pfd->events = POLLIN;
+
+	free(client->buf);
+	free(client->out);
+	memset(client, 0, sizeof(*client));
+}
+
+static void queue_response(struct pollfd *pfd, struct http_client *client, Http_response *res) {
+
+	FILE *stream;
+
+	stream = open_memstream(&client->out, &client->out_len);
+	if (!stream) {
+		free(res->body);
+		close_client(pfd, client);
+		return;
+	}
+	fprintf(stream, "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n", res->status, status_text(res->status),
+		(res->content_type ? res->content_type : "text/plain; charset=utf-8"), res->len);
+	if (res->location)
+		fprintf(stream, "Location: %s\r\n", res->location);
+
+	fputs("Connection: close\r\n\r\n", stream);
+	if (res->len)
+		fwrite(res->body, 1, res->len, stream);
+
+	fclose(stream);
+	free(res->body);
+
+	client->out_sent = 0;
+	pfd->events = POLLOUT;
+}
+
+static void queue_error(struct pollfd *pfd, struct http_client *client, int status) {
+
+	Http_response res = { 0 };
+
+	http_reply(&res, status, NULL, "%d %s\n", status, status_text(status));
+	queue_response(pfd, client, &res);
+}
+
+STATIC bool parse_request(char *buf, Http_request *req) {
+
+	char *line, *value, *saveptr = NULL;
+
+	memset(req, 0, sizeof(*req));
+
+	// Request line. Example: "GET /metrics?x=1 HTTP/1.1"
+	req->method = strtok_r(buf, " ", &saveptr);
+	req->path   = strtok_r(NULL, " ", &saveptr);
+	if (!req->method || !req->path || !starts_with(saveptr, "HTTP/1."))
+		return false;
+
+	req->query = strchr(req->path, '?');
+	if (req->query)
+		*req->query++ = '\0';
+
+	// Skip the rest of the request line and split "Name: value" pairs
+	strtok_r(NULL, "\n", &saveptr);
+	while ((line = strtok_r(NULL, "\n", &saveptr)) && req->header_count < HTTPD_MAXHEADERS) {
+		null_terminate(line, '\r');
+		value = strchr(line, ':');
+		if (!value)
+			continue;
+
+		*value++ = '\0';
+		req->headers[req->header_count][0] = line;
+		req->headers[req->header_count][1] = value + strspn(value, " \t");
+		req->header_count++;
+	}
+	return true;
+}
+
+static void dispatch_request(struct pollfd *pfd, struct http_client *client) {
+
+	Http_request req;
+	Http_response res = { 200, NULL, NULL, NULL, 0 };
+	int i;
+
+	// Headers are terminated here so they can be parsed as plain strings, the body starts right after
+	client->buf[client->header_len - 2] = '\0';
+	if (!parse_request(client->buf, &req)) {
+		queue_error(pfd, client, 400);
+		return;
+	}
+	req.body = client->buf + client->header_len;
+	req.body_len = client->content_length;
+
+	for (i = 0; i < route_count; i++)
+		if ((!routes[i].method || streq(routes[i].method, req.method)) && starts_with(req.path, routes[i].prefix))
+			break;
+
+	if (i == route_count) {
+		queue_error(pfd, client, 404);
+		return;
+	}
+	routes[i].handler(&req, &res);
+	queue_response(pfd, client, &res);
+}
+
+static void read_request(struct pollfd *pfd, struct http_client *client) {
+
+	char *end, *length;
+	ssize_t n;
+
+	if (!client->buf)
+		client->buf = MALLOC_W(HTTPD_HEADERLEN + HTTPD_MAXBODY + 1);
+
+	n = sock_read_non_blocking(pfd->fd, client->buf + client->len, HTTPD_HEADERLEN + HTTPD_MAXBODY - client->len);
+	if (n == -EAGAIN)
+		return;
+
+	if (n <= 0) {
+		close_client(pfd, client);
+		return;
+	}
+	client->len += n;
+	client->buf[client->len] = '\0';
+
+	if (!client->header_len) {
+		end = strstr(client->buf, "\r\n\r\n");
+		if (!end) {
+			if (client->len >= HTTPD_HEADERLEN)
+				queue_error(pfd, client, 431);
+			return;
+		}
+		client->header_len = end - client->buf + 4;
+
+		length = strcasestr(client->buf, "\r\nContent-Length:");
+		if (length && length < end)
+			client->content_length = strtoul(length + 17, NULL, 10);
+
+		if (client->content_length > HTTPD_MAXBODY) {
+			queue_error(pfd, client, 413);
+			return;
+		}
+	}
+	if (client->len >= client->header_len + client->content_length)
+		dispatch_request(pfd, client);
+}
+
+static void write_response(struct pollfd *pfd, struct http_client *client) {
+
+	ssize_t n;
+
+	// Partial writes are expected here, so don't use sock_write_non_blocking()
+	n = write(pfd->fd, client->out + client->out_sent, client->out_len - client->out_sent);
+	if (n < 0 && errno == EAGAIN)
+		return;
+
+	if (n < 0) {
+		close_client(pfd, client);
+		return;
+	}
+	client->out_sent += n;
+	if (client->out_sent == client->out_len)
+		close_client(pfd, client);
+}
+
+static void accept_client(struct pollfd *pfd) {
+
+	const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+	int i, fd;
+
+	fd = sock_accept(pfd[0].fd, NONBLOCK);
+	if (fd < 0)
+		return;
+
+	for (i = 1; i <= HTTPD_MAXCLIENTS; i++)
+		if (pfd[i].fd < 0)
+			break;
+
+	if (i > HTTPD_MAXCLIENTS) {
+		sock_write_non_blocking(fd, busy, sizeof(busy) - 1);
+		close(fd);
+		return;
+	}
+	pfd[i].fd = fd;
+	pfd[i].events = POLLIN;
+	clients[i - 1].started = time(NULL);
+}
+
+void httpd_poll(struct pollfd *pfd) {
+
+	struct http_client *client;
+	time_t now = time(NULL);
+	int i;
+
+	if (pfd[0].fd < 0)
+		return;
+
+	for (i = 1; i <= HTTPD_MAXCLIENTS; i++) {
+		if (pfd[i].fd < 0)
+			continue;
+
+		client = &clients[i - 1];
+		if (pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL) && !(pfd[i].revents & POLLIN))
+			close_client(&pfd[i], client);
+		else if (pfd[i].revents & POLLIN)
+			read_request(&pfd[i], client);
+		else if (pfd[i].revents & POLLOUT)
+			write_response(&pfd[i], client);
+		else if (now - client->started > HTTPD_TIMEOUT)
+			close_client(&pfd[i], client);
+	}
+	if (pfd[0].revents & POLLIN)
+		accept_client(pfd);
+}
@@ -6,9 +6,25 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <assert.h>
+#include <signal.h>
+#include <sys/ioctl.h>
 #include "socket.h"
 #include "irc.h"
 #include "gperf.h"
+#include "metrics.h"
+#include "trace.h"
+#include "recorder.h"
+#include "probes.h"
+#include "profiler.h"
+#include "capture.h"
+#include "log.h"
+#include "archive.h"
+#include "seen.h"
+#include "quotes.h"
+#include "chanstats.h"
+#include "trending.h"
+#include "triggers.h"
+#include "flood.h"
 #include "common.h"
 
 // Wrapper functions. If VA_ARGS is NULL (last 2 args) then ':' will be ommited. Do not call _irc_command() directly
@@ -17,6 +33,8 @@
 #define irc_channel_command(server, target) _irc_command(server, "JOIN", target, NULL, (char *) NULL)
 #define irc_ping_command(server, target)    _irc_command(server, "PONG", target, NULL, (char *) NULL)
 #define irc_quit_command(server, target)    _irc_command(server, "QUIT", "", target,   (char *) NULL)
+#define irc_mode_command(server, target)    _irc_command(server, "MODE", target, NULL, (char *) NULL)
+#define irc_kick_command(server, target, reason) _irc_command(server, "KICK", target, "%s", reason)
 
 struct irc_type {
 	int sock;
@@ -35,12 +53,15 @@ struct irc_type {
 Irc irc_connect(const char *address, const char *port) {
 
 	Irc server = CALLOC_W(sizeof(*server));
+	char endpoint[ADDRLEN + PORTLEN + 2];
 
 	// Minimum validity checks
 	if (!strchr(address, '.') || atoi(port) > 65535)
 		return NULL;
 
+	snprintf(endpoint, sizeof(endpoint), "%s:%s", address, port);
 	server->sock = sock_connect(address, port);
+	recorder_text(REC_CONNECT, server->sock < 0 ? -1 : 0, endpoint);
 	if (server->sock < 0)
 		return NULL;
 
@@ -60,6 +81,11 @@ int get_socket(Irc server) {
 	return server->sock;
 }
 
+bool is_connected(Irc server) {
+
+	return server->isConnected;
+}
+
 char *default_channel(Irc server) {
 
 	return server->channels[0];
@@ -86,6 +112,22 @@ void set_nick(Irc server, const char *nick) {
 	irc_nick_command(server, server->nick);
 }
 
+void set_mode(Irc server, const char *channel, const char *mode) {
+
+	char target[CHANLEN + 16];
+
+	snprintf(target, sizeof(target), "%s %s", channel, mode);
+	irc_mode_command(server, target);
+}
+
+void kick_user(Irc server, const char *channel, const char *nick, const char *reason) {
+
+	char target[CHANLEN + NICKLEN + 1];
+
+	snprintf(target, sizeof(target), "%s %s", channel, nick);
+	irc_kick_command(server, target, reason);
+}
+
 void set_user(Irc server, const char *user) {
 
 	char user_with_flags[USERLEN * 2 + 6];
@@ -127,20 +169,32 @@ ssize_t parse_irc_line(Irc server) {
 	Function_list flist;
 	int reply;
 	ssize_t n;
+	uint64_t received;
 
 	// Read raw line from server. Example: ":laxanofido!~laxanofid@snf-23545.vm.okeanos.grnet.gr PRIVMSG #foss-teimes :How YA doing fossbot"
 	n = sock_readline(server->sock, server->line + server->line_offset, IRCLEN - server->line_offset);
 	if (n <= 0) {
-		if (n != -EAGAIN)
+		if (n != -EAGAIN && cfg.replay)
+			replay_finish();
+
+		if (n != -EAGAIN) {
+			recorder_text(REC_DISCONNECT, n, "connection closed by server");
 			exit_msg("IRC connection closed");
+		}
 
 		server->line_offset = strlen(server->line);
 		return n;
 	}
 	server->line_offset = 0; // Clear offset if the read was successful
+	capture_line(server->line);
+	recorder_text(REC_INBOUND, 0, server->line);
+	received = monotonic_usec();
+	PROBE2(line_received, server->line, received);
+	metrics_line_parsed();
+	trace_line_received(received);
 
 	if (cfg.verbose)
-		puts(server->line);
+		log_msg(LVL_INFO, LOG_IRC_IN, "%s", server->line);
 
 	// Check for server ping request. Example: "PING :wolfe.freenode.net"
 	// If we match PING then change the 2nd char to 'O' and terminate the argument before sending back
@@ -171,14 +225,21 @@ ssize_t parse_irc_line(Irc server) {
 
 	// Find out if server command is a numeric reply
 	reply = atoi(pdata.command);
-	if (reply)
+	if (reply) {
 		numeric_reply(server, reply);
-	else {
+		if (reply == NAMREPLY)
+			flood_names(pdata.message);
+	} else {
 		// Find & launch any functions registered to IRC commands
 		flist = function_lookup(pdata.command, strlen(pdata.command));
-		if (flist)
+		PROBE2(command_lookup, pdata.command, flist);
+		if (flist) {
+			PROBE1(handler_start, flist->command);
 			flist->function(server, pdata);
+			PROBE1(handler_end, flist->command);
+		}
 	}
+	metrics_observe(DISPATCH_LATENCY, monotonic_usec() - received);
 	return n;
 }
 
@@ -197,14 +258,48 @@ int numeric_reply(Irc server, int reply) {
 	return reply;
 }
 
+/** The host is still there after a nick cut by null_terminate(). Example: "laxanofido\0~laxanofid@snf-23545.vm.okeanos.grnet.gr" */
+static const char *sender_host(const char *nick) {
+
+	const char *host = strchr(nick + strlen(nick) + 1, '@');
+
+	return host ? host + 1 : "";
+}
+
 void irc_privmsg(Irc server, Parsed_data pdata) {
 
 	Function_list flist;
+	const char *reply = NULL;
+	char *text, command[IRCLEN + 1];
+	bool flooding;
+	pid_t pid;
+	int slot;
 
 	// Discard hostname from nickname. "laxanofido!~laxanofid@snf-23545.vm.okeanos.grnet.gr" becomes "laxanofido"
 	if (!null_terminate(pdata.sender, '!'))
 		return;
 
+	// Flooders are still archived and counted, but their commands and triggers are ignored
+	text = strstr(pdata.message, " :");
+	flooding = text && flood_message(server, pdata.message, text - pdata.message, pdata.sender, sender_host(pdata.sender),
+		text + 2);
+
+	// Archive channel messages before strtok splits them, bot commands excluded. Example: "#foss-teimes :hello there"
+	if (*pdata.message == '#' && text) {
+		if (text[2] != '!') {
+			archive_append(pdata.message, text - pdata.message, pdata.sender, text + 2);
+			quote_remember(pdata.message, text - pdata.message, pdata.sender, text + 2);
+			trending_message(pdata.message, text - pdata.message, text + 2);
+			if (!flooding)
+				reply = trigger_match(pdata.message, text - pdata.message, text + 2);
+		}
+
+		chanstats_message(pdata.message, text - pdata.message, pdata.sender);
+		*text = '\0'; // Put back below
+		seen_activity(server, pdata.sender, pdata.message, SEEN_MESSAGE, text + 2);
+		*text = ' ';
+	}
+
 	// Store message destination. Example channel: "#foss-teimes" or private: "fossbot"
 	pdata.target = strtok(pdata.message, " ");
 	if (!pdata.target)
@@ -224,26 +319,57 @@ void irc_privmsg(Irc server, Parsed_data pdata) {
 	// Make sure BOT command / CTCP request gets null terminated if there are no parameters
 	pdata.message = strtok(NULL, "");
 
+	// Triggers answer with canned text, or run a bot command as if the sender had typed it
+	if (reply && *reply != '!')
+		send_message(server, pdata.target, "%s", reply);
+	else if (reply) {
+		snprintf(command, sizeof(command), "%s", reply);
+		pdata.command = strtok(command, " ");
+		pdata.message = strtok(NULL, "");
+	}
+
 	// Bot commands must begin with '!'
-	if (*pdata.command == '!') {
+	if (*pdata.command == '!' && !flooding) {
 		pdata.command++; // Skip leading '!' before passing the command
 
 		// Query our hash table for any functions registered to BOT commands
 		flist = function_lookup(pdata.command, strlen(pdata.command));
+		PROBE2(command_lookup, pdata.command, flist);
 		if (!flist)
 			return;
 
+		// Register the command before forking, so every worker inherits the same statistics slot and request ID
+		slot = metrics_command(flist->command);
+		trace_request_begin(flist->command);
+
 		// Launch the function in a new process
-		switch (fork()) {
+		pid = fork();
+		PROBE1(fork, pid);
+		switch (pid) {
 		case 0:
+			signal(SIGCHLD, SIG_IGN); // Helpers forked by the worker are reaped automatically
+			metrics_command_start(slot);
+			trace_worker_start();
+			profiler_worker_start(flist->command);
+			PROBE1(handler_start, flist->command);
 			flist->function(server, pdata);
+			PROBE1(handler_end, flist->command);
+			trace_worker_end();
+			metrics_command_end();
 			_exit(EXIT_SUCCESS);
 		case -1:
 			perror("fork");
+			metrics_fork(false);
+			break;
+		default:
+			metrics_fork(true);
 		}
+		recorder_text(REC_DISPATCH, pid, flist->command);
+		log_msg(LVL_DEBUG, LOG_DISPATCH, "%s from %s handled by worker %d", flist->command, pdata.sender, pid);
+		trace_request_end();
 	}
 	// CTCP requests must begin with ascii char 1
-	else if (*pdata.command == '\x01') {
+	else if (*pdata.command == '\x01' && !flooding) {
 		if (starts_with(pdata.command + 1, "VERSION")) // Skip the leading escape char
 			send_notice(server, pdata.sender, "\x01VERSION %s\x01", cfg.bot_version);
 	}
@@ -252,7 +378,6 @@ void irc_privmsg(Irc server, Parsed_data pdata) {
 void irc_notice(Irc server, Parsed_data pdata) {
 
 	char *test;
-	bool temp;
 	int auth_level;
 
 	// Discard hostname from nickname
@@ -281,17 +406,15 @@ void irc_notice(Irc server, Parsed_data pdata) {
 		if (write(server->pipe[1], &auth_level, 4) != 4)
 			perror(__func__);
 	} else if (starts_with(pdata.message, "This nickname is registered")) {
-		temp = cfg.verbose;
-		cfg.verbose = false;
 		send_message(server, pdata.sender, "identify %s", cfg.nick_password);
 		memset(cfg.nick_password, 0, strlen(cfg.nick_password));
-		cfg.verbose = temp;
 	}
 }
 
 void irc_kick(Irc server, Parsed_data pdata) {
 
 	int i;
+	unsigned left;
 	char *victim;
 
 	// Discard hostname from nickname
@@ -309,7 +432,7 @@ void irc_kick(Irc server, Parsed_data pdata) {
 
 	// Rejoin and send a message back to the one who kicked us
 	if (streq(victim, server->nick)) {
-		sleep(4);
+		for (left = 4; left; left = sleep(left)); // Child exits interrupt sleep(), wait the whole delay
 
 		// Find the channel we got kicked on and remove it from our list
 		// TODO verify if we actually rejoined the channel
@@ -323,10 +446,72 @@ void irc_kick(Irc server, Parsed_data pdata) {
 	}
 }
 
+void irc_join(Irc server, Parsed_data pdata) {
+
+	// Example: ":laxanofido!~laxanofid@host JOIN #foss-teimes" or "JOIN :#foss-teimes"
+	if (!null_terminate(pdata.sender, '!') || streq(pdata.sender, server->nick))
+		return;
+
+	pdata.target = strtok(pdata.message + (*pdata.message == ':'), " ");
+	if (!pdata.target)
+		return;
+
+	seen_activity(server, pdata.sender, pdata.target, SEEN_JOIN, NULL);
+	flood_join(server, pdata.target, pdata.sender, sender_host(pdata.sender));
+}
+
+void irc_part(Irc server, Parsed_data pdata) {
+
+	char *reason;
+
+	// Example: ":laxanofido!~laxanofid@host PART #foss-teimes :Leaving"
+	if (!null_terminate(pdata.sender, '!') || streq(pdata.sender, server->nick))
+		return;
+
+	pdata.target = strtok(pdata.message, " ");
+	if (!pdata.target)
+		return;
+
+	reason = strtok(NULL, "");
+	seen_activity(server, pdata.sender, pdata.target, SEEN_PART, reason ? reason + (*reason == ':') : NULL);
+	flood_part(pdata.target, pdata.sender);
+}
+
+void irc_quit(Irc server, Parsed_data pdata) {
+
+	// Example: ":laxanofido!~laxanofid@host QUIT :Ping timeout"
+	if (!null_terminate(pdata.sender, '!'))
+		return;
+
+	seen_activity(server, pdata.sender, NULL, SEEN_QUIT, pdata.message + (*pdata.message == ':'));
+	flood_part(NULL, pdata.sender);
+}
+
+void irc_nick(Irc server, Parsed_data pdata) {
+
+	char *nick;
+
+	// Example: ":laxanofido!~laxanofid@host NICK :laxanofido_"
+	if (!null_terminate(pdata.sender, '!') || streq(pdata.sender, server->nick))
+		return;
+
+	nick = strtok(pdata.message + (*pdata.message == ':'), " ");
+	if (!nick)
+		return;
+
+	seen_activity(server, pdata.sender, NULL, SEEN_NICK, nick);
+	seen_activity(server, nick, NULL, SEEN_NEWNICK, pdata.sender);
+	flood_nick(pdata.sender, nick);
+}
+
 void _irc_command(Irc server, const char *type, const char *target, const char *format, ...) {
 
 	va_list args;
-	char msg[IRCLEN - 50], irc_msg[IRCLEN];
+	char msg[IRCLEN - 50], irc_msg[IRCLEN], shown[IRCLEN];
+	size_t len;
+	ssize_t n;
+	int queued;
+	uint64_t start;
 
 	va_start(args, format);
 	vsnprintf(msg, IRCLEN - 50, format, args);
@@ -335,12 +520,32 @@ void _irc_command(Irc server, const char *type, const char *target, const char *
 	else
 		snprintf(irc_msg, IRCLEN, "%s %s\r\n", type, target);
 
+	// Only this copy leaves the function: the NickServ password never reaches the probes, traces, recorder or log.
+	// The line terminators are left out as well
+	if (streq(target, "NickServ") && starts_with(msg, "identify"))
+		snprintf(shown, IRCLEN, "%s %s :identify ********", type, target);
+	else
+		snprintf(shown, IRCLEN, "%s", irc_msg);
+	len = strlen(shown);
+	if (len >= 2 && shown[len - 2] == '\r' && shown[len - 1] == '\n') // A truncated line has none
+		shown[len - 2] = '\0';
+
 	// Send message & print it on stdout
-	if (sock_write_non_blocking(server->sock, irc_msg, strlen(irc_msg)) == -1)
+	start = monotonic_usec();
+	n = sock_write_non_blocking(server->sock, irc_msg, strlen(irc_msg));
+	if (n == -1)
 		exit_msg("Failed to send message");
 
+	trace_span(TRACE_SEND, start, monotonic_usec() - start, target);
+	PROBE2(send, shown, (long) n);
+	recorder_text(REC_OUTBOUND, n < 0 ? n : 0, shown);
+
+	metrics_count(n == -EAGAIN ? SEND_FAILURES : LINES_SENT, 1);
+	if (!ioctl(server->sock, TIOCOUTQ, &queued))
+		metrics_gauge(SEND_QUEUE_BYTES, queued);
+
 	if (cfg.verbose)
-		fputs(irc_msg, stdout);
+		log_msg(LVL_INFO, LOG_IRC_OUT, "%s", shown);
 
 	va_end(args);
 }
@@ -349,6 +554,7 @@ void quit_server(Irc server, const char *msg) {
 
 	assert(msg && "Error in quit_server");
 	irc_quit_command(server, msg);
+	recorder_text(REC_DISCONNECT, 0, msg);
 
 	if (close(server->sock) < 0)
 		perror(__func__);
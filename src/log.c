@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "common.h"
+
+#define LOG_LINEMAX (LOG_TEXTLEN * 2 + 128) //!< Escaping at most doubles the message
+
+struct log_ring {
+	uint64_t head; //!< Position of the next record to claim
+	uint64_t dropped;
+	struct log_record records[LOG_RECORDS];
+};
+
+static struct log_ring *ring;
+static enum log_level min_level = LVL_INFO;
+
+// Writer process state
+static char log_path[PATHLEN];
+static int log_fd = -1;
+static long max_bytes, max_age;
+static off_t log_size;
+static time_t log_opened;
+
+static const char *level_names[LVL_MAX] = { "debug", "info", "warn", "error" };
+static const char *category_names[LOG_CATEGORY_MAX] = { "irc_in", "irc_out", "dispatch", "system" };
+
+static uint64_t realtime_usec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void log_msg(enum log_level level, enum log_category category, const char *format, ...) {
+
+	struct log_record *rec;
+	uint64_t pos, seq;
+	va_list args;
+	int n;
+
+	if (!ring || level < min_level)
+		return;
+
+	// Claim the slot at head once the writer has freed it. A slot behind head means the ring is full
+	for (;;) {
+		pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		rec = &ring->records[pos & (LOG_RECORDS - 1)];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__sync_bool_compare_and_swap(&ring->head, pos, pos + 1))
+				break;
+		} else if (seq < pos) {
+			__sync_fetch_and_add(&ring->dropped, 1);
+			return;
+		}
+	}
+	va_start(args, format);
+	n = vsnprintf(rec->text, LOG_TEXTLEN, format, args);
+	va_end(args);
+
+	rec->time     = realtime_usec();
+	rec->pid      = getpid();
+	rec->level    = level;
+	rec->category = category;
+	rec->len      = n < 0 ? 0 : n >= LOG_TEXTLEN ? LOG_TEXTLEN - 1 : n;
+
+	// Fails if we took so long that the writer gave up on the slot
+	if (!__sync_bool_compare_and_swap(&rec->seq, pos, pos + 1))
+		__sync_fetch_and_add(&ring->dropped, 1);
+}
+
+STATIC size_t log_format(char *buf, size_t size, const struct log_record *rec) {
+
+	time_t sec = rec->time / 1000000;
+	struct tm tm;
+	size_t n, i;
+	char c;
+
+	if (size < LOG_LINEMAX)
+		return 0;
+
+	gmtime_r(&sec, &tm);
+	n = strftime(buf, size, "time=%Y-%m-%dT%H:%M:%S", &tm);
+	n += snprintf(buf + n, size - n, ".%06uZ level=%s cat=%s pid=%d msg=\"", (unsigned) (rec->time % 1000000),
+		level_names[rec->level % LVL_MAX], category_names[rec->category % LOG_CATEGORY_MAX], rec->pid);
+
+	// Keep every record on one line. Other control characters are replaced
+	for (i = 0; i < rec->len && i < LOG_TEXTLEN; i++) {
+		c = rec->text[i];
+		if (c == '"' || c == '\\') {
+			buf[n++] = '\\';
+			buf[n++] = c;
+		} else if (c == '\n' || c == '\r') {
+			buf[n++] = '\\';
+			buf[n++] = c == '\n' ? 'n' : 'r';
+		} else
+			buf[n++] = (unsigned char) c < 0x20 ? '?' : c;
+	}
+	buf[n++] = '"';
+	buf[n++] = '\n';
+	buf[n] = '\0';
+	return n;
+}
+
+static void open_log(void) {
+
+	struct stat st;
+
+	log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (log_fd < 0) {
+		perror(log_path);
+		log_fd = STDOUT_FILENO;
+		*log_path = '\0'; // Don't try to rotate stdout
+	}
+	log_size = fstat(log_fd, &st) ? 0 : st.st_size;
+	log_opened = time(NULL);
+}
+
+static void rotate(void) {
+
+	char from[PATHLEN + 8], to[PATHLEN + 8];
+	int i;
+
+	close(log_fd);
+	for (i = LOG_KEEP - 1; i > 0; i--) {
+		snprintf(from, sizeof(from), "%s.%d", log_path, i);
+		snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+		rename(from, to);
+	}
+	snprintf(to, sizeof(to), "%s.1", log_path);
+	rename(log_path, to);
+	open_log();
+}
+
+static void write_batch(const char *buf, size_t len) {
+
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(log_fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return; // Nothing better to do with it
+
+		buf += n;
+		len -= n;
+		log_size += n;
+	}
+	if (*log_path && ((max_bytes && log_size >= max_bytes) || (max_age && time(NULL) - log_opened >= max_age)))
+		rotate();
+}
+
+/** True if the claimed slot at tail has been unfinished for LOG_STALL_MS. Its producer died or hangs */
+static bool stalled(uint64_t tail) {
+
+	static uint64_t position = UINT64_MAX, since;
+	uint64_t now = monotonic_usec();
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <= tail)
+		return false; // Not claimed, the ring is empty
+
+	if (position != tail) {
+		position = tail;
+		since = now;
+	}
+	return now - since >= LOG_STALL_MS * 1000ULL;
+}
+
+/** Format every finished record, up to a batch, and free their slots. Returns the batch's length */
+static size_t drain(char *batch, uint64_t *tail) {
+
+	static uint64_t reported;
+	struct log_record *rec, note;
+	uint64_t dropped;
+	size_t len = 0;
+
+	dropped = __atomic_load_n(&ring->dropped, __ATOMIC_ACQUIRE);
+	if (dropped != reported) {
+		note.time     = realtime_usec();
+		note.pid      = getpid();
+		note.level    = LVL_WARN;
+		note.category = LOG_SYSTEM;
+		note.len      = snprintf(note.text, LOG_TEXTLEN,
+			"%llu records dropped, the log ring was full or they were never finished",
+			(unsigned long long) (dropped - reported));
+		len += log_format(batch, LOG_BATCH, &note);
+		reported = dropped;
+	}
+	while (LOG_BATCH - len >= LOG_LINEMAX) {
+		rec = &ring->records[*tail & (LOG_RECORDS - 1)];
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != *tail + 1) {
+			if (!stalled(*tail) || !__sync_bool_compare_and_swap(&rec->seq, *tail, *tail + LOG_RECORDS))
+				break;
+
+			// Free the slot without its record. The loss is reported with the next batch
+			__sync_fetch_and_add(&ring->dropped, 1);
+			(*tail)++;
+			continue;
+		}
+
+		len += log_format(batch + len, LOG_BATCH - len, rec);
+		__atomic_store_n(&rec->seq, *tail + LOG_RECORDS, __ATOMIC_RELEASE);
+		(*tail)++;
+	}
+	return len;
+}
+
+static void writer(pid_t parent) {
+
+	static char batch[LOG_BATCH];
+	struct timespec flush = { 0, LOG_FLUSH_MS * 1000000L };
+	uint64_t tail = 0;
+	size_t len;
+
+	// Keep running through Ctrl-C or SIGTERM to the process group, the bot going away is what stops us
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, SIG_IGN);
+	signal(SIGHUP, SIG_IGN);
+
+	if (*log_path)
+		open_log();
+	else
+		log_fd = STDOUT_FILENO;
+
+	for (;;) {
+		len = drain(batch, &tail);
+		if (len)
+			write_batch(batch, len);
+		else if (getppid() != parent)
+			_exit(EXIT_SUCCESS); // Everything the bot logged is written
+		else
+			nanosleep(&flush, NULL);
+	}
+}
+
+void log_init(const char *path, const char *level, long max_kb, long max_hours) {
+
+	pid_t parent = getpid();
+	int i;
+
+	for (i = 0; i < LVL_MAX && strcasecmp(level, level_names[i]); i++);
+	if (i == LVL_MAX)
+		exit_msg("log_level: must be one of debug, info, warn, error");
+	min_level = i;
+
+	ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED) {
+		perror("log: mmap");
+		ring = NULL;
+		return;
+	}
+	for (i = 0; i < LOG_RECORDS; i++)
+		ring->records[i].seq = i;
+
+	snprintf(log_path, PATHLEN, "%s", path);
+	max_bytes = max_kb * 1024;
+	max_age = max_hours * 3600;
+
+	fflush(stdout);
+	switch (fork()) {
+	case 0:
+		writer(parent);
+		break;
+	case -1:
+		perror("log: fork");
+		munmap(ring, sizeof(*ring));
+		ring = NULL;
+	}
+}
@@ -1,20 +1,34 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <poll.h>
 #include "socket.h"
 #include "irc.h"
 #include "murmur.h"
 #include "mpd.h"
+#include "httpd.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "alloc_profile.h"
+#include "profiler.h"
+#include "remind.h"
+#include "watch.h"
+#include "webhook.h"
+#include "shorten.h"
+#include "paste.h"
+#include "feed.h"
 #include "common.h"
 
-enum { IRC, MURM_LISTEN, MURM_ACCEPT, MPD };
+enum { IRC, MURM_LISTEN, MURM_ACCEPT, MPD, HTTPD, HTTPD_CLIENTS, PFD_COUNT = HTTPD_CLIENTS + HTTPD_MAXCLIENTS };
 
 int mpdfd;
 
 int main(int argc, char *argv[]) {
 
 	Irc irc_server;
-	struct pollfd pfd[4];
-	int i, ready, murm_listenfd = -1;
+	struct pollfd pfd[PFD_COUNT];
+	int i, ready, timeout = TIMEOUT, wait = TIMEOUT, murm_listenfd = -1;
+	uint64_t last_line;
 
 	initialize(argc, argv);
 
@@ -22,14 +36,25 @@ int main(int argc, char *argv[]) {
 		pfd[i].fd = -1;
 		pfd[i].events = POLLIN;
 	}
-	if (add_murmur_callbacks(cfg.murmur_port))
-		murm_listenfd = pfd[MURM_LISTEN].fd = sock_listen(LOCALHOST, CB_LISTEN_PORT_S);
-	else
-		fprintf(stderr, "Could not connect to Murmur\n");
+	// A replay only talks to the feeder standing in for the IRC server
+	if (cfg.replay)
+		mpdfd = -1;
+	else {
+		if (add_murmur_callbacks(cfg.murmur_port))
+			murm_listenfd = pfd[MURM_LISTEN].fd = sock_listen(LOCALHOST, CB_LISTEN_PORT_S);
+		else
+			fprintf(stderr, "Could not connect to Murmur\n");
+
+		mpdfd = pfd[MPD].fd = mpd_connect(cfg.mpd_port);
+		if (mpdfd < 0)
+			fprintf(stderr, "Could not connect to MPD\n");
+	}
 
-	mpdfd = pfd[MPD].fd = mpd_connect(cfg.mpd_port);
-	if (mpdfd < 0)
-		fprintf(stderr, "Could not connect to MPD\n");
+	pfd[HTTPD].fd = httpd_listen(cfg.http_port);
+	httpd_route("GET", "/metrics", metrics_serve);
+	httpd_route("GET", "/profile", profiler_serve);
+	shortener_init(cfg.shortener_file, cfg.shortener_url); // Before any worker can shorten
+	paste_init(cfg.paste_url, atoi(cfg.paste_lines));
 
 	// Connect to server and set IRC details
 	irc_server = irc_connect(cfg.server, cfg.port);
@@ -37,15 +62,31 @@ int main(int argc, char *argv[]) {
 		exit_msg("Irc connection failed");
 
 	pfd[IRC].fd = get_socket(irc_server);
+	webhook_init(irc_server, cfg.webhook_secret, cfg.webhook_channels);
 	set_nick(irc_server, cfg.nick);
 	set_user(irc_server, cfg.user);
 	for (i = 0; i < cfg.channels_set; i++)
 		join_channel(irc_server, cfg.channels[i]);
 
-	while ((ready = poll(pfd, SIZE(pfd), TIMEOUT)) > 0) {
+	watch_start(irc_server);
+	feeds_start(irc_server);
+
+	last_line = monotonic_usec();
+	// Waking up early for a reminder isn't a timeout
+	while ((ready = poll(pfd, SIZE(pfd), wait)) != 0 || wait < timeout) {
+		if (ready == -1) {
+			if (errno != EINTR)
+				break;
+
+			// A signal handler ran (child exit, SIGUSR1). Nothing is ready but the timeouts still need updating
+			for (i = 0; i < SIZE(pfd); i++)
+				pfd[i].revents = 0;
+		}
 		// Keep reading & parsing lines as long the connection is active and act on any registered actions found
-		if (pfd[IRC].revents & POLLIN)
+		if (pfd[IRC].revents & POLLIN) {
 			while (parse_irc_line(irc_server) > 0);
+			last_line = monotonic_usec();
+		}
 
 		if (pfd[MURM_LISTEN].revents & POLLIN) {
 			pfd[MURM_ACCEPT].fd = accept_murmur_connection(murm_listenfd);
@@ -62,6 +103,19 @@ int main(int argc, char *argv[]) {
 		if (pfd[MPD].revents & POLLIN)
 			if (!print_song(irc_server, default_channel(irc_server)))
 				pfd[MPD].fd = mpdfd = mpd_connect(cfg.mpd_port);
+
+		httpd_poll(pfd + HTTPD);
+		alloc_profile_poll();
+		reminders_poll(irc_server);
+
+		// Other sockets must not keep us alive if the IRC server stopped talking to us
+		timeout = TIMEOUT - (int) ((monotonic_usec() - last_line) / 1000);
+		if (timeout <= 0)
+			break;
+
+		wait = reminders_timeout(irc_server);
+		if (wait < 0 || wait > timeout)
+			wait = timeout;
 	}
 	// If we reach here, it means we got disconnected from server. Exit with error (1)
 	if (ready == -1)
@@ -69,6 +123,7 @@ int main(int argc, char *argv[]) {
 	else
 		fprintf(stderr, "%d minutes passed without getting a message, exiting...\n", TIMEOUT / 1000 / 60);
 
+	recorder_dump(ready == -1 ? "poll failed" : "IRC timeout");
 	quit_server(irc_server, cfg.quit_message);
 	cleanup();
 	return 1;
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "irc.h"
+#include "httpd.h"
+#include "metrics.h"
+#include "alloc_profile.h"
+#include "common.h"
+
+struct metrics {
+	uint64_t counters[COUNTER_MAX];
+	int64_t gauges[GAUGE_MAX];
+	struct histogram histograms[HISTOGRAM_MAX];
+	struct {
+		uint64_t second;
+		uint32_t lines;
+	} rate[RATE_WINDOW];
+	uint64_t start_time;
+	int command_count;
+	struct command_stats commands[MAXCMDS];
+};
+
+static struct metrics *metrics;
+static struct command_stats *current_cmd; //!< Command running in this process, if any
+static uint64_t current_cmd_start;
+
+static const char *counter_info[COUNTER_MAX][2] = {
+	[LINES_PARSED]    = { "irc_bot_lines_parsed_total",      "IRC lines read from the server" },
+	[LINES_SENT]      = { "irc_bot_lines_sent_total",        "IRC lines sent to the server" },
+	[SEND_FAILURES]   = { "irc_bot_send_failures_total",     "IRC lines dropped because the socket would block" },
+	[COMMANDS]        = { "irc_bot_commands_total",          "Bot commands dispatched" },
+	[FORKS]           = { "irc_bot_forks_total",             "Processes forked by the main process and the workers" },
+	[FORK_FAILURES]   = { "irc_bot_fork_failures_total",     "Failed fork() calls" },
+	[HTTP_REQUESTS]   = { "irc_bot_http_requests_total",     "HTTP transfers performed with curl" },
+	[HTTP_FAILURES]   = { "irc_bot_http_failures_total",     "HTTP transfers that did not complete" },
+	[HTTP_BYTES]      = { "irc_bot_http_received_bytes_total", "HTTP body bytes received" },
+	[MPD_FAILURES]    = { "irc_bot_mpd_failures_total",      "Failed MPD connections or queries" },
+	[MURMUR_FAILURES] = { "irc_bot_murmur_failures_total",   "Failed Murmur connections or queries" },
+	[FLOODS]          = { "irc_bot_floods_total",            "Flooders caught and join floods" },
+	[SHORT_EVICTIONS] = { "irc_bot_short_links_evicted_total", "Old short links dropped to make room for new ones" }
+};
+
+static const char *gauge_info[GAUGE_MAX][2] = {
+	[SEND_QUEUE_BYTES] = { "irc_bot_send_queue_bytes", "Unsent bytes in the IRC socket's send queue" }
+};
+
+static const char *http_class[6] = { "error", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+static const char *histogram_info[HISTOGRAM_MAX][2] = {
+	[DISPATCH_LATENCY] = { "irc_bot_dispatch_duration_seconds", "Time from reading an IRC line until it's handler is launched" }
+};
+
+void metrics_init(void) {
+
+	metrics = mmap(NULL, sizeof(*metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (metrics == MAP_FAILED)
+		exit_msg("metrics: mmap failed");
+
+	metrics->start_time = monotonic_usec();
+}
+
+STATIC unsigned histogram_index(uint64_t value) {
+
+	unsigned magnitude;
+
+	if (value < (1 << HIST_SUBBITS))
+		return value;
+
+	if (value > UINT32_MAX)
+		return HIST_BUCKETS - 1;
+
+	// Position of the highest bit set selects the group and the next HIST_SUBBITS bits the bucket inside it
+	magnitude = 63 - __builtin_clzll(value);
+	return ((magnitude - HIST_SUBBITS + 1) << HIST_SUBBITS) + ((value >> (magnitude - HIST_SUBBITS)) & ((1 << HIST_SUBBITS) - 1));
+}
+
+STATIC uint64_t histogram_upper_bound(unsigned index) {
+
+	unsigned magnitude, sub = index & ((1 << HIST_SUBBITS) - 1);
+
+	if (index < (1 << HIST_SUBBITS))
+		return index + 1;
+
+	magnitude = (index >> HIST_SUBBITS) + HIST_SUBBITS - 1;
+	return (uint64_t) ((1 << HIST_SUBBITS) + sub + 1) << (magnitude - HIST_SUBBITS);
+}
+
+static void histogram_record(struct histogram *hist, uint64_t usec) {
+
+	__sync_fetch_and_add(&hist->buckets[histogram_index(usec)], 1);
+	__sync_fetch_and_add(&hist->count, 1);
+	__sync_fetch_and_add(&hist->sum, usec);
+}
+
+STATIC uint64_t histogram_percentile(const struct histogram *hist, double percentile) {
+
+	uint64_t rank, seen = 0;
+	unsigned i;
+
+	if (!hist->count)
+		return 0;
+
+	rank = hist->count * percentile / 100;
+	if (!rank)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+	return histogram_upper_bound(i < HIST_BUCKETS ? i : HIST_BUCKETS - 1) - 1;
+}
+
+void metrics_count(enum metric_counter counter, uint64_t n) {
+
+	if (metrics)
+		__sync_fetch_and_add(&metrics->counters[counter], n);
+}
+
+void metrics_gauge(enum metric_gauge gauge, int64_t value) {
+
+	if (metrics)
+		metrics->gauges[gauge] = value;
+}
+
+void metrics_observe(enum metric_histogram hist, uint64_t usec) {
+
+	if (metrics)
+		histogram_record(&metrics->histograms[hist], usec);
+}
+
+void metrics_line_parsed(void) {
+
+	uint64_t second;
+	unsigned slot;
+
+	if (!metrics)
+		return;
+
+	metrics->counters[LINES_PARSED]++; // Only the main process parses lines
+
+	second = monotonic_usec() / 1000000;
+	slot = second % RATE_WINDOW;
+	if (metrics->rate[slot].second != second) {
+		metrics->rate[slot].second = second;
+		metrics->rate[slot].lines = 0;
+	}
+	metrics->rate[slot].lines++;
+}
+
+static double lines_per_second(void) {
+
+	uint64_t second, sum = 0;
+	int i;
+
+	second = monotonic_usec() / 1000000;
+	for (i = 0; i < RATE_WINDOW; i++)
+		if (metrics->rate[i].second + RATE_WINDOW > second)
+			sum += metrics->rate[i].lines;
+
+	return (double) sum / RATE_WINDOW;
+}
+
+int metrics_command(const char *command) {
+
+	int i;
+
+	if (!metrics)
+		return -1;
+
+	for (i = 0; i < metrics->command_count; i++)
+		if (!strncasecmp(metrics->commands[i].name, command, CMDNAMELEN - 1))
+			return i;
+
+	if (metrics->command_count == MAXCMDS)
+		return -1;
+
+	snprintf(metrics->commands[i].name, CMDNAMELEN, "%s", command);
+	metrics->command_count++;
+	return i;
+}
+
+void metrics_command_start(int slot) {
+
+	if (!metrics || slot < 0)
+		return;
+
+	current_cmd = &metrics->commands[slot];
+	current_cmd_start = monotonic_usec();
+	__sync_fetch_and_add(&current_cmd->calls, 1);
+	metrics_count(COMMANDS, 1);
+}
+
+void metrics_command_end(void) {
+
+	if (!current_cmd)
+		return;
+
+	histogram_record(&current_cmd->wall_time, monotonic_usec() - current_cmd_start);
+	current_cmd = NULL;
+}
+
+void metrics_fork(bool success) {
+
+	metrics_count(success ? FORKS : FORK_FAILURES, 1);
+	if (success && current_cmd)
+		__sync_fetch_and_add(&current_cmd->forks, 1);
+}
+
+void metrics_http(long status, size_t bytes) {
+
+	int class = status / 100;
+
+	if (class < 1 || class > 5)
+		class = 0;
+
+	metrics_count(HTTP_REQUESTS, 1);
+	metrics_count(HTTP_BYTES, bytes);
+	if (!class)
+		metrics_count(HTTP_FAILURES, 1);
+
+	if (current_cmd) {
+		__sync_fetch_and_add(&current_cmd->http_status[class], 1);
+		__sync_fetch_and_add(&current_cmd->http_bytes, bytes);
+	}
+}
+
+static void write_histogram(FILE *stream, const char *name, const char *label, const struct histogram *hist) {
+
+	uint64_t cumulative = 0;
+	unsigned i;
+
+	// Only export the power of two boundaries, the sub buckets are used for the percentiles in !stats
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		cumulative += hist->buckets[i];
+		if ((i + 1) % (1 << HIST_SUBBITS) == 0)
+			fprintf(stream, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, label, (*label ? "," : ""),
+				histogram_upper_bound(i) / 1e6, (unsigned long long) cumulative);
+	}
+	fprintf(stream, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, (*label ? "," : ""), (unsigned long long) hist->count);
+	fprintf(stream, "%s_sum%s%s%s %g\n", name, (*label ? "{" : ""), label, (*label ? "}" : ""), hist->sum / 1e6);
+	fprintf(stream, "%s_count%s%s%s %llu\n", name, (*label ? "{" : ""), label, (*label ? "}" : ""), (unsigned long long) hist->count);
+}
+
+void metrics_write_prometheus(FILE *stream) {
+
+	struct command_stats *cmd;
+	char label[CMDNAMELEN + 16];
+	int i, j;
+
+	if (!metrics)
+		return;
+
+	fprintf(stream, "# HELP irc_bot_uptime_seconds Seconds since the bot started\n# TYPE irc_bot_uptime_seconds gauge\n");
+	fprintf(stream, "irc_bot_uptime_seconds %llu\n", (unsigned long long) (monotonic_usec() - metrics->start_time) / 1000000);
+	fprintf(stream, "# HELP irc_bot_lines_per_second Lines parsed per second over the last minute\n# TYPE irc_bot_lines_per_second gauge\n");
+	fprintf(stream, "irc_bot_lines_per_second %g\n", lines_per_second());
+
+	for (i = 0; i < COUNTER_MAX; i++) {
+		fprintf(stream, "# HELP %s %s\n# TYPE %s counter\n", counter_info[i][0], counter_info[i][1], counter_info[i][0]);
+		fprintf(stream, "%s %llu\n", counter_info[i][0], (unsigned long long) metrics->counters[i]);
+	}
+	for (i = 0; i < GAUGE_MAX; i++) {
+		fprintf(stream, "# HELP %s %s\n# TYPE %s gauge\n", gauge_info[i][0], gauge_info[i][1], gauge_info[i][0]);
+		fprintf(stream, "%s %lld\n", gauge_info[i][0], (long long) metrics->gauges[i]);
+	}
+	for (i = 0; i < HISTOGRAM_MAX; i++) {
+		fprintf(stream, "# HELP %s %s\n# TYPE %s histogram\n", histogram_info[i][0], histogram_info[i][1], histogram_info[i][0]);
+		write_histogram(stream, histogram_info[i][0], "", &metrics->histograms[i]);
+	}
+	alloc_profile_write_prometheus(stream);
+	if (!metrics->command_count)
+		return;
+
+	fprintf(stream, "# HELP irc_bot_command_calls_total Times each bot command was run\n# TYPE irc_bot_command_calls_total counter\n");
+	for (i = 0; i < metrics->command_count; i++)
+		fprintf(stream, "irc_bot_command_calls_total{command=\"%s\"} %llu\n", metrics->commands[i].name,
+			(unsigned long long) metrics->commands[i].calls);
+
+	fprintf(stream, "# HELP irc_bot_command_forks_total Processes forked while running each command\n# TYPE irc_bot_command_forks_total counter\n");
+	for (i = 0; i < metrics->command_count; i++)
+		fprintf(stream, "irc_bot_command_forks_total{command=\"%s\"} %llu\n", metrics->commands[i].name,
+			(unsigned long long) metrics->commands[i].forks);
+
+	fprintf(stream, "# HELP irc_bot_command_http_responses_total HTTP responses by status class (\"error\" for failed transfers)\n"
+		"# TYPE irc_bot_command_http_responses_total counter\n");
+	for (i = 0; i < metrics->command_count; i++) {
+		cmd = &metrics->commands[i];
+		for (j = 0; j < 6; j++)
+			if (cmd->http_status[j])
+				fprintf(stream, "irc_bot_command_http_responses_total{command=\"%s\",code=\"%s\"} %llu\n", cmd->name,
+					http_class[j], (unsigned long long) cmd->http_status[j]);
+	}
+	fprintf(stream, "# HELP irc_bot_command_http_received_bytes_total HTTP body bytes received by each command\n"
+		"# TYPE irc_bot_command_http_received_bytes_total counter\n");
+	for (i = 0; i < metrics->command_count; i++)
+		fprintf(stream, "irc_bot_command_http_received_bytes_total{command=\"%s\"} %llu\n", metrics->commands[i].name,
+			(unsigned long long) metrics->commands[i].http_bytes);
+
+	fprintf(stream, "# HELP irc_bot_command_duration_seconds Wall time of each bot command\n# TYPE irc_bot_command_duration_seconds histogram\n");
+	for (i = 0; i < metrics->command_count; i++) {
+		snprintf(label, sizeof(label), "command=\"%s\"", metrics->commands[i].name);
+		write_histogram(stream, "irc_bot_command_duration_seconds", label, &metrics->commands[i].wall_time);
+	}
+}
+
+void metrics_serve(Http_request *req, Http_response *res) {
+
+	FILE *stream;
+
+	(void) req; // Silence unused variable warning
+
+	stream = open_memstream(&res->body, &res->len);
+	if (!stream) {
+		res->status = 500;
+		return;
+	}
+	metrics_write_prometheus(stream);
+	fclose(stream);
+	res->content_type = "text/plain; version=0.0.4";
+}
+
+STATIC char *format_usec(char *buf, size_t len, uint64_t usec) {
+
+	if (usec < 1000)
+		snprintf(buf, len, "%lluus", (unsigned long long) usec);
+	else if (usec < 1000000)
+		snprintf(buf, len, "%.1fms", usec / 1e3);
+	else
+		snprintf(buf, len, "%.2fs", usec / 1e6);
+
+	return buf;
+}
+
+void metrics_print_summary(Irc server, const char *target) {
+
+	struct command_stats *cmd, *top[3] = { NULL };
+	struct histogram *dispatch;
+	char p50[16], p99[16], line[IRCLEN / 2];
+	uint64_t uptime;
+	int i, j, len = 0;
+
+	if (!metrics)
+		return;
+
+	uptime = (monotonic_usec() - metrics->start_time) / 1000000;
+	dispatch = &metrics->histograms[DISPATCH_LATENCY];
+	send_message(server, target, "uptime %llud %02llu:%02llu, lines %llu (%.2f/s), sent %llu (%llu dropped), commands %llu, forks %llu (%llu failed)",
+		(unsigned long long) uptime / 86400, (unsigned long long) uptime % 86400 / 3600, (unsigned long long) uptime % 3600 / 60,
+		(unsigned long long) metrics->counters[LINES_PARSED], lines_per_second(),
+		(unsigned long long) metrics->counters[LINES_SENT], (unsigned long long) metrics->counters[SEND_FAILURES],
+		(unsigned long long) metrics->counters[COMMANDS], (unsigned long long) metrics->counters[FORKS],
+		(unsigned long long) metrics->counters[FORK_FAILURES]);
+
+	send_message(server, target, "dispatch p50 %s p99 %s, http %llu (%llu failed, %llu KB), mpd failures %llu, murmur failures %llu, send queue %lld B",
+		format_usec(p50, sizeof(p50), histogram_percentile(dispatch, 50)), format_usec(p99, sizeof(p99), histogram_percentile(dispatch, 99)),
+		(unsigned long long) metrics->counters[HTTP_REQUESTS], (unsigned long long) metrics->counters[HTTP_FAILURES],
+		(unsigned long long) metrics->counters[HTTP_BYTES] / 1024, (unsigned long long) metrics->counters[MPD_FAILURES],
+		(unsigned long long) metrics->counters[MURMUR_FAILURES], (long long) metrics->gauges[SEND_QUEUE_BYTES]);
+
+	// Keep the 3 most used commands sorted by calls
+	for (i = 0; i < metrics->command_count; i++) {
+		cmd = &metrics->commands[i];
+		for (j = SIZE(top) - 1; j >= 0 && (!top[j] || top[j]->calls < cmd->calls); j--)
+			if (j < SIZE(top) - 1)
+				top[j + 1] = top[j];
+
+		if (j < SIZE(top) - 1)
+			top[j + 1] = cmd;
+	}
+	for (i = 0; i < SIZE(top) && top[i] && top[i]->calls && len < (int) sizeof(line); i++)
+		len += snprintf(line + len, sizeof(line) - len, "%s%s: %llu calls p50 %s p99 %s", (i ? " | " : ""), top[i]->name,
+			(unsigned long long) top[i]->calls, format_usec(p50, sizeof(p50), histogram_percentile(&top[i]->wall_time, 50)),
+			format_usec(p99, sizeof(p99), histogram_percentile(&top[i]->wall_time, 99)));
+
+	if (len)
+		send_message(server, target, "%s", line);
+}
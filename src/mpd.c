@@ -8,6 +8,8 @@
 #include "socket.h"
 #include "irc.h"
 #include "mpd.h"
+#include "metrics.h"
+#include "probes.h"
 #include "common.h"
 
 extern int mpdfd;
@@ -139,8 +141,11 @@ int mpd_connect(const char *port) {
 	char buf[64];
 
 	mpd = sock_connect(LOCALHOST, port);
-	if (mpd < 0)
+	PROBE1(mpd_connect, mpd);
+	if (mpd < 0) {
+		metrics_count(MPD_FAILURES, 1);
 		return -1;
+	}
 
 	if (sock_read(mpd, buf, sizeof(buf) - 1) <= 0)
 		goto cleanup;
@@ -156,6 +161,7 @@ int mpd_connect(const char *port) {
 	return mpd; // Success
 
 cleanup:
+	metrics_count(MPD_FAILURES, 1);
 	close(mpd);
 	return -1;
 }
@@ -201,10 +207,15 @@ bool print_song(Irc server, const char *channel) {
 
 	static char old_song[SONG_TITLE_LEN];
 	char *song_title, buf[128 + 1];
+	ssize_t n;
 
-	if (sock_read_non_blocking(mpdfd, buf, 128) <= 0)
+	n = sock_read_non_blocking(mpdfd, buf, 128);
+	if (n <= 0)
 		goto cleanup;
 
+	buf[n] = '\0';
+	PROBE1(mpd_event, buf);
+
 	// Preserve the connection if "noidle" was issued
 	if (!starts_with(buf, "changed"))
 		return true;
@@ -226,6 +237,7 @@ bool print_song(Irc server, const char *channel) {
 		return true;
 
 cleanup:
+	metrics_count(MPD_FAILURES, 1);
 	close(mpdfd);
 	return false;
 }
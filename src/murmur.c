@@ -8,6 +8,8 @@
 #include "socket.h"
 #include "irc.h"
 #include "murmur.h"
+#include "metrics.h"
+#include "probes.h"
 #include "common.h"
 
 
@@ -24,8 +26,11 @@ STATIC int murmur_connect(const char *port) {
 	};
 
 	murmfd = sock_connect(LOCALHOST, port);
-	if (murmfd < 0)
+	PROBE1(murmur_connect, murmfd);
+	if (murmfd < 0) {
+		metrics_count(MURMUR_FAILURES, 1);
 		return -1;
+	}
 
 	if (sock_read(murmfd, read_buffer, READ_BUFFER_SIZE) != VALIDATE_CONNECTION_PACKET_SIZE) {
 		fprintf(stderr, "Error: Failed to receive validate_packet\n");
@@ -42,6 +47,7 @@ STATIC int murmur_connect(const char *port) {
 	return murmfd; // Everything succeeded
 
 cleanup:
+	metrics_count(MURMUR_FAILURES, 1);
 	close(murmfd);
 	return -1;
 }
@@ -79,6 +85,7 @@ bool add_murmur_callbacks(const char *port) {
 	return true; // Success
 
 cleanup:
+	metrics_count(MURMUR_FAILURES, 1);
 	close(murm_callbackfd);
 	return false;
 }
@@ -102,11 +109,13 @@ char *fetch_murmur_users(void) {
 
 	if (sock_write(murmfd, getUsers_packet, sizeof(getUsers_packet)) < 0) {
 		fprintf(stderr, "Error: Failed to send getUsers_packet\n");
+		metrics_count(MURMUR_FAILURES, 1);
 		close(murmfd);
 		return NULL;
 	}
 	if (sock_read(murmfd, read_buffer, USERLIST_BUFFER_SIZE) < 0) {
 		fprintf(stderr, "Error: Failed to receive getUsers_packet reply\n");
+		metrics_count(MURMUR_FAILURES, 1);
 		close(murmfd);
 		return NULL;
 	}
@@ -168,13 +177,15 @@ bool listen_murmur_callbacks(Irc server, int murm_acceptfd) {
 	errno = 0;
 	while (sock_read_non_blocking(murm_acceptfd, read_buffer, sizeof(read_buffer)) > 0) {
 		/* Close connection when related packet received */
-		if (read_buffer[8] == 0x4)
+		if (read_buffer[8] == 0x4) {
+			PROBE2(murmur_callback, read_buffer[8], NULL);
 			break;
-
+		}
 		/* Determine if received packet represents userConnected callback */
 		if (read_buffer[62] == 'C') {
 			username = read_buffer + 99;
 			username[(unsigned) *(username - 1)] = '\0';
+			PROBE2(murmur_callback, read_buffer[8], username);
 			send_message(server, default_channel(server), "Mumble: %s connected", username);
 		}
 	}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <openssl/rand.h>
+#include "paste.h"
+#include "common.h"
+
+struct paste_store {
+	pthread_mutex_t lock;
+	uint32_t next_entry;
+	uint32_t next_offset;
+	struct paste_entry entries[PASTE_SLOTS];
+	char text[PASTE_SIZE];
+};
+
+static struct paste_store *store;
+static const char *base;
+static int threshold;
+
+static void lock(void) {
+
+	// The owner may have died half way through a paste, drop them all rather than serve a torn one
+	if (!shared_mutex_lock(&store->lock)) {
+		fprintf(stderr, "paste: a worker died holding the lock, dropping every paste\n");
+		memset(store->entries, 0, sizeof(store->entries));
+		store->next_entry = store->next_offset = 0;
+	}
+}
+
+static void unlock(void) {
+
+	pthread_mutex_unlock(&store->lock);
+}
+
+/**
+ * Copy a paste out of the store, the text it points to can be overwritten as soon as the lock is released
+ *
+ * @returns  the text or NULL if it expired or was dropped
+ */
+STATIC char *paste_get(uint64_t id, size_t *len) {
+
+	struct paste_entry *e;
+	char *text;
+	bool found = false;
+	int i;
+
+	if (!store || !id)
+		return NULL;
+
+	text = MALLOC_W(PASTE_MAXLEN); // Not under the lock, it exits if it fails
+	lock();
+	for (i = 0; i < PASTE_SLOTS; i++) {
+		e = &store->entries[i];
+		if (e->id != id || e->expires <= time(NULL))
+			continue;
+
+		memcpy(text, store->text + e->offset, e->len);
+		*len = e->len;
+		found = true;
+		break;
+	}
+	unlock();
+
+	if (!found) {
+		free(text);
+		return NULL;
+	}
+	return *len ? REALLOC_W(text, *len) : text;
+}
+
+char *paste_store(const char *text, size_t len) {
+
+	struct paste_entry *e;
+	uint64_t id;
+	uint32_t start;
+	char *url;
+	int i;
+
+	if (!store || !RAND_bytes((unsigned char *) &id, sizeof(id)) || !id)
+		return NULL;
+
+	if (len > PASTE_MAXLEN)
+		len = PASTE_MAXLEN;
+
+	lock();
+	start = store->next_offset;
+	if (start + len > PASTE_SIZE)
+		start = 0;
+
+	// Drop the pastes we are about to overwrite, the oldest ones
+	for (i = 0; i < PASTE_SLOTS; i++) {
+		e = &store->entries[i];
+		if (e->id && e->offset < start + len && start < e->offset + e->len)
+			e->id = 0;
+	}
+	e = &store->entries[store->next_entry++ % PASTE_SLOTS];
+	memcpy(store->text + start, text, len);
+	e->id = id;
+	e->expires = time(NULL) + PASTE_TTL;
+	e->offset = start;
+	e->len = len;
+	store->next_offset = start + len;
+	unlock();
+
+	url = MALLOC_W(strlen(base) + 17);
+	sprintf(url, "%s%016" PRIx64, base, id);
+	return url;
+}
+
+static void paste_serve(Http_request *req, Http_response *res) {
+
+	const char *hex = req->path + strlen(PASTE_PATH);
+	char *end;
+	uint64_t id;
+
+	id = strtoull(hex, &end, 16);
+	if (end - hex != 16 || *end || !(res->body = paste_get(id, &res->len))) {
+		http_reply(res, 404, NULL, "%s", "Not found or expired\n");
+		return;
+	}
+	res->status = 200;
+}
+
+void paste_init(const char *base_url, int lines) {
+
+	if (!*base_url)
+		return;
+
+	store = mmap(NULL, sizeof(*store), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (store == MAP_FAILED) {
+		perror("paste: mmap");
+		store = NULL;
+		return;
+	}
+	shared_mutex_init(&store->lock);
+	base = base_url;
+	threshold = lines > 0 ? lines : 1;
+	httpd_route("GET", PASTE_PATH, paste_serve);
+}
+
+int paste_lines(void) {
+
+	return store ? threshold : 0;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "httpd.h"
+#include "profiler.h"
+#include "common.h"
+
+struct stack {
+	uint64_t hash; //!< Zero if the slot is free
+	uint32_t count;
+	uint32_t ready; //!< Set once the frames have been copied
+	int depth;
+	char tag[PROFILE_TAGLEN];
+	void *frames[PROFILE_DEPTH];
+};
+
+struct profile {
+	uint64_t samples;
+	uint64_t dropped;
+	struct stack stacks[PROFILE_STACKS];
+};
+
+static struct profile *profile;
+static char tag[PROFILE_TAGLEN] = "main";
+static struct itimerval timer;
+
+static uint64_t hash_stack(void **frames, int depth) {
+
+	uint64_t hash = 14695981039346656037llu; // FNV-1a
+	int i;
+
+	for (i = 0; i < depth; i++)
+		hash = (hash ^ (uintptr_t) frames[i]) * 1099511628211llu;
+
+	for (i = 0; i < PROFILE_TAGLEN && tag[i]; i++)
+		hash = (hash ^ (unsigned char) tag[i]) * 1099511628211llu;
+
+	return hash ? hash : 1;
+}
+
+static void sample(int sig) {
+
+	void *frames[PROFILE_DEPTH + 2];
+	struct stack *stack;
+	uint64_t hash;
+	int depth, i;
+
+	(void) sig;
+	__sync_fetch_and_add(&profile->samples, 1);
+
+	// Skip this handler and the signal trampoline
+	depth = backtrace(frames, SIZE(frames)) - 2;
+	if (depth <= 0)
+		return;
+
+	hash = hash_stack(frames + 2, depth);
+	for (i = 0; i < PROFILE_STACKS; i++) {
+		stack = &profile->stacks[(hash + i) % PROFILE_STACKS];
+		if (stack->hash == hash) {
+			__sync_fetch_and_add(&stack->count, 1);
+			return;
+		}
+		if (!stack->hash && __sync_bool_compare_and_swap(&stack->hash, 0, hash)) {
+			stack->depth = depth;
+			memcpy(stack->tag, tag, PROFILE_TAGLEN);
+			memcpy(stack->frames, frames + 2, depth * sizeof(void *));
+			__sync_synchronize();
+			stack->ready = 1;
+			__sync_fetch_and_add(&stack->count, 1);
+			return;
+		}
+		if (stack->hash == hash) { // Another process inserted the same stack first
+			__sync_fetch_and_add(&stack->count, 1);
+			return;
+		}
+	}
+	__sync_fetch_and_add(&profile->dropped, 1);
+}
+
+static void write_profile_file(void) {
+
+	FILE *file;
+
+	file = fopen(PROFILE_FILE, "w");
+	if (!file) {
+		perror(PROFILE_FILE);
+		return;
+	}
+	profiler_write_collapsed(file);
+	fclose(file);
+}
+
+void profiler_init(int hz) {
+
+	struct sigaction sa;
+	void *frames[1];
+
+	if (hz <= 0)
+		return;
+
+	profile = mmap(NULL, sizeof(*profile), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (profile == MAP_FAILED) {
+		perror("profiler: mmap");
+		profile = NULL;
+		return;
+	}
+	// The first backtrace() call loads libgcc, which must not happen inside the signal handler
+	backtrace(frames, 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = sample;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGPROF, &sa, NULL);
+
+	if (hz > 1000)
+		hz = 1000;
+
+	timer.it_interval.tv_sec  = hz == 1;
+	timer.it_interval.tv_usec = hz == 1 ? 0 : 1000000 / hz;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, NULL) < 0)
+		perror("setitimer");
+
+	atexit(write_profile_file); // Workers leave with _exit(), only the main process writes the file
+}
+
+void profiler_worker_start(const char *command) {
+
+	if (!profile)
+		return;
+
+	snprintf(tag, PROFILE_TAGLEN, "%s", command);
+	if (setitimer(ITIMER_PROF, &timer, NULL) < 0)
+		perror("setitimer");
+}
+
+static void write_frame(FILE *stream, void *frame, bool caller) {
+
+	Dl_info info;
+	const char *module;
+
+	// Return addresses point after the call instruction, step back inside it for callers
+	if (caller)
+		frame = (char *) frame - 1;
+
+	if (!dladdr(frame, &info) || !info.dli_fname) {
+		fprintf(stream, "%p", frame);
+		return;
+	}
+	if (info.dli_sname) {
+		fputs(info.dli_sname, stream);
+		return;
+	}
+	module = strrchr(info.dli_fname, '/');
+	fprintf(stream, "%s+%#lx", (module ? module + 1 : info.dli_fname),
+		(unsigned long) ((char *) frame - (char *) info.dli_fbase));
+}
+
+void profiler_write_collapsed(FILE *stream) {
+
+	struct stack *stack;
+	int i, j;
+
+	if (!profile)
+		return;
+
+	for (i = 0; i < PROFILE_STACKS; i++) {
+		stack = &profile->stacks[i];
+		if (!stack->ready)
+			continue;
+
+		fprintf(stream, "%.*s", PROFILE_TAGLEN, stack->tag);
+		for (j = stack->depth - 1; j >= 0; j--) {
+			fputc(';', stream);
+			write_frame(stream, stack->frames[j], j > 0);
+		}
+		fprintf(stream, " %u\n", stack->count);
+	}
+}
+
+void profiler_serve(Http_request *req, Http_response *res) {
+
+	FILE *stream;
+
+	(void) req;
+
+	if (!profile) {
+		http_reply(res, 404, NULL, "%s\n", "Profiler disabled. Start the bot with --profile[=hz]");
+		return;
+	}
+	stream = open_memstream(&res->body, &res->len);
+	if (!stream) {
+		res->status = 500;
+		return;
+	}
+	profiler_write_collapsed(stream);
+	fprintf(stream, "# %llu samples, %llu dropped\n", (unsigned long long) profile->samples, (unsigned long long) profile->dropped);
+	fclose(stream);
+	res->content_type = "text/plain";
+}
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "irc.h"
+#include "bot.h"
+#include "quotes.h"
+#include "common.h"
+
+struct ring_line {
+	char nick[NICKLEN];
+	char text[IRCLEN];
+};
+
+struct channel_ring {
+	char channel[CHANLEN];
+	struct ring_line lines[QUOTE_RING];
+	int next;
+};
+
+static char data_path[PATHLEN], index_path[PATHLEN + 4];
+static const char *data;
+static const struct quote_entry *entries;
+static size_t data_size, index_size;
+static uint32_t quote_count;
+static struct channel_ring rings[MAXCHANS];
+
+static void *map_file(const char *path, size_t *size) {
+
+	struct stat st;
+	void *map;
+	int fd;
+
+	*size = 0;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	*size = st.st_size;
+	return map;
+}
+
+/** Map the files again if they grew since they were mapped */
+static void quotes_refresh(void) {
+
+	struct stat st;
+
+	if (!stat(index_path, &st) && (size_t) st.st_size == index_size && entries)
+		return;
+
+	if (data)
+		munmap((void *) data, data_size);
+	if (entries)
+		munmap((void *) entries, index_size);
+
+	// The index is written after the data, map it first so every entry points inside the data we map
+	entries = map_file(index_path, &index_size);
+	data = map_file(data_path, &data_size);
+	quote_count = data ? index_size / sizeof(*entries) : 0;
+}
+
+/** @returns  the quote or NULL if id is out of range or the entry is damaged */
+static const struct quote_entry *get_quote(uint32_t id) {
+
+	const struct quote_entry *e;
+
+	if (!id || id > quote_count)
+		return NULL;
+
+	e = &entries[id - 1];
+	if (e->offset + e->len >= data_size || data[e->offset + e->len])
+		return NULL;
+
+	return e;
+}
+
+/** Append a quote and it's index entry under an exclusive lock. Returns the new ID or 0 on failure */
+STATIC uint32_t quote_append(const char *text, size_t len, const char *added_by) {
+
+	struct quote_entry e;
+	struct stat st;
+	int ifd, dfd = -1;
+	off_t end;
+	uint32_t id = 0;
+
+	ifd = open(index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (ifd < 0) {
+		perror(index_path);
+		return 0;
+	}
+	if (flock(ifd, LOCK_EX) < 0 || fstat(ifd, &st) < 0)
+		goto cleanup;
+
+	dfd = open(data_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	end = dfd < 0 ? -1 : lseek(dfd, 0, SEEK_END);
+	if (end < 0) {
+		perror(data_path);
+		goto cleanup;
+	}
+	memset(&e, 0, sizeof(e));
+	e.offset = end;
+	e.len = len;
+	e.time = time(NULL);
+	snprintf(e.added_by, NICKLEN, "%s", added_by);
+
+	// Data must be on disk before the entry that points to it
+	if (pwrite(dfd, text, len, end) != (ssize_t) len || pwrite(dfd, "", 1, end + len) != 1 || fdatasync(dfd) < 0) {
+		perror(data_path);
+		goto cleanup;
+	}
+	// A partial entry left by a crash is overwritten
+	st.st_size -= st.st_size % sizeof(e);
+	if (pwrite(ifd, &e, sizeof(e), st.st_size) != sizeof(e)) {
+		perror(index_path);
+		goto cleanup;
+	}
+	id = st.st_size / sizeof(e) + 1;
+
+cleanup:
+	if (dfd >= 0)
+		close(dfd);
+	close(ifd); // Releases the lock
+	return id;
+}
+
+void quotes_init(const char *path) {
+
+	int i;
+
+	if (!*path)
+		return;
+
+	snprintf(data_path, PATHLEN, "%s", path);
+	snprintf(index_path, sizeof(index_path), "%s.idx", path);
+	quotes_refresh();
+	if (quote_count)
+		return;
+
+	for (i = 0; i < cfg.quote_count; i++)
+		quote_append(cfg.quotes[i], strlen(cfg.quotes[i]), "config");
+	quotes_refresh();
+}
+
+void quote_remember(const char *channel, size_t channel_len, const char *nick, const char *text) {
+
+	struct channel_ring *ring = NULL;
+	struct ring_line *line;
+	int i;
+
+	if (!*data_path || channel_len >= CHANLEN)
+		return;
+
+	for (i = 0; i < MAXCHANS && *rings[i].channel; i++) {
+		if (strlen(rings[i].channel) == channel_len && !strncasecmp(rings[i].channel, channel, channel_len)) {
+			ring = &rings[i];
+			break;
+		}
+	}
+	if (!ring) {
+		if (i == MAXCHANS)
+			return;
+
+		ring = &rings[i];
+		memcpy(ring->channel, channel, channel_len);
+	}
+	line = &ring->lines[ring->next];
+	ring->next = (ring->next + 1) % QUOTE_RING;
+	snprintf(line->nick, NICKLEN, "%s", nick);
+	snprintf(line->text, IRCLEN, "%s", text);
+}
+
+/** Send each line of a quote straight from the mapping. The first line can be prefixed */
+static void print_quote(Irc server, const char *target, const struct quote_entry *e, const char *prefix) {
+
+	const char *p = data + e->offset, *end = p + e->len;
+	size_t len;
+
+	while (p < end) {
+		len = strcspn(p, "\n");
+		if (len)
+			send_message(server, target, "%s%.*s", prefix, (int) len, p);
+		p += len + 1;
+		prefix = "";
+	}
+}
+
+void bot_fail(Irc server, Parsed_data pdata) {
+
+	const struct quote_entry *e;
+	const char *p, *end;
+	size_t len;
+	int clr_r;
+
+	quotes_refresh();
+	if (!quote_count)
+		return;
+
+	// Make sure the seed is different even if we call the command twice in a second
+	srand(time(NULL) + getpid());
+	e     = get_quote(rand() % quote_count + 1);
+	clr_r = rand() % COLORCOUNT;
+	if (!e)
+		return;
+
+	for (p = data + e->offset, end = p + e->len; p < end; p += len + 1) {
+		len = strcspn(p, "\n");
+		if (!len)
+			return;
+
+		send_message(server, pdata.target, COLOR "%d%.*s", clr_r, (int) len, p);
+	}
+}
+
+/** Newest first. Every word must appear in the quote, case insensitive */
+static void search_quotes(Irc server, const char *target, char **words, int count) {
+
+	char ids[QUOTE_MATCHES * 12 + 1] = "";
+	const struct quote_entry *e, *newest = NULL;
+	uint32_t id, newest_id = 0;
+	int i, found = 0;
+	size_t len = 0;
+
+	for (id = quote_count; id > 0 && found <= QUOTE_MATCHES; id--) {
+		e = get_quote(id);
+		if (!e)
+			continue;
+		for (i = 0; i < count && strcasestr(data + e->offset, words[i]); i++);
+		if (i < count)
+			continue;
+
+		if (!found++) {
+			newest = e;
+			newest_id = id;
+		} else if (found <= QUOTE_MATCHES)
+			len += snprintf(ids + len, sizeof(ids) - len, " #%u", id);
+	}
+	if (!newest) {
+		send_message(server, target, "%s", "no quotes found");
+		return;
+	}
+	snprintf(ids + len, sizeof(ids) - len, "%s", found > QUOTE_MATCHES ? " ..." : "");
+	print_quote(server, target, newest, "");
+	if (found > 1)
+		send_message(server, target, "#%u, also:%s", newest_id, ids);
+}
+
+void quote(Irc server, Parsed_data pdata) {
+
+	const struct quote_entry *e;
+	char **argv, *end, prefix[16];
+	unsigned long id;
+	int argc;
+
+	quotes_refresh();
+	if (!quote_count)
+		return;
+
+	argc = extract_params(pdata.message, &argv);
+	if (argc == 1 && (id = strtoul(*argv[0] == '#' ? argv[0] + 1 : argv[0], &end, 10), !*end)) {
+		e = get_quote(id);
+		if (e) {
+			snprintf(prefix, sizeof(prefix), "#%lu ", id);
+			print_quote(server, pdata.target, e, prefix);
+		} else
+			send_message(server, pdata.target, "quote #%lu doesn't exist, there are %u", id, quote_count);
+	} else if (argc)
+		search_quotes(server, pdata.target, argv, argc);
+	else {
+		srand(time(NULL) + getpid());
+		id = rand() % quote_count + 1;
+		e = get_quote(id);
+		snprintf(prefix, sizeof(prefix), "#%lu ", id);
+		if (e)
+			print_quote(server, pdata.target, e, prefix);
+	}
+	if (argc)
+		free(argv);
+}
+
+void addquote(Irc server, Parsed_data pdata) {
+
+	char text[QUOTE_MAXLEN + 1], *s;
+	size_t len = 0;
+	uint32_t id;
+
+	if (!*data_path)
+		return;
+
+	if (!pdata.message || !*pdata.message) {
+		send_message(server, pdata.target, "%s", "usage: !addquote text, a literal \\n starts a new line");
+		return;
+	}
+	// Turn "\n" into new lines
+	for (s = pdata.message; *s && len < QUOTE_MAXLEN; s++) {
+		if (s[0] == '\\' && s[1] == 'n') {
+			text[len++] = '\n';
+			s++;
+		} else
+			text[len++] = *s;
+	}
+	if (*s) {
+		send_message(server, pdata.target, "quote too long, the limit is %d bytes", QUOTE_MAXLEN);
+		return;
+	}
+	id = quote_append(text, len, pdata.sender);
+	if (id)
+		send_message(server, pdata.target, "added quote #%u", id);
+}
+
+void grab(Irc server, Parsed_data pdata) {
+
+	char **argv, text[QUOTE_MAXLEN];
+	struct channel_ring *ring = NULL;
+	struct ring_line *line = NULL;
+	uint32_t id;
+	int argc, i, len;
+
+	if (!*data_path)
+		return;
+
+	argc = extract_params(pdata.message, &argv);
+	if (argc != 1) {
+		send_message(server, pdata.target, "%s", "usage: !grab nick");
+		goto cleanup;
+	}
+	for (i = 0; i < MAXCHANS && !ring; i++)
+		if (!strcasecmp(rings[i].channel, pdata.target))
+			ring = &rings[i];
+
+	// Walk back from the newest line. The copy we got at fork time doesn't change under us
+	for (i = 1; ring && i <= QUOTE_RING; i++) {
+		line = &ring->lines[(ring->next - i + QUOTE_RING) % QUOTE_RING];
+		if (!strcasecmp(line->nick, argv[0]))
+			break;
+		line = NULL;
+	}
+	if (!line) {
+		send_message(server, pdata.target, "%s hasn't said anything lately", argv[0]);
+		goto cleanup;
+	}
+	len = snprintf(text, sizeof(text), "<%s> %s", line->nick, line->text);
+	id = quote_append(text, len < (int) sizeof(text) ? len : (int) sizeof(text) - 1, pdata.sender);
+	if (id)
+		send_message(server, pdata.target, "added quote #%u", id);
+
+cleanup:
+	if (argc)
+		free(argv);
+}
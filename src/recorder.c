@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "recorder.h"
+#include "common.h"
+
+struct recorder {
+	uint64_t next; //!< Sequence number of the next event
+	struct recorder_event events[RECORDER_EVENTS];
+};
+
+static struct recorder *ring;
+static char dump_path[PATHLEN];
+
+static const int fatal_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM };
+
+static uint64_t realtime_usec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void record(enum recorder_type type, pid_t pid, int32_t value, const char *data, size_t len) {
+
+	struct recorder_event *event;
+	uint64_t seq;
+
+	if (!ring)
+		return;
+
+	// Claim a slot. Writers racing for the same slot after a full wrap only cost us that older event
+	seq = __sync_fetch_and_add(&ring->next, 1);
+	event = &ring->events[seq % RECORDER_EVENTS];
+	event->seq = 0; // Mark it incomplete while we fill it
+
+	if (!data)
+		len = 0;
+	if (len > RECORDER_DATALEN)
+		len = RECORDER_DATALEN;
+
+	event->time  = realtime_usec();
+	event->pid   = pid;
+	event->value = value;
+	event->type  = type;
+	event->len   = len;
+	memcpy(event->data, data, len);
+
+	__sync_synchronize();
+	event->seq = seq + 1;
+}
+
+void recorder_event(enum recorder_type type, int32_t value, const char *data, size_t len) {
+
+	record(type, getpid(), value, data, len);
+}
+
+void recorder_text(enum recorder_type type, int32_t value, const char *text) {
+
+	record(type, getpid(), value, text, text ? strlen(text) : 0);
+}
+
+void recorder_dump(const char *reason) {
+
+	struct recorder_header header = { .magic = RECORDER_MAGIC };
+	const char *buf;
+	size_t left;
+	ssize_t n;
+	int fd;
+
+	if (!ring)
+		return;
+
+	header.events     = RECORDER_EVENTS;
+	header.event_size = sizeof(struct recorder_event);
+	header.time       = realtime_usec();
+	header.pid        = getpid();
+	strncpy(header.reason, reason, sizeof(header.reason) - 1);
+
+	fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+
+	if (write(fd, &header, sizeof(header)) == sizeof(header)) {
+		buf = (const char *) ring->events;
+		left = sizeof(ring->events);
+		while (left > 0) {
+			n = write(fd, buf, left);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+
+			buf += n;
+			left -= n;
+		}
+	}
+	close(fd);
+}
+
+static void dump_on_signal(int sig) {
+
+	int saved_errno = errno;
+	const char *reason;
+
+	switch (sig) {
+	case SIGUSR1: reason = "SIGUSR1"; break;
+	case SIGSEGV: reason = "SIGSEGV"; break;
+	case SIGBUS:  reason = "SIGBUS";  break;
+	case SIGFPE:  reason = "SIGFPE";  break;
+	case SIGILL:  reason = "SIGILL";  break;
+	case SIGABRT: reason = "SIGABRT"; break;
+	default:      reason = "SIGTERM";
+	}
+	recorder_event(REC_SIGNAL, sig, reason, strlen(reason));
+	recorder_dump(reason);
+
+	// The handler has been reset by SA_RESETHAND, let the default action kill us (and leave a core)
+	if (sig != SIGUSR1)
+		raise(sig);
+
+	errno = saved_errno;
+}
+
+static void reap_children(int sig) {
+
+	int saved_errno = errno, status;
+	pid_t pid;
+
+	(void) sig;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+		record(REC_CHILD_EXIT, pid, status, NULL, 0);
+
+	errno = saved_errno;
+}
+
+void recorder_init(const char *dump_file) {
+
+	struct sigaction sa;
+	int i;
+
+	if (!dump_file || !*dump_file)
+		return;
+
+	ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED) {
+		perror("recorder: mmap");
+		ring = NULL;
+		return;
+	}
+	snprintf(dump_path, PATHLEN, "%s", dump_file);
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = dump_on_signal;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	sa.sa_flags = SA_RESETHAND;
+	for (i = 0; i < SIZE(fatal_signals); i++)
+		sigaction(fatal_signals[i], &sa, NULL);
+
+	// Reap the workers ourselves instead of ignoring SIGCHLD, so their exit status ends up in the ring
+	sa.sa_handler = reap_children;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, NULL);
+}
@@ -0,0 +1,606 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "irc.h"
+#include "remind.h"
+#include "common.h"
+
+#define HEADER_SIZE ((off_t) sizeof(struct remind_header))
+
+/** A pending reminder and it's place in the heap */
+struct reminder {
+	struct remind_record rec;
+	uint32_t heap_pos;
+};
+
+static char log_path[PATHLEN];
+static int log_fd = -1;
+static off_t log_offset; //!< Records before this were loaded
+static uint32_t dead;    //!< Records in the log that aren't pending reminders
+
+static struct reminder *pool;
+static uint32_t *heap; //!< Pool indexes, min-heap on due time
+static uint32_t count, size;
+static int32_t *by_id; //!< Open addressing on the id, pool index or -1 for empty slots
+static uint32_t id_slots;
+
+static uint64_t now_msec(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static bool before(uint32_t a, uint32_t b) {
+
+	return pool[a].rec.due < pool[b].rec.due || (pool[a].rec.due == pool[b].rec.due && pool[a].rec.id < pool[b].rec.id);
+}
+
+static void heap_swap(uint32_t i, uint32_t j) {
+
+	uint32_t temp = heap[i];
+
+	heap[i] = heap[j];
+	heap[j] = temp;
+	pool[heap[i]].heap_pos = i;
+	pool[heap[j]].heap_pos = j;
+}
+
+static void sift_up(uint32_t i) {
+
+	for (; i > 0 && before(heap[i], heap[(i - 1) / 2]); i = (i - 1) / 2)
+		heap_swap(i, (i - 1) / 2);
+}
+
+static void sift_down(uint32_t i) {
+
+	uint32_t smallest, child;
+
+	for (;;) {
+		smallest = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2 && child < count; child++)
+			if (before(heap[child], heap[smallest]))
+				smallest = child;
+		if (smallest == i)
+			return;
+
+		heap_swap(i, smallest);
+		i = smallest;
+	}
+}
+
+/** @returns  the id's slot or the empty slot where it would go */
+static uint32_t id_slot(uint32_t id) {
+
+	uint32_t i;
+
+	for (i = id & (id_slots - 1); by_id[i] >= 0 && pool[by_id[i]].rec.id != id; i = (i + 1) & (id_slots - 1));
+	return i;
+}
+
+static bool id_home(void *table, uint32_t slot, uint32_t *home) {
+
+	(void) table;
+	if (by_id[slot] < 0)
+		return false;
+
+	*home = pool[by_id[slot]].rec.id & (id_slots - 1);
+	return true;
+}
+
+static void id_move(void *table, uint32_t from, uint32_t to) {
+
+	(void) table;
+	by_id[to] = by_id[from];
+}
+
+/** Empty an id slot and shift back the rest of it's probe run */
+static void id_remove(uint32_t i) {
+
+	by_id[probe_remove(NULL, i, id_slots - 1, id_home, id_move)] = -1;
+}
+
+/** Double everything, the id table is rebuilt at half load */
+static void grow(void) {
+
+	uint32_t i;
+
+	size = size ? size * 2 : 64;
+	pool = REALLOC_W(pool, size * sizeof(*pool));
+	heap = REALLOC_W(heap, size * sizeof(*heap));
+
+	free(by_id);
+	id_slots = size * 2;
+	by_id = MALLOC_W(id_slots * sizeof(*by_id));
+	memset(by_id, 0xff, id_slots * sizeof(*by_id));
+	for (i = 0; i < count; i++)
+		by_id[id_slot(pool[i].rec.id)] = i;
+}
+
+static void add_reminder(const struct remind_record *rec) {
+
+	uint32_t slot;
+
+	if (count && by_id[id_slot(rec->id)] >= 0)
+		return;
+	if (count == size)
+		grow();
+
+	pool[count].rec = *rec;
+	pool[count].heap_pos = count;
+	heap[count] = count;
+	by_id[id_slot(rec->id)] = count;
+	slot = count++;
+	sift_up(slot);
+}
+
+/** Take the reminder out of the heap and the id table, then move the last one of the pool in it's place */
+static void remove_reminder(uint32_t index) {
+
+	uint32_t pos = pool[index].heap_pos, last = count - 1;
+
+	id_remove(id_slot(pool[index].rec.id));
+	heap_swap(pos, last);
+	count--;
+	if (pos < count) {
+		sift_down(pos);
+		sift_up(pos);
+	}
+	if (index != last) {
+		pool[index] = pool[last];
+		heap[pool[index].heap_pos] = index;
+		by_id[id_slot(pool[index].rec.id)] = index;
+	}
+}
+
+static struct reminder *find_reminder(uint32_t id) {
+
+	int32_t index;
+
+	if (!count)
+		return NULL;
+
+	index = by_id[id_slot(id)];
+	return index < 0 ? NULL : &pool[index];
+}
+
+static void apply(const struct remind_record *rec) {
+
+	struct reminder *r;
+
+	if (rec->op == REMIND_ADD)
+		add_reminder(rec);
+	else {
+		r = find_reminder(rec->id);
+		if (r)
+			remove_reminder(r - pool);
+		dead += 2; // This record and the one that added it
+	}
+}
+
+/** Apply the whole records appended since the last time. A partial one at the end is read next time */
+static void load_new(void) {
+
+	struct remind_record recs[64];
+	struct stat st;
+	ssize_t n;
+	int i;
+
+	if (fstat(log_fd, &st) < 0)
+		return;
+
+	while (st.st_size - log_offset >= (off_t) sizeof(*recs)) {
+		n = pread(log_fd, recs, sizeof(recs), log_offset);
+		if (n < (ssize_t) sizeof(*recs))
+			return;
+
+		n /= sizeof(*recs);
+		for (i = 0; i < n; i++)
+			apply(&recs[i]);
+		log_offset += n * sizeof(*recs);
+	}
+}
+
+/** Open the log and lock it, again if it was replaced while we waited for the lock */
+static int lock_log(void) {
+
+	struct stat st, current;
+	int fd;
+
+	for (;;) {
+		fd = open(log_path, O_RDWR | O_CLOEXEC);
+		if (fd < 0 || flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0 || stat(log_path, &current) < 0) {
+			perror(log_path);
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+		if (st.st_ino == current.st_ino)
+			return fd;
+
+		close(fd);
+	}
+}
+
+/**
+ * Append records with one write under the lock, giving a new id to the ones that add a reminder
+ *
+ * @param sync  Wait for the disk. Only the adds are worth it, a lost done record just fires a reminder twice
+ */
+static bool append_records(struct remind_record *recs, uint32_t n, bool sync) {
+
+	struct remind_header h;
+	struct stat st;
+	bool adds = false;
+	ssize_t len = n * sizeof(*recs);
+	uint32_t i;
+	off_t end;
+	int fd;
+
+	fd = lock_log();
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || pread(fd, &h, sizeof(h), 0) != sizeof(h))
+		goto error;
+
+	for (i = 0; i < n; i++) {
+		if (recs[i].op == REMIND_ADD) {
+			recs[i].id = h.next_id++;
+			adds = true;
+		}
+	}
+	if (adds && pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+		goto error;
+
+	// A partial record left by a crash is overwritten
+	end = st.st_size - (st.st_size - HEADER_SIZE) % sizeof(*recs);
+	if (pwrite(fd, recs, len, end) != len || (sync && fdatasync(fd) < 0))
+		goto error;
+
+	close(fd); // Releases the lock
+	return true;
+
+error:
+	perror(log_path);
+	close(fd);
+	return false;
+}
+
+/**
+ * Append a record, giving it a new id if it adds a reminder
+ *
+ * @param sync  Same as append_records()
+ * @returns     the id or 0 on failure
+ */
+STATIC uint32_t remind_append(struct remind_record *rec, bool sync) {
+
+	return append_records(rec, 1, sync) ? rec->id : 0;
+}
+
+/** Rewrite the log with the pending reminders only. The lock keeps the workers out until it's replaced */
+static void compact(void) {
+
+	struct remind_header h;
+	char tmp[PATHLEN + 8];
+	uint32_t i;
+	int fd, new_fd;
+	FILE *file;
+
+	fd = lock_log();
+	if (fd < 0)
+		return;
+
+	load_new();
+	snprintf(tmp, sizeof(tmp), "%s.tmp", log_path);
+	file = fopen(tmp, "w");
+	if (!file || pread(fd, &h, sizeof(h), 0) != sizeof(h) || fwrite(&h, sizeof(h), 1, file) != 1)
+		goto error;
+
+	for (i = 0; i < count; i++)
+		if (fwrite(&pool[i].rec, sizeof(pool[i].rec), 1, file) != 1)
+			goto error;
+
+	if (fflush(file) || fsync(fileno(file)) < 0 || rename(tmp, log_path) < 0)
+		goto error;
+
+	fclose(file);
+	new_fd = open(log_path, O_RDONLY | O_CLOEXEC);
+	if (new_fd < 0) {
+		perror(log_path);
+		close(fd);
+		return;
+	}
+	close(log_fd);
+	log_fd = new_fd;
+	log_offset = HEADER_SIZE + count * sizeof(struct remind_record);
+	dead = 0;
+	close(fd);
+	return;
+
+error:
+	perror(tmp);
+	if (file)
+		fclose(file);
+	close(fd);
+}
+
+void reminders_init(const char *path) {
+
+	struct remind_header h;
+	struct stat st;
+	int fd;
+
+	if (!*path)
+		return;
+
+	snprintf(log_path, PATHLEN, "%s", path);
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		return;
+	}
+	if (!st.st_size) {
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, REMIND_MAGIC, sizeof(h.magic));
+		h.next_id = 1;
+		if (write(fd, &h, sizeof(h)) != sizeof(h)) {
+			perror(path);
+			close(fd);
+			return;
+		}
+	} else if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || memcmp(h.magic, REMIND_MAGIC, sizeof(h.magic))) {
+		fprintf(stderr, "%s: not a reminder log, reminders disabled\n", path);
+		close(fd);
+		return;
+	}
+	log_fd = fd;
+	log_offset = HEADER_SIZE;
+	load_new();
+}
+
+static int compare_targets(const void *a, const void *b) {
+
+	const struct remind_record *x = a, *y = b;
+	int diff = strcasecmp(x->target, y->target);
+
+	return diff ? diff : x->due < y->due ? -1 : x->due > y->due;
+}
+
+/** Every reminder due on a target goes in one batch of lines if there's more than one or they're late */
+static void deliver(Irc server, const struct remind_record *due, uint32_t n, uint32_t now) {
+
+	char line[IRCLEN - 100], late[32];
+	uint32_t i, j;
+	bool first;
+	int len;
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && !strcasecmp(due[j].target, due[i].target); j++);
+		if (j - i == 1 && now - due[i].due < REMIND_LATE) {
+			format_duration(late, sizeof(late), now - due[i].created);
+			send_message(server, due[i].target, "%s: reminder from %s ago: %s", due[i].nick, late, due[i].text);
+			continue;
+		}
+		len = snprintf(line, sizeof(line), "%s", "missed reminders: ");
+		for (first = true; i < j; i++, first = false) {
+			format_duration(late, sizeof(late), now - due[i].due);
+			if (!first && len + strlen(due[i].nick) + strlen(due[i].text) + 24 >= sizeof(line)) {
+				send_message(server, due[i].target, "%s", line);
+				len = 0;
+				first = true;
+			}
+			len += snprintf(line + len, sizeof(line) - len, "%s%s: %s (%s late)", first ? "" : " | ", due[i].nick,
+				due[i].text, late);
+		}
+		send_message(server, due[j - 1].target, "%s", line);
+	}
+}
+
+void reminders_poll(Irc server) {
+
+	struct remind_record *due = NULL;
+	uint32_t id, now = now_msec() / 1000, n = 0, due_size = 0, i;
+
+	if (log_fd < 0)
+		return;
+
+	load_new();
+	if (!is_connected(server) || !count || pool[heap[0]].rec.due > now)
+		goto compact;
+
+	while (count && pool[heap[0]].rec.due <= now) {
+		if (n == due_size) {
+			due_size = due_size ? due_size * 2 : 16;
+			due = REALLOC_W(due, due_size * sizeof(*due));
+		}
+		due[n++] = pool[heap[0]].rec;
+		remove_reminder(heap[0]);
+	}
+	qsort(due, n, sizeof(*due), compare_targets);
+	deliver(server, due, n, now);
+
+	// Turn the batch into its done records, they are all appended at once
+	for (i = 0; i < n; i++) {
+		id = due[i].id;
+		memset(&due[i], 0, sizeof(due[i]));
+		due[i].op = REMIND_DONE;
+		due[i].id = id;
+	}
+	append_records(due, n, false);
+	free(due);
+
+compact:
+	if (dead >= REMIND_COMPACT && dead > count)
+		compact();
+}
+
+int reminders_timeout(Irc server) {
+
+	uint64_t due, now = now_msec();
+
+	if (log_fd < 0 || !count || !is_connected(server))
+		return -1;
+
+	due = pool[heap[0]].rec.due * 1000ULL;
+	return due <= now ? 0 : due - now > INT_MAX ? INT_MAX : (int) (due - now);
+}
+
+/**
+ * Understand "2h", "1d12h30m", "18:30", "tomorrow", "tomorrow 09:00", "2025-05-01" and "2025-05-01 09:00"
+ *
+ * @param due  Filled with the time
+ * @returns    The text after the time or NULL if there's no time in the future
+ */
+STATIC char *parse_when(char *s, time_t now, time_t *due) {
+
+	struct tm tm;
+	long n, total = 0;
+	int year, month, day, hour = 9, min = 0, len;
+	bool date = false;
+	char unit;
+
+	localtime_r(&now, &tm);
+	if (sscanf(s, "%4d-%2d-%2d%n", &year, &month, &day, &len) == 3 && (s[len] == ' ' || !s[len])) {
+		tm.tm_year = year - 1900;
+		tm.tm_mon = month - 1;
+		tm.tm_mday = day;
+		date = true;
+		s += len;
+	} else if (starts_case_with(s, "tomorrow") && (s[8] == ' ' || !s[8])) {
+		tm.tm_mday++;
+		date = true;
+		s += 8;
+	} else {
+		while (*s >= '0' && *s <= '9' && sscanf(s, "%ld%c%n", &n, &unit, &len) == 2 && strchr("wdhms", unit)) {
+			total += n * (unit == 'w' ? 604800 : unit == 'd' ? 86400 : unit == 'h' ? 3600 : unit == 'm' ? 60 : 1);
+			s += len;
+		}
+		if (total > 0 && (*s == ' ' || !*s)) {
+			*due = now + total;
+			return s + strspn(s, " ");
+		}
+	}
+	s += strspn(s, " ");
+	if (sscanf(s, "%2d:%2d%n", &hour, &min, &len) == 2 && (s[len] == ' ' || !s[len])) {
+		if (hour > 23 || min > 59)
+			return NULL;
+		s += len;
+	} else if (!date)
+		return NULL;
+
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	*due = mktime(&tm);
+	if (!date && *due <= now) { // A time that already passed today means tomorrow
+		tm.tm_mday++;
+		tm.tm_isdst = -1;
+		*due = mktime(&tm);
+	}
+	return *due > now ? s + strspn(s, " ") : NULL;
+}
+
+static int pending_for(const char *nick) {
+
+	uint32_t i;
+	int n = 0;
+
+	for (i = 0; i < count; i++)
+		n += !strcasecmp(pool[i].rec.nick, nick);
+
+	return n;
+}
+
+void remind(Irc server, Parsed_data pdata) {
+
+	struct remind_record rec;
+	struct reminder *r;
+	char *text, when[64];
+	time_t due, now = time(NULL);
+	unsigned long id;
+
+	if (log_fd < 0)
+		return;
+
+	load_new(); // Our copy is from the fork, catch up with the other workers
+	memset(&rec, 0, sizeof(rec));
+	if (pdata.message && sscanf(pdata.message, "cancel %lu", &id) == 1) {
+		r = find_reminder(id);
+		if (!r || strcasecmp(r->rec.nick, pdata.sender)) {
+			send_message(server, pdata.target, "you have no reminder #%lu", id);
+			return;
+		}
+		rec.op = REMIND_CANCEL;
+		rec.id = id;
+		if (remind_append(&rec, true))
+			send_message(server, pdata.target, "cancelled reminder #%lu", id);
+		return;
+	}
+	text = pdata.message ? parse_when(pdata.message, now, &due) : NULL;
+	if (!text || !*text) {
+		send_message(server, pdata.target, "%s", "usage: !remind 2h | 1d12h30m | 18:30 | tomorrow [09:00] | 2025-05-01 [09:00] text");
+		return;
+	}
+	if (pending_for(pdata.sender) >= REMIND_PER_NICK) {
+		send_message(server, pdata.target, "you already have %d reminders pending", REMIND_PER_NICK);
+		return;
+	}
+	rec.op = REMIND_ADD;
+	rec.due = due;
+	rec.created = now;
+	snprintf(rec.nick, NICKLEN, "%s", pdata.sender);
+	snprintf(rec.target, CHANLEN, "%s", pdata.target);
+	snprintf(rec.text, REMIND_TEXTLEN, "%s", text);
+	if (!remind_append(&rec, true))
+		return;
+
+	strftime(when, sizeof(when), "%a %d %b %H:%M", localtime(&due));
+	send_message(server, pdata.target, "reminder #%u set for %s", rec.id, when);
+}
+
+static int compare_due(const void *a, const void *b) {
+
+	const struct remind_record *x = *(const struct remind_record * const *) a, *y = *(const struct remind_record * const *) b;
+
+	return x->due < y->due ? -1 : x->due > y->due;
+}
+
+void reminders(Irc server, Parsed_data pdata) {
+
+	const struct remind_record **mine;
+	char left[32];
+	time_t now = time(NULL);
+	uint32_t i;
+	int n = 0;
+
+	if (log_fd < 0)
+		return;
+
+	load_new();
+	mine = MALLOC_W((count + 1) * sizeof(*mine));
+	for (i = 0; i < count; i++)
+		if (!strcasecmp(pool[i].rec.nick, pdata.sender))
+			mine[n++] = &pool[i].rec;
+
+	if (!n)
+		send_message(server, pdata.target, "%s", "you have no reminders pending");
+
+	qsort(mine, n, sizeof(*mine), compare_due);
+	for (i = 0; i < (uint32_t) n && i < REMIND_LIST; i++) {
+		format_duration(left, sizeof(left), mine[i]->due - now);
+		send_message(server, pdata.target, "#%u in %s on %s: %s", mine[i]->id, left, mine[i]->target, mine[i]->text);
+	}
+	if (n > REMIND_LIST)
+		send_message(server, pdata.target, "and %d more", n - REMIND_LIST);
+
+	free(mine);
+}
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "irc.h"
+#include "seen.h"
+#include "common.h"
+
+struct seen_file {
+	struct seen_header h;
+	struct seen_entry entries[SEEN_SLOTS];
+	struct seen_memo memos[SEEN_MEMOS];
+};
+
+static struct seen_file *store;
+
+static void reset(void) {
+
+	int i;
+
+	memset(&store->h, 0, offsetof(struct seen_header, lock));
+	memset(store->entries, 0, sizeof(store->entries));
+	memset(store->memos, 0, sizeof(store->memos));
+	memcpy(store->h.magic, SEEN_MAGIC, sizeof(store->h.magic));
+	store->h.slots      = SEEN_SLOTS;
+	store->h.memo_slots = SEEN_MEMOS;
+	store->h.newest     = store->h.oldest = -1;
+	store->h.free_memos = 0;
+	for (i = 0; i < SEEN_MEMOS; i++)
+		store->memos[i].next = i + 1 < SEEN_MEMOS ? i + 1 : -1;
+}
+
+static void lock(void) {
+
+	// The owner may have died half way through relinking the lists, following them could loop forever
+	if (!shared_mutex_lock(&store->h.lock)) {
+		fprintf(stderr, "seen: a worker died holding the lock, dropping every nick and memo\n");
+		reset();
+	}
+}
+
+static void unlock(void) {
+
+	pthread_mutex_unlock(&store->h.lock);
+}
+
+static uint32_t home_slot(const char *nick) {
+
+	uint32_t hash = 2166136261u;
+	int i;
+
+	// Stored nicks are cut at NICKLEN - 1, hash only what's stored
+	for (i = 0; nick[i] && i < NICKLEN - 1; i++)
+		hash = (hash ^ (unsigned char) tolower((unsigned char) nick[i])) * 16777619;
+
+	return hash & (SEEN_SLOTS - 1);
+}
+
+/** @returns  the nick's slot or the empty slot where it would go */
+static int32_t find_slot(const char *nick) {
+
+	uint32_t i;
+
+	for (i = home_slot(nick); *store->entries[i].nick; i = (i + 1) & (SEEN_SLOTS - 1))
+		if (!strncasecmp(store->entries[i].nick, nick, NICKLEN - 1))
+			break;
+
+	return i;
+}
+
+static void list_unlink(int32_t i) {
+
+	struct seen_entry *e = &store->entries[i];
+
+	if (e->prev >= 0)
+		store->entries[e->prev].next = e->next;
+	else
+		store->h.newest = e->next;
+	if (e->next >= 0)
+		store->entries[e->next].prev = e->prev;
+	else
+		store->h.oldest = e->prev;
+}
+
+static void list_push(int32_t i) {
+
+	struct seen_entry *e = &store->entries[i];
+
+	e->prev = -1;
+	e->next = store->h.newest;
+	if (e->next >= 0)
+		store->entries[e->next].prev = i;
+	else
+		store->h.oldest = i;
+	store->h.newest = i;
+}
+
+static bool entry_home(void *table, uint32_t slot, uint32_t *home) {
+
+	(void) table;
+	if (!*store->entries[slot].nick)
+		return false;
+
+	*home = home_slot(store->entries[slot].nick);
+	return true;
+}
+
+/** Move an entry and fix the recency list around it */
+static void entry_move(void *table, uint32_t from, uint32_t to) {
+
+	struct seen_entry *e = &store->entries[to];
+
+	(void) table;
+	*e = store->entries[from];
+	if (e->prev >= 0)
+		store->entries[e->prev].next = to;
+	else
+		store->h.newest = to;
+	if (e->next >= 0)
+		store->entries[e->next].prev = to;
+	else
+		store->h.oldest = to;
+}
+
+/** Empty a slot and shift back the entries of it's probe run */
+static void remove_slot(int32_t i) {
+
+	list_unlink(i);
+	i = probe_remove(NULL, i, SEEN_SLOTS - 1, entry_home, entry_move);
+	memset(&store->entries[i], 0, sizeof(store->entries[i]));
+	store->h.used--;
+}
+
+/** Give the memos that waited longer than SEEN_MEMO_TTL back to the pool */
+static void expire_memos(struct seen_entry *e, uint32_t now) {
+
+	int32_t *m = &e->memos, stale;
+
+	while (*m >= 0) {
+		if (now - store->memos[*m].time < SEEN_MEMO_TTL) {
+			m = &store->memos[*m].next;
+			continue;
+		}
+		stale = *m;
+		*m = store->memos[stale].next;
+		store->memos[stale].next = store->h.free_memos;
+		store->h.free_memos = stale;
+	}
+}
+
+/** Expire the memos of every nick and drop the entries that only held memos. Used once the pool runs out */
+static void expire_all(uint32_t now) {
+
+	struct seen_entry *e;
+	int32_t i;
+
+	for (i = 0; i < SEEN_SLOTS; i++) {
+		e = &store->entries[i];
+		if (!*e->nick || e->memos < 0)
+			continue;
+
+		expire_memos(e, now);
+		if (e->memos < 0 && !e->time) {
+			remove_slot(i);
+			i--; // Another entry may have shifted into the slot
+		}
+	}
+}
+
+/** Evict the least recently active nick that has no memos waiting, after dropping the expired ones */
+static bool evict(void) {
+
+	uint32_t now = time(NULL);
+	int32_t i;
+
+	for (i = store->h.oldest; i >= 0; i = store->entries[i].prev) {
+		expire_memos(&store->entries[i], now);
+		if (store->entries[i].memos < 0) {
+			remove_slot(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Find or add a nick's entry and make it the newest. Returns NULL if the table is full */
+STATIC struct seen_entry *seen_touch(const char *nick) {
+
+	struct seen_entry *e;
+	int32_t i;
+
+	i = find_slot(nick);
+	e = &store->entries[i];
+	if (*e->nick) {
+		list_unlink(i);
+		list_push(i);
+		return e;
+	}
+	if (store->h.used >= SEEN_MAXUSED) {
+		if (!evict())
+			return NULL;
+		i = find_slot(nick); // Entries may have shifted into the slot we found
+		e = &store->entries[i];
+	}
+	memset(e, 0, sizeof(*e));
+	snprintf(e->nick, NICKLEN, "%s", nick);
+	e->memos = -1;
+	list_push(i);
+	store->h.used++;
+	return e;
+}
+
+void seen_init(const char *path) {
+
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (!*path)
+		return;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0 || (st.st_size != sizeof(*store) && ftruncate(fd, sizeof(*store)) < 0)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	map = mmap(NULL, sizeof(*store), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("seen: mmap");
+		return;
+	}
+	store = map;
+	if (memcmp(store->h.magic, SEEN_MAGIC, sizeof(store->h.magic)) || store->h.slots != SEEN_SLOTS
+			|| store->h.memo_slots != SEEN_MEMOS)
+		reset();
+
+	shared_mutex_init(&store->h.lock); // Whoever held it is gone
+}
+
+void seen_activity(Irc server, const char *nick, const char *channel, enum seen_action action, const char *text) {
+
+	struct seen_memo delivered[SEEN_NICK_MEMOS];
+	struct seen_entry *e;
+	char ago[32];
+	int32_t m, next;
+	int i, count = 0;
+
+	if (!store)
+		return;
+
+	lock();
+	e = seen_touch(nick);
+	if (!e) {
+		unlock();
+		return;
+	}
+	snprintf(e->nick, NICKLEN, "%s", nick); // Keep the latest capitalization
+	snprintf(e->channel, CHANLEN, "%s", channel ? channel : "");
+	snprintf(e->text, SEEN_TEXTLEN, "%s", text ? text : "");
+	e->time = time(NULL);
+	e->action = action;
+
+	// Take the memos out under the lock, send them after
+	if (action != SEEN_PART && action != SEEN_QUIT && action != SEEN_NICK) {
+		expire_memos(e, e->time);
+		for (m = e->memos; m >= 0 && count < SEEN_NICK_MEMOS; m = next) {
+			delivered[count++] = store->memos[m];
+			next = store->memos[m].next;
+			store->memos[m].next = store->h.free_memos;
+			store->h.free_memos = m;
+		}
+		e->memos = -1;
+	}
+	unlock();
+
+	for (i = 0; i < count; i++) {
+		format_duration(ago, sizeof(ago), time(NULL) - (long) delivered[i].time);
+		send_message(server, channel ? channel : nick, "%s: %s said %s ago: %s", nick, delivered[i].from, ago,
+			delivered[i].text);
+	}
+}
+
+void seen(Irc server, Parsed_data pdata) {
+
+	struct seen_entry e;
+	char **argv, ago[32];
+	int32_t i;
+	int argc;
+
+	if (!store)
+		return;
+
+	argc = extract_params(pdata.message, &argv);
+	if (argc != 1) {
+		send_message(server, pdata.target, "%s", "usage: !seen nick");
+		goto cleanup;
+	}
+	lock();
+	i = find_slot(argv[0]);
+	e = store->entries[i];
+	unlock();
+
+	if (!*e.nick || !e.time) {
+		send_message(server, pdata.target, "I haven't seen %s", argv[0]);
+		goto cleanup;
+	}
+	format_duration(ago, sizeof(ago), time(NULL) - (long) e.time);
+	switch (e.action) {
+	case SEEN_MESSAGE:
+		send_message(server, pdata.target, "%s was last seen %s ago on %s saying: %s", e.nick, ago, e.channel, e.text);
+		break;
+	case SEEN_JOIN:
+		send_message(server, pdata.target, "%s was last seen %s ago joining %s", e.nick, ago, e.channel);
+		break;
+	case SEEN_PART:
+		send_message(server, pdata.target, "%s was last seen %s ago leaving %s (%s)", e.nick, ago, e.channel, e.text);
+		break;
+	case SEEN_QUIT:
+		send_message(server, pdata.target, "%s was last seen %s ago quitting (%s)", e.nick, ago, e.text);
+		break;
+	case SEEN_NICK:
+		send_message(server, pdata.target, "%s was last seen %s ago changing nick to %s", e.nick, ago, e.text);
+		break;
+	case SEEN_NEWNICK:
+		send_message(server, pdata.target, "%s was last seen %s ago changing nick from %s", e.nick, ago, e.text);
+	}
+
+cleanup:
+	if (argc)
+		free(argv);
+}
+
+void tell(Irc server, Parsed_data pdata) {
+
+	struct seen_entry *e;
+	struct seen_memo *memo;
+	int32_t m, *last;
+	char *nick, *text;
+	int pending = 0;
+
+	if (!store)
+		return;
+
+	nick = strtok(pdata.message, " ");
+	text = strtok(NULL, "");
+	if (!nick || !text) {
+		send_message(server, pdata.target, "%s", "usage: !tell nick message");
+		return;
+	}
+	lock();
+	if (store->h.free_memos < 0)
+		expire_all(time(NULL));
+
+	// Never seen, keep an entry just for the memos. Its time stays 0 so !seen doesn't report it
+	e = &store->entries[find_slot(nick)];
+	if (!*e->nick)
+		e = seen_touch(nick);
+	if (e)
+		for (last = &e->memos; *last >= 0; last = &store->memos[*last].next, pending++);
+
+	m = store->h.free_memos;
+	if (!e || m < 0 || pending >= SEEN_NICK_MEMOS) {
+		unlock();
+		send_message(server, pdata.target, "%s", "Too many memos waiting, try again later");
+		return;
+	}
+	memo = &store->memos[m];
+	store->h.free_memos = memo->next;
+	snprintf(memo->from, NICKLEN, "%s", pdata.sender);
+	snprintf(memo->text, SEEN_TEXTLEN, "%s", text);
+	memo->time = time(NULL);
+	memo->next = -1;
+	*last = m;
+	unlock();
+
+	send_message(server, pdata.target, "I'll pass that on to %s", nick);
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shorten.h"
+#include "curl.h"
+#include "metrics.h"
+#include "common.h"
+
+#define MASK (SHORT_SLOTS - 1)
+
+struct short_file {
+	struct short_header h;
+	struct short_entry entries[SHORT_SLOTS];
+	char heap[SHORT_HEAP];
+};
+
+static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static struct short_file *store;
+static const char *base;
+static uint32_t *order; // Eviction's buffers, allocated up front so nothing under the lock can exit
+static bool *needed;
+
+static void reset(void) {
+
+	memset(&store->h, 0, offsetof(struct short_header, lock));
+	memset(store->entries, 0, sizeof(store->entries));
+	memcpy(store->h.magic, SHORT_MAGIC, sizeof(store->h.magic));
+	store->h.slots     = SHORT_SLOTS;
+	store->h.heap_size = SHORT_HEAP;
+	store->h.heap_used = 1; // Offset 0 marks empty slots
+}
+
+static void lock(void) {
+
+	// The owner may have died half way through an eviction, the links can't be trusted
+	if (!shared_mutex_lock(&store->h.lock)) {
+		fprintf(stderr, "URL shortener: a worker died holding the lock, dropping every link\n");
+		reset();
+	}
+}
+
+static void unlock(void) {
+
+	pthread_mutex_unlock(&store->h.lock);
+}
+
+static uint32_t url_hash(const char *url) {
+
+	uint32_t hash = 2166136261u; // FNV-1a
+
+	for (; *url; url++)
+		hash = (hash ^ (unsigned char) *url) * 16777619;
+
+	return hash;
+}
+
+static bool live(const struct short_entry *e) {
+
+	return e->offset && e->offset != SHORT_DEAD;
+}
+
+/** @returns  the URL's slot, otherwise the first tombstone or the empty slot where it would go */
+static uint32_t find_slot(const char *url, uint32_t hash) {
+
+	uint32_t i, tomb = SHORT_DEAD;
+	struct short_entry *e;
+
+	for (i = hash & MASK; store->entries[i].offset; i = (i + 1) & MASK) {
+		e = &store->entries[i];
+		if (e->offset == SHORT_DEAD) {
+			if (tomb == SHORT_DEAD)
+				tomb = i;
+		} else if (e->hash == hash && streq(store->heap + e->offset, url))
+			return i;
+	}
+	return tomb != SHORT_DEAD ? tomb : i;
+}
+
+/** Oldest first, URLs are appended and keep their order when the heap is compacted */
+static int compare_age(const void *a, const void *b) {
+
+	uint32_t x = store->entries[*(const uint32_t *) a].offset, y = store->entries[*(const uint32_t *) b].offset;
+
+	return (x > y) - (x < y);
+}
+
+/** Drop the oldest half of the links, and at least half of the heap, then compact the heap. Returns links dropped */
+static uint32_t evict(void) {
+
+	uint32_t *slots = order, count = 0, dropped, heap_used = 1, i, j;
+	struct short_entry *e;
+	size_t len;
+
+	memset(needed, 0, SHORT_SLOTS * sizeof(*needed));
+	for (i = 0; i < SHORT_SLOTS; i++)
+		if (live(&store->entries[i]))
+			slots[count++] = i;
+	qsort(slots, count, sizeof(*slots), compare_age);
+
+	dropped = count / 2;
+	while (dropped < count && store->entries[slots[dropped]].offset < store->h.heap_used / 2)
+		dropped++;
+	for (i = 0; i < dropped; i++)
+		store->entries[slots[i]].offset = SHORT_DEAD;
+
+	// Oldest first, so a URL only moves over ones already moved or dropped
+	for (i = dropped; i < count; i++) {
+		e = &store->entries[slots[i]];
+		len = strlen(store->heap + e->offset) + 1;
+		memmove(store->heap + heap_used, store->heap + e->offset, len);
+		e->offset = heap_used;
+		heap_used += len;
+	}
+	store->h.heap_used = heap_used;
+
+	// Keep the tombstones between a link's home slot and its slot, so finding it doesn't stop early. Empty the rest
+	for (i = dropped; i < count; i++)
+		for (j = store->entries[slots[i]].hash & MASK; j != slots[i]; j = (j + 1) & MASK)
+			needed[j] = true;
+
+	store->h.used = count - dropped;
+	for (i = 0; i < SHORT_SLOTS; i++) {
+		e = &store->entries[i];
+		if (e->offset == SHORT_DEAD && !needed[i])
+			memset(e, 0, sizeof(*e));
+		else if (e->offset == SHORT_DEAD)
+			store->h.used++;
+	}
+	return dropped;
+}
+
+/** True if there's room for a link of len bytes in slot */
+static bool fits(uint32_t slot, size_t len) {
+
+	return (store->entries[slot].offset || store->h.used < SHORT_MAXUSED) && store->h.heap_used + len + 1 <= SHORT_HEAP;
+}
+
+/** Most significant digit first, zero padded to SHORT_CODELEN */
+static void encode(uint32_t value, char *code) {
+
+	int i;
+
+	for (i = SHORT_CODELEN - 1; i >= 0; i--, value /= 62)
+		code[i] = digits[value % 62];
+	code[SHORT_CODELEN] = '\0';
+}
+
+/** @returns  the URL a code points to or NULL if there's none. Valid until the next call, evictions move URLs */
+STATIC const char *shortener_lookup(const char *code) {
+
+	static char url[URLLEN];
+	const char *digit;
+	bool found = false;
+	uint64_t value = 0;
+	uint32_t slot;
+	int i;
+
+	if (!store || strlen(code) != SHORT_CODELEN)
+		return NULL;
+
+	for (i = 0; i < SHORT_CODELEN; i++) {
+		digit = code[i] ? strchr(digits, code[i]) : NULL;
+		if (!digit)
+			return NULL;
+		value = value * 62 + (digit - digits);
+	}
+	if (value > UINT32_MAX)
+		return NULL;
+
+	slot = value & MASK;
+	lock();
+	if (live(&store->entries[slot]) && (store->entries[slot].hash & ~MASK) == (value & ~MASK)) {
+		snprintf(url, URLLEN, "%s", store->heap + store->entries[slot].offset);
+		found = true;
+	}
+	unlock();
+
+	return found ? url : NULL;
+}
+
+char *shorten_url(const char *long_url) {
+
+	char url[URLLEN], code[SHORT_CODELEN + 1], *short_url;
+	struct short_entry *e;
+	uint32_t hash, slot, dropped = 0;
+	size_t len;
+	const char *c;
+
+	if (!store)
+		return NULL;
+
+	// The URL ends up in a Location header, so no whitespace or control chars
+	for (c = long_url; *c; c++)
+		if ((unsigned char) *c <= ' ' || *c == 0x7f)
+			return NULL;
+
+	// Without a scheme the browser would take it as a path on our own server
+	len = snprintf(url, URLLEN, "%s%s", strstr(long_url, "://") ? "" : "http://", long_url);
+	if (len >= URLLEN)
+		return NULL;
+
+	hash = url_hash(url);
+	lock();
+	slot = find_slot(url, hash);
+	if (!live(&store->entries[slot]) && !fits(slot, len)) {
+		dropped = evict();
+		slot = find_slot(url, hash);
+		if (!fits(slot, len)) { // Only if the kept links and tombstones still fill it
+			unlock();
+			fprintf(stderr, "URL shortener is full\n");
+			return NULL;
+		}
+	}
+	e = &store->entries[slot];
+	if (!live(e)) {
+		if (!e->offset)
+			store->h.used++;
+		memcpy(store->heap + store->h.heap_used, url, len + 1);
+		e->hash = hash;
+		e->offset = store->h.heap_used;
+		store->h.heap_used += len + 1;
+	}
+	unlock();
+
+	if (dropped)
+		metrics_count(SHORT_EVICTIONS, dropped);
+
+	encode((hash & ~MASK) | slot, code);
+	short_url = MALLOC_W(strlen(base) + SHORT_CODELEN + 1);
+	sprintf(short_url, "%s%s", base, code);
+	return short_url;
+}
+
+static void shortener_serve(Http_request *req, Http_response *res) {
+
+	const char *url = shortener_lookup(req->path + strlen(SHORT_PATH));
+
+	if (!url) {
+		http_reply(res, 404, NULL, "%s", "Not found\n");
+		return;
+	}
+	http_reply(res, 301, NULL, "%s\n", url);
+	res->location = url;
+}
+
+void shortener_init(const char *path, const char *base_url) {
+
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (!*path || !*base_url || cfg.replay) // A replay never adds links to the live bot's store
+		return;
+
+	// Sparse, the heap takes disk space as it fills
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0 || (st.st_size != sizeof(*store) && ftruncate(fd, sizeof(*store)) < 0)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	map = mmap(NULL, sizeof(*store), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("shortener: mmap");
+		return;
+	}
+	store = map;
+	if (memcmp(store->h.magic, SHORT_MAGIC, sizeof(store->h.magic)) || store->h.slots != SHORT_SLOTS
+			|| store->h.heap_size != SHORT_HEAP || !store->h.heap_used || store->h.heap_used > SHORT_HEAP)
+		reset();
+
+	shared_mutex_init(&store->h.lock); // Whoever held it is gone
+	order  = MALLOC_W(SHORT_SLOTS * sizeof(*order));
+	needed = MALLOC_W(SHORT_SLOTS * sizeof(*needed));
+	base = base_url;
+	httpd_route("GET", SHORT_PATH, shortener_serve);
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "common.h"
+
+static int trace_fd = -1;
+static int32_t session;
+static uint32_t last_request;
+static uint32_t current_request; //!< Inherited by the worker processes
+static uint64_t line_received;
+static uint64_t dispatched;
+static uint64_t worker_started;
+static char current_command[TRACE_NAMELEN];
+
+void trace_init(const char *path) {
+
+	struct stat st;
+	char old[PATHLEN];
+
+	if (!path || !*path)
+		return;
+
+	// Keep the previous file around once, so the file never grows without limits
+	if (!stat(path, &st) && st.st_size > TRACE_MAXSIZE) {
+		snprintf(old, PATHLEN, "%s.old", path);
+		if (rename(path, old) < 0)
+			perror("rename");
+	}
+	trace_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (trace_fd < 0) {
+		perror("trace file");
+		return;
+	}
+	session = getpid();
+}
+
+void trace_line_received(uint64_t usec) {
+
+	line_received = usec;
+}
+
+void trace_request_begin(const char *command) {
+
+	if (trace_fd < 0)
+		return;
+
+	current_request = ++last_request;
+	snprintf(current_command, TRACE_NAMELEN, "%s", command);
+
+	dispatched = monotonic_usec();
+	trace_span(TRACE_DISPATCH, line_received, dispatched - line_received, current_command);
+}
+
+void trace_request_end(void) {
+
+	current_request = 0;
+}
+
+void trace_worker_start(void) {
+
+	worker_started = monotonic_usec();
+	trace_span(TRACE_FORK_WAIT, dispatched, worker_started - dispatched, NULL);
+}
+
+void trace_worker_end(void) {
+
+	trace_span(TRACE_COMMAND, worker_started, monotonic_usec() - worker_started, current_command);
+}
+
+void trace_span(enum trace_type type, uint64_t start, uint64_t duration, const char *name) {
+
+	struct trace_record rec = { 0 };
+
+	if (trace_fd < 0 || !current_request)
+		return;
+
+	rec.start    = start;
+	rec.duration = duration > UINT32_MAX ? UINT32_MAX : duration;
+	rec.request  = current_request;
+	rec.session  = session;
+	rec.pid      = getpid();
+	rec.type     = type;
+	if (name)
+		strncpy(rec.name, name, TRACE_NAMELEN - 1);
+
+	// O_APPEND makes every record land whole at the end of the file, even with many workers writing at once
+	if (write(trace_fd, &rec, sizeof(rec)) != sizeof(rec))
+		perror("trace write");
+}
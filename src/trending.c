@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include "irc.h"
+#include "trending.h"
+#include "common.h"
+
+#define MAX_SCALE 1e12 //!< Rescale once the forward decay factor gets this big
+#define STOPWORD_MAX 7 //!< Length of the longest stopword, longer words skip the lookup
+#define STOPWORD_SLOTS 256
+
+static const char *stopwords[] = {
+	"about", "after", "again", "all", "also", "and", "any", "are", "because", "been", "before", "but", "can", "could",
+	"den", "did", "does", "doing", "don", "dont", "einai", "exei", "for", "from", "get", "going", "gonna", "had", "has",
+	"have", "her", "here", "him", "his", "how", "its", "just", "kai", "like", "more", "most", "not", "now", "one",
+	"only", "other", "our", "out", "over", "own", "pou", "same", "she", "should", "some", "still", "such", "tha",
+	"than", "that", "the", "their", "them", "then", "there", "these", "they", "this", "those", "too", "very", "was",
+	"way", "well", "were", "what", "when", "where", "which", "while", "who", "why", "will", "with", "would", "yeah",
+	"yes", "you", "your"
+};
+
+static struct channel_trends trends[MAXCHANS];
+static uint8_t stopword_table[STOPWORD_SLOTS]; //!< Open addressing on term_hash(). Index in stopwords + 1, 0 for empty slots
+static bool stopwords_ready;
+
+static double now_seconds(void) {
+
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static uint32_t term_hash(const char *term) {
+
+	uint32_t hash = 2166136261u;
+
+	for (; *term; term++)
+		hash = (hash ^ (unsigned char) *term) * 16777619;
+
+	return hash;
+}
+
+/** A hash lookup, a binary search costs several times the rest of the tokenizing */
+static bool is_stopword(const char *term) {
+
+	uint32_t i, j;
+
+	if (!stopwords_ready) {
+		for (i = 0; i < SIZE(stopwords); i++) {
+			for (j = term_hash(stopwords[i]) & (STOPWORD_SLOTS - 1); stopword_table[j]; j = (j + 1) & (STOPWORD_SLOTS - 1));
+			stopword_table[j] = i + 1;
+		}
+		stopwords_ready = true;
+	}
+	for (j = term_hash(term) & (STOPWORD_SLOTS - 1); stopword_table[j]; j = (j + 1) & (STOPWORD_SLOTS - 1))
+		if (!strcmp(stopwords[stopword_table[j] - 1], term))
+			return true;
+
+	return false;
+}
+
+// Plain ASCII checks, the ctype functions are calls into the locale for every byte
+static bool is_digit(char c) {
+
+	return c >= '0' && c <= '9';
+}
+
+static bool is_term_char(char c) {
+
+	return (unsigned char) c >= 0x80 || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || is_digit(c);
+}
+
+/**
+ * Cut the next term out of text
+ *
+ * @param term  Filled with the lowercased term
+ * @returns     Position after the term or NULL at the end of the text
+ */
+STATIC const char *next_term(const char *text, char *term) {
+
+	const char *start;
+	size_t n;
+	bool digits;
+
+	for (;;) {
+		while (*text && !is_term_char(*text))
+			text++;
+		if (!*text)
+			return NULL;
+
+		// Links are kept whole up to the next space
+		start = text;
+		if ((*text | 0x20) == 'h' && (starts_case_with(text, "http://") || starts_case_with(text, "https://"))) {
+			for (n = 0; *text && *text != ' '; text++)
+				if (n < TREND_TERMLEN - 1)
+					term[n++] = *text;
+			term[n] = '\0';
+			return text;
+		}
+		for (n = 0, digits = true; is_term_char(*text); text++) {
+			digits &= is_digit(*text);
+			if (n < TREND_TERMLEN - 1)
+				term[n++] = *text >= 'A' && *text <= 'Z' ? *text | 0x20 : *text;
+		}
+		term[n] = '\0';
+		if (text - start < 3 || digits)
+			continue;
+		if (n > STOPWORD_MAX || !is_stopword(term))
+			return text;
+	}
+}
+
+/** Divide everything by the current scale, so the scaled counts never overflow */
+static void rescale(struct channel_trends *ch, double now) {
+
+	double recent = exp2((now - ch->recent_start) / TREND_RECENT);
+	double baseline = exp2((now - ch->baseline_start) / TREND_BASELINE);
+	uint32_t i, j;
+
+	if (recent > MAX_SCALE) {
+		for (i = 0; i < ch->used; i++) {
+			ch->counters[i].count /= recent;
+			ch->counters[i].error /= recent;
+		}
+		ch->recent_start = now;
+	}
+	if (baseline > MAX_SCALE) {
+		for (i = 0; i < TREND_CMS_DEPTH; i++)
+			for (j = 0; j < TREND_CMS_WIDTH; j++)
+				ch->cms[i][j] /= baseline;
+		ch->baseline_start = now;
+	}
+}
+
+static void cms_add(struct channel_trends *ch, uint32_t hash, float weight) {
+
+	uint32_t h2 = (hash >> 16) | 1;
+	int i;
+
+	for (i = 0; i < TREND_CMS_DEPTH; i++)
+		ch->cms[i][(hash + i * h2) & (TREND_CMS_WIDTH - 1)] += weight;
+}
+
+static float cms_estimate(const struct channel_trends *ch, uint32_t hash) {
+
+	uint32_t h2 = (hash >> 16) | 1;
+	float min = INFINITY, value;
+	int i;
+
+	for (i = 0; i < TREND_CMS_DEPTH; i++) {
+		value = ch->cms[i][(hash + i * h2) & (TREND_CMS_WIDTH - 1)];
+		if (value < min)
+			min = value;
+	}
+	return min;
+}
+
+#define HEAP_COUNT(ch, i) ((ch)->counters[(ch)->heap[i]].count)
+
+static void heap_swap(struct channel_trends *ch, uint32_t i, uint32_t j) {
+
+	uint8_t temp = ch->heap[i];
+
+	ch->heap[i] = ch->heap[j];
+	ch->heap[j] = temp;
+	ch->position[ch->heap[i]] = i;
+	ch->position[ch->heap[j]] = j;
+}
+
+static void sift_down(struct channel_trends *ch, uint32_t i) {
+
+	uint32_t smallest, child;
+
+	for (;;) {
+		smallest = i;
+		for (child = 2 * i + 1; child <= 2 * i + 2 && child < ch->used; child++)
+			if (HEAP_COUNT(ch, child) < HEAP_COUNT(ch, smallest))
+				smallest = child;
+		if (smallest == i)
+			return;
+
+		heap_swap(ch, i, smallest);
+		i = smallest;
+	}
+}
+
+/** @returns  the table slot of the term or the empty slot where it would go */
+static uint32_t find_slot(const struct channel_trends *ch, const char *term, uint32_t hash) {
+
+	uint32_t i, c;
+
+	for (i = hash & (TREND_TABLE - 1); ch->table[i]; i = (i + 1) & (TREND_TABLE - 1)) {
+		c = ch->table[i] - 1;
+		if (ch->hashes[c] == hash && !strcmp(ch->counters[c].term, term))
+			break;
+	}
+	return i;
+}
+
+static bool slot_home(void *table, uint32_t slot, uint32_t *home) {
+
+	struct channel_trends *ch = table;
+
+	if (!ch->table[slot])
+		return false;
+
+	*home = ch->hashes[ch->table[slot] - 1] & (TREND_TABLE - 1);
+	return true;
+}
+
+static void slot_move(void *table, uint32_t from, uint32_t to) {
+
+	struct channel_trends *ch = table;
+
+	ch->table[to] = ch->table[from];
+}
+
+/** Empty a table slot and shift back the rest of it's probe run */
+static void remove_slot(struct channel_trends *ch, uint32_t i) {
+
+	ch->table[probe_remove(ch, i, TREND_TABLE - 1, slot_home, slot_move)] = 0;
+}
+
+/** Space-Saving: count the term if it has a counter, otherwise take over the smallest one, the root of the heap */
+static void count_term(struct channel_trends *ch, const char *term, uint32_t hash, double weight) {
+
+	uint32_t slot = find_slot(ch, term, hash), c, i;
+
+	if (ch->table[slot]) {
+		c = ch->table[slot] - 1;
+		ch->counters[c].count += weight;
+		sift_down(ch, ch->position[c]); // Counts only grow, so it can only move down
+		return;
+	}
+	if (ch->used < TREND_TERMS) {
+		// A new counter has the smallest count possible, move it up to the root
+		c = i = ch->used++;
+		ch->heap[i] = c;
+		ch->position[c] = i;
+		for (; i > 0; i = (i - 1) / 2)
+			heap_swap(ch, i, (i - 1) / 2);
+		ch->counters[c].count = ch->counters[c].error = 0;
+	} else {
+		c = ch->heap[0];
+		remove_slot(ch, find_slot(ch, ch->counters[c].term, ch->hashes[c]));
+		slot = find_slot(ch, term, hash); // The hole may have moved it
+		ch->counters[c].error = ch->counters[c].count;
+	}
+	ch->table[slot] = c + 1;
+	ch->hashes[c] = hash;
+	ch->counters[c].count += weight;
+	memcpy(ch->counters[c].term, term, strlen(term) + 1);
+	sift_down(ch, 0);
+}
+
+STATIC struct channel_trends *find_channel(const char *channel, size_t len) {
+
+	int i;
+
+	for (i = 0; i < MAXCHANS && *trends[i].channel; i++)
+		if (strlen(trends[i].channel) == len && !strncasecmp(trends[i].channel, channel, len))
+			return &trends[i];
+
+	return NULL;
+}
+
+STATIC void trending_add(const char *channel, size_t channel_len, const char *text, double now) {
+
+	struct channel_trends *ch;
+	char term[TREND_TERMLEN];
+	double recent, baseline;
+	uint32_t hash;
+	int i;
+
+	ch = find_channel(channel, channel_len);
+	if (!ch) {
+		for (i = 0; i < MAXCHANS && *trends[i].channel; i++);
+		if (i == MAXCHANS || channel_len >= CHANLEN)
+			return;
+
+		ch = &trends[i];
+		memcpy(ch->channel, channel, channel_len);
+		ch->since = ch->recent_start = ch->baseline_start = now;
+	}
+	recent = exp2((now - ch->recent_start) / TREND_RECENT);
+	baseline = exp2((now - ch->baseline_start) / TREND_BASELINE);
+	if (recent > MAX_SCALE || baseline > MAX_SCALE) {
+		rescale(ch, now);
+		recent = exp2((now - ch->recent_start) / TREND_RECENT);
+		baseline = exp2((now - ch->baseline_start) / TREND_BASELINE);
+	}
+
+	while ((text = next_term(text, term))) {
+		hash = term_hash(term);
+		count_term(ch, term, hash, recent);
+		cms_add(ch, hash, baseline);
+	}
+}
+
+void trending_message(const char *channel, size_t channel_len, const char *text) {
+
+	trending_add(channel, channel_len, text, now_seconds());
+}
+
+static int compare_trends(const void *a, const void *b) {
+
+	const struct trend *x = a, *y = b;
+
+	return x->ratio < y->ratio ? 1 : x->ratio > y->ratio ? -1 : 0;
+}
+
+/** Ratio of the recent rate over the baseline rate. An exponential window with half-life h spans h / ln 2 seconds,
+ *  less if we haven't been watching that long. Right after startup both spans are equal and nothing trends */
+STATIC int find_trends(const struct channel_trends *ch, double now, struct trend *out) {
+
+	double recent = exp2((now - ch->recent_start) / TREND_RECENT);
+	double baseline = exp2((now - ch->baseline_start) / TREND_BASELINE);
+	double watched = fmax(now - ch->since, 1);
+	double recent_span = fmin(watched, TREND_RECENT / M_LN2), baseline_span = fmin(watched, TREND_BASELINE / M_LN2);
+	double count, usual;
+	uint32_t i;
+	int n = 0;
+
+	for (i = 0; i < ch->used; i++) {
+		count = (ch->counters[i].count - ch->counters[i].error) / recent; // Guaranteed part of the count
+		if (count < TREND_MINCOUNT)
+			continue;
+
+		usual = cms_estimate(ch, ch->hashes[i]) / baseline;
+		out[n].term  = ch->counters[i].term;
+		out[n].count = count;
+		out[n].ratio = (count / recent_span) / (usual / baseline_span);
+		if (out[n].ratio >= TREND_MINRATIO)
+			n++;
+	}
+	qsort(out, n, sizeof(*out), compare_trends);
+	return n;
+}
+
+void trending(Irc server, Parsed_data pdata) {
+
+	const struct channel_trends *ch;
+	struct trend found[TREND_TERMS];
+	char **argv, line[IRCLEN / 2];
+	const char *channel = pdata.target;
+	int argc, i, n, len = 0;
+
+	argc = extract_params(pdata.message, &argv);
+	if (argc == 1 && *argv[0] == '#')
+		channel = argv[0];
+
+	ch = find_channel(channel, strlen(channel));
+	n = ch ? find_trends(ch, now_seconds(), found) : 0;
+	for (i = 0; i < n && i < TREND_SHOW && len < (int) sizeof(line); i++)
+		len += snprintf(line + len, sizeof(line) - len, "%s%s (%.0f, x%.0f)", i ? ", " : "", found[i].term,
+			found[i].count, found[i].ratio);
+
+	if (len)
+		send_message(server, pdata.target, "trending on %s: %s", channel, line);
+	else
+		send_message(server, pdata.target, "nothing trending on %s", channel);
+
+	if (argc)
+		free(argv);
+}
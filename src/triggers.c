@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <yajl/yajl_tree.h>
+#include "irc.h"
+#include "triggers.h"
+#include "common.h"
+
+struct pattern {
+	uint32_t len;
+	int trigger;
+	int next; //!< Next pattern ending on the same state, -1 for none
+};
+
+static struct trigger *triggers;
+static int trigger_count;
+static struct pattern *patterns;
+static int pattern_count;
+
+// The automaton. Every array is indexed by state, the root is state 0
+static uint8_t byte_class[256]; //!< 0 for bytes that appear in no phrase
+static uint32_t classes;
+static int32_t *delta;  //!< state * classes + class gives the next state, failures already followed
+static int32_t *output; //!< First pattern ending on the state, -1 for none
+static int32_t *dict;   //!< Closest state down the failure chain with an output, 0 for none
+static uint32_t state_count;
+
+static bool is_word_char(unsigned char c) {
+
+	return c >= 0x80 || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || (c >= '0' && c <= '9');
+}
+
+static unsigned char fold(unsigned char c) {
+
+	return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+static void free_triggers(void) {
+
+	int i;
+
+	for (i = 0; i < trigger_count; i++)
+		free(triggers[i].channels);
+
+	free(triggers);
+	free(patterns);
+	free(delta);
+	free(output);
+	free(dict);
+	triggers = NULL;
+	patterns = NULL;
+	delta = output = dict = NULL;
+	trigger_count = pattern_count = 0;
+	state_count = classes = 0;
+}
+
+static const char *get_string(yajl_val obj, const char *field, int i) {
+
+	yajl_val val = yajl_tree_get(obj, CFG(field), yajl_t_string);
+	if (!val)
+		exit_msg("triggers[%d].%s: missing / wrong type", i, field);
+
+	return YAJL_GET_STRING(val);
+}
+
+static yajl_val get_array(yajl_val obj, const char *field, int i) {
+
+	yajl_val val = yajl_tree_get(obj, CFG(field), yajl_t_array);
+	if (!val)
+		exit_msg("triggers[%d].%s: missing / wrong type", i, field);
+
+	return val;
+}
+
+/** Walk the phrase down the trie, adding the states it's missing, and attach the pattern to the last one */
+static void add_phrase(const char *phrase, int trigger) {
+
+	const unsigned char *p = (const unsigned char *) phrase;
+	int32_t state = 0, *next;
+
+	for (; *p; p++) {
+		next = &delta[state * classes + byte_class[*p]];
+		if (*next < 0) {
+			*next = state_count++;
+			output[*next] = -1;
+		}
+		state = *next;
+	}
+	patterns[pattern_count].len = (const char *) p - phrase;
+	patterns[pattern_count].trigger = trigger;
+	patterns[pattern_count].next = output[state];
+	output[state] = pattern_count++;
+}
+
+/** Breadth first, so the failure state of every state is complete before it's children need it */
+static void link_states(void) {
+
+	int32_t *queue, *fail, s, t;
+	uint32_t head = 0, tail = 0, c;
+
+	queue = MALLOC_W(state_count * sizeof(*queue));
+	fail = CALLOC_W(state_count * sizeof(*fail));
+	for (c = 0; c < classes; c++) {
+		t = delta[c];
+		if (t < 0)
+			delta[c] = 0;
+		else
+			queue[tail++] = t;
+	}
+	while (head < tail) {
+		s = queue[head++];
+		for (c = 0; c < classes; c++) {
+			t = delta[s * classes + c];
+			if (t < 0) {
+				delta[s * classes + c] = delta[fail[s] * classes + c];
+				continue;
+			}
+			fail[t] = delta[fail[s] * classes + c];
+			dict[t] = output[fail[t]] >= 0 ? fail[t] : dict[fail[t]];
+			queue[tail++] = t;
+		}
+	}
+	free(queue);
+	free(fail);
+}
+
+void triggers_init(yajl_val array) {
+
+	yajl_val match, channels, obj;
+	const char *phrase, *cooldown;
+	size_t max_states = 1, count;
+	uint32_t i, j;
+	const unsigned char *p;
+	unsigned char c;
+
+	free_triggers();
+	count = YAJL_IS_ARRAY(array) ? YAJL_GET_ARRAY(array)->len : 0;
+	if (!count)
+		return;
+
+	// Check the config and find the byte classes first, the table width depends on them
+	memset(byte_class, 0, sizeof(byte_class));
+	classes = 1;
+	for (i = 0; i < count; i++) {
+		obj = YAJL_GET_ARRAY(array)->values[i];
+		get_string(obj, "reply", i);
+		get_string(obj, "cooldown", i);
+		get_array(obj, "channels", i);
+		match = get_array(obj, "match", i);
+		for (j = 0; j < YAJL_GET_ARRAY(match)->len; j++) {
+			phrase = YAJL_GET_STRING(YAJL_GET_ARRAY(match)->values[j]);
+			if (!phrase || !*phrase)
+				exit_msg("triggers[%d].match: phrases must be non empty strings", i);
+
+			for (p = (const unsigned char *) phrase; *p; p++) {
+				c = fold(*p);
+				if (byte_class[c])
+					continue;
+				byte_class[c] = classes++;
+				if (c >= 'a' && c <= 'z') // Both cases go to the same state
+					byte_class[c & ~0x20] = byte_class[c];
+			}
+			max_states += p - (const unsigned char *) phrase;
+			pattern_count++;
+		}
+	}
+	triggers = CALLOC_W(count * sizeof(*triggers));
+	patterns = MALLOC_W(pattern_count * sizeof(*patterns));
+	delta = MALLOC_W(max_states * classes * sizeof(*delta));
+	output = MALLOC_W(max_states * sizeof(*output));
+	dict = CALLOC_W(max_states * sizeof(*dict));
+	memset(delta, 0xff, max_states * classes * sizeof(*delta)); // -1 for missing transitions
+	output[0] = -1;
+	state_count = 1;
+	pattern_count = 0;
+
+	for (i = 0; i < count; i++) {
+		obj = YAJL_GET_ARRAY(array)->values[i];
+		triggers[i].reply = get_string(obj, "reply", i);
+		cooldown = get_string(obj, "cooldown", i);
+		triggers[i].cooldown = atoi(cooldown);
+
+		channels = get_array(obj, "channels", i);
+		triggers[i].channels = MALLOC_W((YAJL_GET_ARRAY(channels)->len + 1) * sizeof(char *));
+		for (j = 0; j < YAJL_GET_ARRAY(channels)->len; j++)
+			if (YAJL_IS_STRING(YAJL_GET_ARRAY(channels)->values[j]))
+				triggers[i].channels[triggers[i].channel_count++] = YAJL_GET_STRING(YAJL_GET_ARRAY(channels)->values[j]);
+
+		match = get_array(obj, "match", i);
+		for (j = 0; j < YAJL_GET_ARRAY(match)->len; j++)
+			add_phrase(YAJL_GET_STRING(YAJL_GET_ARRAY(match)->values[j]), i);
+	}
+	trigger_count = count;
+	link_states();
+}
+
+/** The trigger's scope includes the channel and it's cooldown is over. Starts the cooldown */
+static bool trigger_fires(struct trigger *t, const char *channel, size_t channel_len, time_t now) {
+
+	struct trigger_cooldown *c = NULL;
+	int i;
+
+	for (i = 0; i < t->channel_count; i++)
+		if (strlen(t->channels[i]) == channel_len && !strncasecmp(t->channels[i], channel, channel_len))
+			break;
+	if (t->channel_count && i == t->channel_count)
+		return false;
+
+	for (i = 0; i < TRIGGER_MAXCHANS && *t->fired[i].channel; i++) {
+		if (strlen(t->fired[i].channel) == channel_len && !strncasecmp(t->fired[i].channel, channel, channel_len)) {
+			c = &t->fired[i];
+			break;
+		}
+	}
+	if (!c) {
+		if (i == TRIGGER_MAXCHANS || channel_len >= CHANLEN)
+			return false;
+
+		c = &t->fired[i];
+		memcpy(c->channel, channel, channel_len);
+	} else if (now - c->last < t->cooldown)
+		return false;
+
+	c->last = now;
+	return true;
+}
+
+STATIC const char *trigger_find(const char *channel, size_t channel_len, const char *text, time_t now) {
+
+	const unsigned char *s = (const unsigned char *) text;
+	int32_t state = 0, out, p;
+	size_t i, start;
+
+	if (!trigger_count)
+		return NULL;
+
+	for (i = 0; s[i]; i++) {
+		state = delta[state * classes + byte_class[s[i]]];
+		for (out = output[state] >= 0 ? state : dict[state]; out; out = dict[out]) {
+			for (p = output[out]; p >= 0; p = patterns[p].next) {
+				// Phrases that start or end with a word character must not be part of a longer word
+				start = i + 1 - patterns[p].len;
+				if (start > 0 && is_word_char(s[start]) && is_word_char(s[start - 1]))
+					continue;
+				if (is_word_char(s[i]) && is_word_char(s[i + 1]))
+					continue;
+				if (trigger_fires(&triggers[patterns[p].trigger], channel, channel_len, now))
+					return triggers[patterns[p].trigger].reply;
+			}
+		}
+	}
+	return NULL;
+}
+
+const char *trigger_match(const char *channel, size_t channel_len, const char *text) {
+
+	return trigger_find(channel, channel_len, text, time(NULL));
+}
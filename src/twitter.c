@@ -5,6 +5,7 @@
 #include <curl/curl.h>
 #include <openssl/hmac.h>
 #include "twitter.h"
+#include "curl.h"
 #include "common.h"
 
 
@@ -133,14 +134,6 @@ STATIC char *generate_oauth_signature(CURL *curl, const char *signature_base_str
 	return oauth_signature_encoded;
 }
 
-STATIC size_t discard_response(char *data, size_t size, size_t elements, void *null) {
-	
-	// Silence unused warnings
-	(void) data;
-	(void) null;
-	return size * elements;
-}
-
 STATIC struct curl_slist *prepare_http_post_request(CURL *curl, char **status_msg, const char *oauth_signature, const char *oauth_nonce, time_t timestamp) {
 
 	char *temp, buffer[TWTLEN];
@@ -158,11 +151,8 @@ STATIC struct curl_slist *prepare_http_post_request(CURL *curl, char **status_ms
 	free(*status_msg);
 	*status_msg = temp;
 
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, *status_msg);
-	curl_easy_setopt(curl, CURLOPT_URL, TWTURL);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_response);
 
 	return headers;
 }
@@ -179,6 +169,7 @@ long send_tweet(char *status_msg) {
 	char *oauth_nonce;
 	time_t timestamp;
 	long http_status = 0;
+	Mem_buffer mem = { NULL, 0, 0 };
 
 	curl = curl_easy_init();
 	if (!curl)
@@ -192,15 +183,15 @@ long send_tweet(char *status_msg) {
 
 	oauth_signature = generate_oauth_signature(curl, signature_base_string);
 	request = prepare_http_post_request(curl, &status_msg, oauth_signature, oauth_nonce, timestamp);
-	code = curl_easy_perform(curl);
+	code = perform_transfer(curl, TWTURL, status_msg, &mem); // The reply is not needed, only it's status
 	if (code != CURLE_OK) {
 		fprintf(stderr, "Error: %s\n", curl_easy_strerror(code));
 		goto cleanup;
 	}
-
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+	http_status = mem.status;
 
 cleanup:
+	free(mem.buffer);
 	free(status_msg);
 	free(oauth_nonce);
 	free(oauth_signature);
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <yajl/yajl_tree.h>
+#include "watch.h"
+#include "bot.h"
+#include "curl.h"
+#include "metrics.h"
+#include "common.h"
+
+static struct watched_repo repos[MAXWATCH];
+static int repo_count;
+
+/** @returns  The number of commits before last_sha, all of them if it's not there (force push or a big one) */
+STATIC int new_commits(const Github *commits, int count, const char *last_sha) {
+
+	int i;
+
+	for (i = 0; i < count && strcmp(commits[i].sha, last_sha); i++);
+	return i;
+}
+
+/** Seconds to wait before the next request of any repo */
+STATIC long watch_interval(const Github_poll *poll, int repos, time_t now) {
+
+	long left, interval, min = (WATCH_MIN_PERIOD + repos - 1) / repos;
+
+	if (poll->retry_after > 0)
+		return poll->retry_after;
+
+	if (poll->remaining < 0) // No headers, maybe the fixtures answered
+		interval = WATCH_DEFAULT;
+	else {
+		left = poll->reset > now ? poll->reset - now : 1;
+		if (poll->remaining <= WATCH_RESERVE)
+			return left + 1; // Wait for the refill
+
+		interval = left / (poll->remaining - WATCH_RESERVE);
+	}
+	return interval < min ? min : interval;
+}
+
+static void announce(Irc server, struct watched_repo *repo, const Github *commits, int count) {
+
+	int i, n;
+
+	if (*repo->last_sha) {
+		n = new_commits(commits, count, repo->last_sha);
+		if (n)
+			send_message(server, default_channel(server), "%s: %d%s new commit%s", repo->name, n,
+				n == count ? "+" : "", n > 1 ? "s" : "");
+
+		// Oldest first
+		for (i = (n < WATCH_ANNOUNCE ? n : WATCH_ANNOUNCE) - 1; i >= 0; i--)
+			print_commit(server, default_channel(server), &commits[i]);
+	}
+	snprintf(repo->last_sha, SHALEN + 1, "%s", commits[0].sha);
+}
+
+static void watcher(Irc server, pid_t parent) {
+
+	Github *commits;
+	yajl_val root;
+	long wait;
+	int i, count;
+
+	for (i = 0;; i = (i + 1) % repo_count) {
+		root = NULL;
+		count = WATCH_FETCH;
+		commits = poll_github_commits(&root, repos[i].name, &count, &repos[i].poll);
+		if (count)
+			announce(server, &repos[i], commits, count);
+
+		yajl_tree_free(root);
+		free(commits);
+
+		// The bot going away is what stops us
+		for (wait = watch_interval(&repos[i].poll, repo_count, time(NULL)); wait > 0; wait--) {
+			if (getppid() != parent)
+				_exit(EXIT_SUCCESS);
+			sleep(1);
+		}
+	}
+}
+
+void watch_start(Irc server) {
+
+	pid_t parent = getpid();
+	int i;
+
+	if (cfg.replay)
+		return;
+
+	// Repos without an author get the default one, like !github
+	for (i = 0; i < cfg.watch_repo_count; i++) {
+		if (strchr(cfg.watch_repos[i], '/'))
+			snprintf(repos[repo_count].name, REPOLEN + 1, "%s", cfg.watch_repos[i]);
+		else
+			snprintf(repos[repo_count].name, REPOLEN + 1, "%s/%s", cfg.github_repo, cfg.watch_repos[i]);
+		repo_count++;
+	}
+	if (!repo_count)
+		return;
+
+	switch (fork()) {
+	case 0:
+		watcher(server, parent);
+		break;
+	case -1:
+		perror("watch: fork");
+		metrics_fork(false);
+		break;
+	default:
+		metrics_fork(true);
+	}
+}
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <yajl/yajl_parse.h>
+#include <yajl/yajl_tree.h>
+#include "webhook.h"
+#include "bot.h"
+#include "common.h"
+
+#define FIELD(path, member, if_empty) { path, offsetof(struct webhook_event, member), \
+	sizeof(((struct webhook_event *) 0)->member), if_empty }
+
+/** Where the strings of the payload go. Booleans are handled in parse_boolean() */
+static const struct {
+	const char *path;
+	size_t offset;
+	size_t size;
+	bool if_empty; //!< Only a fallback for another field
+} fields[] = {
+	FIELD("repository.full_name",  repo,   false),
+	FIELD("action",                action, false),
+	FIELD("ref",                   ref,    false),
+	FIELD("pusher.name",           user,   false),
+	FIELD("sender.login",          user,   true),
+	FIELD("compare",               url,    false),
+	FIELD("pull_request.html_url", url,    false),
+	FIELD("issue.html_url",        url,    false),
+	FIELD("pull_request.title",    title,  false),
+	FIELD("issue.title",           title,  false),
+	FIELD("number",                number, false),
+	FIELD("issue.number",          number, false)
+};
+
+struct parser {
+	struct webhook_event *event;
+	char path[WEBHOOK_PATHLEN]; //!< Keys from the root joined with '.', "[]" for array elements
+	size_t start[WEBHOOK_DEPTH + 1]; //!< Length of path where each open container starts
+	int depth;
+	int ignored; //!< Containers opened past WEBHOOK_DEPTH or a full path
+};
+
+static Irc irc_server;
+static const char *webhook_secret;
+static yajl_val channel_map;
+
+STATIC bool webhook_verify(const char *secret, const char *body, size_t len, const char *signature) {
+
+	unsigned char mac[EVP_MAX_MD_SIZE];
+	char hex[2 * EVP_MAX_MD_SIZE + 1];
+	unsigned int mac_len, i;
+
+	if (!signature || !starts_with(signature, "sha256="))
+		return false;
+
+	if (!HMAC(EVP_sha256(), secret, strlen(secret), (const unsigned char *) body, len, mac, &mac_len))
+		return false;
+
+	for (i = 0; i < mac_len; i++)
+		snprintf(hex + 2 * i, 3, "%02x", mac[i]);
+
+	// Constant time, the comparison must not tell how much of a forged signature was right
+	return strlen(signature + 7) == 2 * mac_len && !CRYPTO_memcmp(hex, signature + 7, 2 * mac_len);
+}
+
+static void copy_text(char *dest, size_t size, const unsigned char *s, size_t len) {
+
+	if (len >= size)
+		len = size - 1;
+
+	memcpy(dest, s, len);
+	dest[len] = '\0';
+	dest[strcspn(dest, "\r\n")] = '\0'; // One line on IRC
+}
+
+/** Field of the commit being parsed for the current path, NULL if it's not one */
+static char *commit_field(struct parser *p, size_t *size) {
+
+	int slot = (p->event->commit_count - 1) % WATCH_ANNOUNCE;
+	const char *member = p->path + strlen("commits[].");
+
+	if (!p->event->commit_count || !starts_with(p->path, "commits[]."))
+		return NULL;
+
+	*size = sizeof(p->event->commits[0].message);
+	if (streq(member, "message"))
+		return p->event->commits[slot].message;
+
+	*size = sizeof(p->event->commits[0].id);
+	if (streq(member, "id"))
+		return p->event->commits[slot].id;
+
+	*size = sizeof(p->event->commits[0].author);
+	if (streq(member, "author.name"))
+		return p->event->commits[slot].author;
+
+	return NULL;
+}
+
+static int parse_string(void *ctx, const unsigned char *s, size_t len) {
+
+	struct parser *p = ctx;
+	char *dest;
+	size_t i, size;
+
+	if (p->ignored)
+		return 1;
+
+	dest = commit_field(p, &size);
+	if (dest) {
+		copy_text(dest, size, s, len);
+		return 1;
+	}
+	for (i = 0; i < SIZE(fields); i++) {
+		if (!streq(p->path, fields[i].path))
+			continue;
+
+		dest = (char *) p->event + fields[i].offset;
+		if (!fields[i].if_empty || !*dest)
+			copy_text(dest, fields[i].size, s, len);
+		break;
+	}
+	return 1;
+}
+
+static int parse_number(void *ctx, const char *s, size_t len) {
+
+	return parse_string(ctx, (const unsigned char *) s, len);
+}
+
+static int parse_boolean(void *ctx, int value) {
+
+	struct parser *p = ctx;
+
+	if (streq(p->path, "pull_request.merged"))
+		p->event->merged = value;
+	else if (streq(p->path, "forced"))
+		p->event->forced = value;
+	else if (streq(p->path, "deleted"))
+		p->event->deleted = value;
+
+	return 1;
+}
+
+static int open_container(struct parser *p, const char *suffix) {
+
+	size_t len = strlen(p->path);
+
+	if (p->ignored || p->depth == WEBHOOK_DEPTH || len + strlen(suffix) >= WEBHOOK_PATHLEN) {
+		p->ignored++;
+		return 1;
+	}
+	p->start[++p->depth] = len;
+	strcat(p->path, suffix);
+	return 1;
+}
+
+static int close_container(void *ctx) {
+
+	struct parser *p = ctx;
+
+	if (p->ignored) {
+		p->ignored--;
+		return 1;
+	}
+	p->path[p->start[p->depth--]] = '\0';
+	return 1;
+}
+
+static int parse_start_map(void *ctx) {
+
+	struct parser *p = ctx;
+
+	// A new element of the commits array
+	if (!p->ignored && streq(p->path, "commits[]"))
+		memset(&p->event->commits[p->event->commit_count++ % WATCH_ANNOUNCE], 0, sizeof(p->event->commits[0]));
+
+	return open_container(p, "");
+}
+
+static int parse_start_array(void *ctx) {
+
+	return open_container(ctx, "[]");
+}
+
+static int parse_map_key(void *ctx, const unsigned char *key, size_t len) {
+
+	struct parser *p = ctx;
+	size_t start;
+
+	if (p->ignored)
+		return 1;
+
+	start = p->start[p->depth];
+	if (start + len + 2 > WEBHOOK_PATHLEN) {
+		snprintf(p->path + start, WEBHOOK_PATHLEN - start, "%s", start ? ".?" : "?"); // Too long to be one of ours
+		return 1;
+	}
+	snprintf(p->path + start, WEBHOOK_PATHLEN - start, "%s%.*s", start ? "." : "", (int) len, key);
+	return 1;
+}
+
+STATIC bool parse_event(const char *body, size_t len, struct webhook_event *event) {
+
+	static const yajl_callbacks callbacks = {
+		.yajl_boolean     = parse_boolean,
+		.yajl_number      = parse_number,
+		.yajl_string      = parse_string,
+		.yajl_start_map   = parse_start_map,
+		.yajl_map_key     = parse_map_key,
+		.yajl_end_map     = close_container,
+		.yajl_start_array = parse_start_array,
+		.yajl_end_array   = close_container
+	};
+	struct parser p;
+	yajl_handle handle;
+	bool ok;
+
+	memset(event, 0, sizeof(*event));
+	memset(&p, 0, sizeof(p));
+	p.event = event;
+	p.depth = -1; // The root object opens depth 0
+
+	handle = yajl_alloc(&callbacks, NULL, &p);
+	if (!handle)
+		return false;
+
+	ok = yajl_parse(handle, (const unsigned char *) body, len) == yajl_status_ok
+		&& yajl_complete_parse(handle) == yajl_status_ok;
+	yajl_free(handle);
+	return ok && *event->repo;
+}
+
+static const char *event_channel(const char *repo) {
+
+	size_t i;
+
+	for (i = 0; i < YAJL_GET_OBJECT(channel_map)->len; i++)
+		if (!strcasecmp(YAJL_GET_OBJECT(channel_map)->keys[i], repo)
+				&& YAJL_IS_STRING(YAJL_GET_OBJECT(channel_map)->values[i]))
+			return YAJL_GET_STRING(YAJL_GET_OBJECT(channel_map)->values[i]);
+
+	return default_channel(irc_server);
+}
+
+static void announce_push(const struct webhook_event *ev, const char *channel) {
+
+	const char *ref = ev->ref;
+	int i, shown = ev->commit_count < WATCH_ANNOUNCE ? ev->commit_count : WATCH_ANNOUNCE;
+
+	if (starts_with(ref, "refs/heads/") || starts_with(ref, "refs/tags/"))
+		ref = strchr(ref + 5, '/') + 1;
+
+	if (ev->deleted) {
+		send_message(irc_server, channel, PURPLE "[%s]" RESET " %s deleted %s", ev->repo, ev->user, ref);
+		return;
+	}
+	if (!ev->commit_count) { // A tag or a branch created at an existing commit
+		send_message(irc_server, channel, PURPLE "[%s]" RESET " %s pushed %s", ev->repo, ev->user, ref);
+		return;
+	}
+	send_message(irc_server, channel, PURPLE "[%s]" RESET " %s %spushed %d commit%s to %s" BLUE " %s", ev->repo,
+		ev->user, ev->forced ? "force-" : "", ev->commit_count, ev->commit_count > 1 ? "s" : "", ref, ev->url);
+
+	// Same as !github, oldest first
+	for (i = ev->commit_count - shown; i < ev->commit_count; i++)
+		send_message(irc_server, channel, PURPLE "[%.7s]" RESET " %.120s" ORANGE " --%s",
+			ev->commits[i % WATCH_ANNOUNCE].id, ev->commits[i % WATCH_ANNOUNCE].message,
+			ev->commits[i % WATCH_ANNOUNCE].author);
+}
+
+static void webhook_serve(Http_request *req, Http_response *res) {
+
+	struct webhook_event ev;
+	const char *event = http_header(req, "X-GitHub-Event"), *type = http_header(req, "Content-Type"), *channel;
+
+	if (!webhook_verify(webhook_secret, req->body, req->body_len, http_header(req, "X-Hub-Signature-256"))) {
+		http_reply(res, 401, NULL, "%s", "Bad signature\n");
+		return;
+	}
+	if (!event || !type || !starts_with(type, "application/json")) {
+		http_reply(res, 400, NULL, "%s", "Expected a GitHub event with content type application/json\n");
+		return;
+	}
+	if (streq(event, "ping")) {
+		http_reply(res, 200, NULL, "%s", "pong\n");
+		return;
+	}
+	if (!parse_event(req->body, req->body_len, &ev)) {
+		http_reply(res, 400, NULL, "%s", "Bad payload\n");
+		return;
+	}
+	channel = event_channel(ev.repo);
+	if (streq(event, "push"))
+		announce_push(&ev, channel);
+	else if ((streq(event, "pull_request") || streq(event, "issues"))
+			&& (streq(ev.action, "opened") || streq(ev.action, "closed") || streq(ev.action, "reopened")))
+		send_message(irc_server, channel, PURPLE "[%s]" RESET " %s %s %s #%s: %.120s" BLUE " %s", ev.repo, ev.user,
+			ev.merged ? "merged" : ev.action, *event == 'p' ? "pull request" : "issue", ev.number, ev.title, ev.url);
+	else {
+		http_reply(res, 202, NULL, "%s", "Ignored\n");
+		return;
+	}
+	http_reply(res, 200, NULL, "%s", "OK\n");
+}
+
+void webhook_init(Irc server, const char *secret, yajl_val channels) {
+
+	if (!*secret)
+		return;
+
+	irc_server = server;
+	webhook_secret = secret;
+	channel_map = channels;
+	httpd_route("POST", "/github", webhook_serve);
+}
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "xml.h"
+
+static bool prefix(const char *p, const char *end, const char *s) {
+
+	size_t len = strlen(s);
+
+	return (size_t) (end - p) >= len && !memcmp(p, s, len);
+}
+
+bool xml_next(struct xml_reader *reader, struct xml_token *token) {
+
+	const char *p = reader->p, *end = reader->end, *q;
+	char quote = 0;
+
+	memset(token, 0, sizeof(*token));
+	while (p < end) {
+		if (*p != '<') {
+			q = memchr(p, '<', end - p);
+			token->type = XML_TEXT;
+			token->data = p;
+			token->data_len = (q ? q : end) - p;
+			reader->p = q ? q : end;
+			return true;
+		}
+		if (prefix(p, end, "<!--")) {
+			q = memmem(p + 4, end - p - 4, "-->", 3);
+			if (!q)
+				break;
+
+			p = q + 3;
+			continue;
+		}
+		if (prefix(p, end, "<![CDATA[")) {
+			q = memmem(p + 9, end - p - 9, "]]>", 3);
+			if (!q)
+				break;
+
+			token->type = XML_TEXT;
+			token->data = p + 9;
+			token->data_len = q - (p + 9);
+			token->cdata = true;
+			reader->p = q + 3;
+			return true;
+		}
+		// Declarations, doctype and processing instructions
+		if (end - p > 1 && (p[1] == '?' || p[1] == '!')) {
+			q = memchr(p, '>', end - p);
+			if (!q)
+				break;
+
+			p = q + 1;
+			continue;
+		}
+		q = p + 1;
+		token->type = XML_OPEN;
+		if (q < end && *q == '/') {
+			token->type = XML_CLOSE;
+			q++;
+		}
+		token->name = q;
+		while (q < end && !isspace((unsigned char) *q) && *q != '>' && *q != '/')
+			q++;
+		token->name_len = q - token->name;
+
+		// The tag ends at the first '>' outside of quoted attribute values
+		token->data = q;
+		for (; q < end; q++) {
+			if (quote) {
+				if (*q == quote)
+					quote = 0;
+			} else if (*q == '"' || *q == '\'')
+				quote = *q;
+			else if (*q == '>')
+				break;
+		}
+		if (q == end)
+			break;
+
+		token->data_len = q - token->data;
+		if (token->type == XML_OPEN && token->data_len && q[-1] == '/') {
+			token->empty = true;
+			token->data_len--;
+		}
+		reader->p = q + 1;
+		return true;
+	}
+	token->type = XML_EOF;
+	reader->p = end;
+	return false;
+}
+
+bool xml_is(const struct xml_token *token, const char *name) {
+
+	return token->name_len == strlen(name) && !memcmp(token->name, name, token->name_len);
+}
+
+static size_t utf8_encode(unsigned long cp, char *out) {
+
+	if (!cp || cp > 0x10ffff)
+		cp = '?';
+
+	if (cp < 0x80) {
+		out[0] = cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		out[0] = 0xc0 | cp >> 6;
+		out[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+	if (cp < 0x10000) {
+		out[0] = 0xe0 | cp >> 12;
+		out[1] = 0x80 | (cp >> 6 & 0x3f);
+		out[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	out[0] = 0xf0 | cp >> 18;
+	out[1] = 0x80 | (cp >> 12 & 0x3f);
+	out[2] = 0x80 | (cp >> 6 & 0x3f);
+	out[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+/** Decode one character or entity into out. Unknown entities are kept as they are */
+static size_t decode_char(const char **text, const char *end, bool cdata, char *out) {
+
+	static const struct {
+		const char *name;
+		char c;
+	} entities[] = { { "amp;", '&' }, { "lt;", '<' }, { "gt;", '>' }, { "quot;", '"' }, { "apos;", '\'' } };
+	const char *p = *text, *semi;
+	size_t i;
+
+	*text = p + 1;
+	out[0] = *p;
+	if (cdata || *p != '&')
+		return 1;
+
+	semi = memchr(p, ';', end - p < 12 ? end - p : 12);
+	if (!semi)
+		return 1;
+
+	if (p[1] == '#') {
+		*text = semi + 1;
+		return utf8_encode(p[2] == 'x' || p[2] == 'X' ? strtoul(p + 3, NULL, 16) : strtoul(p + 2, NULL, 10), out);
+	}
+	for (i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+		if (prefix(p + 1, semi + 1, entities[i].name)) {
+			*text = semi + 1;
+			out[0] = entities[i].c;
+			break;
+		}
+	}
+	return 1;
+}
+
+void xml_append_text(char *dest, size_t size, size_t *len, const char *text, size_t text_len, bool cdata) {
+
+	const char *p = text, *end = text + text_len, *peek;
+	char c[4], next[4];
+	bool space = !*len || dest[*len - 1] == ' ', in_tag = false;
+	size_t n;
+
+	while (p < end) {
+		n = decode_char(&p, end, cdata, c);
+		if (in_tag) {
+			in_tag = c[0] != '>';
+			continue;
+		}
+		if (n == 1 && c[0] == '<' && p < end) {
+			peek = p;
+			decode_char(&peek, end, cdata, next);
+			if (isalpha((unsigned char) next[0]) || next[0] == '/' || next[0] == '!') {
+				in_tag = true;
+				continue;
+			}
+		}
+		if (n == 1 && isspace((unsigned char) c[0])) {
+			if (space)
+				continue;
+
+			c[0] = ' ';
+			space = true;
+		} else
+			space = false;
+
+		if (*len + n >= size)
+			break;
+
+		memcpy(dest + *len, c, n);
+		*len += n;
+	}
+	dest[*len] = '\0';
+}
+
+bool xml_attr(const struct xml_token *token, const char *name, char *value, size_t size) {
+
+	const char *p = token->data, *end = token->data + token->data_len, *q, *value_end;
+	size_t name_len = strlen(name), len = 0;
+	bool match;
+
+	while (p < end) {
+		while (p < end && isspace((unsigned char) *p))
+			p++;
+		for (q = p; q < end && *q != '=' && !isspace((unsigned char) *q); q++);
+		match = (size_t) (q - p) == name_len && !memcmp(p, name, name_len);
+
+		while (q < end && isspace((unsigned char) *q))
+			q++;
+		if (q == end || *q != '=') { // An attribute without a value
+			p = q > p ? q : q + 1;
+			continue;
+		}
+		for (q++; q < end && isspace((unsigned char) *q); q++);
+		if (q < end && (*q == '"' || *q == '\'')) {
+			value_end = memchr(q + 1, *q, end - q - 1);
+			q++;
+			if (!value_end)
+				value_end = end;
+		} else
+			for (value_end = q; value_end < end && !isspace((unsigned char) *value_end); value_end++);
+
+		if (match) {
+			*value = '\0';
+			xml_append_text(value, size, &len, q, value_end - q, false);
+			return true;
+		}
+		p = value_end + 1;
+	}
+	return false;
+}